@@ -0,0 +1,20 @@
+#include "gtest/gtest.h"
+
+  int cache_main(int argc, char* argv[]);
+  int findkey_main(int argc, char* argv[]);
+  int pksign_bench_main(int argc, char* argv[]);
+
+TEST(AgentTest, cache) {
+    int result = cache_main(0, NULL);
+    ASSERT_EQ(result, 0);
+}
+
+TEST(AgentTest, findkey) {
+    int result = findkey_main(0, NULL);
+    ASSERT_EQ(result, 0);
+}
+
+TEST(AgentTest, pksign_bench) {
+    int result = pksign_bench_main(0, NULL);
+    ASSERT_EQ(result, 0);
+}
@@ -69,12 +69,20 @@ struct options
 
   int disable_scdaemon;         /* Never use the SCdaemon. */
 
+  /* Run the connection threads in parallel instead of letting nPth
+     serialize them.  Only evaluated at startup.  */
+  int parallel_connections;
+
   int no_grab;         /* Don't let the pinentry grab the keyboard */
 
   /* The default and maximum TTL of cache entries. */
   unsigned long def_cache_ttl;     /* Default. */
   unsigned long max_cache_ttl;     /* Default. */
 
+  /* The time in seconds unprotected keys are cached.  0 disables the
+     key cache.  */
+  unsigned long key_cache_ttl;
+
   /* Flag disallowing bypassing of the warning.  */
   int enforce_passphrase_constraints;
 
@@ -303,6 +311,8 @@ gpg_error_t ssh_search_control_file (ssh_control_file_t cf,
 void start_command_handler_ssh (ctrl_t, gnupg_fd_t);
 
 /*-- findkey.c --*/
+void initialize_module_findkey (void);
+void agent_flush_key_cache (const unsigned char *grip);
 gpg_error_t agent_modify_description (const char *in, const char *comment,
                                       const gcry_sexp_t key, char **result);
 int agent_write_private_key (const unsigned char *grip,
@@ -43,8 +43,23 @@ static const size_t ENCRYPTION_KEYSIZE = 128/8;
    necessary infrastructure to make it more secure.  */
 static Botan::SymmetricKey *encryption_handle;
 
-/* A mutex used to serialize access to the cache.  */
-static npth_mutex_t cache_lock;
+/* A mutex used to protect the creation of ENCRYPTION_HANDLE.  */
+static npth_mutex_t encryption_lock;
+
+/* The cache is split into shards, each with its own lock, hash table
+   and timer wheel, so that connections running in parallel rarely
+   wait for each other.  These are the number of shards and the
+   number of hash buckets per shard.  */
+#define CACHE_SHARDS  16
+#define CACHE_BUCKETS 64
+
+/* The number of slots of the timer wheel.  Each slot covers one
+   second; items expiring further in the future stay in their slot
+   until the wheel has come around often enough.  */
+#define WHEEL_SLOTS 256
+
+/* Unused slots are removed 30 minutes after their last access.  */
+#define UNUSED_SLOT_TTL (60*30)
 
 
 struct secret_data_s {
@@ -54,7 +69,12 @@ struct secret_data_s {
 
 typedef struct cache_item_s *ITEM;
 struct cache_item_s {
-  ITEM next;
+  ITEM next;            /* Next item in the same hash bucket.  */
+  ITEM wheel_next;      /* Next item in the same slot of the wheel.  */
+  ITEM *wheel_prevp;    /* The pointer pointing to this item in the
+                           wheel or NULL if not scheduled.  */
+  time_t expires;       /* The time the item needs to be looked at.  */
+  unsigned int hash;    /* The hash value of KEY.  */
   time_t created;
   time_t accessed;
   int ttl;  /* max. lifetime given in seconds, -1 one means infinite */
@@ -63,12 +83,29 @@ struct cache_item_s {
   char key[1];
 };
 
+/* One shard of the cache.  */
+struct cache_shard_s {
+  npth_mutex_t lock;
+  ITEM buckets[CACHE_BUCKETS];
+  ITEM wheel[WHEEL_SLOTS];
+  time_t wheel_time;    /* All slots up to this time have been
+                           processed.  */
+};
+
 /* The cache himself.  */
-static ITEM thecache;
+static struct cache_shard_s cache_shards[CACHE_SHARDS];
+
+/* A mutex and the time of the last run of sweep_cache.  */
+static npth_mutex_t sweep_lock;
+static time_t last_sweep;
 
 /* NULL or the last cache key stored by agent_store_cache_hit.  */
 static char *last_stored_cache_key;
 
+/* A mutex used to protect LAST_STORED_CACHE_KEY.  It is always taken
+   before a shard lock.  */
+static npth_mutex_t stored_key_lock;
+
 
 /* This function must be called once to initialize this module. It
    has to be done before a second thread is spawned.  */
@@ -76,8 +113,15 @@ void
 initialize_module_cache (void)
 {
   int err;
+  int i;
 
-  err = npth_mutex_init (&cache_lock, NULL);
+  err = npth_mutex_init (&encryption_lock, NULL);
+  if (!err)
+    err = npth_mutex_init (&sweep_lock, NULL);
+  if (!err)
+    err = npth_mutex_init (&stored_key_lock, NULL);
+  for (i=0; !err && i < CACHE_SHARDS; i++)
+    err = npth_mutex_init (&cache_shards[i].lock, NULL);
 
   if (err)
     log_fatal ("error initializing cache module: %s\n", strerror (err));
@@ -92,6 +136,28 @@ deinitialize_module_cache (void)
 }
 
 
+static void
+lock_shard (struct cache_shard_s *shard)
+{
+  int res;
+
+  res = npth_mutex_lock (&shard->lock);
+  if (res)
+    log_fatal ("failed to acquire cache mutex: %s\n", strerror (res));
+}
+
+
+static void
+unlock_shard (struct cache_shard_s *shard)
+{
+  int res;
+
+  res = npth_mutex_unlock (&shard->lock);
+  if (res)
+    log_fatal ("failed to release cache mutex: %s\n", strerror (res));
+}
+
+
 /* We do the encryption init on the fly.  We can't do it in the module
    init code because that is run before we listen for connections and
    in case we are started on demand by gpg etc. it will only wait for
@@ -101,14 +167,21 @@ deinitialize_module_cache (void)
 static gpg_error_t
 init_encryption (void)
 {
-  gpg_error_t err;
-  void *key;
+  int res;
 
-  if (encryption_handle)
-    return 0;
+  res = npth_mutex_lock (&encryption_lock);
+  if (res)
+    log_fatal ("failed to acquire cache mutex: %s\n", strerror (res));
 
-  std::unique_ptr<Botan::RandomNumberGenerator> rng(new Botan::AutoSeeded_RNG);
-  encryption_handle = new Botan::SymmetricKey(*rng, ENCRYPTION_KEYSIZE);
+  if (!encryption_handle)
+    {
+      std::unique_ptr<Botan::RandomNumberGenerator> rng(new Botan::AutoSeeded_RNG);
+      encryption_handle = new Botan::SymmetricKey(*rng, ENCRYPTION_KEYSIZE);
+    }
+
+  res = npth_mutex_unlock (&encryption_lock);
+  if (res)
+    log_fatal ("failed to release cache mutex: %s\n", strerror (res));
 
   return 0;
 }
@@ -165,7 +238,7 @@ new_data (const char *string, struct secret_data_s **r_data)
   assert(enc.size() == total);
   memcpy(d_enc->data, enc.data(), total);
   err = 0;
-  
+
   xfree (d);
   if (err)
     {
@@ -177,100 +250,251 @@ new_data (const char *string, struct secret_data_s **r_data)
 }
 
 
+/* Decrypt DATA into the secure buffer VALUE which must have room for
+   DATA->TOTALLEN - 8 bytes.  The encryption context exists because it
+   has been created before DATA was stored.  */
+static void
+unwrap_data (const struct secret_data_s *data, char *value)
+{
+  const uint8_t *p = (const uint8_t *) data->data;
+
+  assert (encryption_handle);
+  Botan::secure_vector<uint8_t> val = Botan::rfc3394_keyunwrap
+    (Botan::secure_vector<uint8_t> (p, p + data->totallen),
+     *encryption_handle);
+  assert(val.size() == data->totallen - 8);
+  memcpy (value, val.data(), val.size());
+}
+
+
+
+/* Return the hash value for KEY.  The cache mode is not included
+   because a lookup may match several modes.  */
+static unsigned int
+cache_hash (const char *key)
+{
+  const unsigned char *s = (const unsigned char *) key;
+  unsigned int h = 0;
+
+  for (; *s; s++)
+    h = h * 33 + *s;
+  return h;
+}
+
+
+/* Return the shard holding the items with HASH.  */
+static struct cache_shard_s *
+hash_shard (unsigned int hash)
+{
+  return cache_shards + (hash % CACHE_SHARDS);
+}
+
+
+/* Return the bucket of SHARD holding the items with HASH.  */
+static ITEM *
+hash_bucket (struct cache_shard_s *shard, unsigned int hash)
+{
+  return shard->buckets + ((hash / CACHE_SHARDS) % CACHE_BUCKETS);
+}
+
 
-/* Check whether there are items to expire.  */
+/* Remove item R from the timer wheel.  */
 static void
-housekeeping (void)
+unschedule_item (ITEM r)
 {
-  ITEM r, rprev;
-  time_t current = gnupg_get_time ();
+  if (!r->wheel_prevp)
+    return;
+  *r->wheel_prevp = r->wheel_next;
+  if (r->wheel_next)
+    r->wheel_next->wheel_prevp = r->wheel_prevp;
+  r->wheel_next = NULL;
+  r->wheel_prevp = NULL;
+}
+
+
+/* Put item R of SHARD on the timer wheel at the time it expires next.
+   Items which never expire are not put on the wheel.  */
+static void
+schedule_item (struct cache_shard_s *shard, ITEM r)
+{
+  time_t expires;
+  ITEM *slot;
+
+  unschedule_item (r);
+
+  /* This is the first second for which one of the tests in
+     expire_item will be true.  */
+  if (r->pw)
+    {
+      expires = r->created + (time_t)opt.max_cache_ttl + 1;
+      if (r->ttl >= 0 && r->accessed + r->ttl + 1 < expires)
+        expires = r->accessed + r->ttl + 1;
+    }
+  else if (r->ttl >= 0)
+    expires = r->accessed + UNUSED_SLOT_TTL + 1;
+  else
+    return;
+
+  /* Items which are already due go to the next slot looked at.  */
+  if (expires <= shard->wheel_time)
+    expires = shard->wheel_time + 1;
+
+  r->expires = expires;
+  slot = shard->wheel + (expires % WHEEL_SLOTS);
+  r->wheel_next = *slot;
+  if (r->wheel_next)
+    r->wheel_next->wheel_prevp = &r->wheel_next;
+  r->wheel_prevp = slot;
+  *slot = r;
+}
+
+
+/* Apply the expiration rules to item R of SHARD at time CURRENT and
+   reschedule it.  Returns true if R has been removed from the cache
+   and may not be accessed anymore.  */
+static int
+expire_item (struct cache_shard_s *shard, ITEM r, time_t current)
+{
+  ITEM *rp;
 
   /* First expire the actual data */
-  for (r=thecache; r; r = r->next)
+  if (r->pw && r->ttl >= 0 && r->accessed + r->ttl < current)
     {
-      if (r->pw && r->ttl >= 0 && r->accessed + r->ttl < current)
-        {
-          if (DBG_CACHE)
-            log_debug ("  expired '%s' (%ds after last access)\n",
-                       r->key, r->ttl);
-          release_data (r->pw);
-          r->pw = NULL;
-          r->accessed = current;
-        }
+      if (DBG_CACHE)
+        log_debug ("  expired '%s' (%ds after last access)\n",
+                   r->key, r->ttl);
+      release_data (r->pw);
+      r->pw = NULL;
+      r->accessed = current;
     }
 
   /* Second, make sure that we also remove them based on the created stamp so
      that the user has to enter it from time to time. */
-  for (r=thecache; r; r = r->next)
+  if (r->pw && r->created + (time_t)opt.max_cache_ttl < current)
     {
-      unsigned long maxttl;
-
-      maxttl = opt.max_cache_ttl;
-      if (r->pw && r->created + maxttl < current)
-        {
-          if (DBG_CACHE)
-            log_debug ("  expired '%s' (%lus after creation)\n",
-                       r->key, opt.max_cache_ttl);
-          release_data (r->pw);
-          r->pw = NULL;
-          r->accessed = current;
-        }
+      if (DBG_CACHE)
+        log_debug ("  expired '%s' (%lus after creation)\n",
+                   r->key, opt.max_cache_ttl);
+      release_data (r->pw);
+      r->pw = NULL;
+      r->accessed = current;
     }
 
   /* Third, make sure that we don't have too many items in the list.
      Expire old and unused entries after 30 minutes */
-  for (rprev=NULL, r=thecache; r; )
+  if (!r->pw && r->ttl >= 0 && r->accessed + UNUSED_SLOT_TTL < current)
     {
-      if (!r->pw && r->ttl >= 0 && r->accessed + 60*30 < current)
-        {
-          ITEM r2 = r->next;
-          if (DBG_CACHE)
-            log_debug ("  removed '%s' (mode %d) (slot not used for 30m)\n",
-                       r->key, r->cache_mode);
-          xfree (r);
-          if (!rprev)
-            thecache = r2;
-          else
-            rprev->next = r2;
-          r = r2;
-        }
-      else
+      if (DBG_CACHE)
+        log_debug ("  removed '%s' (mode %d) (slot not used for 30m)\n",
+                   r->key, r->cache_mode);
+      unschedule_item (r);
+      for (rp = hash_bucket (shard, r->hash); *rp != r; rp = &(*rp)->next)
+        ;
+      *rp = r->next;
+      xfree (r);
+      return 1;
+    }
+
+  schedule_item (shard, r);
+  return 0;
+}
+
+
+/* Check whether there are items of SHARD to expire.  Only the slots
+   of the timer wheel which became due since the last call are looked
+   at.  */
+static void
+housekeeping (struct cache_shard_s *shard, time_t current)
+{
+  time_t t;
+  long n;
+  ITEM r, r2;
+
+  if (!shard->wheel_time || current - shard->wheel_time >= WHEEL_SLOTS)
+    {
+      t = current - WHEEL_SLOTS + 1;
+      n = WHEEL_SLOTS;
+    }
+  else
+    {
+      t = shard->wheel_time + 1;
+      n = current - shard->wheel_time;
+    }
+
+  for (; n > 0; t++, n--)
+    for (r = shard->wheel[t % WHEEL_SLOTS]; r; r = r2)
+      {
+        /* A rescheduled item is inserted at the head of a slot and
+           thus not visited again.  */
+        r2 = r->wheel_next;
+        if (r->expires <= current)
+          expire_item (shard, r, current);
+      }
+
+  if (current > shard->wheel_time)
+    shard->wheel_time = current;
+}
+
+
+/* Run the housekeeping of all shards, but at most once per second.
+   This way the secrets of all expired items are released on the next
+   access to the cache.  */
+static void
+sweep_cache (time_t current)
+{
+  int i;
+  int res;
+
+  /* If another thread is sweeping right now we don't need to.  */
+  if (npth_mutex_trylock (&sweep_lock))
+    return;
+
+  if (last_sweep != current)
+    {
+      last_sweep = current;
+      for (i=0; i < CACHE_SHARDS; i++)
         {
-          rprev = r;
-          r = r->next;
+          lock_shard (cache_shards + i);
+          housekeeping (cache_shards + i, current);
+          unlock_shard (cache_shards + i);
         }
     }
+
+  res = npth_mutex_unlock (&sweep_lock);
+  if (res)
+    log_fatal ("failed to release cache mutex: %s\n", strerror (res));
 }
 
 
 void
 agent_flush_cache (void)
 {
+  struct cache_shard_s *shard;
   ITEM r;
-  int res;
+  int i, j;
 
   if (DBG_CACHE)
     log_debug ("agent_flush_cache\n");
 
-  res = npth_mutex_lock (&cache_lock);
-  if (res)
-    log_fatal ("failed to acquire cache mutex: %s\n", strerror (res));
-
-  for (r=thecache; r; r = r->next)
+  for (i=0; i < CACHE_SHARDS; i++)
     {
-      if (r->pw)
-        {
-          if (DBG_CACHE)
-            log_debug ("  flushing '%s'\n", r->key);
-          release_data (r->pw);
-          r->pw = NULL;
-          r->accessed = 0;
-        }
+      shard = cache_shards + i;
+      lock_shard (shard);
+      for (j=0; j < CACHE_BUCKETS; j++)
+        for (r=shard->buckets[j]; r; r = r->next)
+          {
+            if (r->pw)
+              {
+                if (DBG_CACHE)
+                  log_debug ("  flushing '%s'\n", r->key);
+                release_data (r->pw);
+                r->pw = NULL;
+                r->accessed = 0;
+                schedule_item (shard, r);
+              }
+          }
+      unlock_shard (shard);
     }
-
-  res = npth_mutex_unlock (&cache_lock);
-  if (res)
-    log_fatal ("failed to release cache mutex: %s\n", strerror (res));
 }
 
 
@@ -284,6 +508,29 @@ cache_mode_equal (cache_mode_t a, cache_mode_t b)
 }
 
 
+/* Return the first item of SHARD stored under KEY with HASH which
+   matches CACHE_MODE or NULL.  If WITH_DATA is set only items which
+   have data are considered.  */
+static ITEM
+find_item (struct cache_shard_s *shard, unsigned int hash,
+           const char *key, cache_mode_t cache_mode, int with_data)
+{
+  ITEM r;
+
+  for (r = *hash_bucket (shard, hash); r; r = r->next)
+    {
+      if (r->hash == hash
+          && (r->pw || !with_data)
+          && ((cache_mode != CACHE_MODE_USER
+               && cache_mode != CACHE_MODE_NONCE)
+              || cache_mode_equal (r->cache_mode, cache_mode))
+          && !strcmp (r->key, key))
+        break;
+    }
+  return r;
+}
+
+
 /* Store the string DATA in the cache under KEY and mark it with a
    maximum lifetime of TTL seconds.  If there is already data under
    this key, it will be replaced.  Using a DATA of NULL deletes the
@@ -296,30 +543,26 @@ agent_put_cache (const char *key, cache_mode_t cache_mode,
 {
   gpg_error_t err = 0;
   ITEM r;
-  int res;
+  unsigned int hash;
+  struct cache_shard_s *shard;
+  time_t current = gnupg_get_time ();
 
-  res = npth_mutex_lock (&cache_lock);
-  if (res)
-    log_fatal ("failed to acquire cache mutex: %s\n", strerror (res));
+  sweep_cache (current);
+
+  hash = cache_hash (key);
+  shard = hash_shard (hash);
+  lock_shard (shard);
 
   if (DBG_CACHE)
     log_debug ("agent_put_cache '%s' (mode %d) requested ttl=%d\n",
                key, cache_mode, ttl);
-  housekeeping ();
 
   if (!ttl)
     ttl = opt.def_cache_ttl;
   if ((!ttl && data) || cache_mode == CACHE_MODE_IGNORE)
     goto out;
 
-  for (r=thecache; r; r = r->next)
-    {
-      if (((cache_mode != CACHE_MODE_USER
-            && cache_mode != CACHE_MODE_NONCE)
-           || cache_mode_equal (r->cache_mode, cache_mode))
-          && !strcmp (r->key, key))
-        break;
-    }
+  r = find_item (shard, hash, key, cache_mode, 0);
   if (r) /* Replace.  */
     {
       if (r->pw)
@@ -329,13 +572,14 @@ agent_put_cache (const char *key, cache_mode_t cache_mode,
         }
       if (data)
         {
-          r->created = r->accessed = gnupg_get_time ();
+          r->created = r->accessed = current;
           r->ttl = ttl;
           r->cache_mode = cache_mode;
           err = new_data (data, &r->pw);
           if (err)
             log_error ("error replacing cache item: %s\n", gpg_strerror (err));
         }
+      schedule_item (shard, r);
     }
   else if (data) /* Insert.  */
     {
@@ -345,7 +589,8 @@ agent_put_cache (const char *key, cache_mode_t cache_mode,
       else
         {
           strcpy (r->key, key);
-          r->created = r->accessed = gnupg_get_time ();
+          r->hash = hash;
+          r->created = r->accessed = current;
           r->ttl = ttl;
           r->cache_mode = cache_mode;
           err = new_data (data, &r->pw);
@@ -353,8 +598,11 @@ agent_put_cache (const char *key, cache_mode_t cache_mode,
             xfree (r);
           else
             {
-              r->next = thecache;
-              thecache = r;
+              ITEM *bucket = hash_bucket (shard, hash);
+
+              r->next = *bucket;
+              *bucket = r;
+              schedule_item (shard, r);
             }
         }
       if (err)
@@ -362,9 +610,7 @@ agent_put_cache (const char *key, cache_mode_t cache_mode,
     }
 
  out:
-  res = npth_mutex_unlock (&cache_lock);
-  if (res)
-    log_fatal ("failed to release cache mutex: %s\n", strerror (res));
+  unlock_shard (shard);
 
   return err;
 }
@@ -381,72 +627,81 @@ agent_get_cache (const char *key, cache_mode_t cache_mode)
   char *value = NULL;
   int res;
   int last_stored = 0;
+  unsigned int hash;
+  struct cache_shard_s *shard;
+  time_t current;
 
   if (cache_mode == CACHE_MODE_IGNORE)
     return NULL;
 
-  res = npth_mutex_lock (&cache_lock);
-  if (res)
-    log_fatal ("failed to acquire cache mutex: %s\n", strerror (res));
+  current = gnupg_get_time ();
+  sweep_cache (current);
 
   if (!key)
     {
+      /* Keep the stored key locked while we use it.  */
+      res = npth_mutex_lock (&stored_key_lock);
+      if (res)
+        log_fatal ("failed to acquire cache mutex: %s\n", strerror (res));
+      last_stored = 1;
       key = last_stored_cache_key;
       if (!key)
         goto out;
-      last_stored = 1;
     }
 
   if (DBG_CACHE)
     log_debug ("agent_get_cache '%s' (mode %d)%s ...\n",
                key, cache_mode,
                last_stored? " (stored cache key)":"");
-  housekeeping ();
 
-  for (r=thecache; r; r = r->next)
+  hash = cache_hash (key);
+  shard = hash_shard (hash);
+  lock_shard (shard);
+
+  /* The housekeeping of a shard may lag behind by a second, thus we
+     apply the expiration rules to the hit again.  If it has just
+     expired an item stored under another mode may still match.  */
+  for (;;)
     {
-      if (r->pw
-          && ((cache_mode != CACHE_MODE_USER
-               && cache_mode != CACHE_MODE_NONCE)
-              || cache_mode_equal (r->cache_mode, cache_mode))
-          && !strcmp (r->key, key))
+      r = find_item (shard, hash, key, cache_mode, 1);
+      if (!r || (!expire_item (shard, r, current) && r->pw))
+        break;
+    }
+  if (r)
+    {
+      r->accessed = current;
+      schedule_item (shard, r);
+      if (DBG_CACHE)
+        log_debug ("... hit\n");
+      if (r->pw->totallen < 32)
+        err = GPG_ERR_INV_LENGTH;
+      else if (!(value = (char*) xtrymalloc_secure (r->pw->totallen - 8)))
+        err = gpg_error_from_syserror ();
+      else
         {
-          /* Note: To avoid races KEY may not be accessed anymore below.  */
-          r->accessed = gnupg_get_time ();
-          if (DBG_CACHE)
-            log_debug ("... hit\n");
-          if (r->pw->totallen < 32)
-            err = GPG_ERR_INV_LENGTH;
-          else if ((err = init_encryption ()))
-            ;
-          else if (!(value = (char*) xtrymalloc_secure (r->pw->totallen - 8)))
-            err = gpg_error_from_syserror ();
-          else
-            {
-	      const Botan::secure_vector<uint8_t> pw_data(r->pw->totallen);
-	      memcpy((void*) (pw_data.data()), r->pw->data, r->pw->totallen);
-	      Botan::secure_vector<uint8_t> val = Botan::rfc3394_keyunwrap(pw_data, *encryption_handle);
-	      assert(val.size() == r->pw->totallen - 8);
-	      memcpy(value, val.data(), val.size());
-	      err = 0;
-            }
-          if (err)
-            {
-              xfree (value);
-              value = NULL;
-              log_error ("retrieving cache entry '%s' failed: %s\n",
-                         key, gpg_strerror (err));
-            }
-          break;
+          unwrap_data (r->pw, value);
+          err = 0;
+        }
+      if (err)
+        {
+          xfree (value);
+          value = NULL;
+          log_error ("retrieving cache entry '%s' failed: %s\n",
+                     key, gpg_strerror (err));
         }
     }
   if (DBG_CACHE && value == NULL)
     log_debug ("... miss\n");
 
+  unlock_shard (shard);
+
  out:
-  res = npth_mutex_unlock (&cache_lock);
-  if (res)
-    log_fatal ("failed to release cache mutex: %s\n", strerror (res));
+  if (last_stored)
+    {
+      res = npth_mutex_unlock (&stored_key_lock);
+      if (res)
+        log_fatal ("failed to release cache mutex: %s\n", strerror (res));
+    }
 
   return value;
 }
@@ -460,27 +715,23 @@ agent_store_cache_hit (const char *key)
 {
   char *neu;
   char *old;
+  int res;
 
-  /* To make sure the update is atomic under the non-preemptive thread
-   * model, we must make sure not to surrender control to a different
-   * thread.  Therefore, we avoid calling the allocator during the
-   * update.
-   *
-   * Background: xtrystrdup uses gcry_strdup which may use the secure
+  /* Note that xtrystrdup uses gcry_strdup which may use the secure
    * memory allocator of Libgcrypt.  That allocator takes locks and
-   * since version 1.14 libgpg-error is nPth aware and thus taking a
-   * lock may now lead to thread switch.  Note that this only happens
-   * when secure memory is _allocated_ (the standard allocator uses
-   * malloc which is not nPth aware) but not when calling _xfree_
-   * because gcry_free needs to check whether the pointer is in secure
-   * memory and thus needs to take a lock.
-   */
+   * thus we better call it before taking our own lock.  */
   neu = key ? xtrystrdup (key) : NULL;
 
-  /* Atomic update.  */
+  res = npth_mutex_lock (&stored_key_lock);
+  if (res)
+    log_fatal ("failed to acquire cache mutex: %s\n", strerror (res));
+
   old = last_stored_cache_key;
   last_stored_cache_key = neu;
-  /* Done.  */
+
+  res = npth_mutex_unlock (&stored_key_lock);
+  if (res)
+    log_fatal ("failed to release cache mutex: %s\n", strerror (res));
 
   xfree (old);
 }
@@ -101,7 +101,10 @@ struct inq_needpin_parm_s
    anchored at this variable. */
 static struct scd_local_s *scd_local_list;
 
-/* A Mutex used inside the start_scd function. */
+/* A Mutex used inside the start_scd function.  It also protects
+   SCD_LOCAL_LIST and the LOCKED flags of its items so that the
+   aliveness check can tell which contexts are in use even if the
+   connections run in parallel.  */
 static npth_mutex_t start_scd_lock;
 
 /* The context of the primary connection.  This is also used as a flag
@@ -162,6 +165,11 @@ agent_scd_dump_state (void)
 static int
 unlock_scd (ctrl_t ctrl, int rc)
 {
+  int res;
+
+  res = npth_mutex_lock (&start_scd_lock);
+  if (res)
+    log_fatal ("failed to acquire the start_scd lock: %s\n", strerror (res));
   if (ctrl->scd_local->locked != 1)
     {
       log_error ("unlock_scd: invalid lock count (%d)\n",
@@ -170,6 +178,9 @@ unlock_scd (ctrl_t ctrl, int rc)
         rc = GPG_ERR_INTERNAL;
     }
   ctrl->scd_local->locked = 0;
+  res = npth_mutex_unlock (&start_scd_lock);
+  if (res)
+    log_fatal ("failed to release the start_scd lock: %s\n", strerror (res));
   return rc;
 }
 
@@ -207,13 +218,25 @@ start_scd (ctrl_t ctrl)
   if (opt.disable_scdaemon)
     return GPG_ERR_NOT_SUPPORTED;
 
+  /* We need to protect the following code. */
+  rc = npth_mutex_lock (&start_scd_lock);
+  if (rc)
+    {
+      log_error ("failed to acquire the start_scd lock: %s\n",
+                 strerror (rc));
+      return GPG_ERR_INTERNAL;
+    }
+
   /* If this is the first call for this session, setup the local data
      structure. */
   if (!ctrl->scd_local)
     {
       ctrl->scd_local = (struct scd_local_s*)xtrycalloc (1, sizeof *ctrl->scd_local);
       if (!ctrl->scd_local)
-        return gpg_error_from_syserror ();
+        {
+          err = gpg_error_from_syserror ();
+          goto unlock;
+        }
       ctrl->scd_local->ctrl_backlink = ctrl;
       ctrl->scd_local->next_local = scd_local_list;
       scd_local_list = ctrl->scd_local;
@@ -225,26 +248,17 @@ start_scd (ctrl_t ctrl)
     {
       log_error ("start_scd: invalid lock count (%d)\n",
                  ctrl->scd_local->locked);
-      return GPG_ERR_INTERNAL;
+      err = GPG_ERR_INTERNAL;
+      goto unlock;
     }
   ctrl->scd_local->locked++;
 
   if (ctrl->scd_local->ctx)
-    return 0; /* Okay, the context is fine.  We used to test for an
-                 alive context here and do an disconnect.  Now that we
-                 have a ticker function to check for it, it is easier
-                 not to check here but to let the connection run on an
-                 error instead. */
-
-
-  /* We need to protect the following code. */
-  rc = npth_mutex_lock (&start_scd_lock);
-  if (rc)
-    {
-      log_error ("failed to acquire the start_scd lock: %s\n",
-                 strerror (rc));
-      return GPG_ERR_INTERNAL;
-    }
+    goto unlock; /* Okay, the context is fine.  We used to test for an
+                    alive context here and do an disconnect.  Now that
+                    we have a ticker function to check for it, it is
+                    easier not to check here but to let the connection
+                    run on an error instead. */
 
   /* Check whether the pipe server has already been started and in
      this case either reuse a lingering pipe connection or establish a
@@ -331,7 +345,8 @@ start_scd (ctrl_t ctrl)
   xfree (abs_homedir);
   if (err)
     {
-      unlock_scd (ctrl, err);
+      /* Same as unlock_scd but we already hold the lock.  */
+      ctrl->scd_local->locked = 0;
       if (ctx)
 	assuan_release (ctx);
     }
@@ -339,6 +354,7 @@ start_scd (ctrl_t ctrl)
     {
       ctrl->scd_local->ctx = ctx;
     }
+ unlock:
   rc = npth_mutex_unlock (&start_scd_lock);
   if (rc)
     log_error ("failed to release the start_scd lock: %s\n", strerror (rc));
@@ -399,10 +415,18 @@ agent_scd_check_aliveness (void)
              now but take care that it won't do another wait. Also
              cleanup all other connections and release their
              resources.  The next use will start a new daemon then.
-             Due to the use of the START_SCD_LOCAL we are sure that
-             none of these context are actually in use. */
+             The contexts are released only if none of them is
+             locked; a connection may still be using its context
+             when the connections run in parallel.  In that case we
+             try again at the next tick.  */
           struct scd_local_s *sl;
 
+          for (sl=scd_local_list; sl; sl = sl->next_local)
+            if (sl->locked)
+              break;
+          if (sl)
+            goto leave;
+
           assuan_set_flag (primary_scd_ctx, ASSUAN_NO_WAITPID, 1);
           assuan_release (primary_scd_ctx);
 
@@ -421,6 +445,7 @@ agent_scd_check_aliveness (void)
         }
     }
 
+ leave:
   err = npth_mutex_unlock (&start_scd_lock);
   if (err)
     log_error ("failed to release the start_scd lock while"
@@ -434,8 +459,17 @@ agent_scd_check_aliveness (void)
 int
 agent_reset_scd (ctrl_t ctrl)
 {
+  int rc;
+
   if (ctrl->scd_local)
     {
+      /* The lock is held across the RESTART so that the aliveness
+         check does not release our context meanwhile.  */
+      rc = npth_mutex_lock (&start_scd_lock);
+      if (rc)
+        log_fatal ("failed to acquire the start_scd lock: %s\n",
+                   strerror (rc));
+
       if (ctrl->scd_local->ctx)
         {
           /* We can't disconnect the primary context because libassuan
@@ -481,6 +515,11 @@ agent_reset_scd (ctrl_t ctrl)
         }
       xfree (ctrl->scd_local);
       ctrl->scd_local = NULL;
+
+      rc = npth_mutex_unlock (&start_scd_lock);
+      if (rc)
+        log_fatal ("failed to release the start_scd lock: %s\n",
+                   strerror (rc));
     }
 
   return 0;
@@ -428,14 +428,63 @@ cmd_marktrusted (assuan_context_t ctx, char *line)
 
 static const char hlp_havekey[] =
   "HAVEKEY <hexstrings_with_keygrips>\n"
+  "HAVEKEY --list[=<limit>]\n"
   "\n"
   "Return success if at least one of the secret keys with the given\n"
-  "keygrips is available.";
+  "keygrips is available.  With --list return all available keygrips\n"
+  "as binary data; with <limit> bail out at this number of keygrips.";
 static gpg_error_t
 cmd_havekey (assuan_context_t ctx, char *line)
 {
   gpg_error_t err;
   unsigned char buf[20];
+  const char *s;
+  int limit, counter;
+  char *dirname;
+  DIR *dir;
+  struct dirent *dir_entry;
+
+  if (has_option_name (line, "--list"))
+    {
+      /* List mode.  */
+      s = option_value (line, "--list");
+      limit = s? atoi (s) : 0;
+
+      dirname = make_filename_try (gnupg_homedir (),
+                                   GNUPG_PRIVATE_KEYS_DIR, NULL);
+      if (!dirname)
+        return leave_cmd (ctx, gpg_error_from_syserror ());
+      dir = opendir (dirname);
+      if (!dir)
+        {
+          err = gpg_error_from_syserror ();
+          xfree (dirname);
+          return leave_cmd (ctx, err);
+        }
+      xfree (dirname);
+
+      err = 0;
+      counter = 0;
+      while ( (dir_entry = readdir (dir)) )
+        {
+          if (strlen (dir_entry->d_name) != 44
+              || strcmp (dir_entry->d_name + 40, ".key"))
+            continue;
+          if (hex2bin (dir_entry->d_name, buf, 20) < 0)
+            continue; /* Bad hex string.  */
+
+          if (limit > 0 && ++counter > limit)
+            {
+              err = GPG_ERR_TRUNCATED;
+              break;
+            }
+          err = assuan_send_data (ctx, buf, 20);
+          if (err)
+            break;
+        }
+      closedir (dir);
+      return leave_cmd (ctx, err);
+    }
 
   do
     {
@@ -1303,6 +1352,7 @@ cmd_clear_passphrase (assuan_context_t ctx, char *line)
   char *cacheid = NULL;
   char *p;
   int opt_normal;
+  unsigned char grip[20];
 
   opt_normal = has_option (line, "--mode=normal");
   line = skip_options (line);
@@ -1320,6 +1370,11 @@ cmd_clear_passphrase (assuan_context_t ctx, char *line)
   agent_put_cache (cacheid, opt_normal ? CACHE_MODE_NORMAL : CACHE_MODE_USER,
                    NULL, 0);
 
+  /* The cache id of a key is its keygrip; an unprotected copy of that
+     key shall not be used anymore either.  */
+  if (opt_normal && strlen (cacheid) == 40 && hex2bin (cacheid, grip, 20) > 0)
+    agent_flush_key_cache (grip);
+
   agent_clear_passphrase (ctrl, cacheid,
 			  opt_normal ? CACHE_MODE_NORMAL : CACHE_MODE_USER);
 
@@ -51,6 +51,238 @@ struct try_unprotect_arg_s
 };
 
 
+/* A mutex used to serialize the writing of key files.  Keys are
+   updated in place and thus two connections running in parallel may
+   not write the same file at the same time.  */
+static npth_mutex_t write_key_lock;
+
+
+/* The number of keys kept in the cache of unprotected keys.  */
+#define KEY_CACHE_SIZE 32
+
+/* An item of the cache of unprotected keys.  It is only used if
+   --key-cache-ttl has been given.  The key is kept as a canonical
+   S-expression in secure memory along with the identity of the file
+   it has been read from; if the file changes the item is not used
+   anymore.  */
+struct key_cache_item_s
+{
+  unsigned char grip[20];
+  unsigned char *key;   /* NULL if the slot is unused.  */
+  size_t keylen;
+  dev_t dev;            /* The identity of the key file.  */
+  ino_t ino;
+  off_t size;
+  time_t mtime;
+  time_t ctime;
+  time_t created;       /* The time the item has been stored.  */
+  time_t used;          /* The time of the last use.  */
+};
+
+static struct key_cache_item_s key_cache[KEY_CACHE_SIZE];
+
+/* A mutex used to protect KEY_CACHE.  */
+static npth_mutex_t key_cache_lock;
+
+
+/* This function must be called once to initialize this module.  This
+   has to be done before a second thread is spawned.  We can't do the
+   static initialization because Pth emulation code might not be able
+   to do a static init; in particular, it is not possible for W32. */
+void
+initialize_module_findkey (void)
+{
+  static int initialized;
+  int err;
+
+  if (!initialized)
+    {
+      err = npth_mutex_init (&write_key_lock, NULL);
+      if (!err)
+        err = npth_mutex_init (&key_cache_lock, NULL);
+      if (err)
+        log_fatal ("failed to init mutex in %s: %s\n", __FILE__,strerror (err));
+      initialized = 1;
+    }
+}
+
+/* Stat the key file for GRIP and store the result at ST.  */
+static gpg_error_t
+stat_key_file (const unsigned char *grip, struct stat *st)
+{
+  gpg_error_t err = 0;
+  char *fname;
+  char hexgrip[40+4+1];
+
+  bin2hex (grip, 20, hexgrip);
+  strcpy (hexgrip+40, ".key");
+  fname = make_filename (gnupg_homedir (), GNUPG_PRIVATE_KEYS_DIR,
+                         hexgrip, NULL);
+  if (stat (fname, st))
+    err = gpg_error_from_syserror ();
+  xfree (fname);
+  return err;
+}
+
+
+static void
+lock_key_cache (void)
+{
+  int res;
+
+  res = npth_mutex_lock (&key_cache_lock);
+  if (res)
+    log_fatal ("failed to acquire key cache mutex: %s\n", strerror (res));
+}
+
+
+static void
+unlock_key_cache (void)
+{
+  int res;
+
+  res = npth_mutex_unlock (&key_cache_lock);
+  if (res)
+    log_fatal ("failed to release key cache mutex: %s\n", strerror (res));
+}
+
+
+/* Wipe and release the key stored in ITEM.  */
+static void
+release_key_cache_item (struct key_cache_item_s *item)
+{
+  if (item->key)
+    {
+      wipememory (item->key, item->keylen);
+      xfree (item->key);
+      item->key = NULL;
+    }
+}
+
+
+/* Release all expired items of the key cache.  The caller must hold
+   KEY_CACHE_LOCK.  */
+static void
+expire_key_cache (time_t current)
+{
+  int i;
+
+  for (i=0; i < KEY_CACHE_SIZE; i++)
+    if (key_cache[i].key
+        && key_cache[i].created + (time_t)opt.key_cache_ttl < current)
+      release_key_cache_item (key_cache + i);
+}
+
+
+/* Look up the unprotected key for GRIP in the key cache.  ST is the
+   current status of the key file.  On success the key is stored as a
+   new S-expression at R_KEY.  */
+static gpg_error_t
+key_cache_get (const unsigned char *grip, const struct stat *st,
+               gcry_sexp_t *r_key)
+{
+  gpg_error_t err = GPG_ERR_NOT_FOUND;
+  struct key_cache_item_s *item;
+  time_t current = gnupg_get_time ();
+  int i;
+
+  *r_key = NULL;
+
+  lock_key_cache ();
+  expire_key_cache (current);
+  for (i=0; i < KEY_CACHE_SIZE; i++)
+    {
+      item = key_cache + i;
+      if (!item->key || memcmp (item->grip, grip, 20))
+        continue;
+
+      if (item->dev != st->st_dev || item->ino != st->st_ino
+          || item->size != st->st_size || item->mtime != st->st_mtime
+          || item->ctime != st->st_ctime)
+        {
+          /* The key file has been changed.  */
+          release_key_cache_item (item);
+          break;
+        }
+
+      err = gcry_sexp_sscan (r_key, NULL, (char*)item->key, item->keylen);
+      if (err)
+        release_key_cache_item (item);
+      else
+        item->used = current;
+      break;
+    }
+  unlock_key_cache ();
+
+  if (DBG_CACHE)
+    log_debug ("key cache lookup: %s\n", err? "miss":"hit");
+  return err;
+}
+
+
+/* Store a copy of the unprotected canonical key KEY of length KEYLEN
+   for GRIP in the key cache.  ST is the status of the key file taken
+   before the key was read.  Errors are ignored.  */
+static void
+key_cache_put (const unsigned char *grip, const struct stat *st,
+               const unsigned char *key, size_t keylen)
+{
+  struct key_cache_item_s *item = NULL;
+  time_t current = gnupg_get_time ();
+  int i;
+
+  lock_key_cache ();
+  expire_key_cache (current);
+  /* Reuse the slot for GRIP, an unused one, or the least recently
+     used one in that order.  */
+  for (i=0; i < KEY_CACHE_SIZE; i++)
+    {
+      if (key_cache[i].key && !memcmp (key_cache[i].grip, grip, 20))
+        {
+          item = key_cache + i;
+          break;
+        }
+      if (!item
+          || (item->key
+              && (!key_cache[i].key || key_cache[i].used < item->used)))
+        item = key_cache + i;
+    }
+  release_key_cache_item (item);
+
+  item->key = (unsigned char*) xtrymalloc_secure (keylen);
+  if (item->key)
+    {
+      memcpy (item->key, key, keylen);
+      item->keylen = keylen;
+      memcpy (item->grip, grip, 20);
+      item->dev = st->st_dev;
+      item->ino = st->st_ino;
+      item->size = st->st_size;
+      item->mtime = st->st_mtime;
+      item->ctime = st->st_ctime;
+      item->created = item->used = current;
+    }
+  unlock_key_cache ();
+}
+
+
+/* Remove the key for GRIP from the cache of unprotected keys.  If
+   GRIP is NULL all keys are removed.  */
+void
+agent_flush_key_cache (const unsigned char *grip)
+{
+  int i;
+
+  lock_key_cache ();
+  for (i=0; i < KEY_CACHE_SIZE; i++)
+    if (key_cache[i].key
+        && (!grip || !memcmp (key_cache[i].grip, grip, 20)))
+      release_key_cache_item (key_cache + i);
+  unlock_key_cache ();
+}
+
+
+
 /* Note: Ownership of FNAME and FP are moved to this function.  */
 static gpg_error_t
 write_extended_private_key (char *fname, estream_t fp, int update,
@@ -134,10 +366,10 @@ write_extended_private_key (char *fname, estream_t fp, int update,
 
 /* Write an S-expression formatted key to our key storage.  With FORCE
    passed as true an existing key with the given GRIP will get
-   overwritten.  */
-int
-agent_write_private_key (const unsigned char *grip,
-                         const void *buffer, size_t length, int force)
+   overwritten.  The caller must hold WRITE_KEY_LOCK.  */
+static int
+write_private_key (const unsigned char *grip,
+                   const void *buffer, size_t length, int force)
 {
   char *fname;
   estream_t fp;
@@ -251,6 +483,27 @@ agent_write_private_key (const unsigned char *grip,
 }
 
 
+/* Write an S-expression formatted key to our key storage.  With FORCE
+   passed as true an existing key with the given GRIP will get
+   overwritten.  */
+int
+agent_write_private_key (const unsigned char *grip,
+                         const void *buffer, size_t length, int force)
+{
+  int rc, res;
+
+  res = npth_mutex_lock (&write_key_lock);
+  if (res)
+    log_fatal ("failed to acquire key write mutex: %s\n", strerror (res));
+  rc = write_private_key (grip, buffer, length, force);
+  agent_flush_key_cache (grip);
+  res = npth_mutex_unlock (&write_key_lock);
+  if (res)
+    log_fatal ("failed to release key write mutex: %s\n", strerror (res));
+  return rc;
+}
+
+
 /* Callback function to try the unprotection from the passphrase query
    code. */
 static gpg_error_t
@@ -787,7 +1040,10 @@ remove_key_file (const unsigned char *grip)
    R_PASSPHRASE is not NULL, the function succeeded and the key was
    protected the used passphrase (entered or from the cache) is stored
    there; if not NULL will be stored.  The caller needs to free the
-   returned passphrase.   */
+   returned passphrase.  If enabled, unprotected keys are taken from
+   and stored in the key cache as long as the key file is unchanged;
+   the cache is not used with CACHE_MODE_IGNORE or if the passphrase
+   is requested.  */
 gpg_error_t
 agent_key_from_file (ctrl_t ctrl, const char *cache_nonce,
                      const char *desc_text,
@@ -799,6 +1055,8 @@ agent_key_from_file (ctrl_t ctrl, const char *cache_nonce,
   unsigned char *buf;
   size_t len, buflen, erroff;
   gcry_sexp_t s_skey;
+  struct stat st;
+  int use_key_cache;
 
   *result = NULL;
   if (shadow_info)
@@ -806,6 +1064,13 @@ agent_key_from_file (ctrl_t ctrl, const char *cache_nonce,
   if (r_passphrase)
     *r_passphrase = NULL;
 
+  /* The file is looked at before it is read, so that a concurrent
+     change of the file will let the next lookup fail.  */
+  use_key_cache = (opt.key_cache_ttl && cache_mode != CACHE_MODE_IGNORE
+                   && !r_passphrase && !stat_key_file (grip, &st));
+  if (use_key_cache && !key_cache_get (grip, &st, result))
+    return 0;
+
   rc = read_key_file (grip, &s_skey);
   if (rc)
     {
@@ -922,6 +1187,9 @@ agent_key_from_file (ctrl_t ctrl, const char *cache_nonce,
 
   buflen = gcry_sexp_canon_len (buf, 0, NULL, NULL);
   rc = gcry_sexp_sscan (&s_skey, &erroff, (char*)buf, buflen);
+  if (!rc && use_key_cache
+      && agent_private_key_type (buf) == PRIVATE_KEY_CLEAR)
+    key_cache_put (grip, &st, buf, buflen);
   wipememory (buf, buflen);
   xfree (buf);
   if (rc)
@@ -1473,6 +1741,7 @@ agent_delete_key (ctrl_t ctrl, const char *desc_text,
     }
 
  leave:
+  agent_flush_key_cache (grip);
   gcry_free (comment);
   xfree (desc_text_final);
   xfree (default_desc);
@@ -83,6 +83,7 @@ enum cmd_and_opt_values
   oScdaemonProgram,
   oDefCacheTTL,
   oMaxCacheTTL,
+  oKeyCacheTTL,
   oEnableExtendedKeyFormat,
   oFakedSystemTime,
 
@@ -91,6 +92,7 @@ enum cmd_and_opt_values
   oNoAllowMarkTrusted,
   oNoAllowExternalCache,
   oDisableScdaemon,
+  oParallelConnections,
   oWriteEnvFile
 };
 
@@ -132,6 +134,7 @@ static ARGPARSE_OPTS opts[] = {
   ARGPARSE_s_u (oDefCacheTTL,    "default-cache-ttl",
                                  N_("|N|expire cached PINs after N seconds")),
   ARGPARSE_s_u (oMaxCacheTTL,    "max-cache-ttl",         "@" ),
+  ARGPARSE_s_u (oKeyCacheTTL,    "key-cache-ttl",         "@" ),
 
   ARGPARSE_s_n (oIgnoreCacheForSigning, "ignore-cache-for-signing",
                 /* */    N_("do not use the PIN cache when signing")),
@@ -141,6 +144,7 @@ static ARGPARSE_OPTS opts[] = {
                 /* */    N_("disallow clients to mark keys as \"trusted\"")),
   ARGPARSE_s_n (oAllowMarkTrusted,   "allow-mark-trusted", "@"),
   ARGPARSE_s_n (oEnableExtendedKeyFormat, "enable-extended-key-format", "@"),
+  ARGPARSE_s_n (oParallelConnections, "parallel-connections", "@"),
 
   /* Dummy options for backward compatibility.  */
   ARGPARSE_o_s (oWriteEnvFile, "write-env-file", "@"),
@@ -385,6 +389,7 @@ parse_rereadable_options (ARGPARSE_ARGS *pargs, int reread)
       opt.debug_pinentry = 0;
       opt.def_cache_ttl = DEFAULT_CACHE_TTL;
       opt.max_cache_ttl = MAX_CACHE_TTL;
+      opt.key_cache_ttl = 0;
       opt.enforce_passphrase_constraints = 0;
       opt.min_passphrase_len = MIN_PASSPHRASE_LEN;
       opt.min_passphrase_nonalpha = MIN_PASSPHRASE_NONALPHA;
@@ -426,6 +431,7 @@ parse_rereadable_options (ARGPARSE_ARGS *pargs, int reread)
 
     case oDefCacheTTL: opt.def_cache_ttl = pargs->r.ret_ulong; break;
     case oMaxCacheTTL: opt.max_cache_ttl = pargs->r.ret_ulong; break;
+    case oKeyCacheTTL: opt.key_cache_ttl = pargs->r.ret_ulong; break;
 
     case oEnableExtendedKeyFormat:
       opt.enable_extended_key_format = 1;
@@ -462,7 +468,13 @@ thread_init_once (void)
   if (!npth_initialized)
     {
       npth_initialized++;
-      npth_init ();
+      /* In parallel mode the connection threads are not serialized
+       * by nPth and may run on all cores at once.  All module state
+       * shared between connections is protected by its own lock;
+       * fall back to the default mode if that is not supported.  */
+      if (!opt.parallel_connections
+          || npth_init_ex (NPTH_INIT_PARALLEL))
+        npth_init ();
     }
   gpgrt_set_syscall_clamp (npth_unprotect, npth_protect);
   /* Now that we have set the syscall clamp we need to tell Libgcrypt
@@ -482,6 +494,7 @@ initialize_modules (void)
   thread_init_once ();
   assuan_set_system_hooks (ASSUAN_SYSTEM_NPTH);
   initialize_module_cache ();
+  initialize_module_findkey ();
   initialize_module_call_pinentry ();
   initialize_module_call_scd ();
   initialize_module_trustlist ();
@@ -649,6 +662,7 @@ agent_main (int argc, char **argv )
         case oNoDetach: nodetach = 1; break;
         case oLogFile: logfile = pargs.r.ret_str; break;
         case oServer: pipe_server = 1; break;
+        case oParallelConnections: opt.parallel_connections = 1; break;
 
         case oLCctype: default_lc_ctype = xstrdup (pargs.r.ret_str); break;
         case oLCmessages: default_lc_messages = xstrdup (pargs.r.ret_str);
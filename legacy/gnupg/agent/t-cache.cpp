@@ -0,0 +1,219 @@
+/* t-cache.c - Regression tests for the passphrase cache
+ * Copyright (C) 2018 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* The tests include the module so that they can look at the shards
+   and control when the sweep runs.  The time is frozen with
+   gnupg_set_time.  */
+#include "cache.cpp"
+
+#define pass()  do { ; } while(0)
+#define fail(a)  do { fprintf (stderr, "%s:%d: test %d failed\n",\
+                               __FILE__,__LINE__, (a));          \
+                     exit (1);                                   \
+                   } while(0)
+
+static time_t base_time;
+
+
+static void
+set_time (time_t offset)
+{
+  gnupg_set_time (base_time + offset, 1);
+}
+
+
+/* Return true if KEY has a secret stored under CACHE_MODE without
+   touching the access time of the item.  */
+static int
+has_data (const char *key, cache_mode_t cache_mode)
+{
+  unsigned int hash = cache_hash (key);
+  struct cache_shard_s *shard = hash_shard (hash);
+  ITEM r;
+
+  lock_shard (shard);
+  r = find_item (shard, hash, key, cache_mode, 1);
+  unlock_shard (shard);
+  return !!r;
+}
+
+
+/* Return true if KEY has a secret equal to VALUE.  */
+static int
+check_value (const char *key, cache_mode_t cache_mode, const char *value)
+{
+  char *p;
+  int okay;
+
+  p = agent_get_cache (key, cache_mode);
+  okay = p && !strcmp (p, value);
+  xfree (p);
+  return okay;
+}
+
+
+/* Store many keys, which are spread over all shards, and read them
+   back.  */
+static void
+test_put_get (void)
+{
+  char key[32], value[32];
+  int i, n;
+  int used[CACHE_SHARDS];
+
+  set_time (0);
+  memset (used, 0, sizeof used);
+  for (i = 0; i < 500; i++)
+    {
+      snprintf (key, sizeof key, "KEY%d", i);
+      snprintf (value, sizeof value, "secret %d", i);
+      if (agent_put_cache (key, CACHE_MODE_NORMAL, value, 600))
+        fail (i);
+      used[cache_hash (key) % CACHE_SHARDS]++;
+    }
+  for (i = n = 0; i < CACHE_SHARDS; i++)
+    if (used[i])
+      n++;
+  if (n != CACHE_SHARDS)
+    fail (0);
+
+  for (i = 0; i < 500; i++)
+    {
+      snprintf (key, sizeof key, "KEY%d", i);
+      snprintf (value, sizeof value, "secret %d", i);
+      if (!check_value (key, CACHE_MODE_NORMAL, value))
+        fail (i);
+    }
+
+  /* Replace and delete.  */
+  if (agent_put_cache ("KEY1", CACHE_MODE_NORMAL, "new secret", 600))
+    fail (1);
+  if (!check_value ("KEY1", CACHE_MODE_NORMAL, "new secret"))
+    fail (1);
+  if (agent_put_cache ("KEY1", CACHE_MODE_NORMAL, NULL, 0))
+    fail (1);
+  if (agent_get_cache ("KEY1", CACHE_MODE_NORMAL))
+    fail (1);
+  if (agent_get_cache ("NO SUCH KEY", CACHE_MODE_NORMAL))
+    fail (1);
+
+  /* The user and nonce modes only match their own items.  */
+  if (agent_get_cache ("KEY2", CACHE_MODE_USER))
+    fail (2);
+  if (!check_value ("KEY2", CACHE_MODE_ANY, "secret 2"))
+    fail (2);
+
+  agent_flush_cache ();
+  if (agent_get_cache ("KEY2", CACHE_MODE_NORMAL))
+    fail (2);
+}
+
+
+/* Check the expiration through the timer wheel, including items
+   which expire after more than one turn of the wheel.  */
+static void
+test_expire (void)
+{
+  time_t t;
+
+  set_time (10000);
+  if (agent_put_cache ("SHORT", CACHE_MODE_NORMAL, "short", 10)
+      || agent_put_cache ("LONG", CACHE_MODE_NORMAL, "long", 1000)
+      || agent_put_cache ("FOREVER", CACHE_MODE_NORMAL, "forever", -1))
+    fail (0);
+
+  /* An access extends the lifetime.  */
+  set_time (10008);
+  if (!check_value ("SHORT", CACHE_MODE_NORMAL, "short"))
+    fail (1);
+  set_time (10016);
+  if (!check_value ("SHORT", CACHE_MODE_NORMAL, "short"))
+    fail (1);
+  set_time (10027);
+  if (agent_get_cache ("SHORT", CACHE_MODE_NORMAL))
+    fail (1);
+
+  /* Only let the sweep look at LONG.  It must survive several turns
+     of the wheel and be released right after its TTL.  */
+  for (t = 10000; t <= 11000; t += 50)
+    {
+      set_time (t);
+      agent_put_cache ("OTHER", CACHE_MODE_NORMAL, NULL, 0);
+      if (!has_data ("LONG", CACHE_MODE_NORMAL))
+        fail (2);
+    }
+  set_time (11001);
+  agent_put_cache ("OTHER", CACHE_MODE_NORMAL, NULL, 0);
+  if (has_data ("LONG", CACHE_MODE_NORMAL))
+    fail (2);
+
+  /* The maximum lifetime also applies to items without a TTL.  */
+  set_time (10000 + opt.max_cache_ttl);
+  if (!check_value ("FOREVER", CACHE_MODE_NORMAL, "forever"))
+    fail (3);
+  set_time (10001 + opt.max_cache_ttl);
+  agent_put_cache ("OTHER", CACHE_MODE_NORMAL, NULL, 0);
+  if (has_data ("FOREVER", CACHE_MODE_NORMAL))
+    fail (3);
+}
+
+
+/* If the sweep has not yet seen an expired item, a lookup must skip
+   it and still find an item of the same key stored under another
+   mode.  */
+static void
+test_expired_hit (void)
+{
+  set_time (20000);
+  if (agent_put_cache ("KEY", CACHE_MODE_NORMAL, "normal", 100)
+      || agent_put_cache ("KEY", CACHE_MODE_USER, "user", 10))
+    fail (0);
+
+  /* Pretend the sweep already ran this second.  The user item comes
+     first in the bucket.  */
+  set_time (20011);
+  last_sweep = base_time + 20011;
+  if (!check_value ("KEY", CACHE_MODE_NORMAL, "normal"))
+    fail (1);
+  if (agent_get_cache ("KEY", CACHE_MODE_USER))
+    fail (1);
+}
+
+
+int
+cache_main (int argc, char **argv)
+{
+  (void)argc;
+  (void)argv;
+
+  if (npth_init ())
+    return 1;
+  /* Stay away from the real time, which would unfreeze the clock.  */
+  base_time = time (NULL) - 100000;
+  opt.def_cache_ttl = 600;
+  opt.max_cache_ttl = 7200;
+  initialize_module_cache ();
+
+  test_put_get ();
+  test_expire ();
+  test_expired_hit ();
+
+  deinitialize_module_cache ();
+  return 0;
+}
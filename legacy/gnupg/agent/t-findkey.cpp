@@ -0,0 +1,300 @@
+/* t-findkey.c - Regression tests for the cache of unprotected keys
+ * Copyright (C) 2018 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* The tests include the module so that they can put items into the
+   key cache directly.  The keys are unprotected and stored in a
+   private key directory below a temporary home directory.  The time
+   is frozen with gnupg_set_time.  */
+#include "findkey.cpp"
+
+#include <sys/time.h>
+
+#define pass()  do { ; } while(0)
+#define fail(a)  do { fprintf (stderr, "%s:%d: test %d failed\n",\
+                               __FILE__,__LINE__, (a));          \
+                     exit (1);                                   \
+                   } while(0)
+
+#define KEY_A "(11:private-key(3:ecc(5:curve7:Ed25519)(1:q3:aaa)(1:d3:AAA)))"
+#define KEY_B "(11:private-key(3:ecc(5:curve7:Ed25519)(1:q3:bbb)(1:d3:BBB)))"
+#define KEY_C "(11:private-key(3:ecc(5:curve7:Ed25519)(1:q3:ccc)(1:d3:CCC)))"
+
+static unsigned char grip[20];
+static char *homedir;
+static char *keyfile;
+static time_t base_time;
+
+
+static void
+set_time (time_t offset)
+{
+  gnupg_set_time (base_time + offset, 1);
+}
+
+
+/* Replace the key file by a new file with the canonical key KEY.  */
+static void
+write_key (const char *key)
+{
+  char *tmpname;
+  FILE *fp;
+
+  tmpname = xstrconcat (keyfile, ".tmp", NULL);
+  fp = fopen (tmpname, "wb");
+  if (!fp || fputs (key, fp) == EOF || fclose (fp))
+    {
+      fprintf (stderr, "error writing '%s': %s\n", tmpname, strerror (errno));
+      exit (1);
+    }
+  if (rename (tmpname, keyfile))
+    {
+      fprintf (stderr, "error renaming '%s': %s\n", tmpname, strerror (errno));
+      exit (1);
+    }
+  xfree (tmpname);
+}
+
+
+/* Put the canonical key KEY into the key cache for the current state
+   of the key file.  */
+static void
+put_cached_key (const char *key)
+{
+  struct stat st;
+
+  if (stat_key_file (grip, &st))
+    fail (0);
+  key_cache_put (grip, &st, (const unsigned char *)key, strlen (key));
+}
+
+
+/* Return true if the key cache has an item for GRIP.  */
+static int
+is_cached (void)
+{
+  int i, found = 0;
+
+  lock_key_cache ();
+  for (i=0; i < KEY_CACHE_SIZE; i++)
+    if (key_cache[i].key && !memcmp (key_cache[i].grip, grip, 20))
+      found = 1;
+  unlock_key_cache ();
+  return found;
+}
+
+
+/* Get the key using CACHE_MODE and return true if it is the
+   canonical key EXPECTED.  If WITH_PASSPHRASE is set, the passphrase
+   is requested from agent_key_from_file.  */
+static int
+check_key (cache_mode_t cache_mode, int with_passphrase,
+           const char *expected)
+{
+  gcry_sexp_t s_key;
+  char *passphrase = NULL;
+  char buf[256];
+  size_t len;
+  int okay;
+
+  if (agent_key_from_file (NULL, NULL, NULL, grip, NULL, cache_mode, NULL,
+                           &s_key, with_passphrase? &passphrase : NULL))
+    return 0;
+  xfree (passphrase);
+  len = gcry_sexp_sprint (s_key, GCRYSEXP_FMT_CANON, buf, sizeof buf);
+  gcry_sexp_release (s_key);
+  okay = len == strlen (expected) && !memcmp (buf, expected, len);
+  return okay;
+}
+
+
+/* A key read from the file is cached and the cached item is
+   returned as long as the file is unchanged.  */
+static void
+test_hit (void)
+{
+  set_time (0);
+  write_key (KEY_A);
+  if (!check_key (CACHE_MODE_NORMAL, 0, KEY_A))
+    fail (1);
+  if (!is_cached ())
+    fail (1);
+
+  /* Replace the cached item, so that a hit can be told apart from a
+     read of the file.  */
+  put_cached_key (KEY_C);
+  if (!check_key (CACHE_MODE_NORMAL, 0, KEY_C))
+    fail (2);
+  if (!check_key (CACHE_MODE_USER, 0, KEY_C))
+    fail (2);
+}
+
+
+/* A change of the key file invalidates the item, also if the new
+   file has the same size and the same mtime.  */
+static void
+test_invalidate (void)
+{
+  struct stat st;
+  struct timeval tv[2];
+
+  set_time (100);
+  write_key (KEY_A);
+  put_cached_key (KEY_C);
+
+  write_key (KEY_B);
+  if (!check_key (CACHE_MODE_NORMAL, 0, KEY_B))
+    fail (1);
+  if (!is_cached ())
+    fail (1);
+
+  /* Rewrite the file in place with the old size and mtime.  Only the
+     ctime tells the change.  */
+  put_cached_key (KEY_C);
+  if (stat (keyfile, &st))
+    fail (2);
+  sleep (1);
+  {
+    FILE *fp = fopen (keyfile, "r+b");
+    if (!fp || fputs (KEY_A, fp) == EOF || fclose (fp))
+      fail (2);
+  }
+  tv[0].tv_sec = st.st_atime;
+  tv[0].tv_usec = 0;
+  tv[1].tv_sec = st.st_mtime;
+  tv[1].tv_usec = 0;
+  if (utimes (keyfile, tv))
+    fail (2);
+  if (!check_key (CACHE_MODE_NORMAL, 0, KEY_A))
+    fail (2);
+
+  /* A removed file must not be served from the cache.  */
+  put_cached_key (KEY_C);
+  if (remove (keyfile))
+    fail (3);
+  if (check_key (CACHE_MODE_NORMAL, 0, KEY_C))
+    fail (3);
+}
+
+
+/* The cache is neither used with CACHE_MODE_IGNORE nor if the
+   passphrase is requested.  */
+static void
+test_bypass (void)
+{
+  set_time (200);
+  write_key (KEY_A);
+  put_cached_key (KEY_C);
+
+  if (!check_key (CACHE_MODE_IGNORE, 0, KEY_A))
+    fail (1);
+  if (!check_key (CACHE_MODE_NORMAL, 1, KEY_A))
+    fail (2);
+  /* The bypass does not store the key.  */
+  if (!check_key (CACHE_MODE_NORMAL, 0, KEY_C))
+    fail (3);
+
+  agent_flush_key_cache (NULL);
+  if (!check_key (CACHE_MODE_IGNORE, 0, KEY_A))
+    fail (4);
+  if (is_cached ())
+    fail (4);
+
+  /* Without a TTL the cache is not used at all.  */
+  opt.key_cache_ttl = 0;
+  if (!check_key (CACHE_MODE_NORMAL, 0, KEY_A))
+    fail (5);
+  if (is_cached ())
+    fail (5);
+  opt.key_cache_ttl = 60;
+}
+
+
+/* The items expire after the TTL and can be flushed.  */
+static void
+test_expire (void)
+{
+  set_time (300);
+  write_key (KEY_A);
+  put_cached_key (KEY_C);
+
+  set_time (360);
+  if (!check_key (CACHE_MODE_NORMAL, 0, KEY_C))
+    fail (1);
+  set_time (361);
+  if (!check_key (CACHE_MODE_NORMAL, 0, KEY_A))
+    fail (1);
+
+  put_cached_key (KEY_C);
+  agent_flush_key_cache (grip);
+  if (is_cached ())
+    fail (2);
+  if (!check_key (CACHE_MODE_NORMAL, 0, KEY_A))
+    fail (2);
+}
+
+
+int
+findkey_main (int argc, char **argv)
+{
+  char template_[] = "/tmp/t-findkey.XXXXXX";
+  char hexgrip[40+4+1];
+  char *dname;
+  int i;
+
+  (void)argc;
+  (void)argv;
+
+  if (npth_init ())
+    return 1;
+  base_time = time (NULL) - 100000;
+  opt.key_cache_ttl = 60;
+  initialize_module_findkey ();
+
+  homedir = mkdtemp (template_);
+  if (!homedir)
+    {
+      fprintf (stderr, "mkdtemp failed: %s\n", strerror (errno));
+      return 1;
+    }
+  gnupg_set_homedir (homedir);
+  dname = make_filename (homedir, GNUPG_PRIVATE_KEYS_DIR, NULL);
+  if (gnupg_mkdir (dname, "-rwx"))
+    {
+      fprintf (stderr, "error creating '%s': %s\n", dname, strerror (errno));
+      return 1;
+    }
+  for (i=0; i < 20; i++)
+    grip[i] = i;
+  bin2hex (grip, 20, hexgrip);
+  strcpy (hexgrip+40, ".key");
+  keyfile = make_filename (dname, hexgrip, NULL);
+
+  test_hit ();
+  test_invalidate ();
+  test_bypass ();
+  test_expire ();
+
+  agent_flush_key_cache (NULL);
+  remove (keyfile);
+  rmdir (dname);
+  rmdir (homedir);
+  xfree (keyfile);
+  xfree (dname);
+  return 0;
+}
@@ -0,0 +1,256 @@
+/* t-pksign.c - Signing throughput with concurrent connections
+ * Copyright (C) 2018 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Each client is a thread with its own control structure, like a
+   connection of gpg-agent after SIGKEY and SETHASH, which runs
+   agent_pksign in a loop.  The key is an unprotected key in a
+   private key directory below a temporary home directory, thus the
+   signing goes through the key file and the key cache.  The
+   signatures per second are printed for each number of clients in
+   the default mode of nPth and with --parallel-connections.  */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <npth.h>
+
+#include "agent.h"
+
+#define pass()  do { ; } while(0)
+#define fail(a)  do { fprintf (stderr, "%s:%d: test %d failed\n",\
+                               __FILE__,__LINE__, (a));          \
+                     exit (1);                                   \
+                   } while(0)
+
+/* The Ed25519 key of test 1 of RFC-8032.  */
+#define KEY_Q "40D75A980182B10AB7D54BFED3C964073A0EE172F3DAA62325AF021A68F707511A"
+#define KEY_D "9D61B19DEFFD5A60BA844AF492EC2CC44449C5697B326919703BAC031CAE7F60"
+
+/* The number of signatures made by all clients of a run.  */
+#define N_SIGNATURES 64
+
+static unsigned char grip[20];
+static unsigned char message[32];
+/* The expected signature; Ed25519 signatures are deterministic.  */
+static char *expected;
+static size_t expectedlen;
+
+
+/* Let the control structure CTRL sign MESSAGE with the test key and
+   return the canonical signature.  */
+static char *
+sign_message (ctrl_t ctrl, size_t *r_len)
+{
+  membuf_t mb;
+
+  init_membuf (&mb, 128);
+  if (agent_pksign (ctrl, NULL, NULL, &mb, CACHE_MODE_NORMAL))
+    {
+      xfree (get_membuf (&mb, NULL));
+      return NULL;
+    }
+  return (char *) get_membuf (&mb, r_len);
+}
+
+
+/* Set up CTRL like a connection after SIGKEY and SETHASH.  */
+static void
+init_ctrl (ctrl_t ctrl)
+{
+  memset (ctrl, 0, sizeof *ctrl);
+  memcpy (ctrl->keygrip, grip, 20);
+  ctrl->have_keygrip = 1;
+  ctrl->digest.algo = GCRY_MD_SHA512;
+  memcpy (ctrl->digest.value, message, sizeof message);
+  ctrl->digest.valuelen = sizeof message;
+}
+
+
+/* A client making NSIGS signatures.  Returns non-NULL on error.  */
+static void *
+client_thread (void *arg)
+{
+  int nsigs = (int)(size_t) arg;
+  struct server_control_s ctrl;
+  char *sig;
+  size_t len;
+  int i;
+  void *result = NULL;
+
+  init_ctrl (&ctrl);
+  for (i=0; i < nsigs && !result; i++)
+    {
+      sig = sign_message (&ctrl, &len);
+      if (!sig || len != expectedlen || memcmp (sig, expected, len))
+        result = &ctrl;
+      xfree (sig);
+    }
+  return result;
+}
+
+
+/* Make N_SIGNATURES signatures with NCLIENTS clients after
+   initializing nPth with FLAGS and return the signatures per
+   second.  */
+static double
+run_bench (unsigned int flags, int nclients)
+{
+  npth_t tid[8];
+  struct timespec start, stop;
+  void *result;
+  double secs;
+  int i;
+
+  if (npth_init_ex (flags))
+    fail (10);
+  if (npth_clock_gettime (&start))
+    fail (10);
+  for (i=0; i < nclients; i++)
+    if (npth_create (&tid[i], NULL, client_thread,
+                     (void *)(size_t)(N_SIGNATURES / nclients)))
+      fail (10);
+  for (i=0; i < nclients; i++)
+    {
+      if (npth_join (tid[i], &result))
+        fail (10);
+      if (result)
+        fail (11);
+    }
+  if (npth_clock_gettime (&stop))
+    fail (10);
+
+  secs = (stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec) / 1e9;
+  if (secs <= 0)
+    secs = 1e-9;
+  return N_SIGNATURES / secs;
+}
+
+
+/* Store the test key in the home directory and make the expected
+   signature.  */
+static void
+setup_key (void)
+{
+  gcry_sexp_t s_skey, s_pkey, s_sig, s_data;
+  struct server_control_s ctrl;
+  unsigned char *buf;
+  size_t len;
+  int i;
+
+  for (i=0; i < sizeof message; i++)
+    message[i] = i * 7;
+
+  if (gcry_sexp_build (&s_skey, NULL,
+                       "(private-key(ecc(curve Ed25519)(flags eddsa)"
+                       "(q #" KEY_Q "#)(d #" KEY_D "#)))")
+      || gcry_sexp_build (&s_pkey, NULL,
+                          "(public-key(ecc(curve Ed25519)(flags eddsa)"
+                          "(q #" KEY_Q "#)))"))
+    fail (1);
+  if (!gcry_pk_get_keygrip (s_pkey, grip))
+    fail (1);
+  if (make_canon_sexp (s_skey, &buf, &len)
+      || agent_write_private_key (grip, buf, len, 0))
+    fail (1);
+  xfree (buf);
+
+  init_ctrl (&ctrl);
+  expected = sign_message (&ctrl, &expectedlen);
+  if (!expected)
+    fail (2);
+
+  /* Check the signature once; the clients compare with it.  */
+  if (gcry_sexp_sscan (&s_sig, NULL, expected, expectedlen)
+      || gcry_sexp_build (&s_data, NULL,
+                          "(data(flags eddsa)(hash-algo sha512)(value %b))",
+                          (int) sizeof message, message))
+    fail (2);
+  if (gcry_pk_verify (s_sig, s_data, s_pkey))
+    fail (2);
+
+  gcry_sexp_release (s_data);
+  gcry_sexp_release (s_sig);
+  gcry_sexp_release (s_pkey);
+  gcry_sexp_release (s_skey);
+}
+
+
+/* The numbers depend on the number of CPUs and are only reported.
+   Each signature is checked.  */
+int
+pksign_bench_main (int argc, char **argv)
+{
+  static const int nclients[] = { 1, 2, 4, 8 };
+  char template_[] = "/tmp/t-pksign.XXXXXX";
+  char hexgrip[40+4+1];
+  char *homedir, *dname, *fname;
+  double def, par;
+  int i;
+
+  (void)argc;
+  (void)argv;
+
+  if (npth_init ())
+    return 1;
+  opt.key_cache_ttl = 600;
+  initialize_module_findkey ();
+
+  homedir = mkdtemp (template_);
+  if (!homedir)
+    {
+      fprintf (stderr, "mkdtemp failed: %s\n", strerror (errno));
+      return 1;
+    }
+  gnupg_set_homedir (homedir);
+  dname = make_filename (homedir, GNUPG_PRIVATE_KEYS_DIR, NULL);
+  if (gnupg_mkdir (dname, "-rwx"))
+    {
+      fprintf (stderr, "error creating '%s': %s\n", dname, strerror (errno));
+      return 1;
+    }
+  setup_key ();
+
+  for (i=0; i < DIM (nclients); i++)
+    {
+      def = run_bench (0, nclients[i]);
+      par = run_bench (NPTH_INIT_PARALLEL, nclients[i]);
+      printf ("agent: %2d clients: default mode %.0f sig/s,"
+              " parallel mode %.0f sig/s (%.2fx)\n",
+              nclients[i], def, par, par / def);
+    }
+
+  /* Return to the default mode for the other tests.  */
+  if (npth_init ())
+    return 1;
+
+  agent_flush_key_cache (NULL);
+  bin2hex (grip, 20, hexgrip);
+  strcpy (hexgrip+40, ".key");
+  fname = make_filename (dname, hexgrip, NULL);
+  remove (fname);
+  rmdir (dname);
+  rmdir (homedir);
+  xfree (fname);
+  xfree (dname);
+  xfree (expected);
+  return 0;
+}
@@ -441,11 +441,15 @@ istrusted_internal (ctrl_t ctrl, const char *fpr, int *r_disabled,
       for (ti=trusttable, len = trusttablesize; len; ti++, len--)
         if (!memcmp (ti->fpr, fprbin, 20))
           {
-            if (ti->flags.disabled && r_disabled)
+            int disabled = ti->flags.disabled;
+
+            if (disabled && r_disabled)
               *r_disabled = 1;
 
             /* Print status messages only if we have not been called
-               in a locked state.  */
+               in a locked state.  Note that TI may not be accessed
+               after the table has been unlocked because another
+               thread may reload the table meanwhile.  */
             if (already_locked)
               ;
             else if (ti->flags.relax)
@@ -462,7 +466,7 @@ istrusted_internal (ctrl_t ctrl, const char *fpr, int *r_disabled,
               }
 
             if (!err)
-              err = ti->flags.disabled? GPG_ERR_NOT_TRUSTED : 0;
+              err = disabled? GPG_ERR_NOT_TRUSTED : 0;
             goto leave;
           }
     }
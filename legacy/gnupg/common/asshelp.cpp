@@ -223,7 +223,28 @@ send_pinentry_environment (assuan_context_t ctx,
 }
 
 
-extern char *neopg_program;
+/* The absolute file name of the neopg executable, which is started
+   for the daemons.  Set by main.  */
+char *neopg_program;
+
+
+/* Ask the server at CTX to send and accept large data chunks as
+   binary frames.  A server which does not support this keeps using
+   data lines, which is not an error.  */
+static gpg_error_t
+enable_binary_data (assuan_context_t ctx, int debug)
+{
+  gpg_error_t err;
+
+  err = assuan_enable_binary_data (ctx);
+  if (err == GPG_ERR_NOT_SUPPORTED)
+    {
+      if (debug)
+        log_debug ("server does not support binary data\n");
+      err = 0;
+    }
+  return err;
+}
 
 /* Try to connect to the agent via socket or start it if it is not
    running and AUTOSTART is set.  Handle the server's initial
@@ -317,6 +338,8 @@ start_new_gpg_agent (assuan_context_t *r_ctx,
             }
         }
     }
+  if (!err)
+    err = enable_binary_data (ctx, debug);
   if (err)
     {
       assuan_release (ctx);
@@ -399,6 +422,13 @@ start_new_dirmngr (assuan_context_t *r_ctx,
   if (debug)
     log_debug ("connection to the dirmngr established\n");
 
+  err = enable_binary_data (ctx, debug);
+  if (err)
+    {
+      assuan_release (ctx);
+      return err;
+    }
+
   *r_ctx = ctx;
   return 0;
 }
@@ -387,26 +387,24 @@ simple_reader_cb (void *cb_value, char *buffer, size_t count, size_t *nread)
 {
   struct reader_cb_parm_s *parm = (reader_cb_parm_s*) cb_value;
   size_t n;
-  int c = 0;
 
   *nread = 0;
   if (!buffer)
     return -1; /* not supported */
+  if (!count)
+    return 0;
 
-  for (n=0; n < count; n++)
+  /* Binary data is read in bulk; the reader asks for large blocks
+     while copying the content of a message.  */
+  if (es_read (parm->fp, buffer, count, &n))
     {
-      c = es_getc (parm->fp);
-      if (c == EOF)
-        {
-          parm->eof_seen = 1;
-          if (es_ferror (parm->fp))
-            return -1;
-          if (n)
-            break; /* Return what we have before an EOF.  */
-          return -1;
-        }
-      *(byte *)buffer++ = c;
+      parm->eof_seen = 1;
+      return -1;
     }
+  if (n < count && es_feof (parm->fp))
+    parm->eof_seen = 1;
+  if (!n)
+    return -1;
 
   *nread = n;
   return 0;
@@ -53,10 +53,26 @@ enum pattern_class
   };
 
 
+/* The secondary indexes of the cache.  */
+enum cert_index
+  {
+    INDEX_ISSUER = 0,   /* By issuer DN.  */
+    INDEX_SN,           /* By issuer DN and serial number.  */
+    INDEX_SUBJECT,      /* By subject DN.  */
+    INDEX_SKI,          /* By subject key identifier.  */
+    N_CERT_INDEXES
+  };
+
+/* The number of hash buckets of each secondary index.  */
+#define CERT_INDEX_SIZE 1024
+
+
 /* A certificate cache item.  This consists of a the KSBA cert object
    and some meta data for easier lookup.  We use a hash table to keep
    track of all items and use the (randomly distributed) first byte of
-   the fingerprint directly as the hash which makes it pretty easy. */
+   the fingerprint directly as the hash which makes it pretty easy.
+   In addition each valid item is linked into the secondary indexes
+   for which it has a key. */
 struct cert_item_s
 {
   struct cert_item_s *next; /* Next item with the same hash value. */
@@ -66,6 +82,12 @@ struct cert_item_s
   char *issuer_dn;          /* The malloced issuer DN.  */
   ksba_sexp_t sn;           /* The malloced serial number  */
   char *subject_dn;         /* The malloced subject DN - maybe NULL.  */
+  ksba_sexp_t ski;          /* The malloced subject key id - maybe NULL.  */
+
+  /* Next item in the same bucket of each secondary index and the
+   * bucket the item is linked into or -1.  */
+  struct cert_item_s *index_next[N_CERT_INDEXES];
+  int index_bucket[N_CERT_INDEXES];
 
   /* If this field is set the certificate has been taken from some
    * configuration and shall not be flushed from the cache.  */
@@ -81,6 +103,9 @@ typedef struct cert_item_s *cert_item_t;
    the first byte of the fingerprint.  */
 static cert_item_t cert_cache[256];
 
+/* The secondary indexes.  They are protected by the same lock.  */
+static cert_item_t cert_index[N_CERT_INDEXES][CERT_INDEX_SIZE];
+
 /* This is the global cache_lock variable. In general locking is not
    needed but it would take extra efforts to make sure that no
    indirect use of npth functions is done, so we simply lock it
@@ -167,6 +192,126 @@ compare_serialno (ksba_sexp_t serial1, ksba_sexp_t serial2 )
 
 
 
+/* Return a hash value for the string S.  */
+static unsigned int
+hash_string (const char *s, unsigned int hash)
+{
+  for (; *s; s++)
+    hash = (hash << 5) + hash + *(const unsigned char *)s;
+  return hash;
+}
+
+
+/* Return a hash value for the canonical S-expression SEXP.  */
+static unsigned int
+hash_sexp (ksba_const_sexp_t sexp, unsigned int hash)
+{
+  const unsigned char *p = (const unsigned char *) sexp;
+  size_t n;
+
+  n = gcry_sexp_canon_len (p, 0, NULL, NULL);
+  for (; n; n--, p++)
+    hash = (hash << 5) + hash + *p;
+  return hash;
+}
+
+
+/* Compute the bucket of CI in secondary index IDX.  Returns -1 if CI
+   has no key for this index.  */
+static int
+index_bucket (cert_item_t ci, enum cert_index idx)
+{
+  unsigned int hash = 5381;
+
+  switch (idx)
+    {
+    case INDEX_ISSUER:
+      hash = hash_string (ci->issuer_dn, hash);
+      break;
+    case INDEX_SN:
+      hash = hash_sexp (ci->sn, hash_string (ci->issuer_dn, hash));
+      break;
+    case INDEX_SUBJECT:
+      if (!ci->subject_dn)
+        return -1;
+      hash = hash_string (ci->subject_dn, hash);
+      break;
+    case INDEX_SKI:
+      if (!ci->ski)
+        return -1;
+      hash = hash_sexp (ci->ski, hash);
+      break;
+    default:
+      return -1;
+    }
+  return hash % CERT_INDEX_SIZE;
+}
+
+
+/* Link the valid item CI into all secondary indexes.  The cache must
+   be write locked.  */
+static void
+link_cert_item (cert_item_t ci)
+{
+  int idx, bucket;
+
+  for (idx=0; idx < N_CERT_INDEXES; idx++)
+    {
+      bucket = index_bucket (ci, (enum cert_index)idx);
+      ci->index_bucket[idx] = bucket;
+      if (bucket < 0)
+        continue;
+      ci->index_next[idx] = cert_index[idx][bucket];
+      cert_index[idx][bucket] = ci;
+    }
+}
+
+
+/* Remove CI from all secondary indexes.  The cache must be write
+   locked.  */
+static void
+unlink_cert_item (cert_item_t ci)
+{
+  cert_item_t *cip;
+  int idx;
+
+  for (idx=0; idx < N_CERT_INDEXES; idx++)
+    {
+      if (ci->index_bucket[idx] < 0)
+        continue;
+      for (cip = &cert_index[idx][ci->index_bucket[idx]]; *cip;
+           cip = &(*cip)->index_next[idx])
+        if (*cip == ci)
+          {
+            *cip = ci->index_next[idx];
+            break;
+          }
+      ci->index_next[idx] = NULL;
+      ci->index_bucket[idx] = -1;
+    }
+}
+
+
+/* Return the first item in the bucket of secondary index IDX which
+   would hold an item with the given keys.  Keys not used by IDX may
+   be NULL.  */
+static cert_item_t
+index_lookup (enum cert_index idx, const char *issuer_dn, ksba_const_sexp_t sn,
+              const char *subject_dn, ksba_const_sexp_t ski)
+{
+  struct cert_item_s key;
+  int bucket;
+
+  key.issuer_dn = (char *) issuer_dn;
+  key.sn = (ksba_sexp_t) sn;
+  key.subject_dn = (char *) subject_dn;
+  key.ski = (ksba_sexp_t) ski;
+  bucket = index_bucket (&key, idx);
+  return bucket < 0 ? NULL : cert_index[idx][bucket];
+}
+
+
+
 /* Return a malloced canonical S-Expression with the serial number
  * converted from the hex string HEXSN.  Return NULL on memory
  * error.  */
@@ -230,6 +375,9 @@ clean_cache_slot (cert_item_t ci)
   if (!ci->cert)
     return; /* Already cleaned.  */
 
+  unlink_cert_item (ci);
+  ksba_free (ci->ski);
+  ci->ski = NULL;
   ksba_free (ci->sn);
   ci->sn = NULL;
   ksba_free (ci->issuer_dn);
@@ -265,6 +413,7 @@ put_cert (ksba_cert_t cert, int permanent, unsigned int trustclass,
 {
   unsigned char help_fpr_buffer[20], *fpr;
   cert_item_t ci;
+  int i;
 
   fpr = (unsigned char*) (fpr_buffer? fpr_buffer : &help_fpr_buffer);
 
@@ -283,7 +432,6 @@ put_cert (ksba_cert_t cert, int permanent, unsigned int trustclass,
     {
       static int idx;
       cert_item_t ci_mark;
-      int i;
       unsigned int drop_count;
 
       drop_count = MAX_NONPERM_CACHED_CERTS / 20;
@@ -331,6 +479,8 @@ put_cert (ksba_cert_t cert, int permanent, unsigned int trustclass,
 
   ksba_cert_ref (cert);
   ci->cert = cert;
+  for (i=0; i < N_CERT_INDEXES; i++)
+    ci->index_bucket[i] = -1;
   memcpy (ci->fpr, fpr, 20);
   ci->sn = ksba_cert_get_serial (cert);
   ci->issuer_dn = ksba_cert_get_issuer (cert, 0);
@@ -340,8 +490,11 @@ put_cert (ksba_cert_t cert, int permanent, unsigned int trustclass,
       return GPG_ERR_INV_CERT_OBJ;
     }
   ci->subject_dn = ksba_cert_get_subject (cert, 0);
+  if (ksba_cert_get_subj_key_id (cert, NULL, &ci->ski))
+    ci->ski = NULL;
   ci->permanent = !!permanent;
   ci->trustclasses = trustclass;
+  link_cert_item (ci);
 
   if (!permanent)
     total_nonperm_certificates++;
@@ -924,22 +1077,18 @@ get_cert_byhexfpr (const char *string)
 ksba_cert_t
 get_cert_bysn (const char *issuer_dn, ksba_sexp_t serialno)
 {
-  /* Simple and inefficient implementation.   fixme! */
   cert_item_t ci;
-  int i;
 
   acquire_cache_read_lock ();
-  for (i=0; i < 256; i++)
-    {
-      for (ci=cert_cache[i]; ci; ci = ci->next)
-        if (ci->cert && !strcmp (ci->issuer_dn, issuer_dn)
-            && !compare_serialno (ci->sn, serialno))
-          {
-            ksba_cert_ref (ci->cert);
-            release_cache_lock ();
-            return ci->cert;
-          }
-    }
+  for (ci = index_lookup (INDEX_SN, issuer_dn, serialno, NULL, NULL);
+       ci; ci = ci->index_next[INDEX_SN])
+    if (!strcmp (ci->issuer_dn, issuer_dn)
+        && !compare_serialno (ci->sn, serialno))
+      {
+        ksba_cert_ref (ci->cert);
+        release_cache_lock ();
+        return ci->cert;
+      }
 
   release_cache_lock ();
   return NULL;
@@ -951,22 +1100,18 @@ get_cert_bysn (const char *issuer_dn, ksba_sexp_t serialno)
 ksba_cert_t
 get_cert_byissuer (const char *issuer_dn, unsigned int seq)
 {
-  /* Simple and very inefficient implementation and API.  fixme! */
   cert_item_t ci;
-  int i;
 
   acquire_cache_read_lock ();
-  for (i=0; i < 256; i++)
-    {
-      for (ci=cert_cache[i]; ci; ci = ci->next)
-        if (ci->cert && !strcmp (ci->issuer_dn, issuer_dn))
-          if (!seq--)
-            {
-              ksba_cert_ref (ci->cert);
-              release_cache_lock ();
-              return ci->cert;
-            }
-    }
+  for (ci = index_lookup (INDEX_ISSUER, issuer_dn, NULL, NULL, NULL);
+       ci; ci = ci->index_next[INDEX_ISSUER])
+    if (!strcmp (ci->issuer_dn, issuer_dn))
+      if (!seq--)
+        {
+          ksba_cert_ref (ci->cert);
+          release_cache_lock ();
+          return ci->cert;
+        }
 
   release_cache_lock ();
   return NULL;
@@ -978,26 +1123,47 @@ get_cert_byissuer (const char *issuer_dn, unsigned int seq)
 ksba_cert_t
 get_cert_bysubject (const char *subject_dn, unsigned int seq)
 {
-  /* Simple and very inefficient implementation and API.  fixme! */
   cert_item_t ci;
-  int i;
 
   if (!subject_dn)
     return NULL;
 
   acquire_cache_read_lock ();
-  for (i=0; i < 256; i++)
-    {
-      for (ci=cert_cache[i]; ci; ci = ci->next)
-        if (ci->cert && ci->subject_dn
-            && !strcmp (ci->subject_dn, subject_dn))
-          if (!seq--)
-            {
-              ksba_cert_ref (ci->cert);
-              release_cache_lock ();
-              return ci->cert;
-            }
-    }
+  for (ci = index_lookup (INDEX_SUBJECT, NULL, NULL, subject_dn, NULL);
+       ci; ci = ci->index_next[INDEX_SUBJECT])
+    if (!strcmp (ci->subject_dn, subject_dn))
+      if (!seq--)
+        {
+          ksba_cert_ref (ci->cert);
+          release_cache_lock ();
+          return ci->cert;
+        }
+
+  release_cache_lock ();
+  return NULL;
+}
+
+
+/* Return the certificate matching SUBJECT_DN and the subject key
+   identifier KEYID.  */
+static ksba_cert_t
+get_cert_bysubject_keyid (const char *subject_dn, ksba_const_sexp_t keyid)
+{
+  cert_item_t ci;
+
+  if (!subject_dn)
+    return NULL;
+
+  acquire_cache_read_lock ();
+  for (ci = index_lookup (INDEX_SKI, NULL, NULL, NULL, keyid);
+       ci; ci = ci->index_next[INDEX_SKI])
+    if (!cmp_simple_canon_sexp (ci->ski, keyid)
+        && ci->subject_dn && !strcmp (ci->subject_dn, subject_dn))
+      {
+        ksba_cert_ref (ci->cert);
+        release_cache_lock ();
+        return ci->cert;
+      }
 
   release_cache_lock ();
   return NULL;
@@ -1420,7 +1586,6 @@ ksba_cert_t
 find_cert_bysubject (ctrl_t ctrl, const char *subject_dn, ksba_sexp_t keyid)
 {
   gpg_error_t err;
-  int seq;
   ksba_cert_t cert = NULL;
   cert_fetch_context_t context = NULL;
   ksba_sexp_t subj;
@@ -1435,40 +1600,29 @@ find_cert_bysubject (ctrl_t ctrl, const char *subject_dn, ksba_sexp_t keyid)
     {
       cert_item_t ci;
       cert_ref_t cr;
-      int i;
 
       /* For efficiency reasons we won't use get_cert_bysubject here. */
       acquire_cache_read_lock ();
-      for (i=0; i < 256; i++)
-        for (ci=cert_cache[i]; ci; ci = ci->next)
-          if (ci->cert && ci->subject_dn
-              && !strcmp (ci->subject_dn, subject_dn))
-            for (cr=ctrl->ocsp_certs; cr; cr = cr->next)
-              if (!memcmp (ci->fpr, cr->fpr, 20))
-                {
-                  ksba_cert_ref (ci->cert);
-                  release_cache_lock ();
-                  return ci->cert; /* We use this certificate. */
-                }
+      for (ci = index_lookup (INDEX_SUBJECT, NULL, NULL, subject_dn, NULL);
+           ci; ci = ci->index_next[INDEX_SUBJECT])
+        if (!strcmp (ci->subject_dn, subject_dn))
+          for (cr=ctrl->ocsp_certs; cr; cr = cr->next)
+            if (!memcmp (ci->fpr, cr->fpr, 20))
+              {
+                ksba_cert_ref (ci->cert);
+                release_cache_lock ();
+                return ci->cert; /* We use this certificate. */
+              }
       release_cache_lock ();
       if (DBG_LOOKUP)
         log_debug ("find_cert_bysubject: certificate not in ocsp_certs\n");
     }
 
   /* No check whether the certificate is cached.  */
-  for (seq=0; (cert = get_cert_bysubject (subject_dn, seq)); seq++)
-    {
-      if (!keyid)
-        break; /* No keyid requested, so return the first one found. */
-      if (!ksba_cert_get_subj_key_id (cert, NULL, &subj)
-          && !cmp_simple_canon_sexp (keyid, subj))
-        {
-          xfree (subj);
-          break; /* Found matching cert. */
-        }
-      xfree (subj);
-      ksba_cert_release (cert);
-    }
+  if (keyid)
+    cert = get_cert_bysubject_keyid (subject_dn, keyid);
+  else /* No keyid requested, so return the first one found. */
+    cert = get_cert_bysubject (subject_dn, 0);
   if (cert)
     return cert; /* Done.  */
 
@@ -98,6 +98,7 @@
 #include <dirent.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <npth.h>
 #ifndef HAVE_W32_SYSTEM
 #include <sys/utsname.h>
 #endif
@@ -125,6 +126,17 @@
    idea anyway to limit the number of opened cache files. */
 #define MAX_OPEN_DB_FILES 5
 
+/* A new CRL is processed by a pipeline of three threads: a reader
+   thread copies the raw CRL into a ring buffer of CRL_RING_SIZE
+   bytes, the calling thread parses the CRL and computes its digest,
+   and a writer thread adds the revoked serial numbers to the cdb
+   file.  The items are passed to the writer in CRL_BATCH_COUNT
+   batches of CRL_BATCH_SIZE bytes.  Thus the memory used does not
+   depend on the size of the CRL.  */
+#define CRL_RING_SIZE   (256*1024)
+#define CRL_BATCH_SIZE  (64*1024)
+#define CRL_BATCH_COUNT 4
+
 
 static const char oidstr_crlNumber[] = "2.5.29.20";
 /* static const char oidstr_issuingDistributionPoint[] = "2.5.29.28"; */
@@ -1655,11 +1667,415 @@ abort_sig_check (ksba_crl_t crl, gcry_md_hd_t md)
 }
 
 
+/* A batch of CRL items for the cdb writer.  Each item consists of a
+   two byte length, the serial number and the 16 byte record.  */
+struct crl_batch_s
+{
+  size_t used;
+  unsigned char data[CRL_BATCH_SIZE];
+};
+
+/* The state of the pipeline used by crl_cache_insert.  All fields
+   below LOCK are protected by it; COND is signaled on any change.  */
+struct crl_pipeline_s
+{
+  ksba_reader_t source;         /* The reader with the raw CRL.  */
+  struct cdb_make *cdb;         /* The cdb file being built.  */
+  npth_t reader_thread;
+  npth_t writer_thread;
+  int reader_started;
+  int writer_started;
+
+  npth_mutex_t lock;
+  npth_cond_t cond;
+  int stop;                     /* Ask the reader thread to stop.  */
+
+  unsigned char ring[CRL_RING_SIZE];
+  size_t ring_head;             /* Total number of bytes stored.  */
+  size_t ring_tail;             /* Total number of bytes consumed.  */
+  int source_eof;               /* The source has been read.  */
+  gpg_error_t source_err;       /* Error reading the source.  */
+
+  struct crl_batch_s batches[CRL_BATCH_COUNT];
+  unsigned int batch_head;      /* Number of batches handed over.  */
+  unsigned int batch_tail;      /* Number of batches written.  */
+  int items_done;               /* No more batches will be handed over.  */
+  int writer_done;              /* The writer thread has finished.  */
+  gpg_error_t cdb_err;          /* Error writing the cdb file.  */
+};
+typedef struct crl_pipeline_s *crl_pipeline_t;
+
+
+/* The reader thread of the pipeline.  It copies the raw CRL from the
+   source reader into the ring buffer.  */
+static void *
+crl_pipeline_reader (void *opaque)
+{
+  crl_pipeline_t pl = (crl_pipeline_t) opaque;
+  gpg_error_t err;
+  size_t off, n, nread;
+  int stop;
+
+  for (;;)
+    {
+      npth_mutex_lock (&pl->lock);
+      while (!pl->stop && pl->ring_head - pl->ring_tail == CRL_RING_SIZE)
+        npth_cond_wait (&pl->cond, &pl->lock);
+      stop = pl->stop;
+      off = pl->ring_head % CRL_RING_SIZE;
+      n = CRL_RING_SIZE - (pl->ring_head - pl->ring_tail);
+      if (n > CRL_RING_SIZE - off)
+        n = CRL_RING_SIZE - off;
+      npth_mutex_unlock (&pl->lock);
+      if (stop)
+        break;
+
+      /* Only this thread writes to the free part of the ring; thus
+         we do not need to hold the lock while reading.  */
+      err = ksba_reader_read (pl->source, (char*)pl->ring + off, n, &nread);
+
+      npth_mutex_lock (&pl->lock);
+      if (err == GPG_ERR_EOF)
+        pl->source_eof = 1;
+      else if (err)
+        pl->source_err = err;
+      else
+        pl->ring_head += nread;
+      npth_cond_broadcast (&pl->cond);
+      npth_mutex_unlock (&pl->lock);
+      if (err)
+        break;
+    }
+
+  return NULL;
+}
+
+
+/* The callback of the reader used by the CRL parser.  It returns the
+   data from the ring buffer.  This is called from the parser which
+   runs outside of the nPth lock; the lock is taken for the wait.  */
+static int
+crl_pipeline_read_cb (void *opaque, char *buffer, size_t count,
+                      size_t *r_nread)
+{
+  crl_pipeline_t pl = (crl_pipeline_t) opaque;
+  size_t off, n;
+  int rc;
+
+  if (!buffer)
+    return GPG_ERR_NOT_SUPPORTED;
+
+  npth_protect ();
+  npth_mutex_lock (&pl->lock);
+  while (pl->ring_head == pl->ring_tail
+         && !pl->source_eof && !pl->source_err)
+    npth_cond_wait (&pl->cond, &pl->lock);
+  if (pl->ring_head == pl->ring_tail)
+    {
+      *r_nread = 0;
+      rc = pl->source_err? pl->source_err : GPG_ERR_EOF;
+    }
+  else
+    {
+      off = pl->ring_tail % CRL_RING_SIZE;
+      n = pl->ring_head - pl->ring_tail;
+      if (n > CRL_RING_SIZE - off)
+        n = CRL_RING_SIZE - off;
+      if (n > count)
+        n = count;
+      memcpy (buffer, pl->ring + off, n);
+      pl->ring_tail += n;
+      npth_cond_broadcast (&pl->cond);
+      *r_nread = n;
+      rc = 0;
+    }
+  npth_mutex_unlock (&pl->lock);
+  npth_unprotect ();
+  return rc;
+}
+
+
+/* Add the items of BATCH to the cdb file CDB.  This does not need
+   the nPth lock.  */
+static gpg_error_t
+write_crl_batch (struct cdb_make *cdb, struct crl_batch_s *batch)
+{
+  const unsigned char *p = batch->data;
+  const unsigned char *end = batch->data + batch->used;
+  size_t n;
+
+  while (p < end)
+    {
+      n = (p[0] << 8) | p[1];
+      p += 2;
+      if (cdb_make_add (cdb, p, n, p + n, 1+15))
+        return gpg_error_from_errno (errno);
+      p += n + 1+15;
+    }
+  return 0;
+}
+
+
+/* The writer thread of the pipeline.  It adds the batches of CRL
+   items to the cdb file.  After an error the remaining batches are
+   discarded so that the parser does not block.  */
+static void *
+crl_pipeline_writer (void *opaque)
+{
+  crl_pipeline_t pl = (crl_pipeline_t) opaque;
+  struct crl_batch_s *batch;
+  gpg_error_t err;
+
+  for (;;)
+    {
+      npth_mutex_lock (&pl->lock);
+      while (pl->batch_tail == pl->batch_head && !pl->items_done)
+        npth_cond_wait (&pl->cond, &pl->lock);
+      if (pl->batch_tail == pl->batch_head)
+        {
+          pl->writer_done = 1;
+          npth_cond_broadcast (&pl->cond);
+          npth_mutex_unlock (&pl->lock);
+          break;
+        }
+      batch = pl->batches + (pl->batch_tail % CRL_BATCH_COUNT);
+      err = pl->cdb_err;
+      npth_mutex_unlock (&pl->lock);
+
+      if (!err)
+        {
+          npth_unprotect ();
+          err = write_crl_batch (pl->cdb, batch);
+          npth_protect ();
+        }
+
+      npth_mutex_lock (&pl->lock);
+      if (err && !pl->cdb_err)
+        pl->cdb_err = err;
+      pl->batch_tail++;
+      npth_cond_broadcast (&pl->cond);
+      npth_mutex_unlock (&pl->lock);
+    }
+
+  return NULL;
+}
+
+
+/* Hand the batch currently being filled over to the writer thread
+   and wait until a free batch is available.  Returns an error if the
+   writer failed.  Like crl_pipeline_read_cb this is called outside of
+   the nPth lock.  */
+static gpg_error_t
+crl_pipeline_push_batch (crl_pipeline_t pl)
+{
+  gpg_error_t err;
+
+  npth_protect ();
+  npth_mutex_lock (&pl->lock);
+  pl->batch_head++;
+  npth_cond_broadcast (&pl->cond);
+  while (pl->batch_head - pl->batch_tail >= CRL_BATCH_COUNT)
+    npth_cond_wait (&pl->cond, &pl->lock);
+  pl->batches[pl->batch_head % CRL_BATCH_COUNT].used = 0;
+  err = pl->cdb_err;
+  npth_mutex_unlock (&pl->lock);
+  npth_unprotect ();
+  return err;
+}
+
+
+/* Queue the item with the serial number SERIAL of length N, the
+   REASON and the revocation date RDATE for the cdb file.  This is
+   called outside of the nPth lock.  */
+static gpg_error_t
+crl_pipeline_put (crl_pipeline_t pl, const unsigned char *serial, size_t n,
+                  ksba_crl_reason_t reason, const ksba_isotime_t rdate)
+{
+  gpg_error_t err;
+  struct crl_batch_s *batch;
+  unsigned char *d;
+
+  batch = pl->batches + (pl->batch_head % CRL_BATCH_COUNT);
+  if (batch->used + 2 + n + 1+15 > CRL_BATCH_SIZE)
+    {
+      err = crl_pipeline_push_batch (pl);
+      if (err)
+        return err;
+      batch = pl->batches + (pl->batch_head % CRL_BATCH_COUNT);
+    }
+
+  d = batch->data + batch->used;
+  d[0] = n >> 8;
+  d[1] = n;
+  memcpy (d + 2, serial, n);
+  d[2 + n] = (reason & 0xff);
+  memcpy (d + 2 + n + 1, rdate, 15);
+  batch->used += 2 + n + 1+15;
+  return 0;
+}
+
+
+/* Get the current item from CRL and queue it for the cdb file.  This
+   is called from the parser which runs outside of the nPth lock.  On
+   error R_ITEM_ERR is set if the item could not be retrieved.  */
+static gpg_error_t
+crl_pipeline_add_item (crl_pipeline_t pl, ksba_crl_t crl, int *r_item_err)
+{
+  gpg_error_t err;
+  ksba_sexp_t serial = NULL;
+  const unsigned char *p;
+  ksba_isotime_t rdate;
+  ksba_crl_reason_t reason;
+  size_t n;
+
+  *r_item_err = 0;
+  err = ksba_crl_get_item (crl, &serial, rdate, &reason);
+  if (err)
+    {
+      ksba_free (serial);
+      *r_item_err = 1;
+      return err;
+    }
+  p = serial_to_buffer (serial, &n);
+  if (!p)
+    BUG ();
+  if (n > 1024)
+    {
+      /* No sane serial number is that long.  */
+      ksba_free (serial);
+      *r_item_err = 1;
+      return GPG_ERR_INV_CRL;
+    }
+
+  err = crl_pipeline_put (pl, p, n, reason, rdate);
+  ksba_free (serial);
+  return err;
+}
+
+
+/* Hand the last batch over to the writer thread and wait until all
+   items have been written.  Returns the error of the writer.  This
+   may be called several times.  */
+static gpg_error_t
+crl_pipeline_finish_items (crl_pipeline_t pl)
+{
+  gpg_error_t err;
+
+  if (!pl->writer_started)
+    return 0;
+
+  npth_mutex_lock (&pl->lock);
+  if (!pl->items_done)
+    {
+      if (pl->batches[pl->batch_head % CRL_BATCH_COUNT].used)
+        pl->batch_head++;
+      pl->items_done = 1;
+      npth_cond_broadcast (&pl->cond);
+    }
+  while (!pl->writer_done)
+    npth_cond_wait (&pl->cond, &pl->lock);
+  err = pl->cdb_err;
+  npth_mutex_unlock (&pl->lock);
+
+  npth_join (pl->writer_thread, NULL);
+  pl->writer_started = 0;
+
+  if (err)
+    log_error (_("error inserting item into "
+                 "temporary cache file: %s\n"),
+               gpg_strerror (err));
+  return err;
+}
+
+
+/* Release the pipeline PL.  This stops the reader thread.  */
+static void
+crl_pipeline_release (crl_pipeline_t pl)
+{
+  if (!pl)
+    return;
+
+  crl_pipeline_finish_items (pl);
+  if (pl->reader_started)
+    {
+      npth_mutex_lock (&pl->lock);
+      pl->stop = 1;
+      npth_cond_broadcast (&pl->cond);
+      npth_mutex_unlock (&pl->lock);
+      npth_join (pl->reader_thread, NULL);
+      if (pl->source_err)
+        log_error (_("error reading CRL: %s\n"), gpg_strerror (pl->source_err));
+    }
+  npth_cond_destroy (&pl->cond);
+  npth_mutex_destroy (&pl->lock);
+  xfree (pl);
+}
+
+
+/* Create a pipeline to read the CRL from SOURCE and to build the cdb
+   file CDB.  The reader for the CRL parser is stored at R_READER.  */
+static gpg_error_t
+crl_pipeline_new (ksba_reader_t source, struct cdb_make *cdb,
+                  crl_pipeline_t *r_pipeline, ksba_reader_t *r_reader)
+{
+  gpg_error_t err;
+  crl_pipeline_t pl;
+  npth_attr_t tattr;
+
+  *r_pipeline = NULL;
+  *r_reader = NULL;
+
+  pl = (crl_pipeline_t) xtrycalloc (1, sizeof *pl);
+  if (!pl)
+    return gpg_error_from_syserror ();
+  pl->source = source;
+  pl->cdb = cdb;
+  npth_mutex_init (&pl->lock, NULL);
+  npth_cond_init (&pl->cond, NULL);
+
+  err = ksba_reader_new (r_reader);
+  if (!err)
+    err = ksba_reader_set_cb (*r_reader, crl_pipeline_read_cb, pl);
+  if (err)
+    goto leave;
+
+  npth_attr_init (&tattr);
+  npth_attr_setdetachstate (&tattr, NPTH_CREATE_JOINABLE);
+  err = npth_create (&pl->reader_thread, &tattr, crl_pipeline_reader, pl);
+  if (!err)
+    {
+      pl->reader_started = 1;
+      err = npth_create (&pl->writer_thread, &tattr, crl_pipeline_writer, pl);
+      if (!err)
+        pl->writer_started = 1;
+    }
+  npth_attr_destroy (&tattr);
+  if (err)
+    {
+      err = gpg_error_from_errno (err);
+      log_error ("error spawning CRL pipeline thread: %s\n",
+                 gpg_strerror (err));
+    }
+
+ leave:
+  if (err)
+    {
+      ksba_reader_release (*r_reader);
+      *r_reader = NULL;
+      crl_pipeline_release (pl);
+    }
+  else
+    *r_pipeline = pl;
+  return err;
+}
+
+
 /* Workhorse of the CRL loading machinery.  The CRL is read using the
-   CRL object and stored in the data base file DB with the name FNAME
-   (only used for printing error messages).  That DB should be a
-   temporary one and not the actual one.  If the function fails the
-   caller should delete this temporary database file.  CTRL is
+   CRL object and its items are passed to the PIPELINE which stores
+   them in the data base file with the name FNAME (only used for
+   printing error messages).  That DB should be a temporary one and
+   not the actual one.  If the function fails the caller should
+   delete this temporary database file.  CTRL is
    required to retrieve certificates using the general dirmngr
    callback service.  R_CRLISSUER returns an allocated string with the
    crl-issuer DN, THIS_UPDATE and NEXT_UPDATE are filled with the
@@ -1672,7 +2088,7 @@ abort_sig_check (ksba_crl_t crl, gcry_md_hd_t md)
 */
 static int
 crl_parse_insert (ctrl_t ctrl, ksba_crl_t crl,
-                  struct cdb_make *cdb, const char *fname,
+                  crl_pipeline_t pipeline, const char *fname,
                   char **r_crlissuer,
                   ksba_isotime_t thisupdate, ksba_isotime_t nextupdate,
                   char **r_trust_anchor)
@@ -1682,7 +2098,8 @@ crl_parse_insert (ctrl_t ctrl, ksba_crl_t crl,
   ksba_cert_t crlissuer_cert = NULL;
   gcry_md_hd_t md = NULL;
   int algo = 0;
-  size_t n;
+  gpg_error_t add_err;
+  int item_err;
 
   (void)fname;
 
@@ -1690,11 +2107,39 @@ crl_parse_insert (ctrl_t ctrl, ksba_crl_t crl,
   *thisupdate = *nextupdate = 0;
   *r_trust_anchor = NULL;
 
-  /* Start of the KSBA parser loop. */
+  /* Start of the KSBA parser loop.  Parsing the items and hashing
+     them does not need the nPth lock; thus we release it while doing
+     this so that other requests are served meanwhile.  */
   do
     {
-      err = ksba_crl_parse (crl, &stopreason);
-      if (err)
+      add_err = 0;
+      item_err = 0;
+      npth_unprotect ();
+      for (;;)
+        {
+          err = ksba_crl_parse (crl, &stopreason);
+          if (err || stopreason != KSBA_SR_GOT_ITEM)
+            break;
+          add_err = crl_pipeline_add_item (pipeline, crl, &item_err);
+          if (add_err)
+            break;
+        }
+      npth_protect ();
+      if (add_err && item_err)
+        {
+          log_error (_("error getting CRL item: %s\n"),
+                     gpg_strerror (add_err));
+          err = GPG_ERR_INV_CRL;
+          goto failure;
+        }
+      else if (add_err)
+        {
+          /* Writing the cache file failed.  Wait for the writer
+             thread which logs the error.  */
+          err = crl_pipeline_finish_items (pipeline);
+          goto failure;
+        }
+      else if (err)
         {
           log_error (_("ksba_crl_parse failed: %s\n"), gpg_strerror (err) );
           goto failure;
@@ -1730,43 +2175,6 @@ crl_parse_insert (ctrl_t ctrl, ksba_crl_t crl,
           }
           break;
 
-        case KSBA_SR_GOT_ITEM:
-          {
-            ksba_sexp_t serial;
-            const unsigned char *p;
-            ksba_isotime_t rdate;
-            ksba_crl_reason_t reason;
-            int rc;
-            unsigned char record[1+15];
-
-            err = ksba_crl_get_item (crl, &serial, rdate, &reason);
-            if (err)
-              {
-                log_error (_("error getting CRL item: %s\n"),
-                           gpg_strerror (err));
-                err = GPG_ERR_INV_CRL;
-                ksba_free (serial);
-                goto failure;
-              }
-            p = serial_to_buffer (serial, &n);
-            if (!p)
-              BUG ();
-            record[0] = (reason & 0xff);
-            memcpy (record+1, rdate, 15);
-            rc = cdb_make_add (cdb, p, n, record, 1+15);
-            if (rc)
-              {
-                err = gpg_error_from_errno (errno);
-                log_error (_("error inserting item into "
-                             "temporary cache file: %s\n"),
-                           strerror (errno));
-                goto failure;
-              }
-
-            ksba_free (serial);
-          }
-          break;
-
         case KSBA_SR_END_ITEMS:
           break;
 
@@ -1990,6 +2398,8 @@ crl_cache_insert (ctrl_t ctrl, const char *url, ksba_reader_t reader)
   const char *oid;
   int critical;
   char *trust_anchor = NULL;
+  crl_pipeline_t pipeline = NULL;
+  ksba_reader_t pipeline_reader = NULL;
 
   /* FIXME: We should acquire a mutex for the URL, so that we don't
      simultaneously enter the same CRL twice.  However this needs to be
@@ -2004,13 +2414,6 @@ crl_cache_insert (ctrl_t ctrl, const char *url, ksba_reader_t reader)
       goto leave;
     }
 
-  err = ksba_crl_set_reader (crl, reader);
-  if ( err )
-    {
-      log_error (_("ksba_crl_set_reader failed: %s\n"), gpg_strerror (err));
-      goto leave;
-    }
-
   /* Create a temporary cache file to load the CRL into. */
   {
     char *tmpfname, *p;
@@ -2061,16 +2464,34 @@ crl_cache_insert (ctrl_t ctrl, const char *url, ksba_reader_t reader)
     }
   cdb_make_start(&cdb, fd_cdb);
 
-  err = crl_parse_insert (ctrl, crl, &cdb, fname,
-                          &issuer, thisupdate, nextupdate, &trust_anchor);
+  err = crl_pipeline_new (reader, &cdb, &pipeline, &pipeline_reader);
   if (err)
     {
-      log_error (_("crl_parse_insert failed: %s\n"), gpg_strerror (err));
       /* Error in cleanup ignored.  */
       cdb_make_finish (&cdb);
       goto leave;
     }
 
+  err = ksba_crl_set_reader (crl, pipeline_reader);
+  if ( err )
+    log_error (_("ksba_crl_set_reader failed: %s\n"), gpg_strerror (err));
+  else
+    {
+      err = crl_parse_insert (ctrl, crl, pipeline, fname,
+                              &issuer, thisupdate, nextupdate, &trust_anchor);
+      if (err)
+        log_error (_("crl_parse_insert failed: %s\n"), gpg_strerror (err));
+    }
+  if (!err)
+    err = crl_pipeline_finish_items (pipeline);
+  if (err)
+    {
+      /* Error in cleanup ignored.  */
+      crl_pipeline_finish_items (pipeline);
+      cdb_make_finish (&cdb);
+      goto leave;
+    }
+
   /* Finish the database. */
   if (cdb_make_finish (&cdb))
     {
@@ -2179,12 +2600,6 @@ crl_cache_insert (ctrl_t ctrl, const char *url, ksba_reader_t reader)
   entry->check_trust_anchor = trust_anchor;
   trust_anchor = NULL;
 
-  /* Check whether we already have an entry for this issuer and mark
-     it as deleted. We better use a loop, just in case duplicates got
-     somehow into the list. */
-  for (e = cache->entries; (e=find_entry (e, entry->issuer_hash)); e = e->next)
-    e->deleted = 1;
-
   /* Rename the temporary DB to the real name. */
   newfname = make_db_file_name (entry->issuer_hash);
   if (opt.verbose)
@@ -2226,6 +2641,15 @@ crl_cache_insert (ctrl_t ctrl, const char *url, ksba_reader_t reader)
     }
   xfree (fname); fname = NULL; /*(let the cleanup code not try to remove it)*/
 
+  /* Check whether we already have an entry for this issuer and mark
+     it as deleted. We better use a loop, just in case duplicates got
+     somehow into the list.  This is done right before linking the
+     new entry in, so that lookups keep on using the old CRL until
+     the new one is ready.  Requests which still use the old cache
+     file keep it open.  */
+  for (e = cache->entries; (e=find_entry (e, entry->issuer_hash)); e = e->next)
+    e->deleted = 1;
+
   /* Link the new entry in. */
   entry->next = cache->entries;
   cache->entries = entry;
@@ -2251,6 +2675,8 @@ crl_cache_insert (ctrl_t ctrl, const char *url, ksba_reader_t reader)
     }
   xfree (newfname);
   ksba_crl_release (crl);
+  crl_pipeline_release (pipeline);
+  ksba_reader_release (pipeline_reader);
   xfree (issuer);
   xfree (issuer_hash);
   xfree (checksum);
@@ -0,0 +1,8 @@
+#include "gtest/gtest.h"
+
+  int crlcache_main(int argc, char* argv[]);
+
+TEST(DirmngrTest, crlcache) {
+    int result = crlcache_main(0, NULL);
+    ASSERT_EQ(result, 0);
+}
@@ -0,0 +1,256 @@
+/* t-crlcache.c - Regression tests for the CRL pipeline
+ * Copyright (C) 2018 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* The tests include the module so that they can drive the pipeline
+   of crl_cache_insert without a CRL.  The main thread plays the CRL
+   parser and calls the callbacks outside of the nPth lock, while
+   other threads check that nobody else runs while they hold it.  */
+#include "crlcache.cpp"
+
+#include "t-support.h"
+
+/* The size of the raw data; several turns of the ring buffer.  */
+#define N_DATA (3*CRL_RING_SIZE + 1234)
+/* The number of items; several turns of the batches.  */
+#define N_ITEMS 40000
+/* The number of checker threads.  */
+#define N_CHECKERS 2
+
+static unsigned char *data;
+static size_t data_off;
+
+/* The number of threads running with the nPth lock in a checker
+   section, the flag telling that more than one did, and the flag to
+   stop the checkers.  */
+static volatile int inside;
+static volatile int overlap;
+static volatile int stop_checkers;
+
+
+/* While holding the nPth lock no other nPth thread may run.  Keep
+   the lock for a while and check that.  */
+static void *
+checker_thread (void *arg)
+{
+  volatile int i;
+
+  (void)arg;
+  while (!stop_checkers)
+    {
+      if (++inside > 1)
+        overlap = 1;
+      for (i=0; i < 20000; i++)
+        ;
+      if (inside > 1)
+        overlap = 1;
+      inside--;
+      npth_usleep (10);
+    }
+  return NULL;
+}
+
+
+/* The callback of the source reader.  It returns the data in small
+   pieces and lets the other threads run so that the parser has to
+   wait for the ring buffer.  */
+static int
+source_cb (void *opaque, char *buffer, size_t count, size_t *r_nread)
+{
+  (void)opaque;
+
+  if (!buffer)
+    return GPG_ERR_NOT_SUPPORTED;
+  npth_usleep (50);
+  if (data_off == N_DATA)
+    {
+      *r_nread = 0;
+      return GPG_ERR_EOF;
+    }
+  if (count > 4096)
+    count = 4096;
+  if (count > N_DATA - data_off)
+    count = N_DATA - data_off;
+  memcpy (buffer, data + data_off, count);
+  data_off += count;
+  *r_nread = count;
+  return 0;
+}
+
+
+/* Store the serial number of the item IDX at SERIAL and its length
+   at R_N.  The first three bytes make it unique.  */
+static void
+make_serial (int idx, unsigned char *serial, size_t *r_n)
+{
+  size_t n = 3 + idx % 18;
+  size_t i;
+
+  for (i=0; i < n; i++)
+    serial[i] = idx >> (8 * (i % 3)) ^ i;
+  *r_n = n;
+}
+
+
+/* Read all data through the reader of the pipeline using requests of
+   varying sizes.  Called outside of the nPth lock.  */
+static int
+read_all (ksba_reader_t reader)
+{
+  static char buf[5000];
+  size_t off, n, nread;
+  int i;
+
+  for (off=0, i=0; ; i++)
+    {
+      n = 1 + (i * 997) % sizeof buf;
+      if (ksba_reader_read (reader, buf, n, &nread))
+        break;
+      if (off + nread > N_DATA || memcmp (buf, data + off, nread))
+        return 0;
+      off += nread;
+    }
+  return off == N_DATA;
+}
+
+
+/* Queue all items.  Called outside of the nPth lock.  */
+static int
+put_all (crl_pipeline_t pl)
+{
+  unsigned char serial[20];
+  size_t n;
+  int i;
+
+  for (i=0; i < N_ITEMS; i++)
+    {
+      make_serial (i, serial, &n);
+      if (crl_pipeline_put (pl, serial, n, (ksba_crl_reason_t)(i & 0xff),
+                            "20180101T000000"))
+        return 0;
+    }
+  return 1;
+}
+
+
+/* Return true if the cdb file FD has all items.  */
+static int
+check_cdb (int fd)
+{
+  struct cdb cdb;
+  unsigned char serial[20];
+  unsigned char record[16];
+  size_t n;
+  int i, okay = 1;
+
+  if (cdb_init (&cdb, fd))
+    return 0;
+  for (i=0; i < N_ITEMS && okay; i++)
+    {
+      make_serial (i, serial, &n);
+      if (cdb_find (&cdb, serial, n) != 1
+          || cdb_datalen (&cdb) != 16
+          || cdb_read (&cdb, record, 16, cdb_datapos (&cdb)))
+        okay = 0;
+      else if (record[0] != (i & 0xff)
+               || memcmp (record + 1, "20180101T000000", 15))
+        okay = 0;
+    }
+  cdb_free (&cdb);
+  return okay;
+}
+
+
+static void
+test_pipeline (void)
+{
+  char fname[] = "/tmp/t-crlcache.XXXXXX";
+  npth_t checkers[N_CHECKERS];
+  ksba_reader_t source, reader;
+  crl_pipeline_t pl;
+  struct cdb_make cdb;
+  int fd, i, okay_read, okay_put;
+
+  data_off = 0;
+  stop_checkers = 0;
+  data = (unsigned char *) xmalloc (N_DATA);
+  for (i=0; i < N_DATA; i++)
+    data[i] = i * 7 + (i >> 12);
+  if (ksba_reader_new (&source)
+      || ksba_reader_set_cb (source, source_cb, NULL))
+    fail (0);
+  fd = mkstemp (fname);
+  if (fd == -1 || cdb_make_start (&cdb, fd))
+    fail (0);
+
+  for (i=0; i < N_CHECKERS; i++)
+    if (npth_create (&checkers[i], NULL, checker_thread, NULL))
+      fail (0);
+
+  if (crl_pipeline_new (source, &cdb, &pl, &reader))
+    fail (1);
+
+  /* Run like the parser in crl_parse_insert.  */
+  npth_unprotect ();
+  okay_read = read_all (reader);
+  okay_put = put_all (pl);
+  npth_protect ();
+  if (!okay_read)
+    fail (2);
+  if (!okay_put)
+    fail (3);
+  if (crl_pipeline_finish_items (pl))
+    fail (3);
+
+  stop_checkers = 1;
+  for (i=0; i < N_CHECKERS; i++)
+    npth_join (checkers[i], NULL);
+  if (overlap)
+    fail (4);
+
+  crl_pipeline_release (pl);
+  ksba_reader_release (reader);
+  if (cdb_make_finish (&cdb))
+    fail (5);
+  if (!check_cdb (fd))
+    fail (5);
+
+  close (fd);
+  remove (fname);
+  ksba_reader_release (source);
+  xfree (data);
+}
+
+
+int
+crlcache_main (int argc, char **argv)
+{
+  int i;
+
+  (void)argc;
+  (void)argv;
+
+  if (npth_init ())
+    return 1;
+
+  /* A missing lock shows only up if a checker runs at the wrong
+     time; thus run the test several times.  */
+  for (i=0; i < 10; i++)
+    test_pipeline ();
+  return 0;
+}
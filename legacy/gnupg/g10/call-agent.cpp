@@ -44,9 +44,39 @@
 #define CONTROL_D ('D' - 'A' + 1)
 
 
+/* The connection to the agent.  It is opened on first use and kept
+   for the lifetime of the process.  */
 static assuan_context_t agent_ctx = NULL;
 static int did_early_card_test;
 
+/* The number of pipelined commands sent to the agent before the first
+   response is read back.  The responses to HAVEKEY and KEYINFO are
+   short, thus this keeps the socket buffers from filling up in both
+   directions.  */
+#define PIPELINE_WINDOW 32
+
+/* A snapshot of the keygrips of all secret keys, sorted for bsearch.
+   See agent_load_secret_keygrips.  */
+static struct
+{
+  int refcount;
+  int valid;             /* The snapshot is usable.  */
+  unsigned char *grips;  /* NGRIPS keygrips of 20 bytes each.  */
+  size_t ngrips;
+} secret_keygrips;
+
+/* The results of a pipelined KEYINFO run.  See
+   agent_prefetch_keyinfo.  */
+struct keyinfo_prefetch_s
+{
+  struct keyinfo_prefetch_s *next;
+  char hexgrip[41];
+  gpg_error_t err;
+  char *serialno;
+  int cleartext;
+};
+static struct keyinfo_prefetch_s *keyinfo_prefetch;
+
 struct default_inq_parm_s
 {
   ctrl_t ctrl;
@@ -665,6 +695,9 @@ agent_keytocard (const char *hexgrip, int keyno, int force,
 
   memset (&parm, 0, sizeof parm);
 
+  /* The key becomes a shadowed key.  */
+  agent_release_keyinfo_prefetch ();
+
   snprintf (line, DIM(line), "KEYTOCARD %s%s %s OPENPGP.%d %s",
             force?"--force ": "", hexgrip, serialno, keyno, timestamp);
 
@@ -1335,6 +1368,171 @@ agent_get_s2k_count (unsigned long *r_count)
 
 
 
+/* Close the connection to the agent after a protocol or I/O error.
+   The next request opens a new one.  */
+static void
+drop_agent_connection (void)
+{
+  assuan_release (agent_ctx);
+  agent_ctx = NULL;
+  did_early_card_test = 0;
+}
+
+
+/* Callback for pipelined_transact.  It is called for each status line
+   with the index IDX of the command it belongs to.  */
+typedef gpg_error_t (*pipeline_status_cb_t) (void *opaque, int idx,
+                                             const char *line);
+
+/* Send the NLINES commands in LINES to the agent without waiting for
+   the response to each of them.  The result of each command is stored
+   at R_ERRORS and status lines are passed to STATUS_CB.  Only the
+   first PIPELINE_WINDOW responses may be outstanding.  Returns an
+   error only if the connection failed, in which case it is closed.  */
+static gpg_error_t
+pipelined_transact (char **lines, int nlines, gpg_error_t *r_errors,
+                    pipeline_status_cb_t status_cb, void *opaque)
+{
+  gpg_error_t err = 0;
+  int nsent = 0;
+  int ndone = 0;
+  char *line;
+  int linelen;
+  assuan_response_t response;
+  int off;
+
+  while (ndone < nlines)
+    {
+      while (nsent < nlines && nsent - ndone < PIPELINE_WINDOW)
+        {
+          err = assuan_write_line (agent_ctx, lines[nsent]);
+          if (err)
+            goto leave;
+          nsent++;
+        }
+
+      err = assuan_client_read_response (agent_ctx, &line, &linelen);
+      if (!err)
+        err = assuan_client_parse_response (agent_ctx, line, linelen,
+                                            &response, &off);
+      if (err)
+        goto leave;
+
+      switch (response)
+        {
+        case ASSUAN_RESPONSE_OK:
+          r_errors[ndone++] = 0;
+          break;
+        case ASSUAN_RESPONSE_ERROR:
+          r_errors[ndone++] = atoi (line + off);
+          break;
+        case ASSUAN_RESPONSE_STATUS:
+          if (status_cb)
+            status_cb (opaque, ndone, line + off);
+          break;
+        case ASSUAN_RESPONSE_COMMENT:
+          break;
+        case ASSUAN_RESPONSE_INQUIRE:
+          /* None of the pipelined commands expects an inquiry; cancel
+             it so that the command fails.  */
+          err = assuan_send_data (agent_ctx, NULL, 1);
+          if (err)
+            goto leave;
+          break;
+        default:
+          err = GPG_ERR_ASS_INV_RESPONSE;
+          goto leave;
+        }
+    }
+
+ leave:
+  if (err)
+    {
+      log_error ("pipelined request to the agent failed: %s\n",
+                 gpg_strerror (err));
+      drop_agent_connection ();
+    }
+  return err;
+}
+
+
+static int
+compare_keygrips (const void *a, const void *b)
+{
+  return memcmp (a, b, 20);
+}
+
+
+/* Return true if the snapshot is valid and lists GRIP.  */
+static int
+snapshot_has_keygrip (const unsigned char *grip)
+{
+  return !!bsearch (grip, secret_keygrips.grips, secret_keygrips.ngrips,
+                    20, compare_keygrips);
+}
+
+
+/* Take a snapshot of the keygrips of all secret keys known to the
+   agent with a single HAVEKEY --list request.  Until the matching call
+   to agent_release_secret_keygrips, agent_probe_secret_key and
+   agent_probe_any_secret_key are answered from the snapshot.  This is
+   meant for listing many keys.  Calls may be nested.  If the agent
+   does not support the request, the probes ask the agent as usual.  */
+gpg_error_t
+agent_load_secret_keygrips (ctrl_t ctrl)
+{
+  gpg_error_t err;
+  membuf_t data;
+  unsigned char *buf;
+  size_t len;
+
+  if (secret_keygrips.refcount++)
+    return 0;
+
+  err = start_agent (ctrl, 0);
+  if (err)
+    return err;
+
+  init_membuf (&data, 20 * 64);
+  err = assuan_transact (agent_ctx, "HAVEKEY --list",
+                         put_membuf_cb, &data,
+                         NULL, NULL, NULL, NULL);
+  buf = (unsigned char*) get_membuf (&data, &len);
+  if (!err && !buf)
+    err = gpg_error_from_syserror ();
+  if (!err && (len % 20))
+    err = GPG_ERR_INV_RESPONSE;
+  if (err)
+    {
+      xfree (buf);
+      if (opt.verbose)
+        log_info ("listing the secret keygrips failed: %s\n",
+                  gpg_strerror (err));
+      return err;
+    }
+
+  qsort (buf, len / 20, 20, compare_keygrips);
+  secret_keygrips.grips = buf;
+  secret_keygrips.ngrips = len / 20;
+  secret_keygrips.valid = 1;
+  return 0;
+}
+
+
+/* Release a snapshot taken by agent_load_secret_keygrips.  */
+void
+agent_release_secret_keygrips (void)
+{
+  if (!secret_keygrips.refcount || --secret_keygrips.refcount)
+    return;
+
+  xfree (secret_keygrips.grips);
+  secret_keygrips.grips = NULL;
+  secret_keygrips.ngrips = 0;
+  secret_keygrips.valid = 0;
+}
+
+
 /* Ask the agent whether a secret key for the given public key is
    available.  Returns 0 if available.  */
 gpg_error_t
@@ -1344,6 +1542,16 @@ agent_probe_secret_key (ctrl_t ctrl, PKT_public_key *pk)
   char line[ASSUAN_LINELENGTH];
   char *hexgrip;
 
+  if (secret_keygrips.valid)
+    {
+      unsigned char grip[20];
+
+      err = keygrip_from_pk (pk, grip);
+      if (err)
+        return err;
+      return snapshot_has_keygrip (grip)? 0 : GPG_ERR_NO_SECKEY;
+    }
+
   err = start_agent (ctrl, 0);
   if (err)
     return err;
@@ -1371,6 +1579,23 @@ agent_probe_any_secret_key (ctrl_t ctrl, kbnode_t keyblock)
   int nkeys;
   unsigned char grip[20];
 
+  if (secret_keygrips.valid)
+    {
+      for (kbctx=NULL; (node = walk_kbnode (keyblock, &kbctx, 0)); )
+        if (node->pkt->pkttype == PKT_PUBLIC_KEY
+            || node->pkt->pkttype == PKT_PUBLIC_SUBKEY
+            || node->pkt->pkttype == PKT_SECRET_KEY
+            || node->pkt->pkttype == PKT_SECRET_SUBKEY)
+          {
+            err = keygrip_from_pk (node->pkt->pkt.public_key, grip);
+            if (err)
+              return err;
+            if (snapshot_has_keygrip (grip))
+              return 0;
+          }
+      return GPG_ERR_NO_SECKEY;
+    }
+
   err = start_agent (ctrl, 0);
   if (err)
     return err;
@@ -1447,6 +1672,193 @@ keyinfo_status_cb (void *opaque, const char *line)
 }
 
 
+/* Release the results of agent_prefetch_keyinfo which have not yet
+   been used.  This is called when the listing of the keyblock is
+   done and before the key infos of a key are changed.  */
+void
+agent_release_keyinfo_prefetch (void)
+{
+  struct keyinfo_prefetch_s *item;
+
+  while ((item = keyinfo_prefetch))
+    {
+      keyinfo_prefetch = item->next;
+      xfree (item->serialno);
+      xfree (item);
+    }
+}
+
+
+/* Forget all prefetched information about secret keys.  This is
+   called before the set of secret keys is changed.  */
+static void
+forget_prefetched_keys (void)
+{
+  agent_release_keyinfo_prefetch ();
+  secret_keygrips.valid = 0;
+}
+
+
+/* Take the prefetched result for HEXKEYGRIP from the list.  Returns
+   NULL if there is none.  */
+static struct keyinfo_prefetch_s *
+take_keyinfo_prefetch (const char *hexkeygrip)
+{
+  struct keyinfo_prefetch_s *item, **itemp;
+
+  for (itemp = &keyinfo_prefetch; (item = *itemp); itemp = &item->next)
+    if (!strcmp (item->hexgrip, hexkeygrip))
+      {
+        *itemp = item->next;
+        return item;
+      }
+  return NULL;
+}
+
+
+/* Status callback for the pipelined KEYINFO requests.  Only the
+   KEYINFO line for the keygrip of command IDX is used; other status
+   lines, like PROGRESS, must not reset the result.  */
+static gpg_error_t
+keyinfo_prefetch_status_cb (void *opaque, int idx, const char *line)
+{
+  struct keyinfo_prefetch_s **items = (struct keyinfo_prefetch_s **) opaque;
+  struct keyinfo_data_parm_s keyinfo;
+  const char *s;
+
+  s = has_leading_keyword (line, "KEYINFO");
+  if (!s || ascii_strncasecmp (s, items[idx]->hexgrip, 40)
+      || (s[40] && s[40] != ' '))
+    return 0;
+
+  memset (&keyinfo, 0, sizeof keyinfo);
+  keyinfo_status_cb (&keyinfo, line);
+  if (keyinfo.serialno)
+    {
+      xfree (items[idx]->serialno);
+      items[idx]->serialno = keyinfo.serialno;
+    }
+  items[idx]->cleartext = keyinfo.cleartext;
+  return 0;
+}
+
+
+/* Ask the agent for the key infos of the NGRIPS keygrips at GRIPS
+   with one pipelined round of KEYINFO requests and store the results
+   in KEYINFO_PREFETCH.  */
+static gpg_error_t
+prefetch_keyinfo (const unsigned char *grips, int ngrips)
+{
+  gpg_error_t err;
+  struct keyinfo_prefetch_s **items;
+  char **lines;
+  gpg_error_t *errors;
+  int i;
+
+  items = (struct keyinfo_prefetch_s **) xtrycalloc (ngrips, sizeof *items);
+  lines = (char **) xtrycalloc (ngrips, sizeof *lines);
+  errors = (gpg_error_t *) xtrycalloc (ngrips, sizeof *errors);
+  if (!items || !lines || !errors)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+
+  for (i=0; i < ngrips; i++)
+    {
+      items[i] = (struct keyinfo_prefetch_s *) xtrycalloc (1, sizeof **items);
+      if (!items[i])
+        {
+          err = gpg_error_from_syserror ();
+          goto leave;
+        }
+      bin2hex (grips + 20*i, 20, items[i]->hexgrip);
+      lines[i] = xtryasprintf ("KEYINFO %s", items[i]->hexgrip);
+      if (!lines[i])
+        {
+          err = gpg_error_from_syserror ();
+          goto leave;
+        }
+    }
+
+  err = pipelined_transact (lines, ngrips, errors,
+                            keyinfo_prefetch_status_cb, items);
+  if (err)
+    goto leave;
+
+  for (i=ngrips-1; i >= 0; i--)
+    {
+      items[i]->err = errors[i];
+      items[i]->next = keyinfo_prefetch;
+      keyinfo_prefetch = items[i];
+      items[i] = NULL;
+    }
+
+ leave:
+  for (i=0; i < ngrips; i++)
+    {
+      if (items && items[i])
+        {
+          xfree (items[i]->serialno);
+          xfree (items[i]);
+        }
+      if (lines)
+        xfree (lines[i]);
+    }
+  xfree (items);
+  xfree (lines);
+  xfree (errors);
+  return err;
+}
+
+
+/* Ask the agent for the key infos of all keys in KEYBLOCK with one
+   pipelined round of KEYINFO requests.  The results are used by the
+   next calls to agent_get_keyinfo for these keys; each result is used
+   only once and all are dropped by the next call to this function.  */
+gpg_error_t
+agent_prefetch_keyinfo (ctrl_t ctrl, kbnode_t keyblock)
+{
+  gpg_error_t err;
+  kbnode_t kbctx, node;
+  unsigned char *grips;
+  int nkeys, i;
+
+  agent_release_keyinfo_prefetch ();
+
+  for (kbctx=NULL, nkeys=0; (node = walk_kbnode (keyblock, &kbctx, 0)); )
+    if (node->pkt->pkttype == PKT_PUBLIC_KEY
+        || node->pkt->pkttype == PKT_PUBLIC_SUBKEY)
+      nkeys++;
+  if (nkeys < 2)
+    return 0;  /* Nothing to gain.  */
+
+  err = start_agent (ctrl, 0);
+  if (err)
+    return err;
+
+  grips = (unsigned char *) xtrymalloc (20 * nkeys);
+  if (!grips)
+    return gpg_error_from_syserror ();
+
+  for (kbctx=NULL, i=0; (node = walk_kbnode (keyblock, &kbctx, 0)); )
+    if (node->pkt->pkttype == PKT_PUBLIC_KEY
+        || node->pkt->pkttype == PKT_PUBLIC_SUBKEY)
+      {
+        err = keygrip_from_pk (node->pkt->pkt.public_key, grips + 20*i);
+        if (err)
+          goto leave;
+        i++;
+      }
+
+  err = prefetch_keyinfo (grips, nkeys);
+
+ leave:
+  xfree (grips);
+  return err;
+}
+
+
 /* Return the serial number for a secret key.  If the returned serial
    number is NULL, the key is not stored on a smartcard.  Caller needs
    to free R_SERIALNO.
@@ -1461,22 +1873,33 @@ agent_get_keyinfo (ctrl_t ctrl, const char *hexkeygrip,
   gpg_error_t err;
   char line[ASSUAN_LINELENGTH];
   struct keyinfo_data_parm_s keyinfo;
+  struct keyinfo_prefetch_s *item;
 
   memset (&keyinfo, 0,sizeof keyinfo);
 
   *r_serialno = NULL;
 
-  err = start_agent (ctrl, 0);
-  if (err)
-    return err;
+  if (hexkeygrip && (item = take_keyinfo_prefetch (hexkeygrip)))
+    {
+      err = item->err;
+      keyinfo.serialno = item->serialno;
+      keyinfo.cleartext = item->cleartext;
+      xfree (item);
+    }
+  else
+    {
+      err = start_agent (ctrl, 0);
+      if (err)
+        return err;
 
-  if (!hexkeygrip || strlen (hexkeygrip) != 40)
-    return GPG_ERR_INV_VALUE;
+      if (!hexkeygrip || strlen (hexkeygrip) != 40)
+        return GPG_ERR_INV_VALUE;
 
-  snprintf (line, DIM(line), "KEYINFO %s", hexkeygrip);
+      snprintf (line, DIM(line), "KEYINFO %s", hexkeygrip);
 
-  err = assuan_transact (agent_ctx, line, NULL, NULL, NULL, NULL,
-                         keyinfo_status_cb, &keyinfo);
+      err = assuan_transact (agent_ctx, line, NULL, NULL, NULL, NULL,
+                             keyinfo_status_cb, &keyinfo);
+    }
   if (!err && keyinfo.serialno)
     {
       /* Sanity check for bad characters.  */
@@ -1579,6 +2002,7 @@ agent_genkey (ctrl_t ctrl, char **cache_nonce_addr, char **passwd_nonce_addr,
   dfltparm.ctrl = ctrl;
 
   *r_pubkey = NULL;
+  forget_prefetched_keys ();
   err = start_agent (ctrl, 0);
   if (err)
     return err;
@@ -1964,6 +2388,7 @@ agent_import_key (ctrl_t ctrl, const char *desc, char **cache_nonce_addr,
   memset (&dfltparm, 0, sizeof dfltparm);
   dfltparm.ctrl = ctrl;
 
+  forget_prefetched_keys ();
   err = start_agent (ctrl, 0);
   if (err)
     return err;
@@ -2081,6 +2506,7 @@ agent_delete_key (ctrl_t ctrl, const char *hexkeygrip, const char *desc,
   memset (&dfltparm, 0, sizeof dfltparm);
   dfltparm.ctrl = ctrl;
 
+  forget_prefetched_keys ();
   err = start_agent (ctrl, 0);
   if (err)
     return err;
@@ -2134,6 +2560,10 @@ agent_passwd (ctrl_t ctrl, const char *hexkeygrip, const char *desc, int verify,
   if (!hexkeygrip || strlen (hexkeygrip) != 40)
     return GPG_ERR_INV_VALUE;
 
+  /* The protection of the key changes.  */
+  if (!verify)
+    agent_release_keyinfo_prefetch ();
+
   if (desc)
     {
       snprintf (line, DIM(line), "SETKEYDESC %s", desc);
@@ -148,6 +148,16 @@ gpg_error_t agent_probe_secret_key (ctrl_t ctrl, PKT_public_key *pk);
    keys (primary or sub) in KEYBLOCK.  Returns 0 if available.  */
 gpg_error_t agent_probe_any_secret_key (ctrl_t ctrl, kbnode_t keyblock);
 
+/* Take and release a snapshot of the keygrips of all secret keys
+   which is used by the two functions above.  */
+gpg_error_t agent_load_secret_keygrips (ctrl_t ctrl);
+void agent_release_secret_keygrips (void);
+
+/* Ask for the infos of all keys in KEYBLOCK in one go.  */
+gpg_error_t agent_prefetch_keyinfo (ctrl_t ctrl, kbnode_t keyblock);
+
+/* Drop the infos of agent_prefetch_keyinfo which have not been used.  */
+void agent_release_keyinfo_prefetch (void);
 
 /* Return infos about the secret key with HEXKEYGRIP.  */
 gpg_error_t agent_get_keyinfo (ctrl_t ctrl, const char *hexkeygrip,
@@ -0,0 +1,1149 @@
+/* certgraph.c - Persistent certification graph for the trustdb
+ * Copyright (C) 2017 The NeoPG developers
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Validating the Web-of-Trust used to read every keyblock once for
+ * each certification depth.  This module keeps the certification
+ * edges (key ID of the signer -> key ID of the certified primary key)
+ * in a file next to the trustdb so that validate_keys only needs to
+ * look at the keys certified by the fully valid keys of the previous
+ * depth.  It also records which keys were usable as signers after the
+ * last validation; a later check can then tell whether the keys
+ * changed since then are able to affect any validity at all.
+ *
+ * The file is a journal with a 20 byte header followed by 20 byte
+ * records:
+ *
+ *   byte 0     record type
+ *   byte 1-3   reserved
+ *   byte 4-11  first value
+ *   byte 12-19 second value
+ *
+ * The record types are:
+ *
+ *   EDGE        key ID of the signer, key ID of the certified key
+ *   DIRTY       -, key ID of a changed primary key or 0 for all keys
+ *   SIGNER      -, key ID of a fully valid key
+ *   UTK         -, key ID of an ultimately trusted key
+ *   CHECKPOINT  covered file offset, creation time of the trustdb
+ *               and the next expiration time
+ *
+ * The header holds the magic, the version, an identifier of the
+ * keyrings the graph was built from and a stamp of their state (see
+ * keydb_get_resources_stamp).  Any change of a keyblock through keydb
+ * appends the edges of the new keyblock and a DIRTY record and, once
+ * the keyring has been written, updates the stamp.  If the keyrings
+ * have been modified otherwise the stamp does not match and the
+ * keyrings are scanned again.  After a validation run the SIGNER and UTK records and the
+ * CHECKPOINT are appended with one write; DIRTY records before the
+ * covered offset have been taken into account by that run.
+ *
+ * The edges are a superset of the actual certifications: edges of an
+ * older version of a keyblock are only removed when the keyrings are
+ * scanned again.  That is harmless because validate_keys looks at
+ * the certifications of each candidate key anyway.  The file is only
+ * created by a full scan, thus a keyring change is never missed.  */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "gpg.h"
+#include "../common/util.h"
+#include "options.h"
+#include "packet.h"
+#include "keydb.h"
+#include "main.h"
+#include "trustdb.h"
+#include "../common/i18n.h"
+#include "../common/host2net.h"
+
+#if defined(HAVE_DOSISH_SYSTEM) || defined(__CYGWIN__)
+#define MY_O_BINARY  O_BINARY
+#else
+#define MY_O_BINARY  0
+#endif
+
+#define CERTGRAPH_MAGIC        "GPGcgrf"
+#define CERTGRAPH_VERSION      2
+#define CERTGRAPH_HEADER_SIZE  20
+#define CERTGRAPH_STAMP_OFF    16
+#define CERTGRAPH_RECORD_SIZE  20
+
+#define REC_EDGE        1
+#define REC_DIRTY       2
+#define REC_SIGNER      3
+#define REC_UTK         4
+#define REC_CHECKPOINT  5
+
+/* An edge of the graph.  Edges are kept in one array and chained by
+ * index; 0 terminates a chain.  */
+struct cg_edge
+{
+  unsigned int next;      /* Next edge in the hash chain.  */
+  unsigned int fwd_next;  /* Next edge in the signer bucket.  */
+  unsigned int rev_next;  /* Next edge in the signee bucket.  */
+  u32 signer[2];
+  u32 signee[2];
+};
+
+/* A set of key IDs using open addressing.  */
+struct kidset
+{
+  u32 (*kids)[2];
+  byte *used;
+  unsigned int size;      /* Power of two.  */
+  unsigned int count;
+};
+
+struct cg_dirty
+{
+  u32 kid[2];             /* Both 0 for all keys.  */
+  off_t offset;           /* Offset of the record in the file.  */
+};
+
+static struct
+{
+  int loaded;             /* The in-core graph is complete.  */
+  int need_rewrite;       /* The file needs to be written from scratch.  */
+  char *fname;
+  u32 stamp;              /* The keyring stamp the graph is valid for.  */
+  off_t size;             /* The size of the file as read.  */
+  struct cg_edge *edges;  /* Index 0 is not used.  */
+  unsigned int nedges;    /* Including the unused slot.  */
+  unsigned int nalloced;
+  unsigned int *buckets;
+  unsigned int *fwd_buckets;
+  unsigned int *rev_buckets;
+  unsigned int nbuckets;  /* Power of two.  */
+  struct cg_dirty *dirty;
+  unsigned int ndirty;
+  unsigned int dirty_alloced;
+  int have_checkpoint;
+  u32 tdb_created;        /* From the last checkpoint.  */
+  u32 next_expire;        /* From the last checkpoint.  */
+  struct kidset signers;  /* From the last checkpoint.  */
+  struct kidset utks;     /* From the last checkpoint.  */
+  int staged;             /* NEW_SIGNERS and NEW_UTKS are valid.  */
+  struct kidset new_signers;
+  struct kidset new_utks;
+} graph;
+
+/* Set by certgraph_notice_keyblock if the graph file matched the
+ * keyrings before a keyblock is written.  */
+static int stamp_checked;
+
+
+static inline unsigned int
+kid_hash (const u32 *kid)
+{
+  return kid[1] ^ (kid[0] * 0x9e3779b1);
+}
+
+
+static void
+kidset_release (struct kidset *set)
+{
+  xfree (set->kids);
+  xfree (set->used);
+  memset (set, 0, sizeof *set);
+}
+
+
+static int
+kidset_find (struct kidset *set, const u32 *kid, unsigned int *r_idx)
+{
+  unsigned int i;
+
+  if (!set->size)
+    return 0;
+  for (i = kid_hash (kid) & (set->size - 1); set->used[i];
+       i = (i + 1) & (set->size - 1))
+    if (set->kids[i][0] == kid[0] && set->kids[i][1] == kid[1])
+      {
+        if (r_idx)
+          *r_idx = i;
+        return 1;
+      }
+  if (r_idx)
+    *r_idx = i;
+  return 0;
+}
+
+
+static int
+kidset_has (struct kidset *set, const u32 *kid)
+{
+  return kidset_find (set, kid, NULL);
+}
+
+
+/* Add KID to SET.  Returns false on memory shortage.  */
+static int
+kidset_add (struct kidset *set, const u32 *kid)
+{
+  unsigned int i;
+
+  if (2 * (set->count + 1) > set->size)
+    {
+      struct kidset newset;
+
+      memset (&newset, 0, sizeof newset);
+      newset.size = set->size? 2 * set->size : 64;
+      newset.kids = (u32 (*)[2]) xtrycalloc (newset.size, sizeof *newset.kids);
+      newset.used = (byte*) xtrycalloc (newset.size, 1);
+      if (!newset.kids || !newset.used)
+        {
+          kidset_release (&newset);
+          return 0;
+        }
+      for (i = 0; i < set->size; i++)
+        if (set->used[i])
+          kidset_add (&newset, set->kids[i]);
+      kidset_release (set);
+      *set = newset;
+    }
+
+  if (kidset_find (set, kid, &i))
+    return 1;
+  set->kids[i][0] = kid[0];
+  set->kids[i][1] = kid[1];
+  set->used[i] = 1;
+  set->count++;
+  return 1;
+}
+
+
+static inline unsigned int
+edge_bucket (const u32 *signer, const u32 *signee)
+{
+  return (kid_hash (signer) ^ (kid_hash (signee) * 31)) & (graph.nbuckets - 1);
+}
+
+
+/* Grow the edge table so that it has room for at least one more
+ * edge.  Returns false on memory shortage.  */
+static int
+grow_edges (void)
+{
+  struct cg_edge *e;
+  unsigned int i, n;
+
+  if (graph.nedges < graph.nalloced)
+    return 1;
+
+  n = graph.nalloced? graph.nalloced * 2 : 4096;
+  e = (struct cg_edge*) xtryrealloc (graph.edges, n * sizeof *e);
+  if (!e)
+    return 0;
+  graph.edges = e;
+  graph.nalloced = n;
+  if (!graph.nedges)
+    {
+      memset (&graph.edges[0], 0, sizeof graph.edges[0]);
+      graph.nedges = 1;
+    }
+
+  xfree (graph.buckets);
+  xfree (graph.fwd_buckets);
+  xfree (graph.rev_buckets);
+  graph.nbuckets = n;
+  graph.buckets = (unsigned int*) xtrycalloc (n, sizeof (unsigned int));
+  graph.fwd_buckets = (unsigned int*) xtrycalloc (n, sizeof (unsigned int));
+  graph.rev_buckets = (unsigned int*) xtrycalloc (n, sizeof (unsigned int));
+  if (!graph.buckets || !graph.fwd_buckets || !graph.rev_buckets)
+    {
+      xfree (graph.buckets);
+      xfree (graph.fwd_buckets);
+      xfree (graph.rev_buckets);
+      graph.buckets = graph.fwd_buckets = graph.rev_buckets = NULL;
+      graph.nbuckets = 0;
+      return 0;
+    }
+  for (i = 1; i < graph.nedges; i++)
+    {
+      e = graph.edges + i;
+      e->next = graph.buckets[edge_bucket (e->signer, e->signee)];
+      graph.buckets[edge_bucket (e->signer, e->signee)] = i;
+      e->fwd_next = graph.fwd_buckets[kid_hash (e->signer) & (n - 1)];
+      graph.fwd_buckets[kid_hash (e->signer) & (n - 1)] = i;
+      e->rev_next = graph.rev_buckets[kid_hash (e->signee) & (n - 1)];
+      graph.rev_buckets[kid_hash (e->signee) & (n - 1)] = i;
+    }
+  return 1;
+}
+
+
+/* Add an edge from SIGNER to SIGNEE unless it already exists.
+ * Returns false on memory shortage.  */
+static int
+add_edge (const u32 *signer, const u32 *signee)
+{
+  struct cg_edge *e;
+  unsigned int i;
+
+  if (graph.nbuckets)
+    for (i = graph.buckets[edge_bucket (signer, signee)]; i;
+         i = graph.edges[i].next)
+      {
+        e = graph.edges + i;
+        if (e->signer[0] == signer[0] && e->signer[1] == signer[1]
+            && e->signee[0] == signee[0] && e->signee[1] == signee[1])
+          return 1;
+      }
+
+  if (!grow_edges () || !graph.nbuckets)
+    return 0;
+  i = graph.nedges++;
+  e = graph.edges + i;
+  e->signer[0] = signer[0];
+  e->signer[1] = signer[1];
+  e->signee[0] = signee[0];
+  e->signee[1] = signee[1];
+  e->next = graph.buckets[edge_bucket (signer, signee)];
+  graph.buckets[edge_bucket (signer, signee)] = i;
+  e->fwd_next = graph.fwd_buckets[kid_hash (signer) & (graph.nbuckets - 1)];
+  graph.fwd_buckets[kid_hash (signer) & (graph.nbuckets - 1)] = i;
+  e->rev_next = graph.rev_buckets[kid_hash (signee) & (graph.nbuckets - 1)];
+  graph.rev_buckets[kid_hash (signee) & (graph.nbuckets - 1)] = i;
+  return 1;
+}
+
+
+static int
+add_dirty (const u32 *kid, off_t offset)
+{
+  if (graph.ndirty == graph.dirty_alloced)
+    {
+      unsigned int n = graph.dirty_alloced? 2 * graph.dirty_alloced : 64;
+      struct cg_dirty *d;
+
+      d = (struct cg_dirty*) xtryrealloc (graph.dirty, n * sizeof *d);
+      if (!d)
+        return 0;
+      graph.dirty = d;
+      graph.dirty_alloced = n;
+    }
+  graph.dirty[graph.ndirty].kid[0] = kid[0];
+  graph.dirty[graph.ndirty].kid[1] = kid[1];
+  graph.dirty[graph.ndirty].offset = offset;
+  graph.ndirty++;
+  return 1;
+}
+
+
+static void
+release_graph (void)
+{
+  xfree (graph.edges);
+  xfree (graph.buckets);
+  xfree (graph.fwd_buckets);
+  xfree (graph.rev_buckets);
+  xfree (graph.dirty);
+  kidset_release (&graph.signers);
+  kidset_release (&graph.utks);
+  kidset_release (&graph.new_signers);
+  kidset_release (&graph.new_utks);
+  xfree (graph.fname);
+  memset (&graph, 0, sizeof graph);
+}
+
+
+static const char *
+graph_fname (void)
+{
+  if (!graph.fname)
+    graph.fname = make_filename (gnupg_homedir (),
+                                 "trustgraph" EXTSEP_S "db", NULL);
+  return graph.fname;
+}
+
+
+static void
+build_header (byte *header, u32 stamp)
+{
+  u32 id = keydb_get_resources_id ();
+
+  memset (header, 0, CERTGRAPH_HEADER_SIZE);
+  memcpy (header, CERTGRAPH_MAGIC, 8);
+  header[11] = CERTGRAPH_VERSION;
+  header[12] = id >> 24;
+  header[13] = id >> 16;
+  header[14] = id >>  8;
+  header[15] = id;
+  header[16] = stamp >> 24;
+  header[17] = stamp >> 16;
+  header[18] = stamp >>  8;
+  header[19] = stamp;
+}
+
+
+static void
+build_record (byte *rec, int type, const u32 *a, const u32 *b)
+{
+  memset (rec, 0, CERTGRAPH_RECORD_SIZE);
+  rec[0] = type;
+  if (a)
+    {
+      rec[4]  = a[0] >> 24;
+      rec[5]  = a[0] >> 16;
+      rec[6]  = a[0] >>  8;
+      rec[7]  = a[0];
+      rec[8]  = a[1] >> 24;
+      rec[9]  = a[1] >> 16;
+      rec[10] = a[1] >>  8;
+      rec[11] = a[1];
+    }
+  rec[12] = b[0] >> 24;
+  rec[13] = b[0] >> 16;
+  rec[14] = b[0] >>  8;
+  rec[15] = b[0];
+  rec[16] = b[1] >> 24;
+  rec[17] = b[1] >> 16;
+  rec[18] = b[1] >>  8;
+  rec[19] = b[1];
+}
+
+
+/* Process the record REC found at OFFSET.  IN_GROUP tracks whether
+ * the previous record was a SIGNER or UTK record.  Returns false on
+ * memory shortage.  */
+static int
+parse_record (const byte *rec, off_t offset, int *in_group)
+{
+  u32 a[2], b[2];
+  unsigned int i, j;
+  off_t covered;
+
+  a[0] = buf32_to_u32 (rec + 4);
+  a[1] = buf32_to_u32 (rec + 8);
+  b[0] = buf32_to_u32 (rec + 12);
+  b[1] = buf32_to_u32 (rec + 16);
+
+  switch (rec[0])
+    {
+    case REC_EDGE:
+      *in_group = 0;
+      return add_edge (a, b);
+
+    case REC_DIRTY:
+      *in_group = 0;
+      return add_dirty (b, offset);
+
+    case REC_SIGNER:
+    case REC_UTK:
+      if (!*in_group)
+        {
+          kidset_release (&graph.new_signers);
+          kidset_release (&graph.new_utks);
+          *in_group = 1;
+        }
+      return kidset_add (rec[0] == REC_SIGNER? &graph.new_signers
+                         /**/                : &graph.new_utks, b);
+
+    case REC_CHECKPOINT:
+      if (!*in_group)
+        {
+          /* A validation run without any trusted key.  */
+          kidset_release (&graph.new_signers);
+          kidset_release (&graph.new_utks);
+        }
+      *in_group = 0;
+      covered = ((off_t)a[0] << 32) | a[1];
+      for (i = j = 0; i < graph.ndirty; i++)
+        if (graph.dirty[i].offset >= covered)
+          graph.dirty[j++] = graph.dirty[i];
+      graph.ndirty = j;
+      kidset_release (&graph.signers);
+      kidset_release (&graph.utks);
+      graph.signers = graph.new_signers;
+      graph.utks = graph.new_utks;
+      memset (&graph.new_signers, 0, sizeof graph.new_signers);
+      memset (&graph.new_utks, 0, sizeof graph.new_utks);
+      graph.have_checkpoint = 1;
+      graph.tdb_created = b[0];
+      graph.next_expire = b[1];
+      return 1;
+
+    default: /* Ignore unknown records.  */
+      *in_group = 0;
+      return 1;
+    }
+}
+
+
+static int
+read_all (int fd, byte *buffer, size_t length)
+{
+  ssize_t n;
+
+  while (length)
+    {
+      do
+        n = read (fd, buffer, length);
+      while (n == -1 && errno == EINTR);
+      if (n <= 0)
+        return -1;
+      buffer += n;
+      length -= n;
+    }
+  return 0;
+}
+
+
+static int
+write_all (int fd, const byte *buffer, size_t length)
+{
+  ssize_t n;
+
+  while (length)
+    {
+      do
+        n = write (fd, buffer, length);
+      while (n == -1 && errno == EINTR);
+      if (n <= 0)
+        return -1;
+      buffer += n;
+      length -= n;
+    }
+  return 0;
+}
+
+
+/* Read the graph file.  Returns true if the file is usable.  */
+static int
+load_graph (void)
+{
+  byte buffer[CERTGRAPH_RECORD_SIZE * 512];
+  byte header[CERTGRAPH_HEADER_SIZE];
+  struct stat st;
+  off_t off;
+  size_t n, i;
+  int fd, in_group = 0;
+  int okay = 0;
+
+  release_graph ();
+
+  fd = open (graph_fname (), O_RDONLY | MY_O_BINARY);
+  if (fd == -1)
+    {
+      if (errno != ENOENT)
+        log_info (_("can't open '%s': %s\n"), graph.fname, strerror (errno));
+      return 0;
+    }
+
+  graph.stamp = keydb_get_resources_stamp ();
+  build_header (header, graph.stamp);
+  if (fstat (fd, &st) || st.st_size < CERTGRAPH_HEADER_SIZE
+      || ((st.st_size - CERTGRAPH_HEADER_SIZE) % CERTGRAPH_RECORD_SIZE)
+      || read_all (fd, buffer, CERTGRAPH_HEADER_SIZE)
+      || memcmp (buffer, header, CERTGRAPH_HEADER_SIZE))
+    {
+      if (opt.verbose)
+        log_info ("trustgraph: '%s' does not match the keyrings\n",
+                  graph.fname);
+      goto leave;
+    }
+
+  for (off = CERTGRAPH_HEADER_SIZE; off < st.st_size; off += n)
+    {
+      n = sizeof buffer;
+      if ((off_t)n > st.st_size - off)
+        n = st.st_size - off;
+      if (read_all (fd, buffer, n))
+        goto leave;
+      for (i = 0; i < n; i += CERTGRAPH_RECORD_SIZE)
+        if (!parse_record (buffer + i, off + i, &in_group))
+          goto leave;
+    }
+
+  graph.size = st.st_size;
+  graph.loaded = 1;
+  okay = 1;
+
+ leave:
+  close (fd);
+  if (DBG_TRUST)
+    log_debug ("trustgraph: loaded %u edges and %u dirty keys from '%s'\n",
+               graph.nedges? graph.nedges - 1 : 0, graph.ndirty,
+               graph.fname);
+  return okay;
+}
+
+
+/* Return true if the graph file exists and has been built for the
+ * current state of the keyrings.  A file which does not match is
+ * removed because appending to it would be pointless.  */
+static int
+check_stamp (void)
+{
+  byte header[CERTGRAPH_HEADER_SIZE];
+  byte buffer[CERTGRAPH_HEADER_SIZE];
+  int fd, okay;
+
+  fd = open (graph_fname (), O_RDONLY | MY_O_BINARY);
+  if (fd == -1)
+    return 0;  /* No graph yet.  */
+
+  build_header (header, keydb_get_resources_stamp ());
+  okay = (!read_all (fd, buffer, CERTGRAPH_HEADER_SIZE)
+          && !memcmp (buffer, header, CERTGRAPH_HEADER_SIZE));
+  close (fd);
+  if (!okay)
+    {
+      if (opt.verbose)
+        log_info ("trustgraph: '%s' does not match the keyrings"
+                  " - removing it\n", graph.fname);
+      gnupg_remove (graph.fname);
+    }
+  return okay;
+}
+
+
+/* Append the buffer BUF of N bytes to the existing graph file.  If
+ * the file has been damaged it is removed so that the next
+ * validation rebuilds it.  */
+static void
+append_records (const byte *buf, size_t n)
+{
+  struct stat st;
+  int fd;
+
+  fd = open (graph_fname (), O_WRONLY | O_APPEND | MY_O_BINARY);
+  if (fd == -1)
+    return;  /* No graph yet.  */
+
+  if (fstat (fd, &st) || st.st_size < CERTGRAPH_HEADER_SIZE
+      || ((st.st_size - CERTGRAPH_HEADER_SIZE) % CERTGRAPH_RECORD_SIZE)
+      || write_all (fd, buf, n))
+    {
+      log_info ("trustgraph: error updating '%s' - removing it\n",
+                graph.fname);
+      close (fd);
+      gnupg_remove (graph.fname);
+      return;
+    }
+  close (fd);
+}
+
+
+/* Copy the records of the file open at FD starting at offset START to
+ * the file FNAME.  */
+static void
+copy_tail (int fd, off_t start, const char *fname)
+{
+  byte buffer[CERTGRAPH_RECORD_SIZE * 512];
+  struct stat st;
+  off_t off;
+  size_t n;
+  int outfd;
+
+  if (fstat (fd, &st) || st.st_size <= start
+      || ((st.st_size - start) % CERTGRAPH_RECORD_SIZE)
+      || lseek (fd, start, SEEK_SET) == (off_t)(-1))
+    return;
+
+  outfd = open (fname, O_WRONLY | O_APPEND | MY_O_BINARY);
+  if (outfd == -1)
+    return;
+  for (off = start; off < st.st_size; off += n)
+    {
+      n = sizeof buffer;
+      if ((off_t)n > st.st_size - off)
+        n = st.st_size - off;
+      if (read_all (fd, buffer, n) || write_all (outfd, buffer, n))
+        break;
+    }
+  close (outfd);
+}
+
+
+/* Write the group of the staged SIGNER and UTK records followed by a
+ * CHECKPOINT record into a new buffer and return it.  */
+static byte *
+build_checkpoint (off_t covered, u32 tdb_created, u32 next_expire,
+                  size_t *r_len)
+{
+  struct kidset *signers = graph.staged? &graph.new_signers : &graph.signers;
+  struct kidset *utks = graph.staged? &graph.new_utks : &graph.utks;
+  byte *buf, *p;
+  unsigned int i;
+  u32 a[2], b[2];
+
+  *r_len = (signers->count + utks->count + 1) * CERTGRAPH_RECORD_SIZE;
+  buf = p = (byte*) xtrymalloc (*r_len);
+  if (!buf)
+    return NULL;
+  for (i = 0; i < signers->size; i++)
+    if (signers->used[i])
+      {
+        build_record (p, REC_SIGNER, NULL, signers->kids[i]);
+        p += CERTGRAPH_RECORD_SIZE;
+      }
+  for (i = 0; i < utks->size; i++)
+    if (utks->used[i])
+      {
+        build_record (p, REC_UTK, NULL, utks->kids[i]);
+        p += CERTGRAPH_RECORD_SIZE;
+      }
+  a[0] = (u32)((uint64_t)covered >> 32);
+  a[1] = (u32)covered;
+  b[0] = tdb_created;
+  b[1] = next_expire;
+  build_record (p, REC_CHECKPOINT, a, b);
+  return buf;
+}
+
+
+/* Write the whole graph to a new file followed by a checkpoint.
+ * Records which other processes appended to the old file after
+ * offset START are copied over.  */
+static void
+write_graph (off_t start, u32 tdb_created, u32 next_expire)
+{
+  byte buffer[CERTGRAPH_RECORD_SIZE * 512];
+  byte *group;
+  size_t n, grouplen;
+  unsigned int i;
+  off_t covered;
+  char *tmpname;
+  int fd, oldfd;
+
+  tmpname = xtryasprintf ("%s.%d.tmp", graph_fname (), (int)getpid ());
+  if (!tmpname)
+    return;
+  fd = open (tmpname, O_WRONLY | O_CREAT | O_TRUNC | MY_O_BINARY, 0600);
+  if (fd == -1)
+    {
+      if (errno != ENOENT && !opt.quiet)
+        log_info (_("can't create '%s': %s\n"), tmpname, strerror (errno));
+      xfree (tmpname);
+      return;
+    }
+
+  build_header (buffer, graph.stamp);
+  if (write_all (fd, buffer, CERTGRAPH_HEADER_SIZE))
+    goto write_error;
+  for (n = 0, i = 1; i < graph.nedges; i++)
+    {
+      build_record (buffer + n, REC_EDGE,
+                    graph.edges[i].signer, graph.edges[i].signee);
+      n += CERTGRAPH_RECORD_SIZE;
+      if (n == sizeof buffer)
+        {
+          if (write_all (fd, buffer, n))
+            goto write_error;
+          n = 0;
+        }
+    }
+  if (n && write_all (fd, buffer, n))
+    goto write_error;
+
+  covered = CERTGRAPH_HEADER_SIZE
+    + (off_t)(graph.nedges? graph.nedges - 1 : 0) * CERTGRAPH_RECORD_SIZE;
+  group = build_checkpoint (covered, tdb_created, next_expire, &grouplen);
+  if (!group)
+    goto write_error;
+  if (write_all (fd, group, grouplen))
+    {
+      xfree (group);
+      goto write_error;
+    }
+  xfree (group);
+
+  oldfd = start? open (graph.fname, O_RDONLY | MY_O_BINARY) : -1;
+  if (close (fd) || rename (tmpname, graph.fname))
+    {
+      log_info (_("renaming '%s' to '%s' failed: %s\n"),
+                tmpname, graph.fname, strerror (errno));
+      gnupg_remove (tmpname);
+    }
+  else if (oldfd != -1)
+    copy_tail (oldfd, start, graph.fname);
+  if (oldfd != -1)
+    close (oldfd);
+  xfree (tmpname);
+  return;
+
+ write_error:
+  log_info ("trustgraph: error writing '%s': %s\n", tmpname, strerror (errno));
+  close (fd);
+  gnupg_remove (tmpname);
+  xfree (tmpname);
+}
+
+
+/* Return the EDGE records for the certifications in KEYBLOCK
+ * followed by a DIRTY record for its primary key.  */
+static byte *
+keyblock_records (kbnode_t keyblock, size_t *r_len)
+{
+  kbnode_t node;
+  byte *buf;
+  size_t n;
+  u32 kid[2];
+  int in_uid;
+
+  keyid_from_pk (keyblock->pkt->pkt.public_key, kid);
+
+  for (n = 1, node = keyblock; node; node = node->next)
+    if (node->pkt->pkttype == PKT_SIGNATURE)
+      n++;
+  buf = (byte*) xtrymalloc (n * CERTGRAPH_RECORD_SIZE);
+  if (!buf)
+    return NULL;
+
+  for (n = 0, in_uid = 0, node = keyblock; node; node = node->next)
+    {
+      if (node->pkt->pkttype == PKT_USER_ID)
+        in_uid = 1;
+      else if (node->pkt->pkttype == PKT_PUBLIC_SUBKEY
+               || node->pkt->pkttype == PKT_SECRET_SUBKEY)
+        in_uid = 0;
+      else if (node->pkt->pkttype == PKT_SIGNATURE && in_uid)
+        {
+          PKT_signature *sig = node->pkt->pkt.signature;
+
+          if ((IS_UID_SIG (sig) || IS_UID_REV (sig))
+              && (sig->keyid[0] != kid[0] || sig->keyid[1] != kid[1]))
+            {
+              build_record (buf + n, REC_EDGE, sig->keyid, kid);
+              n += CERTGRAPH_RECORD_SIZE;
+            }
+        }
+    }
+  build_record (buf + n, REC_DIRTY, NULL, kid);
+  *r_len = n + CERTGRAPH_RECORD_SIZE;
+  return buf;
+}
+
+
+/* Scan all keyrings and build a new graph.  */
+static gpg_error_t
+rebuild_graph (void)
+{
+  KEYDB_SEARCH_DESC desc;
+  KEYDB_HANDLE hd;
+  kbnode_t keyblock;
+  gpg_error_t err;
+  struct stat st;
+  off_t start = 0;
+  unsigned int count = 0;
+
+  /* Keep the size of a valid old file to pick up records appended
+   * meanwhile.  */
+  if (!stat (graph_fname (), &st) && st.st_size >= CERTGRAPH_HEADER_SIZE
+      && !((st.st_size - CERTGRAPH_HEADER_SIZE) % CERTGRAPH_RECORD_SIZE))
+    start = st.st_size;
+  release_graph ();
+  /* Changes made while scanning give a different stamp and thus yet
+   * another scan next time.  */
+  graph.stamp = keydb_get_resources_stamp ();
+
+  hd = keydb_new ();
+  if (!hd)
+    return gpg_error_from_syserror ();
+
+  memset (&desc, 0, sizeof desc);
+  desc.mode = KEYDB_SEARCH_MODE_FIRST;
+  err = keydb_search (hd, &desc, 1, NULL);
+  desc.mode = KEYDB_SEARCH_MODE_NEXT;
+  for (; !err; err = keydb_search (hd, &desc, 1, NULL))
+    {
+      byte *buf;
+      size_t n, i;
+      int in_group = 0;
+
+      err = keydb_get_keyblock (hd, &keyblock);
+      if (err)
+        {
+          log_error ("keydb_get_keyblock failed: %s\n", gpg_strerror (err));
+          break;
+        }
+      if (keyblock->pkt->pkttype != PKT_PUBLIC_KEY)
+        {
+          release_kbnode (keyblock);
+          continue;
+        }
+
+      buf = keyblock_records (keyblock, &n);
+      release_kbnode (keyblock);
+      if (!buf)
+        {
+          err = gpg_error_from_syserror ();
+          break;
+        }
+      /* Only the edges are of interest here.  */
+      for (i = 0; i + CERTGRAPH_RECORD_SIZE < n; i += CERTGRAPH_RECORD_SIZE)
+        if (!parse_record (buf + i, 0, &in_group))
+          {
+            err = gpg_error_from_syserror ();
+            break;
+          }
+      xfree (buf);
+      if (err)
+        break;
+      count++;
+    }
+  keydb_release (hd);
+  if (err && err != GPG_ERR_NOT_FOUND)
+    {
+      log_error ("trustgraph: scanning the keyrings failed: %s\n",
+                 gpg_strerror (err));
+      release_graph ();
+      return err;
+    }
+
+  if (opt.verbose)
+    log_info ("trustgraph: %u keys with %u certifications\n",
+              count, graph.nedges? graph.nedges - 1 : 0);
+  graph.loaded = 1;
+  graph.need_rewrite = 1;
+  graph.size = start;
+  return 0;
+}
+
+
+/* Make the graph available for validate_keys.  With FULL_SCAN set or
+ * if there is no usable graph file, all keyrings are scanned; R_SCANNED
+ * tells whether this has been done.  */
+gpg_error_t
+certgraph_open (int full_scan, int *r_scanned)
+{
+  gpg_error_t err;
+
+  *r_scanned = 0;
+  if (!full_scan && load_graph ())
+    return 0;
+
+  err = rebuild_graph ();
+  if (!err)
+    *r_scanned = 1;
+  return err;
+}
+
+
+/* Return true if the changes since the last checkpoint can not
+ * affect any validity, i.e. if none of the changed keys is or was
+ * certified by a key which has been a fully valid signer.  This also
+ * requires that the checkpoint was made for the trustdb created at
+ * TDB_CREATED, the set of ultimately trusted keys did not change and
+ * nothing expired since then.  */
+int
+certgraph_unaffected (u32 tdb_created, u32 curtime)
+{
+  struct key_item *k;
+  unsigned int i, j, n;
+
+  if (!graph.loaded || !graph.have_checkpoint
+      || graph.tdb_created != tdb_created
+      || graph.next_expire <= curtime)
+    return 0;
+
+  for (n = 0, k = tdb_utks (); k; k = k->next, n++)
+    if (!kidset_has (&graph.utks, k->kid))
+      return 0;
+  if (n != graph.utks.count)
+    return 0;
+
+  /* We don't know why a check was requested.  */
+  if (!graph.ndirty)
+    return 0;
+
+  for (i = 0; i < graph.ndirty; i++)
+    {
+      u32 *kid = graph.dirty[i].kid;
+
+      if ((!kid[0] && !kid[1]) || kidset_has (&graph.signers, kid))
+        return 0;
+      for (j = graph.rev_buckets[kid_hash (kid) & (graph.nbuckets - 1)];
+           j; j = graph.edges[j].rev_next)
+        {
+          struct cg_edge *e = graph.edges + j;
+
+          if (e->signee[0] == kid[0] && e->signee[1] == kid[1]
+              && kidset_has (&graph.signers, e->signer))
+            return 0;
+        }
+    }
+
+  if (DBG_TRUST)
+    log_debug ("trustgraph: %u changed keys do not affect the validity\n",
+               graph.ndirty);
+  return 1;
+}
+
+
+/* Return the next expiration time of the last checkpoint.  */
+u32
+certgraph_next_expire (void)
+{
+  return graph.next_expire;
+}
+
+
+/* Call FNC for the key ID of each key certified by SIGNER.  */
+void
+certgraph_enum_signees (u32 *signer, void (*fnc)(void *opaque, u32 *kid),
+                        void *opaque)
+{
+  unsigned int i;
+
+  if (!graph.nbuckets)
+    return;
+  for (i = graph.fwd_buckets[kid_hash (signer) & (graph.nbuckets - 1)];
+       i; i = graph.edges[i].fwd_next)
+    {
+      struct cg_edge *e = graph.edges + i;
+
+      if (e->signer[0] == signer[0] && e->signer[1] == signer[1])
+        fnc (opaque, e->signee);
+    }
+}
+
+
+/* Record the key KID as usable signer of the current validation run.
+ * UTK is set for an ultimately trusted key.  */
+void
+certgraph_add_signer (u32 *kid, int utk)
+{
+  if (!graph.staged)
+    {
+      kidset_release (&graph.new_signers);
+      kidset_release (&graph.new_utks);
+      graph.staged = 1;
+    }
+  kidset_add (utk? &graph.new_utks : &graph.new_signers, kid);
+}
+
+
+/* Store the result of a validation run.  Without a prior call to
+ * certgraph_add_signer the signers of the last checkpoint are kept;
+ * this is used if the validity did not need to be recomputed.  */
+void
+certgraph_checkpoint (u32 tdb_created, u32 next_expire)
+{
+  byte *group;
+  size_t grouplen;
+  off_t compact;
+
+  if (!graph.loaded || opt.dry_run)
+    return;
+
+  compact = CERTGRAPH_HEADER_SIZE
+    + (off_t)(graph.nedges + graph.signers.count + graph.utks.count)
+    * CERTGRAPH_RECORD_SIZE;
+  if (graph.need_rewrite || graph.size > 2 * compact)
+    write_graph (graph.size, tdb_created, next_expire);
+  else
+    {
+      group = build_checkpoint (graph.size, tdb_created, next_expire,
+                                &grouplen);
+      if (group)
+        append_records (group, grouplen);
+      xfree (group);
+    }
+  release_graph ();
+}
+
+
+/* Release the in-core graph.  */
+void
+certgraph_close (void)
+{
+  release_graph ();
+}
+
+
+/* Record the certifications of KEYBLOCK and mark its primary key as
+ * changed.  This is called by keydb when a keyblock is inserted,
+ * updated or deleted.  */
+void
+certgraph_notice_keyblock (kbnode_t keyblock)
+{
+  byte *buf;
+  size_t n;
+
+  stamp_checked = 0;
+  if (opt.dry_run || !keyblock
+      || keyblock->pkt->pkttype != PKT_PUBLIC_KEY)
+    return;
+  if (!check_stamp ())
+    return;
+  stamp_checked = 1;
+
+  buf = keyblock_records (keyblock, &n);
+  if (buf)
+    append_records (buf, n);
+  xfree (buf);
+}
+
+
+/* Mark the key KID as changed; with KID NULL all keys are marked.
+ * This is used for ownertrust changes.  */
+void
+certgraph_notice_key (u32 *kid)
+{
+  byte rec[CERTGRAPH_RECORD_SIZE];
+  u32 all[2] = { 0, 0 };
+
+  if (opt.dry_run)
+    return;
+
+  build_record (rec, REC_DIRTY, NULL, kid? kid : all);
+  append_records (rec, sizeof rec);
+}
+
+
+/* Update the keyring stamp in the header of the graph file after keydb
+ * wrote a keyblock.  This is only done if the file matched the
+ * keyrings before the change; otherwise the next validation will see
+ * a mismatch and scan the keyrings.  */
+void
+certgraph_notice_written (void)
+{
+  byte header[CERTGRAPH_HEADER_SIZE];
+  int fd;
+
+  if (opt.dry_run || !stamp_checked)
+    return;
+  stamp_checked = 0;
+
+  fd = open (graph_fname (), O_RDWR | MY_O_BINARY);
+  if (fd == -1)
+    return;
+
+  build_header (header, keydb_get_resources_stamp ());
+  if (lseek (fd, CERTGRAPH_STAMP_OFF, SEEK_SET) != CERTGRAPH_STAMP_OFF
+      || write_all (fd, header + CERTGRAPH_STAMP_OFF,
+                    CERTGRAPH_HEADER_SIZE - CERTGRAPH_STAMP_OFF))
+    {
+      log_info ("trustgraph: error updating '%s' - removing it\n",
+                graph.fname);
+      close (fd);
+      gnupg_remove (graph.fname);
+      return;
+    }
+  close (fd);
+}
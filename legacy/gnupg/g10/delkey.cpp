@@ -228,6 +228,9 @@ do_delete_key (ctrl_t ctrl, const char *username, int secret, int force,
                          gpg_strerror (err));
               goto leave;
             }
+          sigcache_invalidate_keyblock (keyblock);
+          getkey_invalidate_keyblock (keyblock);
+          certgraph_notice_keyblock (keyblock);
 	}
 
       /* Note that the ownertrust being cleared will trigger a
@@ -482,6 +482,78 @@ pk_ecdh_generate_ephemeral_key (gcry_mpi_t *pkey, gcry_mpi_t *r_k)
 
 
 
+/* Generate the ephemeral keys for the N public ECDH keys PKEYS[0] to
+   PKEYS[N-1] and store them at R_K[0] to R_K[N-1].  The random bits
+   for all keys are requested at once, which is much cheaper than
+   calling the RNG for each key when encrypting to many recipients.
+   On failure all of R_K are set to NULL and an error code is
+   returned.  */
+gpg_error_t
+pk_ecdh_generate_ephemeral_keys (gcry_mpi_t **pkeys, size_t n,
+                                 gcry_mpi_t *r_k)
+{
+  gpg_error_t err = 0;
+  unsigned int *nbits;
+  unsigned char *buffer;
+  size_t i, off, total;
+
+  for (i = 0; i < n; i++)
+    r_k[i] = NULL;
+  if (!n)
+    return 0;
+
+  nbits = (unsigned int *) xtrycalloc (n, sizeof *nbits);
+  if (!nbits)
+    return gpg_error_from_syserror ();
+  for (total = i = 0; i < n; i++)
+    {
+      nbits[i] = pubkey_nbits (PUBKEY_ALGO_ECDH, pkeys[i]);
+      if (!nbits[i])
+        {
+          xfree (nbits);
+          return GPG_ERR_TOO_SHORT;
+        }
+      total += (nbits[i] - 1 + 7) / 8;
+    }
+
+  /* Use secure memory so that the scanned MPIs are secure too.  */
+  buffer = (unsigned char *) gcry_malloc_secure (total);
+  if (!buffer)
+    {
+      err = gpg_error_from_syserror ();
+      xfree (nbits);
+      return err;
+    }
+  gcry_randomize (buffer, total, GCRY_STRONG_RANDOM);
+
+  for (off = i = 0; i < n && !err; i++)
+    {
+      size_t nbytes = (nbits[i] - 1 + 7) / 8;
+
+      if (DBG_CRYPTO)
+        log_debug ("choosing a random k of %u bits\n", nbits[i]);
+      err = gcry_mpi_scan (r_k + i, GCRYMPI_FMT_USG, buffer + off, nbytes,
+                           NULL);
+      if (!err)
+        gcry_mpi_clear_highbit (r_k[i], nbits[i] - 1);
+      off += nbytes;
+    }
+  wipememory (buffer, total);
+  gcry_free (buffer);
+  xfree (nbits);
+
+  if (err)
+    {
+      for (i = 0; i < n; i++)
+        {
+          gcry_mpi_release (r_k[i]);
+          r_k[i] = NULL;
+        }
+    }
+  return err;
+}
+
+
 /* Perform ECDH decryption.   */
 int
 pk_ecdh_decrypt (gcry_mpi_t * result, const byte sk_fp[MAX_FINGERPRINT_LEN],
@@ -24,6 +24,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#ifdef HAVE_PTHREAD
+# include <pthread.h>
+#endif
 
 #include "gpg.h"
 #include "options.h"
@@ -791,23 +794,49 @@ encrypt_filter (void *opaque, int control,
 }
 
 
-/*
- * Write a pubkey-enc packet for the public key PK to OUT.
- */
-int
-write_pubkey_enc (ctrl_t ctrl,
-                  PKT_public_key *pk, int throw_keyid, DEK *dek, iobuf_t out)
+/* A PKESK to be built by write_pubkey_enc_from_list.  The public key
+ * operations of all recipients are independent and run on several
+ * threads; everything else is done by the main thread.  */
+struct pubkey_enc_job
 {
-  PACKET pkt;
+  PKT_public_key *pk;
   PKT_pubkey_enc *enc;
+  gcry_mpi_t frame;       /* The encoded session key.  */
+  gcry_mpi_t k;           /* The ECDH ephemeral secret or NULL.  */
+  byte fp[MAX_FINGERPRINT_LEN];  /* The fingerprint for ECDH.  */
+  size_t fpn;
   int rc;
-  gcry_mpi_t frame;
+};
+
+/* The jobs of one message.  */
+struct pubkey_enc_pool
+{
+  struct pubkey_enc_job *jobs;
+  unsigned int njobs;
+  unsigned int next;      /* The next job to run.  */
+#ifdef HAVE_PTHREAD
+  pthread_mutex_t lock;   /* Protects NEXT.  */
+#endif
+};
+
+/* Maximum number of threads used for the public key operations.  */
+#define PUBKEY_ENC_MAX_THREADS 16
+
+
+/* Set up JOB for encrypting the session key DEK to PK.  */
+static void
+pubkey_enc_prepare (struct pubkey_enc_job *job, PKT_public_key *pk,
+                    int throw_keyid, DEK *dek)
+{
+  PKT_pubkey_enc *enc;
 
   print_pubkey_algo_note ( (pubkey_algo_t) (pk->pubkey_algo ));
   enc = (PKT_pubkey_enc*) xmalloc_clear ( sizeof *enc );
   enc->pubkey_algo = pk->pubkey_algo;
   keyid_from_pk( pk, enc->keyid );
   enc->throw_keyid = throw_keyid;
+  job->pk = pk;
+  job->enc = enc;
 
   /* Okay, what's going on: We have the session key somewhere in
    * the structure DEK and want to encode this session key in an
@@ -821,10 +850,51 @@ write_pubkey_enc (ctrl_t ctrl,
    * for Elgamal).  We don't need frame anymore because we have
    * everything now in enc->data which is the passed to
    * build_packet().  */
-  frame = encode_session_key (pk->pubkey_algo, dek,
-                              pubkey_nbits (pk->pubkey_algo, pk->pkey));
-  rc = pk_encrypt ((pubkey_algo_t) (pk->pubkey_algo), enc->data, frame, pk, pk->pkey);
-  gcry_mpi_release (frame);
+  job->frame = encode_session_key (pk->pubkey_algo, dek,
+                                   pubkey_nbits (pk->pubkey_algo, pk->pkey));
+
+  /* ECDH needs the fingerprint; computing it touches PK and is thus
+   * done here and not by the worker threads.  */
+  if (pk->pubkey_algo == PUBKEY_ALGO_ECDH)
+    fingerprint_from_pk (pk, job->fp, &job->fpn);
+}
+
+
+/* Do the public key operation of JOB.  This may run on any thread.  */
+static void
+pubkey_enc_run (struct pubkey_enc_job *job)
+{
+  if (job->rc)
+    return;  /* Failed to create the ephemeral key.  */
+  job->rc = pk_encrypt_with_k ((pubkey_algo_t) (job->pk->pubkey_algo),
+                               job->enc->data, job->frame,
+                               job->fp, job->fpn, job->pk->pkey, job->k);
+}
+
+
+/* Release the resources of JOB.  */
+static void
+pubkey_enc_release (struct pubkey_enc_job *job)
+{
+  free_pubkey_enc (job->enc);
+  job->enc = NULL;
+  gcry_mpi_release (job->frame);
+  job->frame = NULL;
+  gcry_mpi_release (job->k);
+  job->k = NULL;
+}
+
+
+/* Write the PKESK of JOB to OUT and release the resources of JOB.
+ * Returns the error of the job or of writing the packet.  */
+static int
+pubkey_enc_write (ctrl_t ctrl, struct pubkey_enc_job *job, DEK *dek,
+                  iobuf_t out)
+{
+  PACKET pkt;
+  PKT_pubkey_enc *enc = job->enc;
+  int rc = job->rc;
+
   if (rc)
     log_error ("pubkey_encrypt failed: %s\n", gpg_strerror (rc) );
   else
@@ -847,17 +917,99 @@ write_pubkey_enc (ctrl_t ctrl,
         log_error ("build_packet(pubkey_enc) failed: %s\n",
                    gpg_strerror (rc));
     }
-  free_pubkey_enc(enc);
+  pubkey_enc_release (job);
   return rc;
 }
 
 
 /*
- * Write pubkey-enc packets from the list of PKs to OUT.
+ * Write a pubkey-enc packet for the public key PK to OUT.
+ */
+int
+write_pubkey_enc (ctrl_t ctrl,
+                  PKT_public_key *pk, int throw_keyid, DEK *dek, iobuf_t out)
+{
+  struct pubkey_enc_job job;
+
+  memset (&job, 0, sizeof job);
+  pubkey_enc_prepare (&job, pk, throw_keyid, dek);
+  if (pk->pubkey_algo == PUBKEY_ALGO_ECDH)
+    job.rc = pk_ecdh_generate_ephemeral_key (pk->pkey, &job.k);
+  pubkey_enc_run (&job);
+  return pubkey_enc_write (ctrl, &job, dek, out);
+}
+
+
+/* Run the jobs of POOL until none is left.  */
+static void *
+pubkey_enc_worker (void *arg)
+{
+  struct pubkey_enc_pool *pool = (struct pubkey_enc_pool *) arg;
+  unsigned int idx;
+
+  for (;;)
+    {
+#ifdef HAVE_PTHREAD
+      pthread_mutex_lock (&pool->lock);
+#endif
+      idx = pool->next < pool->njobs? pool->next++ : pool->njobs;
+#ifdef HAVE_PTHREAD
+      pthread_mutex_unlock (&pool->lock);
+#endif
+      if (idx == pool->njobs)
+        break;
+      pubkey_enc_run (pool->jobs + idx);
+    }
+  return NULL;
+}
+
+
+/* Run the public key operations of all jobs of POOL on several
+ * threads and return when they are done.  */
+static void
+pubkey_enc_run_pool (struct pubkey_enc_pool *pool)
+{
+#ifdef HAVE_PTHREAD
+  pthread_t *threads = NULL;
+  unsigned int i, n;
+
+  n = get_worker_threads (PUBKEY_ENC_MAX_THREADS);
+  if (n > pool->njobs)
+    n = pool->njobs;
+  pthread_mutex_init (&pool->lock, NULL);
+  /* The calling thread is one of the workers.  */
+  if (n > 1)
+    threads = (pthread_t*) xcalloc (n - 1, sizeof *threads);
+  for (i = 0; i + 1 < n; i++)
+    if (pthread_create (threads + i, NULL, pubkey_enc_worker, pool))
+      break;
+  n = i;
+  pubkey_enc_worker (pool);
+  for (i = 0; i < n; i++)
+    pthread_join (threads[i], NULL);
+  xfree (threads);
+  pthread_mutex_destroy (&pool->lock);
+#else
+  pubkey_enc_worker (pool);
+#endif
+}
+
+
+/*
+ * Write pubkey-enc packets from the list of PKs to OUT.  The public
+ * key operations are done in parallel but the packets are written in
+ * the order of the list.
  */
 static int
 write_pubkey_enc_from_list (ctrl_t ctrl, PK_LIST pk_list, DEK *dek, iobuf_t out)
 {
+  struct pubkey_enc_pool pool;
+  PK_LIST pkl;
+  gcry_mpi_t **ecdh_pkeys;
+  gcry_mpi_t *ecdh_k;
+  unsigned int i, n, necdh;
+  int rc = 0;
+
   if (opt.throw_keyids && (PGP6 || PGP7 || PGP8))
     {
       log_info(_("you may not use %s while in %s mode\n"),
@@ -866,16 +1018,61 @@ write_pubkey_enc_from_list (ctrl_t ctrl, PK_LIST pk_list, DEK *dek, iobuf_t out)
       compliance_failure();
     }
 
-  for ( ; pk_list; pk_list = pk_list->next )
+  for (n = 0, pkl = pk_list; pkl; pkl = pkl->next)
+    n++;
+  if (n < 2)
     {
-      PKT_public_key *pk = pk_list->pk;
-      int throw_keyid = (opt.throw_keyids || (pk_list->flags&1));
-      int rc = write_pubkey_enc (ctrl, pk, throw_keyid, dek, out);
-      if (rc)
-        return rc;
+      for ( ; pk_list; pk_list = pk_list->next )
+        {
+          PKT_public_key *pk = pk_list->pk;
+          int throw_keyid = (opt.throw_keyids || (pk_list->flags&1));
+          rc = write_pubkey_enc (ctrl, pk, throw_keyid, dek, out);
+          if (rc)
+            return rc;
+        }
+      return 0;
     }
 
-  return 0;
+  memset (&pool, 0, sizeof pool);
+  pool.jobs = (struct pubkey_enc_job*) xcalloc (n, sizeof *pool.jobs);
+  pool.njobs = n;
+  for (i = 0, pkl = pk_list; pkl; pkl = pkl->next, i++)
+    pubkey_enc_prepare (pool.jobs + i, pkl->pk,
+                        (opt.throw_keyids || (pkl->flags&1)), dek);
+
+  /* Create the ephemeral keys of all ECDH recipients at once.  */
+  ecdh_pkeys = (gcry_mpi_t**) xcalloc (n, sizeof *ecdh_pkeys);
+  ecdh_k = (gcry_mpi_t*) xcalloc (n, sizeof *ecdh_k);
+  for (necdh = i = 0; i < n; i++)
+    if (pool.jobs[i].pk->pubkey_algo == PUBKEY_ALGO_ECDH)
+      ecdh_pkeys[necdh++] = pool.jobs[i].pk->pkey;
+  if (necdh)
+    {
+      gpg_error_t err;
+
+      err = pk_ecdh_generate_ephemeral_keys (ecdh_pkeys, necdh, ecdh_k);
+      for (necdh = i = 0; i < n; i++)
+        if (pool.jobs[i].pk->pubkey_algo == PUBKEY_ALGO_ECDH)
+          {
+            pool.jobs[i].k = ecdh_k[necdh++];
+            pool.jobs[i].rc = err;
+          }
+    }
+  xfree (ecdh_k);
+  xfree (ecdh_pkeys);
+
+  pubkey_enc_run_pool (&pool);
+
+  for (i = 0; i < n; i++)
+    {
+      if (!rc)
+        rc = pubkey_enc_write (ctrl, pool.jobs + i, dek, out);
+      else
+        pubkey_enc_release (pool.jobs + i);
+    }
+  xfree (pool.jobs);
+
+  return rc;
 }
 
 void
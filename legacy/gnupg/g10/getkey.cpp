@@ -89,6 +89,15 @@ struct getkey_ctx_s
      their address used in ITEMS.  */
   strlist_t extra_list;
 
+  /* If set, NAME_HITS are the keyblocks matching the single search
+     term as found by prefetch_pubkeys_byname.  They are returned
+     instead of searching the database.  NAME_POS is the next one to
+     return.  */
+  int use_name_cache;
+  struct name_cache_hit *name_hits;
+  unsigned int name_nhits;
+  unsigned int name_pos;
+
   /* Part of the search criteria: The low-level search specification
      as passed to keydb_search.  */
   int nitems;
@@ -99,36 +108,114 @@ struct getkey_ctx_s
 
 typedef struct keyid_list
 {
-  struct keyid_list *next;
+  struct keyid_list *next;      /* Next key of the same user ID record.  */
+  struct keyid_list *kid_next;  /* Next entry in the key ID bucket.  */
+  struct keyid_list *fpr_next;  /* Next entry in the fingerprint bucket.  */
+  struct user_id_db *owner;     /* The record this key belongs to.  */
   char fpr[MAX_FINGERPRINT_LEN];
   u32 keyid[2];
 } *keyid_list_t;
 
 
 #if MAX_PK_CACHE_ENTRIES
+/* The public key cache is a hash table indexed by the key ID.  All
+ * entries are also kept on a list in LRU order so that the least
+ * recently used entry can be evicted when the cache is full.  */
 typedef struct pk_cache_entry
 {
-  struct pk_cache_entry *next;
+  struct pk_cache_entry *next;      /* Next entry in the hash bucket.  */
+  struct pk_cache_entry *lru_prev;  /* More recently used entry.  */
+  struct pk_cache_entry *lru_next;  /* Less recently used entry.  */
   u32 keyid[2];
+  byte fpr[MAX_FINGERPRINT_LEN];
   PKT_public_key *pk;
 } *pk_cache_entry_t;
-static pk_cache_entry_t pk_cache;
-static int pk_cache_entries;	/* Number of entries in pk cache.  */
-static int pk_cache_disabled;
+
+static struct
+{
+  pk_cache_entry_t *buckets;
+  unsigned int nbuckets;        /* A power of 2.  */
+  pk_cache_entry_t lru_first;   /* The most recently used entry.  */
+  pk_cache_entry_t lru_last;    /* The least recently used entry.  */
+  unsigned int entries;         /* Number of entries in pk cache.  */
+  int disabled;
+} pk_cache;
 #endif
 
 #if MAX_UID_CACHE_ENTRIES < 5
 #error we really need the userid cache
 #endif
+/* The user ID cache maps the keys of a keyblock to its primary user
+ * ID.  The records are kept in LRU order and the keys of all records
+ * are indexed by key ID and by fingerprint.  */
 typedef struct user_id_db
 {
-  struct user_id_db *next;
+  struct user_id_db *lru_prev;  /* More recently used record.  */
+  struct user_id_db *lru_next;  /* Less recently used record.  */
   keyid_list_t keyids;
   int len;
   char name[1];
 } *user_id_db_t;
-static user_id_db_t user_id_db;
-static int uid_cache_entries;	/* Number of entries in uid cache. */
+
+static struct
+{
+  keyid_list_t *kid_buckets;
+  keyid_list_t *fpr_buckets;
+  unsigned int nbuckets;        /* A power of 2.  */
+  user_id_db_t lru_first;       /* The most recently used record.  */
+  user_id_db_t lru_last;        /* The least recently used record.  */
+  unsigned int entries;         /* Number of entries in uid cache.  */
+} uid_cache;
+
+/* The name cache holds the keyblocks matching the user IDs given to
+ * prefetch_pubkeys_byname, which finds all of them with one scan of
+ * the database.  A keyblock matching several names is kept only once;
+ * the keyblocks are reference counted because a lookup context may
+ * still use them after the cache has been cleared.  */
+typedef struct name_cache_block
+{
+  unsigned int refcount;
+  iobuf_t image;                /* The keyblock image.  */
+  u32 keyid[2];                 /* The key ID of the primary key.  */
+} *name_cache_block_t;
+
+struct name_cache_hit
+{
+  name_cache_block_t block;
+  int uid_no;                   /* The matching user ID.  */
+};
+
+typedef struct name_cache_entry
+{
+  struct name_cache_entry *next;  /* Next entry in the hash bucket.  */
+  struct name_cache_hit *hits;    /* The keyblocks in database order.  */
+  unsigned int nhits;
+  char name[1];
+} *name_cache_entry_t;
+
+static struct
+{
+  name_cache_entry_t *buckets;
+  unsigned int nbuckets;        /* A power of 2.  */
+  unsigned int entries;         /* Number of names in the cache.  */
+  unsigned int blocks;          /* Number of keyblocks in the cache.  */
+} name_cache;
+
+/* Statistics for the above caches.  */
+static struct
+{
+  unsigned int pk_hits;
+  unsigned int pk_misses;
+  unsigned int pk_evictions;
+  unsigned int pk_invalidations;
+  unsigned int uid_hits;
+  unsigned int uid_misses;
+  unsigned int uid_evictions;
+  unsigned int uid_invalidations;
+  unsigned int name_prefetches;
+  unsigned int name_hits;
+  unsigned int name_invalidations;
+} cache_stats;
 
 static void merge_selfsigs (ctrl_t ctrl, kbnode_t keyblock);
 static int lookup (ctrl_t ctrl, getkey_ctx_t ctx, int want_secret,
@@ -139,11 +226,111 @@ static kbnode_t finish_lookup (kbnode_t keyblock,
 static void print_status_key_considered (kbnode_t keyblock, unsigned int flags);
 
 
+/* Return the maximum number of entries of the public key and the
+ * user ID cache.  This is MAX_PK_CACHE_ENTRIES unless changed with
+ * --key-cache-size.  */
+static unsigned int
+cache_capacity (void)
+{
+  if (opt.key_cache_size <= 0)
+    return MAX_PK_CACHE_ENTRIES;
+  return opt.key_cache_size < 16? 16 : opt.key_cache_size;
+}
+
+
+/* Return the number of hash buckets to use for a cache with N
+ * entries.  */
+static unsigned int
+cache_nbuckets (unsigned int n)
+{
+  unsigned int nbuckets = 64;
+
+  while (nbuckets < n && nbuckets < (1u << 24))
+    nbuckets <<= 1;
+  return nbuckets;
+}
+
+
+#if MAX_PK_CACHE_ENTRIES
+static pk_cache_entry_t *
+pk_cache_bucket (const u32 *keyid)
+{
+  return &pk_cache.buckets[keyid[1] & (pk_cache.nbuckets - 1)];
+}
+
+
+/* Move the cache entry CE to the front of the LRU list.  */
+static void
+pk_cache_touch (pk_cache_entry_t ce)
+{
+  if (ce == pk_cache.lru_first)
+    return;
+
+  ce->lru_prev->lru_next = ce->lru_next;
+  if (ce->lru_next)
+    ce->lru_next->lru_prev = ce->lru_prev;
+  else
+    pk_cache.lru_last = ce->lru_prev;
+
+  ce->lru_prev = NULL;
+  ce->lru_next = pk_cache.lru_first;
+  pk_cache.lru_first->lru_prev = ce;
+  pk_cache.lru_first = ce;
+}
+
+
+/* Return the cache entry for KEYID or NULL.  A found entry is marked
+ * as recently used.  */
+static pk_cache_entry_t
+pk_cache_find (const u32 *keyid)
+{
+  pk_cache_entry_t ce;
+
+  if (!pk_cache.nbuckets)
+    return NULL;
+
+  for (ce = *pk_cache_bucket (keyid); ce; ce = ce->next)
+    if (ce->keyid[0] == keyid[0] && ce->keyid[1] == keyid[1])
+      {
+        pk_cache_touch (ce);
+        return ce;
+      }
+  return NULL;
+}
+
+
+/* Remove the entry CE from the cache and release it.  */
+static void
+pk_cache_remove (pk_cache_entry_t ce)
+{
+  pk_cache_entry_t *ptr;
+
+  for (ptr = pk_cache_bucket (ce->keyid); *ptr != ce; ptr = &(*ptr)->next)
+    ;
+  *ptr = ce->next;
+
+  if (ce->lru_prev)
+    ce->lru_prev->lru_next = ce->lru_next;
+  else
+    pk_cache.lru_first = ce->lru_next;
+  if (ce->lru_next)
+    ce->lru_next->lru_prev = ce->lru_prev;
+  else
+    pk_cache.lru_last = ce->lru_prev;
+
+  free_public_key (ce->pk);
+  xfree (ce);
+  pk_cache.entries--;
+}
+#endif /*MAX_PK_CACHE_ENTRIES*/
+
+
 /* Cache a copy of a public key in the public key cache.  PK is not
  * cached if caching is disabled (via getkey_disable_caches), if
  * PK->FLAGS.DONT_CACHE is set, we don't know how to derive a key id
  * from the public key (e.g., unsupported algorithm), or a key with
- * the key id is already in the cache.
+ * the key id is already in the cache.  If the cache is full the least
+ * recently used entry is evicted.
  *
  * The public key packet is copied into the cache using
  * copy_public_key.  Thus, any secret parts are not copied, for
@@ -155,10 +342,10 @@ void
 cache_public_key (PKT_public_key * pk)
 {
 #if MAX_PK_CACHE_ENTRIES
-  pk_cache_entry_t ce, ce2;
+  pk_cache_entry_t ce, *bucket;
   u32 keyid[2];
 
-  if (pk_cache_disabled)
+  if (pk_cache.disabled)
     return;
 
   if (pk->flags.dont_cache)
@@ -176,43 +363,46 @@ cache_public_key (PKT_public_key * pk)
   else
     return; /* Don't know how to get the keyid.  */
 
-  for (ce = pk_cache; ce; ce = ce->next)
-    if (ce->keyid[0] == keyid[0] && ce->keyid[1] == keyid[1])
-      {
-	if (DBG_CACHE)
-	  log_debug ("cache_public_key: already in cache\n");
-	return;
-      }
+  if (pk_cache_find (keyid))
+    {
+      if (DBG_CACHE)
+        log_debug ("cache_public_key: already in cache\n");
+      return;
+    }
 
-  if (pk_cache_entries >= MAX_PK_CACHE_ENTRIES)
+  if (!pk_cache.nbuckets)
     {
-      int n;
+      unsigned int n = cache_nbuckets (cache_capacity ());
 
-      /* Remove the last 50% of the entries.  */
-      for (ce = pk_cache, n = 0; ce && n < pk_cache_entries/2; n++)
-        ce = ce->next;
-      if (ce && ce != pk_cache && ce->next)
-        {
-          ce2 = ce->next;
-          ce->next = NULL;
-          ce = ce2;
-          for (; ce; ce = ce2)
-            {
-              ce2 = ce->next;
-              free_public_key (ce->pk);
-              xfree (ce);
-              pk_cache_entries--;
-            }
-        }
-      log_assert (pk_cache_entries < MAX_PK_CACHE_ENTRIES);
+      pk_cache.buckets = (pk_cache_entry_t*) xtrycalloc (n, sizeof *bucket);
+      if (!pk_cache.buckets)
+        return;
+      pk_cache.nbuckets = n;
     }
-  pk_cache_entries++;
-  ce = (pk_cache_entry_t) xmalloc (sizeof *ce);
-  ce->next = pk_cache;
-  pk_cache = ce;
+
+  while (pk_cache.entries >= cache_capacity () && pk_cache.lru_last)
+    {
+      pk_cache_remove (pk_cache.lru_last);
+      cache_stats.pk_evictions++;
+    }
+
+  ce = (pk_cache_entry_t) xmalloc_clear (sizeof *ce);
   ce->pk = copy_public_key (NULL, pk);
   ce->keyid[0] = keyid[0];
   ce->keyid[1] = keyid[1];
+  fingerprint_from_pk (ce->pk, ce->fpr, NULL);
+
+  bucket = pk_cache_bucket (keyid);
+  ce->next = *bucket;
+  *bucket = ce;
+
+  ce->lru_next = pk_cache.lru_first;
+  if (pk_cache.lru_first)
+    pk_cache.lru_first->lru_prev = ce;
+  else
+    pk_cache.lru_last = ce;
+  pk_cache.lru_first = ce;
+  pk_cache.entries++;
 #endif
 }
 
@@ -269,6 +459,109 @@ release_keyid_list (keyid_list_t k)
     }
 }
 
+
+static keyid_list_t *
+uid_cache_kid_bucket (const u32 *keyid)
+{
+  return &uid_cache.kid_buckets[keyid[1] & (uid_cache.nbuckets - 1)];
+}
+
+
+static keyid_list_t *
+uid_cache_fpr_bucket (const char *fpr)
+{
+  return &uid_cache.fpr_buckets[buf32_to_uint (fpr)
+                                & (uid_cache.nbuckets - 1)];
+}
+
+
+/* Move the record R to the front of the LRU list.  */
+static void
+uid_cache_touch (user_id_db_t r)
+{
+  if (r == uid_cache.lru_first)
+    return;
+
+  r->lru_prev->lru_next = r->lru_next;
+  if (r->lru_next)
+    r->lru_next->lru_prev = r->lru_prev;
+  else
+    uid_cache.lru_last = r->lru_prev;
+
+  r->lru_prev = NULL;
+  r->lru_next = uid_cache.lru_first;
+  uid_cache.lru_first->lru_prev = r;
+  uid_cache.lru_first = r;
+}
+
+
+/* Return the cached key with KEYID or NULL.  */
+static keyid_list_t
+uid_cache_find_kid (const u32 *keyid)
+{
+  keyid_list_t a;
+
+  if (!uid_cache.nbuckets)
+    return NULL;
+
+  for (a = *uid_cache_kid_bucket (keyid); a; a = a->kid_next)
+    if (a->keyid[0] == keyid[0] && a->keyid[1] == keyid[1])
+      return a;
+  return NULL;
+}
+
+
+/* Return the cached key with the fingerprint FPR, which must be
+ * MAX_FINGERPRINT_LEN bytes in size, or NULL.  */
+static keyid_list_t
+uid_cache_find_fpr (const char *fpr)
+{
+  keyid_list_t a;
+
+  if (!uid_cache.nbuckets)
+    return NULL;
+
+  for (a = *uid_cache_fpr_bucket (fpr); a; a = a->fpr_next)
+    if (!memcmp (a->fpr, fpr, MAX_FINGERPRINT_LEN))
+      return a;
+  return NULL;
+}
+
+
+/* Remove the record R with all its keys from the cache and release
+ * it.  */
+static void
+uid_cache_remove (user_id_db_t r)
+{
+  keyid_list_t a, *ptr;
+
+  for (a = r->keyids; a; a = a->next)
+    {
+      for (ptr = uid_cache_kid_bucket (a->keyid); *ptr != a;
+           ptr = &(*ptr)->kid_next)
+        ;
+      *ptr = a->kid_next;
+      for (ptr = uid_cache_fpr_bucket (a->fpr); *ptr != a;
+           ptr = &(*ptr)->fpr_next)
+        ;
+      *ptr = a->fpr_next;
+    }
+
+  if (r->lru_prev)
+    r->lru_prev->lru_next = r->lru_next;
+  else
+    uid_cache.lru_first = r->lru_next;
+  if (r->lru_next)
+    r->lru_next->lru_prev = r->lru_prev;
+  else
+    uid_cache.lru_last = r->lru_prev;
+
+  release_keyid_list (r->keyids);
+  xfree (r);
+  uid_cache.entries--;
+}
+
+
 /****************
  * Store the association of keyid and userid
  * Feed only public keys to this function.
@@ -280,35 +573,39 @@ cache_user_id (KBNODE keyblock)
   const char *uid;
   size_t uidlen;
   keyid_list_t keyids = NULL;
+  keyid_list_t a;
   KBNODE k;
 
+  if (!uid_cache.nbuckets)
+    {
+      /* A record usually holds a primary key and one or two
+       * subkeys.  */
+      unsigned int n = cache_nbuckets (2 * cache_capacity ());
+
+      uid_cache.kid_buckets = (keyid_list_t*) xcalloc (n, sizeof *keyids);
+      uid_cache.fpr_buckets = (keyid_list_t*) xcalloc (n, sizeof *keyids);
+      uid_cache.nbuckets = n;
+    }
+
   for (k = keyblock; k; k = k->next)
     {
       if (k->pkt->pkttype == PKT_PUBLIC_KEY
 	  || k->pkt->pkttype == PKT_PUBLIC_SUBKEY)
 	{
-	  keyid_list_t a = (keyid_list_t) xmalloc_clear (sizeof *a);
+	  a = (keyid_list_t) xmalloc_clear (sizeof *a);
 	  /* Hmmm: For a long list of keyids it might be an advantage
 	   * to append the keys.  */
           fingerprint_from_pk (k->pkt->pkt.public_key, (byte*) (a->fpr), NULL);
 	  keyid_from_pk (k->pkt->pkt.public_key, a->keyid);
 	  /* First check for duplicates.  */
-	  for (r = user_id_db; r; r = r->next)
-	    {
-	      keyid_list_t b;
-
-	      for (b = r->keyids; b; b = b->next)
-		{
-		  if (!memcmp (b->fpr, a->fpr, MAX_FINGERPRINT_LEN))
-		    {
-		      if (DBG_CACHE)
-			log_debug ("cache_user_id: already in cache\n");
-		      release_keyid_list (keyids);
-		      xfree (a);
-		      return;
-		    }
-		}
-	    }
+          if (uid_cache_find_fpr (a->fpr))
+            {
+              if (DBG_CACHE)
+                log_debug ("cache_user_id: already in cache\n");
+              release_keyid_list (keyids);
+              xfree (a);
+              return;
+            }
 	  /* Now put it into the cache.  */
 	  a->next = keyids;
 	  keyids = a;
@@ -320,22 +617,35 @@ cache_user_id (KBNODE keyblock)
 
   uid = get_primary_uid (keyblock, &uidlen);
 
-  if (uid_cache_entries >= MAX_UID_CACHE_ENTRIES)
+  while (uid_cache.entries >= cache_capacity () && uid_cache.lru_last)
     {
-      /* fixme: use another algorithm to free some cache slots */
-      r = user_id_db;
-      user_id_db = r->next;
-      release_keyid_list (r->keyids);
-      xfree (r);
-      uid_cache_entries--;
+      uid_cache_remove (uid_cache.lru_last);
+      cache_stats.uid_evictions++;
     }
   r = (user_id_db_t) xmalloc (sizeof *r + uidlen - 1);
   r->keyids = keyids;
   r->len = uidlen;
   memcpy (r->name, uid, r->len);
-  r->next = user_id_db;
-  user_id_db = r;
-  uid_cache_entries++;
+  for (a = keyids; a; a = a->next)
+    {
+      keyid_list_t *bucket;
+
+      a->owner = r;
+      bucket = uid_cache_kid_bucket (a->keyid);
+      a->kid_next = *bucket;
+      *bucket = a;
+      bucket = uid_cache_fpr_bucket (a->fpr);
+      a->fpr_next = *bucket;
+      *bucket = a;
+    }
+  r->lru_prev = NULL;
+  r->lru_next = uid_cache.lru_first;
+  if (uid_cache.lru_first)
+    uid_cache.lru_first->lru_prev = r;
+  else
+    uid_cache.lru_last = r;
+  uid_cache.lru_first = r;
+  uid_cache.entries++;
 }
 
 
@@ -346,21 +656,400 @@ void
 getkey_disable_caches ()
 {
 #if MAX_PK_CACHE_ENTRIES
-  {
-    pk_cache_entry_t ce, ce2;
+  while (pk_cache.lru_first)
+    pk_cache_remove (pk_cache.lru_first);
+  pk_cache.disabled = 1;
+#endif
+  /* fixme: disable user id cache ? */
+}
+
+
+/* Remove all cached data for the key with KEYID and the fingerprint
+ * FPR, which must be MAX_FINGERPRINT_LEN bytes in size.  The user ID
+ * cache drops the entire record because the keys of a record share
+ * the primary user ID.  */
+static void
+invalidate_cached_key (const u32 *keyid, const byte *fpr)
+{
+  keyid_list_t a;
+
+#if MAX_PK_CACHE_ENTRIES
+  if (pk_cache.nbuckets)
+    {
+      pk_cache_entry_t ce;
+
+      for (ce = *pk_cache_bucket (keyid); ce; ce = ce->next)
+        if (!memcmp (ce->fpr, fpr, MAX_FINGERPRINT_LEN))
+          {
+            pk_cache_remove (ce);
+            cache_stats.pk_invalidations++;
+            break;
+          }
+    }
+#endif
+
+  a = uid_cache_find_fpr ((const char*)fpr);
+  if (a)
+    {
+      uid_cache_remove (a->owner);
+      cache_stats.uid_invalidations++;
+    }
+}
+
+
+static void
+name_cache_block_unref (name_cache_block_t block)
+{
+  if (block && !--block->refcount)
+    {
+      iobuf_close (block->image);
+      xfree (block);
+    }
+}
+
+
+static void
+name_cache_release_hits (struct name_cache_hit *hits, unsigned int nhits)
+{
+  unsigned int i;
+
+  for (i = 0; i < nhits; i++)
+    name_cache_block_unref (hits[i].block);
+  xfree (hits);
+}
+
+
+/* Drop all entries of the name cache.  */
+static void
+name_cache_clear (void)
+{
+  name_cache_entry_t e, enext;
+  unsigned int i;
 
-    for (ce = pk_cache; ce; ce = ce2)
+  for (i = 0; i < name_cache.nbuckets; i++)
+    for (e = name_cache.buckets[i]; e; e = enext)
       {
-	ce2 = ce->next;
-	free_public_key (ce->pk);
-	xfree (ce);
+        enext = e->next;
+        name_cache_release_hits (e->hits, e->nhits);
+        xfree (e);
       }
-    pk_cache_disabled = 1;
-    pk_cache_entries = 0;
-    pk_cache = NULL;
-  }
+  xfree (name_cache.buckets);
+  name_cache.buckets = NULL;
+  name_cache.nbuckets = 0;
+  name_cache.entries = 0;
+  name_cache.blocks = 0;
+}
+
+
+static name_cache_entry_t *
+name_cache_bucket (const char *name)
+{
+  const unsigned char *s;
+  unsigned int h = 0;
+
+  for (s = (const unsigned char *)name; *s; s++)
+    h = h * 33 + *s;
+  return name_cache.buckets + (h & (name_cache.nbuckets - 1));
+}
+
+
+static name_cache_entry_t
+name_cache_find (const char *name)
+{
+  name_cache_entry_t e;
+
+  if (!name_cache.nbuckets)
+    return NULL;
+  for (e = *name_cache_bucket (name); e; e = e->next)
+    if (!strcmp (e->name, name))
+      return e;
+  return NULL;
+}
+
+
+/* Make a copy of the keyblocks found for NAME for use by a lookup
+ * context.  Returns false if NAME has not been prefetched.  */
+static int
+name_cache_get (const char *name,
+                struct name_cache_hit **r_hits, unsigned int *r_nhits)
+{
+  name_cache_entry_t e;
+  unsigned int i;
+
+  *r_hits = NULL;
+  *r_nhits = 0;
+
+  e = name_cache_find (name);
+  if (!e)
+    return 0;
+
+  cache_stats.name_hits++;
+  if (e->nhits)
+    {
+      *r_hits = (struct name_cache_hit *) xmalloc (e->nhits * sizeof *e->hits);
+      for (i = 0; i < e->nhits; i++)
+        {
+          (*r_hits)[i] = e->hits[i];
+          e->hits[i].block->refcount++;
+        }
+      *r_nhits = e->nhits;
+    }
+  return 1;
+}
+
+
+/* Return the next keyblock of a lookup context using the name cache.
+ * Keyblocks rejected by the skip function of the search term are
+ * skipped as keybox_search would do.  Returns GPG_ERR_NOT_FOUND if no
+ * keyblock is left.  */
+static gpg_error_t
+name_cache_next (getkey_ctx_t ctx, kbnode_t *r_keyblock)
+{
+  gpg_error_t err;
+  struct name_cache_hit *hit;
+
+  *r_keyblock = NULL;
+
+  while (ctx->name_pos < ctx->name_nhits)
+    {
+      hit = ctx->name_hits + ctx->name_pos++;
+      if (ctx->items[0].skipfnc
+          && ctx->items[0].skipfnc (ctx->items[0].skipfncvalue,
+                                    hit->block->keyid, hit->uid_no))
+        continue;
+
+      err = keydb_parse_keyblock_image (hit->block->image, 0, hit->uid_no,
+                                        r_keyblock);
+      if (err)
+        {
+          log_error ("keydb_parse_keyblock_image failed: %s\n",
+                     gpg_strerror (err));
+          continue;
+        }
+      return 0;
+    }
+
+  return GPG_ERR_NOT_FOUND;
+}
+
+
+/* Find the keyblocks of all user IDs in NAMES with a single scan of
+ * the database and keep them in the name cache, so that the following
+ * lookups of these names, as done by build_pk_list for the recipients
+ * of a message, don't need to scan the database one by one.  Only
+ * names which are searched by user ID are prefetched.  The self
+ * signatures of the found keyblocks are verified on several threads
+ * so that merging them during the lookups is served from the
+ * signature cache.  Names which have been prefetched before are
+ * replaced.  Errors are not fatal because the lookups fall back to
+ * searching the database.  */
+gpg_error_t
+prefetch_pubkeys_byname (ctrl_t ctrl, strlist_t names)
+{
+  gpg_error_t err = 0;
+  KEYDB_HANDLE hd = NULL;
+  KEYDB_SEARCH_DESC *desc = NULL;
+  name_cache_entry_t *entries = NULL;
+  int *uid_nos = NULL;
+  kbnode_t *keyblocks = NULL;
+  size_t nkeyblocks = 0;
+  size_t ndesc, n;
+  strlist_t sl;
+  sig_batch_t batch;
+
+  (void)ctrl;
+
+  name_cache_clear ();
+
+  for (n = 0, sl = names; sl; sl = sl->next)
+    n++;
+  if (n < 2)
+    return 0;  /* Nothing to gain.  */
+
+  desc = (KEYDB_SEARCH_DESC *) xtrycalloc (n, sizeof *desc);
+  entries = (name_cache_entry_t *) xtrycalloc (n, sizeof *entries);
+  uid_nos = (int *) xtrycalloc (n, sizeof *uid_nos);
+  if (!desc || !entries || !uid_nos)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  name_cache.nbuckets = cache_nbuckets (n);
+  name_cache.buckets = (name_cache_entry_t *)
+    xcalloc (name_cache.nbuckets, sizeof *name_cache.buckets);
+
+  for (ndesc = 0, sl = names; sl; sl = sl->next)
+    {
+      name_cache_entry_t e;
+      name_cache_entry_t *bucket;
+
+      if (name_cache_find (sl->d))
+        continue;  /* Duplicate.  */
+      if (classify_user_id (sl->d, desc + ndesc, 1))
+        continue;
+      if (desc[ndesc].mode != KEYDB_SEARCH_MODE_EXACT
+          && desc[ndesc].mode != KEYDB_SEARCH_MODE_MAIL
+          && desc[ndesc].mode != KEYDB_SEARCH_MODE_MAILSUB
+          && desc[ndesc].mode != KEYDB_SEARCH_MODE_SUBSTR)
+        continue;  /* Key IDs and fingerprints are found quickly.  */
+
+      e = (name_cache_entry_t) xmalloc_clear (sizeof *e + strlen (sl->d));
+      strcpy (e->name, sl->d);
+      bucket = name_cache_bucket (e->name);
+      e->next = *bucket;
+      *bucket = e;
+      name_cache.entries++;
+      entries[ndesc++] = e;
+    }
+  if (ndesc < 2)
+    {
+      name_cache_clear ();
+      goto leave;
+    }
+
+  hd = keydb_new ();
+  if (!hd)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  keydb_disable_caching (hd);
+
+  while (!(err = keydb_search (hd, desc, ndesc, NULL)))
+    {
+      name_cache_block_t block;
+      iobuf_t image;
+      kbnode_t keyblock;
+      int pk_no, uid_no;
+
+      err = keydb_match_found (hd, desc, ndesc, uid_nos);
+      if (err)
+        break;
+      err = keydb_get_keyblock_image (hd, &image, &pk_no, &uid_no);
+      if (err)
+        break;
+      err = keydb_parse_keyblock_image (image, 0, 0, &keyblock);
+      if (err)
+        {
+          iobuf_close (image);
+          break;
+        }
+
+      block = (name_cache_block_t) xmalloc_clear (sizeof *block);
+      block->image = image;
+      keyid_from_pk (keyblock->pkt->pkt.public_key, block->keyid);
+      name_cache.blocks++;
+
+      for (n = 0; n < ndesc; n++)
+        if (uid_nos[n])
+          {
+            name_cache_entry_t e = entries[n];
+
+            e->hits = (struct name_cache_hit *)
+              xrealloc (e->hits, (e->nhits + 1) * sizeof *e->hits);
+            e->hits[e->nhits].block = block;
+            e->hits[e->nhits].uid_no = uid_nos[n];
+            e->nhits++;
+            block->refcount++;
+          }
+      if (!block->refcount)
+        {
+          /* Can't happen because the search found it.  */
+          name_cache_block_unref (block);
+          name_cache.blocks--;
+          release_kbnode (keyblock);
+          continue;
+        }
+
+      keyblocks = (kbnode_t *)
+        xrealloc (keyblocks, (nkeyblocks + 1) * sizeof *keyblocks);
+      keyblocks[nkeyblocks++] = keyblock;
+    }
+  if (err == GPG_ERR_NOT_FOUND)
+    err = 0;
+  if (err)
+    {
+      log_error ("prefetching keys failed: %s\n", gpg_strerror (err));
+      name_cache_clear ();
+      goto leave;
+    }
+  cache_stats.name_prefetches++;
+
+  /* Verify the self-signatures of all found keys at once.  */
+  batch = sig_batch_new ();
+  for (n = 0; n < nkeyblocks; n++)
+    sig_batch_add_keyblock (batch, keyblocks[n], NULL, NULL);
+  sig_batch_start (batch);
+  sig_batch_finish (batch);
+  sig_batch_release (batch);
+
+ leave:
+  for (n = 0; n < nkeyblocks; n++)
+    release_kbnode (keyblocks[n]);
+  xfree (keyblocks);
+  keydb_release (hd);
+  xfree (uid_nos);
+  xfree (entries);
+  xfree (desc);
+  return err;
+}
+
+
+/* Drop the cached keys and user IDs of all keys in KEYBLOCK.  This
+ * needs to be called after KEYBLOCK has been changed or deleted in
+ * the database; other cache entries stay valid.  The name cache is
+ * dropped entirely because the change may affect which keyblocks
+ * match a name.  */
+void
+getkey_invalidate_keyblock (kbnode_t keyblock)
+{
+  kbnode_t k;
+  u32 keyid[2];
+  byte fpr[MAX_FINGERPRINT_LEN];
+
+  if (name_cache.entries)
+    {
+      name_cache_clear ();
+      cache_stats.name_invalidations++;
+    }
+
+  for (k = keyblock; k; k = k->next)
+    {
+      if (k->pkt->pkttype != PKT_PUBLIC_KEY
+          && k->pkt->pkttype != PKT_PUBLIC_SUBKEY
+          && k->pkt->pkttype != PKT_SECRET_KEY
+          && k->pkt->pkttype != PKT_SECRET_SUBKEY)
+        continue;
+
+      memset (fpr, 0, sizeof fpr);
+      keyid_from_pk (k->pkt->pkt.public_key, keyid);
+      fingerprint_from_pk (k->pkt->pkt.public_key, fpr, NULL);
+      invalidate_cached_key (keyid, fpr);
+    }
+}
+
+
+/* Print statistics for the public key and user ID caches.  */
+void
+getkey_dump_stats (void)
+{
+#if MAX_PK_CACHE_ENTRIES
+  log_info ("pk_cache: entries=%u/%u hits=%u misses=%u"
+            " evicted=%u invalidated=%u\n",
+            pk_cache.entries, cache_capacity (),
+            cache_stats.pk_hits, cache_stats.pk_misses,
+            cache_stats.pk_evictions, cache_stats.pk_invalidations);
 #endif
-  /* fixme: disable user id cache ? */
+  log_info ("uid_cache: entries=%u/%u hits=%u misses=%u"
+            " evicted=%u invalidated=%u\n",
+            uid_cache.entries, cache_capacity (),
+            cache_stats.uid_hits, cache_stats.uid_misses,
+            cache_stats.uid_evictions, cache_stats.uid_invalidations);
+  log_info ("name_cache: names=%u keyblocks=%u prefetches=%u hits=%u"
+            " invalidated=%u\n",
+            name_cache.entries, name_cache.blocks,
+            cache_stats.name_prefetches, cache_stats.name_hits,
+            cache_stats.name_invalidations);
 }
 
 
@@ -680,17 +1369,16 @@ get_pubkey (ctrl_t ctrl, PKT_public_key * pk, u32 * keyid)
       /* Try to get it from the cache.  We don't do this when pk is
          NULL as it does not guarantee that the user IDs are
          cached. */
-      pk_cache_entry_t ce;
-      for (ce = pk_cache; ce; ce = ce->next)
+      pk_cache_entry_t ce = pk_cache_find (keyid);
+      if (ce)
 	{
-	  if (ce->keyid[0] == keyid[0] && ce->keyid[1] == keyid[1])
-	    /* XXX: We don't check PK->REQ_USAGE here, but if we don't
-	       read from the cache, we do check it!  */
-	    {
-	      copy_public_key (pk, ce->pk);
-	      return 0;
-	    }
+	  /* XXX: We don't check PK->REQ_USAGE here, but if we don't
+	     read from the cache, we do check it!  */
+	  cache_stats.pk_hits++;
+	  copy_public_key (pk, ce->pk);
+	  return 0;
 	}
+      cache_stats.pk_misses++;
     }
 #endif
   /* More init stuff.  */
@@ -774,20 +1462,19 @@ get_pubkey_fast (PKT_public_key * pk, u32 * keyid)
 #if MAX_PK_CACHE_ENTRIES
   {
     /* Try to get it from the cache */
-    pk_cache_entry_t ce;
+    pk_cache_entry_t ce = pk_cache_find (keyid);
 
-    for (ce = pk_cache; ce; ce = ce->next)
+    if (ce
+        /* Only consider primary keys.  */
+        && ce->pk->keyid[0] == ce->pk->main_keyid[0]
+        && ce->pk->keyid[1] == ce->pk->main_keyid[1])
       {
-	if (ce->keyid[0] == keyid[0] && ce->keyid[1] == keyid[1]
-	    /* Only consider primary keys.  */
-	    && ce->pk->keyid[0] == ce->pk->main_keyid[0]
-	    && ce->pk->keyid[1] == ce->pk->main_keyid[1])
-	  {
-	    if (pk)
-	      copy_public_key (pk, ce->pk);
-	    return 0;
-	  }
+        cache_stats.pk_hits++;
+        if (pk)
+          copy_public_key (pk, ce->pk);
+        return 0;
       }
+    cache_stats.pk_misses++;
   }
 #endif
 
@@ -1087,6 +1774,13 @@ key_byname (ctrl_t ctrl, GETKEY_CTX *retctx, strlist_t namelist,
 	}
     }
 
+  /* A single name may have been prefetched together with others.
+     The name cache can't be used if the caller wants the database
+     handle positioned at the result.  */
+  if (namelist && ctx->nitems == 1 && !ret_kdbhd)
+    ctx->use_name_cache = name_cache_get (namelist->d, &ctx->name_hits,
+                                          &ctx->name_nhits);
+
   ctx->want_secret = want_secret;
   ctx->kr_handle = keydb_new ();
   if (!ctx->kr_handle)
@@ -2214,6 +2908,7 @@ getkey_end (ctrl_t ctrl, getkey_ctx_t ctx)
 #endif /*!HAVE_W32_SYSTEM*/
 
       free_strlist (ctx->extra_list);
+      name_cache_release_hits (ctx->name_hits, ctx->name_nhits);
       if (!ctx->not_allocated)
 	xfree (ctx);
     }
@@ -2745,7 +3440,12 @@ merge_selfsigs_main (ctrl_t ctrl, kbnode_t keyblock, int *r_revoked,
 	  /* Clear SIGNODE.  The only relevant self-signed data for
 	     UIDNODE follows it.  */
 	  if (k->pkt->pkttype == PKT_USER_ID)
-	    uidnode = k;
+	    {
+	      uidnode = k;
+	      /* Verify the self-sigs of this user ID in one batch; the
+	         checks below then use the cached results.  */
+	      check_uid_signatures (ctrl, keyblock, uidnode, 1);
+	    }
 	  else
 	    uidnode = NULL;
 	  signode = NULL;
@@ -3260,6 +3960,7 @@ merge_selfsigs (ctrl_t ctrl, kbnode_t keyblock)
   PKT_public_key *main_pk;
   prefitem_t *prefs;
   unsigned int mdc_feature;
+  sig_prefix_cache_t prefix_cache;
 
   if (keyblock->pkt->pkttype != PKT_PUBLIC_KEY)
     {
@@ -3275,6 +3976,8 @@ merge_selfsigs (ctrl_t ctrl, kbnode_t keyblock)
       BUG ();
     }
 
+  prefix_cache = sig_prefix_cache_open (keyblock);
+
   merge_selfsigs_main (ctrl, keyblock, &revoked, &rinfo);
 
   /* Now merge in the data from each of the subkeys.  */
@@ -3286,6 +3989,8 @@ merge_selfsigs (ctrl_t ctrl, kbnode_t keyblock)
 	}
     }
 
+  sig_prefix_cache_close (prefix_cache);
+
   main_pk = keyblock->pkt->pkt.public_key;
   if (revoked || main_pk->has_expired || !main_pk->flags.valid)
     {
@@ -3696,6 +4401,14 @@ lookup (ctrl_t ctrl, getkey_ctx_t ctx, int want_secret,
 
   for (;;)
     {
+      if (ctx->use_name_cache)
+        {
+          rc = name_cache_next (ctx, &keyblock);
+          if (rc)
+            break;
+          goto got_keyblock;
+        }
+
       rc = keydb_search (ctx->kr_handle, ctx->items, ctx->nitems, NULL);
       if (rc)
         break;
@@ -3714,6 +4427,7 @@ lookup (ctrl_t ctrl, getkey_ctx_t ctx, int want_secret,
 	  goto skip;
 	}
 
+    got_keyblock:
       if (want_secret && agent_probe_any_secret_key (NULL, keyblock))
         goto skip; /* No secret key available.  */
 
@@ -4021,39 +4735,39 @@ get_user_id_string (ctrl_t ctrl, u32 * keyid, int mode, size_t *r_len)
   /* Try it two times; second pass reads from the database.  */
   do
     {
-      for (r = user_id_db; r; r = r->next)
-	{
-	  for (a = r->keyids; a; a = a->next)
-	    {
-	      if (a->keyid[0] == keyid[0] && a->keyid[1] == keyid[1])
-		{
-                  if (mode == 2)
-                    {
-                      /* An empty string as user id is possible.  Make
-                         sure that the malloc allocates one byte and
-                         does not bail out.  */
-                      p = (char*) xmalloc (r->len? r->len : 1);
-                      memcpy (p, r->name, r->len);
-                      if (r_len)
-                        *r_len = r->len;
-                    }
-                  else
-                    {
-                      if (mode)
-                        p = xasprintf ("%08lX%08lX %.*s",
-                                       (unsigned long) keyid[0], (unsigned long) keyid[1],
-                                       r->len, r->name);
-                      else
-                        p = xasprintf ("%s %.*s", keystr (keyid),
-                                       r->len, r->name);
-                      if (r_len)
-                        *r_len = strlen (p);
-                    }
+      a = uid_cache_find_kid (keyid);
+      if (a)
+        {
+          r = a->owner;
+          uid_cache_touch (r);
+          cache_stats.uid_hits++;
+          if (mode == 2)
+            {
+              /* An empty string as user id is possible.  Make
+                 sure that the malloc allocates one byte and
+                 does not bail out.  */
+              p = (char*) xmalloc (r->len? r->len : 1);
+              memcpy (p, r->name, r->len);
+              if (r_len)
+                *r_len = r->len;
+            }
+          else
+            {
+              if (mode)
+                p = xasprintf ("%08lX%08lX %.*s",
+                               (unsigned long) keyid[0], (unsigned long) keyid[1],
+                               r->len, r->name);
+              else
+                p = xasprintf ("%s %.*s", keystr (keyid),
+                               r->len, r->name);
+              if (r_len)
+                *r_len = strlen (p);
+            }
 
-                  return p;
-		}
-	    }
-	}
+          return p;
+        }
+      if (!pass)
+        cache_stats.uid_misses++;
     }
   while (++pass < 2 && !get_pubkey (ctrl, NULL, keyid));
 
@@ -4122,23 +4836,21 @@ get_user_id_byfpr (ctrl_t ctrl, const byte *fpr, size_t *rn)
   /* Try it two times; second pass reads from the database.  */
   do
     {
-      for (r = user_id_db; r; r = r->next)
-	{
-	  keyid_list_t a;
-	  for (a = r->keyids; a; a = a->next)
-	    {
-	      if (!memcmp (a->fpr, fpr, MAX_FINGERPRINT_LEN))
-		{
-                  /* An empty string as user id is possible.  Make
-                     sure that the malloc allocates one byte and does
-                     not bail out.  */
-		  p = (char*) xmalloc (r->len? r->len : 1);
-		  memcpy (p, r->name, r->len);
-		  *rn = r->len;
-		  return p;
-		}
-	    }
-	}
+      keyid_list_t a = uid_cache_find_fpr ((const char*)fpr);
+      if (a)
+        {
+          r = a->owner;
+          uid_cache_touch (r);
+          cache_stats.uid_hits++;
+          /* An empty string as user id is possible.  Make sure that
+             the malloc allocates one byte and does not bail out.  */
+          p = (char*) xmalloc (r->len? r->len : 1);
+          memcpy (p, r->name, r->len);
+          *rn = r->len;
+          return p;
+        }
+      if (!pass)
+        cache_stats.uid_misses++;
     }
   while (++pass < 2
 	 && !get_pubkey_byfprint (ctrl, NULL, NULL, fpr, MAX_FINGERPRINT_LEN));
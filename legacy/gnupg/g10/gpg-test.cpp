@@ -0,0 +1,13 @@
+#include "gtest/gtest.h"
+
+  int call_agent_main(int argc, char* argv[]);
+  int sigcache_main(int argc, char* argv[]);
+
+/* The tests of test.cpp exit with the result.  */
+TEST(GpgTest, call_agent) {
+    EXPECT_EXIT(call_agent_main(0, NULL), ::testing::ExitedWithCode(0), "");
+}
+
+TEST(GpgTest, sigcache) {
+    EXPECT_EXIT(sigcache_main(0, NULL), ::testing::ExitedWithCode(0), "");
+}
@@ -48,6 +48,7 @@
 #include "options.h"
 #include "keydb.h"
 #include "trustdb.h"
+#include "tdbio.h"
 #include "filter.h"
 #include "../common/ttyio.h"
 #include "../common/i18n.h"
@@ -322,6 +323,8 @@ enum cmd_and_opt_values
     oTryAllSecrets,
     oTrustedKey,
     oNoSigCache,
+    oKeyCacheSize,
+    oTrustDBMmap,
     oAutoCheckTrustDB,
     oNoAutoCheckTrustDB,
     oPreservePermissions,
@@ -700,6 +703,8 @@ static ARGPARSE_OPTS opts[] = {
   ARGPARSE_s_n (oAutoKeyRetrieve, "auto-key-retrieve", "@"),
   ARGPARSE_s_n (oNoAutoKeyRetrieve, "no-auto-key-retrieve", "@"),
   ARGPARSE_s_n (oNoSigCache,         "no-sig-cache", "@"),
+  ARGPARSE_s_i (oKeyCacheSize,       "key-cache-size", "@"),
+  ARGPARSE_s_n (oTrustDBMmap,        "trustdb-mmap", "@"),
   ARGPARSE_s_n (oMergeOnly,	  "merge-only", "@" ),
   ARGPARSE_s_n (oAllowSecretKeyImport, "allow-secret-key-import", "@"),
   ARGPARSE_s_n (oTryAllSecrets,  "try-all-secrets", "@"),
@@ -2739,6 +2744,8 @@ gpg_main (int argc, char **argv)
             }
             break;
           case oNoSigCache: opt.no_sig_cache = 1; break;
+          case oKeyCacheSize: opt.key_cache_size = pargs.r.ret_int; break;
+          case oTrustDBMmap: opt.trustdb_mmap = 1; break;
 	  case oAllowNonSelfsignedUID: opt.allow_non_selfsigned_uid = 1; break;
 	  case oNoAllowNonSelfsignedUID: opt.allow_non_selfsigned_uid=0; break;
 	  case oAllowFreeformUID: opt.allow_freeform_uid = 1; break;
@@ -4270,10 +4277,15 @@ g10_exit( int rc )
   if (DBG_CLOCK)
     log_clock ("stop");
 
-  if ( (opt.debug & DBG_MEMSTAT_VALUE) )
+  if ( (opt.debug & (DBG_MEMSTAT_VALUE|DBG_CACHE_VALUE)) )
     {
       keydb_dump_stats ();
+      getkey_dump_stats ();
       sig_check_dump_stats ();
+      tdbio_dump_stats ();
+    }
+  if ( (opt.debug & DBG_MEMSTAT_VALUE) )
+    {
       gcry_control (GCRYCTL_DUMP_MEMORY_STATS);
       gcry_control (GCRYCTL_DUMP_RANDOM_STATS);
     }
@@ -2483,6 +2483,9 @@ chk_self_sigs (ctrl_t ctrl, kbnode_t keyblock, u32 *keyid, int *non_self)
   int rc;
   u32 bsdate=0, rsdate=0;
   kbnode_t bsnode = NULL, rsnode = NULL;
+  sig_prefix_cache_t prefix_cache;
+
+  prefix_cache = sig_prefix_cache_open (keyblock);
 
   for (n=keyblock; (n = find_next_kbnode (n, 0)); )
     {
@@ -2496,6 +2499,13 @@ chk_self_sigs (ctrl_t ctrl, kbnode_t keyblock, u32 *keyid, int *non_self)
 	  continue;
 	}
 
+      /* Check the self-sigs of a user ID in one batch.  */
+      if (n->pkt->pkttype == PKT_USER_ID)
+        {
+          check_uid_signatures (ctrl, keyblock, n, 1);
+          continue;
+        }
+
       if ( n->pkt->pkttype != PKT_SIGNATURE )
         continue;
 
@@ -2518,6 +2528,7 @@ chk_self_sigs (ctrl_t ctrl, kbnode_t keyblock, u32 *keyid, int *non_self)
             {
               log_error( _("key %s: no user ID for signature\n"),
                          keystr(keyid));
+              sig_prefix_cache_close (prefix_cache);
               return -1;  /* The complete keyblock is invalid.  */
             }
 
@@ -2660,6 +2671,7 @@ chk_self_sigs (ctrl_t ctrl, kbnode_t keyblock, u32 *keyid, int *non_self)
         }
     }
 
+  sig_prefix_cache_close (prefix_cache);
   return 0;
 }
 
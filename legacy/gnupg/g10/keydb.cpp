@@ -34,6 +34,7 @@
 #include "packet.h"
 #include "../kbx/keybox.h"
 #include "keydb.h"
+#include "trustdb.h"
 #include "../common/i18n.h"
 
 static int active_handles;
@@ -64,6 +65,9 @@ static void *primary_keydb;
 /* Whether we have successfully registered any resource.  */
 static int any_registered;
 
+/* A hash over the file names of ALL_RESOURCES.  */
+static u32 resources_id;
+
 /* This is a simple cache used to return the last result of a
    successful fingerprint search.  This works only for keybox resources
    because (due to lack of a copy_keyblock function) we need to store
@@ -133,28 +137,43 @@ struct keydb_handle
    particularly helps the --list-sigs and --check-sigs commands.
 
    The cache stores the results in a hash using separate chaining.
-   Concretely: we use the LSB of the keyid to index the hash table and
-   each bucket consists of a linked list of entries.  An entry
-   consists of the 64-bit key id.  If a key id is not in the cache,
-   then we don't know whether it is in the DB or not.
+   Concretely: we use the low word of the keyid to index the hash
+   table and each bucket consists of a linked list of entries.  An
+   entry consists of the 64-bit key id.  If a key id is not in the
+   cache, then we don't know whether it is in the DB or not.  All
+   entries are also kept on a list in LRU order; if the cache is full
+   the least recently used entry is evicted.
 
-   To simplify the cache consistency protocol, we simply flush the
-   whole cache whenever a key is inserted or updated.  */
+   Only inserting or updating a keyblock can make a key id appear in
+   the database, thus we then remove the key ids of that keyblock
+   from the cache.  The whole cache is only flushed when a new
+   resource is registered.  */
 
-#define KID_NOT_FOUND_CACHE_BUCKETS 256
-static struct kid_not_found_cache_bucket *
-  kid_not_found_cache[KID_NOT_FOUND_CACHE_BUCKETS];
+#define KID_NOT_FOUND_CACHE_SIZE (4 * PK_UID_CACHE_SIZE)
 
 struct kid_not_found_cache_bucket
 {
-  struct kid_not_found_cache_bucket *next;
+  struct kid_not_found_cache_bucket *next;      /* Next entry in the bucket.  */
+  struct kid_not_found_cache_bucket *lru_prev;  /* More recently used.  */
+  struct kid_not_found_cache_bucket *lru_next;  /* Less recently used.  */
   u32 kid[2];
 };
 
+static struct
+{
+  struct kid_not_found_cache_bucket **buckets;
+  unsigned int nbuckets;  /* A power of 2.  */
+  struct kid_not_found_cache_bucket *lru_first;
+  struct kid_not_found_cache_bucket *lru_last;
+} kid_not_found_cache;
+
 struct
 {
   unsigned int count;   /* The current number of entries in the hash table.  */
   unsigned int peak;    /* The peak of COUNT.  */
+  unsigned int hits;    /* The number of lookups answered by the cache.  */
+  unsigned int evictions; /* The number of entries evicted.  */
+  unsigned int removals;  /* The number of entries removed by an update.  */
   unsigned int flushes; /* The number of flushes.  */
 } kid_not_found_stats;
 
@@ -180,6 +199,50 @@ static int lock_all (KEYDB_HANDLE hd);
 static void unlock_all (KEYDB_HANDLE hd);
 
 
+/* Return the maximum number of entries in the kid_not_found_cache.
+   This scales with --key-cache-size.  */
+static unsigned int
+kid_not_found_capacity (void)
+{
+  if (opt.key_cache_size <= 0)
+    return KID_NOT_FOUND_CACHE_SIZE;
+  return 4 * (opt.key_cache_size < 16? 16 : opt.key_cache_size);
+}
+
+
+static struct kid_not_found_cache_bucket **
+kid_not_found_bucket (u32 *kid)
+{
+  return &kid_not_found_cache.buckets[kid[1]
+                                      & (kid_not_found_cache.nbuckets - 1)];
+}
+
+
+/* Unlink the entry K from the hash table and the LRU list and
+   release it.  */
+static void
+kid_not_found_remove (struct kid_not_found_cache_bucket *k)
+{
+  struct kid_not_found_cache_bucket **ptr;
+
+  for (ptr = kid_not_found_bucket (k->kid); *ptr != k; ptr = &(*ptr)->next)
+    ;
+  *ptr = k->next;
+
+  if (k->lru_prev)
+    k->lru_prev->lru_next = k->lru_next;
+  else
+    kid_not_found_cache.lru_first = k->lru_next;
+  if (k->lru_next)
+    k->lru_next->lru_prev = k->lru_prev;
+  else
+    kid_not_found_cache.lru_last = k->lru_prev;
+
+  xfree (k);
+  kid_not_found_stats.count--;
+}
+
+
 /* Check whether the keyid KID is in key id is definitely not in the
    database.
 
@@ -197,14 +260,29 @@ kid_not_found_p (u32 *kid)
 {
   struct kid_not_found_cache_bucket *k;
 
-  for (k = kid_not_found_cache[kid[0] % KID_NOT_FOUND_CACHE_BUCKETS]; k; k = k->next)
-    if (k->kid[0] == kid[0] && k->kid[1] == kid[1])
-      {
-        if (DBG_CACHE)
-          log_debug ("keydb: kid_not_found_p (%08lx%08lx) => not in DB\n",
-                     (unsigned long)kid[0], (unsigned long)kid[1]);
-        return 1;
-      }
+  if (kid_not_found_cache.nbuckets)
+    for (k = *kid_not_found_bucket (kid); k; k = k->next)
+      if (k->kid[0] == kid[0] && k->kid[1] == kid[1])
+        {
+          if (DBG_CACHE)
+            log_debug ("keydb: kid_not_found_p (%08lx%08lx) => not in DB\n",
+                       (unsigned long)kid[0], (unsigned long)kid[1]);
+          /* Move it to the front of the LRU list.  */
+          if (k->lru_prev)
+            {
+              k->lru_prev->lru_next = k->lru_next;
+              if (k->lru_next)
+                k->lru_next->lru_prev = k->lru_prev;
+              else
+                kid_not_found_cache.lru_last = k->lru_prev;
+              k->lru_prev = NULL;
+              k->lru_next = kid_not_found_cache.lru_first;
+              kid_not_found_cache.lru_first->lru_prev = k;
+              kid_not_found_cache.lru_first = k;
+            }
+          kid_not_found_stats.hits++;
+          return 1;
+        }
 
   if (DBG_CACHE)
     log_debug ("keydb: kid_not_found_p (%08lx%08lx) => indeterminate\n",
@@ -221,17 +299,83 @@ kid_not_found_p (u32 *kid)
 static void
 kid_not_found_insert (u32 *kid)
 {
-  struct kid_not_found_cache_bucket *k;
+  struct kid_not_found_cache_bucket *k, **bucket;
 
   if (DBG_CACHE)
     log_debug ("keydb: kid_not_found_insert (%08lx%08lx)\n",
                (unsigned long)kid[0], (unsigned long)kid[1]);
+
+  if (!kid_not_found_cache.nbuckets)
+    {
+      unsigned int n = 256;
+
+      while (n < kid_not_found_capacity () && n < (1u << 24))
+        n <<= 1;
+      kid_not_found_cache.buckets = (kid_not_found_cache_bucket**)
+        xtrycalloc (n, sizeof *kid_not_found_cache.buckets);
+      if (!kid_not_found_cache.buckets)
+        return;
+      kid_not_found_cache.nbuckets = n;
+    }
+
+  while (kid_not_found_stats.count >= kid_not_found_capacity ()
+         && kid_not_found_cache.lru_last)
+    {
+      kid_not_found_remove (kid_not_found_cache.lru_last);
+      kid_not_found_stats.evictions++;
+    }
+
   k = (kid_not_found_cache_bucket*) xmalloc (sizeof *k);
   k->kid[0] = kid[0];
   k->kid[1] = kid[1];
-  k->next = kid_not_found_cache[kid[0] % KID_NOT_FOUND_CACHE_BUCKETS];
-  kid_not_found_cache[kid[0] % KID_NOT_FOUND_CACHE_BUCKETS] = k;
+  bucket = kid_not_found_bucket (kid);
+  k->next = *bucket;
+  *bucket = k;
+  k->lru_prev = NULL;
+  k->lru_next = kid_not_found_cache.lru_first;
+  if (kid_not_found_cache.lru_first)
+    kid_not_found_cache.lru_first->lru_prev = k;
+  else
+    kid_not_found_cache.lru_last = k;
+  kid_not_found_cache.lru_first = k;
   kid_not_found_stats.count++;
+  if (kid_not_found_stats.count > kid_not_found_stats.peak)
+    kid_not_found_stats.peak = kid_not_found_stats.count;
+}
+
+
+/* Remove the key ids of all keys in the keyblock KB from the kid not
+   found cache.  */
+static void
+kid_not_found_remove_keyblock (kbnode_t kb)
+{
+  struct kid_not_found_cache_bucket *k;
+  kbnode_t node;
+  u32 kid[2];
+
+  if (!kid_not_found_stats.count)
+    return;
+
+  for (node = kb; node; node = node->next)
+    {
+      if (node->pkt->pkttype != PKT_PUBLIC_KEY
+          && node->pkt->pkttype != PKT_PUBLIC_SUBKEY
+          && node->pkt->pkttype != PKT_SECRET_KEY
+          && node->pkt->pkttype != PKT_SECRET_SUBKEY)
+        continue;
+
+      keyid_from_pk (node->pkt->pkt.public_key, kid);
+      for (k = *kid_not_found_bucket (kid); k; k = k->next)
+        if (k->kid[0] == kid[0] && k->kid[1] == kid[1])
+          {
+            if (DBG_CACHE)
+              log_debug ("keydb: kid_not_found_remove (%08lx%08lx)\n",
+                         (unsigned long)kid[0], (unsigned long)kid[1]);
+            kid_not_found_remove (k);
+            kid_not_found_stats.removals++;
+            break;
+          }
+    }
 }
 
 
@@ -239,27 +383,14 @@ kid_not_found_insert (u32 *kid)
 static void
 kid_not_found_flush (void)
 {
-  struct kid_not_found_cache_bucket *k, *knext;
-  int i;
-
   if (DBG_CACHE)
     log_debug ("keydb: kid_not_found_flush\n");
 
   if (!kid_not_found_stats.count)
     return;
 
-  for (i=0; i < DIM(kid_not_found_cache); i++)
-    {
-      for (k = kid_not_found_cache[i]; k; k = knext)
-        {
-          knext = k->next;
-          xfree (k);
-        }
-      kid_not_found_cache[i] = NULL;
-    }
-  if (kid_not_found_stats.count > kid_not_found_stats.peak)
-    kid_not_found_stats.peak = kid_not_found_stats.count;
-  kid_not_found_stats.count = 0;
+  while (kid_not_found_cache.lru_first)
+    kid_not_found_remove (kid_not_found_cache.lru_first);
   kid_not_found_stats.flushes++;
 }
 
@@ -640,6 +771,7 @@ keydb_add_resource (const char *url, unsigned int flags)
   int read_only = !!(flags&KEYDB_RESOURCE_FLAG_READONLY);
   int is_default = !!(flags&KEYDB_RESOURCE_FLAG_DEFAULT);
   int is_gpgvdef = !!(flags&KEYDB_RESOURCE_FLAG_GPGVDEF);
+  const byte *s;
   gpg_error_t err = 0;
   KeydbResourceType rt = KEYDB_RESOURCE_TYPE_NONE;
   void *token;
@@ -724,6 +856,10 @@ keydb_add_resource (const char *url, unsigned int flags)
                    user is currently using the keybox. */
 
                 used_resources++;
+                for (s = (const byte*)filename; *s; s++)
+                  resources_id = (resources_id ^ *s) * 16777619;
+                /* Keys we did not find may be in the new resource.  */
+                kid_not_found_flush ();
               }
           }
         else if (err == GPG_ERR_EEXIST)
@@ -758,6 +894,49 @@ keydb_add_resource (const char *url, unsigned int flags)
 }
 
 
+/* Return an identifier for the set of registered resources.  This is
+   used to tell whether data derived from the keyrings is still
+   valid.  */
+u32
+keydb_get_resources_id (void)
+{
+  return resources_id;
+}
+
+
+/* Return a value which changes whenever one of the registered
+   resources is modified, by us or by another program.  It is derived
+   from the inode, the size and the modification time of the files;
+   most keybox updates write a new file and thus change the inode.  */
+u32
+keydb_get_resources_stamp (void)
+{
+  struct stat st;
+  u32 stamp = 2166136261;
+  u32 v[4];
+  const byte *s;
+  size_t n;
+  int i;
+
+  for (i = 0; i < used_resources; i++)
+    {
+      const char *fname = keybox_get_token_fname (all_resources[i].token);
+
+      memset (v, 0, sizeof v);
+      if (fname && !stat (fname, &st))
+        {
+          v[0] = (u32)st.st_ino;
+          v[1] = (u32)st.st_size;
+          v[2] = (u32)((uint64_t)st.st_size >> 32);
+          v[3] = (u32)st.st_mtime;
+        }
+      for (s = (const byte*)v, n = 0; n < sizeof v; n++)
+        stamp = (stamp ^ s[n]) * 16777619;
+    }
+  return stamp;
+}
+
+
 void
 keydb_dump_stats (void)
 {
@@ -777,9 +956,14 @@ keydb_dump_stats (void)
             keydb_stats.notfound,
             keydb_stats.found_cached,
             keydb_stats.notfound_cached);
-  log_info ("kid_not_found_cache: count=%u peak=%u flushes=%u\n",
+  log_info ("kid_not_found_cache: count=%u/%u peak=%u hits=%u\n",
             kid_not_found_stats.count,
+            kid_not_found_capacity (),
             kid_not_found_stats.peak,
+            kid_not_found_stats.hits);
+  log_info ("                     evicted=%u removed=%u flushes=%u\n",
+            kid_not_found_stats.evictions,
+            kid_not_found_stats.removals,
             kid_not_found_stats.flushes);
 }
 
@@ -1292,6 +1476,61 @@ keydb_get_keyblock (KEYDB_HANDLE hd, KBNODE *ret_kb)
 }
 
 
+/* Return the image of the keyblock last found by keydb_search() as a
+ * new iobuf at R_IOBUF.  The numbers of the matched key and user ID
+ * are stored at R_PK_NO and R_UID_NO.  The image can later be turned
+ * into a keyblock using keydb_parse_keyblock_image; this allows
+ * callers to keep found keyblocks around without holding on to the
+ * parsed packets.  */
+gpg_error_t
+keydb_get_keyblock_image (KEYDB_HANDLE hd, iobuf_t *r_iobuf,
+                          int *r_pk_no, int *r_uid_no)
+{
+  gpg_error_t err = 0;
+
+  *r_iobuf = NULL;
+
+  if (!hd)
+    return GPG_ERR_INV_ARG;
+
+  if (hd->found < 0 || hd->found >= hd->used)
+    return GPG_ERR_VALUE_NOT_FOUND;
+
+  switch (hd->active[hd->found].type)
+    {
+    case KEYDB_RESOURCE_TYPE_NONE:
+      err = GPG_ERR_GENERAL; /* oops */
+      break;
+    case KEYDB_RESOURCE_TYPE_KEYBOX:
+      err = keybox_get_keyblock (hd->active[hd->found].u.kb,
+                                 r_iobuf, r_pk_no, r_uid_no);
+      break;
+    }
+
+  return err;
+}
+
+
+/* Parse the keyblock image IOBUF as returned by
+ * keydb_get_keyblock_image.  PK_NO and UID_NO select the nodes which
+ * are flagged like keydb_get_keyblock does.  IOBUF is rewound first
+ * and may thus be parsed several times.  On success the new keyblock
+ * is stored at R_KEYBLOCK.  */
+gpg_error_t
+keydb_parse_keyblock_image (iobuf_t iobuf, int pk_no, int uid_no,
+                            kbnode_t *r_keyblock)
+{
+  gpg_error_t err;
+
+  *r_keyblock = NULL;
+
+  err = iobuf_seek (iobuf, 0);
+  if (err)
+    return err;
+  return parse_keyblock_image (iobuf, pk_no, uid_no, r_keyblock);
+}
+
+
 /* Build a keyblock image from KEYBLOCK.  Returns 0 on success and
  * only then stores a new iobuf object at R_IOBUF.  */
 static gpg_error_t
@@ -1364,7 +1603,7 @@ keydb_update_keyblock (ctrl_t ctrl, KEYDB_HANDLE hd, kbnode_t kb)
   if (!hd)
     return GPG_ERR_INV_ARG;
 
-  kid_not_found_flush ();
+  kid_not_found_remove_keyblock (kb);
   keyblock_cache_clear (hd);
 
   if (opt.dry_run)
@@ -1377,6 +1616,9 @@ keydb_update_keyblock (ctrl_t ctrl, KEYDB_HANDLE hd, kbnode_t kb)
 #ifdef USE_TOFU
   tofu_notice_key_changed (ctrl, kb);
 #endif
+  sigcache_invalidate_keyblock (kb);
+  getkey_invalidate_keyblock (kb);
+  certgraph_notice_keyblock (kb);
 
   memset (&desc, 0, sizeof (desc));
   fingerprint_from_pk (pk, desc.u.fpr, &len);
@@ -1412,6 +1654,8 @@ keydb_update_keyblock (ctrl_t ctrl, KEYDB_HANDLE hd, kbnode_t kb)
       break;
     }
 
+  if (!err)
+    certgraph_notice_written ();
   unlock_all (hd);
   if (!err)
     keydb_stats.update_keyblocks++;
@@ -1438,7 +1682,7 @@ keydb_insert_keyblock (KEYDB_HANDLE hd, kbnode_t kb)
   if (!hd)
     return GPG_ERR_INV_ARG;
 
-  kid_not_found_flush ();
+  kid_not_found_remove_keyblock (kb);
   keyblock_cache_clear (hd);
 
   if (opt.dry_run)
@@ -1455,6 +1699,10 @@ keydb_insert_keyblock (KEYDB_HANDLE hd, kbnode_t kb)
   if (err)
     return err;
 
+  sigcache_invalidate_keyblock (kb);
+  getkey_invalidate_keyblock (kb);
+  certgraph_notice_keyblock (kb);
+
   switch (hd->active[idx].type)
     {
     case KEYDB_RESOURCE_TYPE_NONE:
@@ -1479,6 +1727,8 @@ keydb_insert_keyblock (KEYDB_HANDLE hd, kbnode_t kb)
       break;
     }
 
+  if (!err)
+    certgraph_notice_written ();
   unlock_all (hd);
   if (!err)
     keydb_stats.insert_keyblocks++;
@@ -1499,7 +1749,6 @@ keydb_delete_keyblock (KEYDB_HANDLE hd)
   if (!hd)
     return GPG_ERR_INV_ARG;
 
-  kid_not_found_flush ();
   keyblock_cache_clear (hd);
 
   if (hd->found < 0 || hd->found >= hd->used)
@@ -1522,6 +1771,8 @@ keydb_delete_keyblock (KEYDB_HANDLE hd)
       break;
     }
 
+  if (!rc)
+    certgraph_notice_written ();
   unlock_all (hd);
   if (!rc)
     keydb_stats.delete_keyblocks++;
@@ -1815,6 +2066,37 @@ keydb_search (KEYDB_HANDLE hd, KEYDB_SEARCH_DESC *desc,
 }
 
 
+/* Check which of the NDESC user ID searches in DESC are matched by
+ * the keyblock last found by keydb_search().  For each description
+ * the 1-based number of the matching user ID, or 0, is stored at the
+ * corresponding slot of R_UID_NO.  */
+gpg_error_t
+keydb_match_found (KEYDB_HANDLE hd, KEYDB_SEARCH_DESC *desc,
+                   size_t ndesc, int *r_uid_no)
+{
+  gpg_error_t err = 0;
+
+  if (!hd)
+    return GPG_ERR_INV_ARG;
+
+  if (hd->found < 0 || hd->found >= hd->used)
+    return GPG_ERR_VALUE_NOT_FOUND;
+
+  switch (hd->active[hd->found].type)
+    {
+    case KEYDB_RESOURCE_TYPE_NONE:
+      err = GPG_ERR_GENERAL; /* oops */
+      break;
+    case KEYDB_RESOURCE_TYPE_KEYBOX:
+      err = keybox_match_found (hd->active[hd->found].u.kb,
+                                desc, ndesc, r_uid_no);
+      break;
+    }
+
+  return err;
+}
+
+
 /* Return the first non-legacy key in the database.
  *
  * If you want the very first key in the database, you can directly
@@ -147,6 +147,10 @@ gpg_error_t keydb_add_resource (const char *url, unsigned int flags);
 /* Dump some statistics to the log.  */
 void keydb_dump_stats (void);
 
+/* Return an identifier for the set of registered resources.  */
+u32 keydb_get_resources_id (void);
+u32 keydb_get_resources_stamp (void);
+
 /* Create a new database handle.  Returns NULL on error, sets ERRNO,
    and prints an error diagnostic. */
 KEYDB_HANDLE keydb_new (void);
@@ -171,6 +175,14 @@ const char *keydb_get_resource_name (KEYDB_HANDLE hd);
 /* Return the keyblock last found by keydb_search.  */
 gpg_error_t keydb_get_keyblock (KEYDB_HANDLE hd, KBNODE *ret_kb);
 
+/* Return the image of the keyblock last found by keydb_search.  */
+gpg_error_t keydb_get_keyblock_image (KEYDB_HANDLE hd, iobuf_t *r_iobuf,
+                                      int *r_pk_no, int *r_uid_no);
+
+/* Parse an image returned by keydb_get_keyblock_image.  */
+gpg_error_t keydb_parse_keyblock_image (iobuf_t iobuf, int pk_no, int uid_no,
+                                        kbnode_t *r_keyblock);
+
 /* Update the keyblock KB.  */
 gpg_error_t keydb_update_keyblock (ctrl_t ctrl, KEYDB_HANDLE hd, kbnode_t kb);
 
@@ -194,6 +206,10 @@ gpg_error_t keydb_search_reset (KEYDB_HANDLE hd);
 gpg_error_t keydb_search (KEYDB_HANDLE hd, KEYDB_SEARCH_DESC *desc,
                           size_t ndesc, size_t *descindex);
 
+/* Return which user ID searches match the last found keyblock.  */
+gpg_error_t keydb_match_found (KEYDB_HANDLE hd, KEYDB_SEARCH_DESC *desc,
+                               size_t ndesc, int *r_uid_no);
+
 /* Return the first non-legacy key in the database.  */
 gpg_error_t keydb_search_first (KEYDB_HANDLE hd);
 
@@ -272,6 +288,15 @@ void cache_public_key( PKT_public_key *pk );
 /* Disable and drop the public key cache.  */
 void getkey_disable_caches(void);
 
+/* Drop the cached keys and user IDs of all keys in KEYBLOCK.  */
+void getkey_invalidate_keyblock (kbnode_t keyblock);
+
+/* Print statistics for the key and user ID caches.  */
+void getkey_dump_stats (void);
+
+/* Find the keys of many user IDs with one scan of the database.  */
+gpg_error_t prefetch_pubkeys_byname (ctrl_t ctrl, strlist_t names);
+
 /* Return the public key with the key id KEYID and store it at PK.  */
 int get_pubkey (ctrl_t ctrl, PKT_public_key *pk, u32 *keyid);
 
@@ -508,6 +508,10 @@ list_all (ctrl_t ctrl, int secret, int mark_secret)
   if (opt.check_sigs)
     listctx.check_sigs = 1;
 
+  /* Ask the agent only once for all secret keys.  */
+  if (secret || mark_secret)
+    agent_load_secret_keygrips (ctrl);
+
   hd = keydb_new ();
   if (!hd)
     rc = gpg_error_from_syserror ();
@@ -576,6 +580,8 @@ list_all (ctrl_t ctrl, int secret, int mark_secret)
     print_signature_stats (&listctx);
 
  leave:
+  if (secret || mark_secret)
+    agent_release_secret_keygrips ();
   keylist_context_release (&listctx);
   release_kbnode (keyblock);
   keydb_release (hd);
@@ -597,6 +603,9 @@ list_one (ctrl_t ctrl, strlist_t names, int secret, int mark_secret)
   if (!secret && opt.check_sigs)
     listctx.check_sigs = 1;
 
+  if (secret || mark_secret)
+    agent_load_secret_keygrips (ctrl);
+
   /* fixme: using the bynames function has the disadvantage that we
    * don't know whether one of the names given was not found.  OTOH,
    * this function has the advantage to list the names in the
@@ -611,6 +620,8 @@ list_one (ctrl_t ctrl, strlist_t names, int secret, int mark_secret)
     {
       log_error ("error reading key: %s\n", gpg_strerror (rc));
       getkey_end (ctrl, ctx);
+      if (secret || mark_secret)
+        agent_release_secret_keygrips ();
       return;
     }
 
@@ -634,6 +645,8 @@ list_one (ctrl_t ctrl, strlist_t names, int secret, int mark_secret)
   if (opt.check_sigs && !opt.with_colons)
     print_signature_stats (&listctx);
 
+  if (secret || mark_secret)
+    agent_release_secret_keygrips ();
   keylist_context_release (&listctx);
 }
 
@@ -877,6 +890,7 @@ list_keyblock_print (ctrl_t ctrl, kbnode_t keyblock, int secret, int fpr,
   int skip_sigs = 0;
   char *hexgrip = NULL;
   char *serialno = NULL;
+  sig_prefix_cache_t prefix_cache = NULL;
 
   /* Get the keyid from the keyblock.  */
   node = find_kbnode (keyblock, PKT_PUBLIC_KEY);
@@ -923,6 +937,9 @@ list_keyblock_print (ctrl_t ctrl, kbnode_t keyblock, int secret, int fpr,
   if (opt.with_key_data)
     print_key_data (pk);
 
+  if (listctx->check_sigs)
+    prefix_cache = sig_prefix_cache_open (keyblock);
+
   for (kbctx = NULL; (node = walk_kbnode (keyblock, &kbctx, 0));)
     {
       if (node->pkt->pkttype == PKT_USER_ID)
@@ -940,6 +957,9 @@ list_keyblock_print (ctrl_t ctrl, kbnode_t keyblock, int secret, int fpr,
 	  else
 	    skip_sigs = 0;
 
+	  if (listctx->check_sigs && opt.list_sigs)
+	    check_uid_signatures (ctrl, keyblock, node, 0);
+
 	  if (attrib_fp && uid->attrib_data != NULL)
 	    dump_attribs (uid, pk);
 
@@ -1141,6 +1161,7 @@ list_keyblock_print (ctrl_t ctrl, kbnode_t keyblock, int secret, int fpr,
 	  /* fixme: check or list other sigs here */
 	}
     }
+  sig_prefix_cache_close (prefix_cache);
   es_putc ('\n', es_stdout);
   xfree (serialno);
   xfree (hexgrip);
@@ -1220,6 +1241,7 @@ list_keyblock_colon (ctrl_t ctrl, kbnode_t keyblock,
   char *hexgrip_buffer = NULL;
   const char *hexgrip = NULL;
   char *serialno = NULL;
+  sig_prefix_cache_t prefix_cache = NULL;
   int stubkey;
   unsigned int keylength;
   char *curve = NULL;
@@ -1322,6 +1344,9 @@ list_keyblock_colon (ctrl_t ctrl, kbnode_t keyblock,
   if (opt.with_key_data)
     print_key_data (pk);
 
+  if (opt.check_sigs)
+    prefix_cache = sig_prefix_cache_open (keyblock);
+
   for (kbctx = NULL; (node = walk_kbnode (keyblock, &kbctx, 0));)
     {
       if (node->pkt->pkttype == PKT_USER_ID)
@@ -1329,6 +1354,9 @@ list_keyblock_colon (ctrl_t ctrl, kbnode_t keyblock,
 	  PKT_user_id *uid = node->pkt->pkt.user_id;
           int uid_validity;
 
+	  if (opt.check_sigs && opt.list_sigs)
+	    check_uid_signatures (ctrl, keyblock, node, 0);
+
 	  if (attrib_fp && uid->attrib_data != NULL)
 	    dump_attribs (uid, pk);
 
@@ -1571,6 +1599,7 @@ list_keyblock_colon (ctrl_t ctrl, kbnode_t keyblock,
           xfree (siguid);
 	}
     }
+  sig_prefix_cache_close (prefix_cache);
 
   xfree (curve);
   xfree (hexgrip_buffer);
@@ -1640,11 +1669,18 @@ list_keyblock (ctrl_t ctrl,
 {
   reorder_keyblock (keyblock);
 
+  /* Avoid a round trip to the agent for each key.  */
+  if (secret || (opt.with_colons && has_secret))
+    agent_prefetch_keyinfo (ctrl, keyblock);
+
   if (opt.with_colons)
     list_keyblock_colon (ctrl, keyblock, secret, has_secret);
   else
     list_keyblock_print (ctrl, keyblock, secret, fpr, listctx);
 
+  /* The infos may be outdated by the time they are asked for again.  */
+  agent_release_keyinfo_prefetch ();
+
   if (secret)
     es_fflush (es_stdout);
 }
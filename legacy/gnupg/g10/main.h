@@ -109,6 +109,7 @@ u16 checksum( byte *p, unsigned n );
 u16 checksum_mpi( gcry_mpi_t a );
 u32 buffer_to_u32( const byte *buffer );
 const byte *get_session_marker( size_t *rlen );
+unsigned int get_worker_threads (unsigned int max);
 
 enum gcry_cipher_algos map_cipher_openpgp_to_gcry (cipher_algo_t algo);
 #define openpgp_cipher_open(_a,_b,_c,_d) \
@@ -280,6 +281,36 @@ gpg_error_t check_signature_over_key_or_uid (ctrl_t ctrl,
                                              int *is_selfsig,
                                              PKT_public_key *ret_pk);
 
+/* Hash prefix caches to speed up checking many signatures over the
+   same keyblock.  */
+typedef struct sig_prefix_cache_s *sig_prefix_cache_t;
+sig_prefix_cache_t sig_prefix_cache_open (kbnode_t keyblock);
+void sig_prefix_cache_close (sig_prefix_cache_t cache);
+
+/* Check all signatures on the user ID UIDNODE of ROOT and cache the
+   results in the signature packets.  */
+int check_uid_signatures (ctrl_t ctrl, kbnode_t root, kbnode_t uidnode,
+                          int self_only);
+
+/* Check the signatures of many keyblocks on several threads.  */
+typedef struct sig_batch_s *sig_batch_t;
+typedef PKT_public_key *(*sig_batch_signer_t) (void *opaque, u32 *keyid);
+sig_batch_t sig_batch_new (void);
+void sig_batch_release (sig_batch_t batch);
+void sig_batch_add_keyblock (sig_batch_t batch, kbnode_t keyblock,
+                             sig_batch_signer_t get_signer, void *opaque);
+void sig_batch_start (sig_batch_t batch);
+void sig_batch_finish (sig_batch_t batch);
+
+
+/*-- sigcache.c --*/
+#define SIGCACHE_KEYLEN 32
+int sigcache_make_key (PKT_public_key *pk, PKT_signature *sig,
+                       gcry_md_hd_t digest, byte *hash);
+int sigcache_lookup (const byte *hash, gpg_error_t *r_rc);
+void sigcache_store (const byte *hash, PKT_public_key *pk, gpg_error_t rc);
+void sigcache_invalidate_keyblock (kbnode_t keyblock);
+void sigcache_dump_stats (void);
 
 /*-- delkey.c --*/
 gpg_error_t delete_keys (ctrl_t ctrl,
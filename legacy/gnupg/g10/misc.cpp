@@ -397,6 +397,27 @@ print_further_info (const char *format, ...)
 }
 
 
+/* Return the number of threads to use for independent public key
+ * operations, which is the number of online processors but at most
+ * MAX.  Without thread support this is always 1.  */
+unsigned int
+get_worker_threads (unsigned int max)
+{
+  static unsigned int ncpus;
+
+  if (!ncpus)
+    {
+      long n = -1;
+
+#if defined(HAVE_PTHREAD) && defined(_SC_NPROCESSORS_ONLN)
+      n = sysconf (_SC_NPROCESSORS_ONLN);
+#endif
+      ncpus = n < 1? 1 : (unsigned int)n;
+    }
+  return ncpus > max? max : ncpus;
+}
+
+
 /* Map OpenPGP algo numbers to those used by Libgcrypt.  We need to do
    this for algorithms we implemented in Libgcrypt after they become
    part of OpenPGP.  */
@@ -193,6 +193,8 @@ struct options
   const char *gpg_agent_info;
   int try_all_secrets;
   int no_sig_cache;
+  int key_cache_size;   /* Capacity of the key caches or 0.  */
+  int trustdb_mmap;     /* Map the trustdb into memory.  */
   int no_auto_check_trustdb;
   int preserve_permissions;
   struct groupitem *grouplist;
@@ -1005,6 +1005,19 @@ build_pk_list (ctrl_t ctrl, strlist_t rcpts, PK_LIST *ret_pk_list)
         }
     }
 
+  /* Find the keys of all recipients with one scan of the key
+   * database instead of one scan per recipient.  */
+  {
+    strlist_t names = NULL;
+
+    for (rov = remusr; rov; rov = rov->next)
+      if (!(rov->flags & PK_LIST_FROM_FILE)
+          && (!(rov->flags & PK_LIST_ENCRYPT_TO) || !opt.no_encrypt_to))
+        add_to_strlist (&names, rov->d);
+    prefetch_pubkeys_byname (ctrl, names);
+    free_strlist (names);
+  }
+
   /* Check whether there are any recipients in the list and build the
    * list of the encrypt-to ones (we always trust them). */
   for ( rov = remusr; rov; rov = rov->next )
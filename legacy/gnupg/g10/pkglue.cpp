@@ -240,6 +240,34 @@ pk_verify (pubkey_algo_t pkalgo, gcry_mpi_t hash,
 int
 pk_encrypt (pubkey_algo_t algo, gcry_mpi_t *resarr, gcry_mpi_t data,
             PKT_public_key *pk, gcry_mpi_t *pkey)
+{
+  gcry_mpi_t k = NULL;
+  byte fp[MAX_FINGERPRINT_LEN];
+  size_t fpn = 0;
+  int rc;
+
+  if (algo == PUBKEY_ALGO_ECDH)
+    {
+      rc = pk_ecdh_generate_ephemeral_key (pkey, &k);
+      if (rc)
+        return rc;
+      fingerprint_from_pk (pk, fp, &fpn);
+    }
+
+  rc = pk_encrypt_with_k (algo, resarr, data, fp, fpn, pkey, k);
+  gcry_mpi_release (k);
+  return rc;
+}
+
+
+/* This is pk_encrypt with the ECDH ephemeral secret K and the
+ * fingerprint FP of length FPN of the public key provided by the
+ * caller; both are ignored for other algorithms.  The function does
+ * not touch the public key object and may thus run on several threads
+ * at once.  */
+int
+pk_encrypt_with_k (pubkey_algo_t algo, gcry_mpi_t *resarr, gcry_mpi_t data,
+                   const byte *fp, size_t fpn, gcry_mpi_t *pkey, gcry_mpi_t k)
 {
   gcry_sexp_t s_ciph = NULL;
   gcry_sexp_t s_data = NULL;
@@ -267,32 +295,28 @@ pk_encrypt (pubkey_algo_t algo, gcry_mpi_t *resarr, gcry_mpi_t data,
     }
   else if (algo == PUBKEY_ALGO_ECDH)
     {
-      gcry_mpi_t k;
+      char *curve;
 
-      rc = pk_ecdh_generate_ephemeral_key (pkey, &k);
-      if (!rc)
+      if (!k)
+        return GPG_ERR_INV_ARG;
+
+      curve = openpgp_oid_to_str (pkey[0]);
+      if (!curve)
+        rc = gpg_error_from_syserror ();
+      else
         {
-          char *curve;
+          int with_djb_tweak_flag = openpgp_oid_is_cv25519 (pkey[0]);
 
-          curve = openpgp_oid_to_str (pkey[0]);
-          if (!curve)
-            rc = gpg_error_from_syserror ();
-          else
-            {
-              int with_djb_tweak_flag = openpgp_oid_is_cv25519 (pkey[0]);
-
-              /* Now use the ephemeral secret to compute the shared point.  */
-              rc = gcry_sexp_build (&s_pkey, NULL,
-                                    with_djb_tweak_flag ?
-                                    "(public-key(ecdh(curve%s)(flags djb-tweak)(q%m)))"
-                                    : "(public-key(ecdh(curve%s)(q%m)))",
-                                    curve, pkey[1]);
-              xfree (curve);
-              /* Put K into a simplified S-expression.  */
-              if (!rc)
-                rc = gcry_sexp_build (&s_data, NULL, "%m", k);
-            }
-          gcry_mpi_release (k);
+          /* Now use the ephemeral secret to compute the shared point.  */
+          rc = gcry_sexp_build (&s_pkey, NULL,
+                                with_djb_tweak_flag ?
+                                "(public-key(ecdh(curve%s)(flags djb-tweak)(q%m)))"
+                                : "(public-key(ecdh(curve%s)(q%m)))",
+                                curve, pkey[1]);
+          xfree (curve);
+          /* Put K into a simplified S-expression.  */
+          if (!rc)
+            rc = gcry_sexp_build (&s_data, NULL, "%m", k);
         }
     }
   else
@@ -310,8 +334,6 @@ pk_encrypt (pubkey_algo_t algo, gcry_mpi_t *resarr, gcry_mpi_t data,
   else if (algo == PUBKEY_ALGO_ECDH)
     {
       gcry_mpi_t shared, public_x, result;
-      byte fp[MAX_FINGERPRINT_LEN];
-      size_t fpn;
 
       /* Get the shared point and the ephemeral public key.  */
       shared = get_mpi_from_sexp (s_ciph, "s", GCRYMPI_FMT_USG);
@@ -326,7 +348,6 @@ pk_encrypt (pubkey_algo_t algo, gcry_mpi_t *resarr, gcry_mpi_t data,
         }
 
       result = NULL;
-      fingerprint_from_pk (pk, fp, &fpn);
       if (fpn != 20)
         rc = GPG_ERR_INV_LENGTH;
       else
@@ -29,12 +29,17 @@ int pk_verify (pubkey_algo_t algo, gcry_mpi_t hash, gcry_mpi_t *data,
                gcry_mpi_t *pkey);
 int pk_encrypt (pubkey_algo_t algo, gcry_mpi_t *resarr, gcry_mpi_t data,
 		PKT_public_key *pk, gcry_mpi_t *pkey);
+int pk_encrypt_with_k (pubkey_algo_t algo, gcry_mpi_t *resarr,
+                       gcry_mpi_t data, const byte *fp, size_t fpn,
+                       gcry_mpi_t *pkey, gcry_mpi_t k);
 int pk_check_secret_key (pubkey_algo_t algo, gcry_mpi_t *skey);
 
 
 /*-- ecdh.c --*/
 gcry_mpi_t  pk_ecdh_default_params (unsigned int qbits);
 gpg_error_t pk_ecdh_generate_ephemeral_key (gcry_mpi_t *pkey, gcry_mpi_t *r_k);
+gpg_error_t pk_ecdh_generate_ephemeral_keys (gcry_mpi_t **pkeys, size_t n,
+                                             gcry_mpi_t *r_k);
 gpg_error_t pk_ecdh_encrypt_with_shared_point
 /*         */  (int is_encrypt, gcry_mpi_t shared_mpi,
                 const byte pk_fp[MAX_FINGERPRINT_LEN],
@@ -23,6 +23,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#ifdef HAVE_PTHREAD
+# include <pthread.h>
+#endif
 
 #include "gpg.h"
 #include "../common/util.h"
@@ -42,6 +46,7 @@ static int check_signature_end (PKT_public_key *pk, PKT_signature *sig,
 
 static int check_signature_end_simple (PKT_public_key *pk, PKT_signature *sig,
                                        gcry_md_hd_t digest);
+static void hash_sig_trailer (PKT_signature *sig, gcry_md_hd_t digest);
 
 
 /* Statistics for signature verification.  */
@@ -51,16 +56,45 @@ struct
   unsigned int cached; /* Number of seen cache entries.  */
   unsigned int goodsig;/* Number of good verifications from the cache.  */
   unsigned int badsig; /* Number of bad verifications from the cache.  */
+  unsigned int prefix; /* Number of hash prefixes taken from the cache.  */
 } cache_stats;
 
 
+/* A hash context with the primary key and optionally a user ID
+   already hashed.  */
+struct sig_prefix_md
+{
+  struct sig_prefix_md *next;
+  int algo;           /* The digest algorithm.  */
+  PKT_user_id *uid;   /* The hashed user ID or NULL.  */
+  int v4;             /* The user ID was hashed for a v4 signature.  */
+  gcry_md_hd_t md;
+};
+
+/* When checking many signatures on a keyblock, the primary key and
+   the user IDs are hashed over and over again.  A prefix cache bound
+   to a keyblock keeps the hash contexts after these prefixes so that
+   they can be copied with gcry_md_copy.  The caches form a stack
+   because checking a signature may require to merge the self-sigs of
+   another keyblock.  */
+struct sig_prefix_cache_s
+{
+  sig_prefix_cache_t prev;
+  kbnode_t keyblock;
+  struct sig_prefix_md *mds;
+};
+
+static sig_prefix_cache_t prefix_caches;
+
+
 /* Dump verification stats.  */
 void
 sig_check_dump_stats (void)
 {
-  log_info ("sig_cache: total=%u cached=%u good=%u bad=%u\n",
+  log_info ("sig_cache: total=%u cached=%u good=%u bad=%u prefix=%u\n",
             cache_stats.total, cache_stats.cached,
-            cache_stats.goodsig, cache_stats.badsig);
+            cache_stats.goodsig, cache_stats.badsig, cache_stats.prefix);
+  sigcache_dump_stats ();
 }
 
 
@@ -449,8 +483,10 @@ check_signature_end_simple (PKT_public_key *pk, PKT_signature *sig,
                             gcry_md_hd_t digest)
 {
     gcry_mpi_t result = NULL;
-    int rc = 0;
+    gpg_error_t rc = 0;
     const struct weakhash *weak;
+    byte cachekey[SIGCACHE_KEYLEN];
+    int have_cachekey;
 
     for (weak = opt.weak_digests; weak; weak = weak->next)
       if (sig->digest_algo == weak->algo)
@@ -464,6 +500,43 @@ check_signature_end_simple (PKT_public_key *pk, PKT_signature *sig,
     gcry_md_enable (digest, sig->digest_algo);
 
     /* Complete the digest. */
+    hash_sig_trailer (sig, digest);
+
+    /* The outcome of the public key operation depends only on the key,
+       the digest and the signature values; see whether an earlier
+       invocation already computed it.  */
+    have_cachekey = sigcache_make_key (pk, sig, digest, cachekey);
+    if (!have_cachekey || !sigcache_lookup (cachekey, &rc))
+      {
+        /* Convert the digest to an MPI.  */
+        result = encode_md_value (pk, digest, sig->digest_algo );
+        if (!result)
+            return GPG_ERR_GENERAL;
+
+        /* Verify the signature.  */
+        rc = pk_verify( (pubkey_algo_t) (pk->pubkey_algo), result, sig->data, pk->pkey );
+        gcry_mpi_release (result);
+
+        if (have_cachekey)
+          sigcache_store (cachekey, pk, rc);
+      }
+
+    if( !rc && sig->flags.unknown_critical )
+      {
+	log_info(_("assuming bad signature from key %s"
+		   " due to an unknown critical bit\n"),keystr_from_pk(pk));
+	rc = GPG_ERR_BAD_SIGNATURE;
+      }
+
+    return rc;
+}
+
+
+/* Hash the trailer of the signature SIG into DIGEST and finalize
+   it.  */
+static void
+hash_sig_trailer (PKT_signature *sig, gcry_md_hd_t digest)
+{
     if( sig->version >= 4 )
 	gcry_md_putc( digest, sig->version );
     gcry_md_putc( digest, sig->sig_class );
@@ -503,24 +576,6 @@ check_signature_end_simple (PKT_public_key *pk, PKT_signature *sig,
 	gcry_md_write( digest, buf, 6 );
     }
     gcry_md_final( digest );
-
-    /* Convert the digest to an MPI.  */
-    result = encode_md_value (pk, digest, sig->digest_algo );
-    if (!result)
-        return GPG_ERR_GENERAL;
-
-    /* Verify the signature.  */
-    rc = pk_verify( (pubkey_algo_t) (pk->pubkey_algo), result, sig->data, pk->pkey );
-    gcry_mpi_release (result);
-
-    if( !rc && sig->flags.unknown_critical )
-      {
-	log_info(_("assuming bad signature from key %s"
-		   " due to an unknown critical bit\n"),keystr_from_pk(pk));
-	rc = GPG_ERR_BAD_SIGNATURE;
-      }
-
-    return rc;
 }
 
 
@@ -555,6 +610,160 @@ hash_uid_packet (PKT_user_id *uid, gcry_md_hd_t md, PKT_signature *sig )
     }
 }
 
+
+/* Return the innermost hash prefix cache open for the keyblock KB or
+ * NULL if there is none.  */
+static sig_prefix_cache_t
+find_prefix_cache (kbnode_t kb)
+{
+  sig_prefix_cache_t cache;
+
+  for (cache = prefix_caches; cache; cache = cache->prev)
+    if (cache->keyblock == kb)
+      break;
+  return cache;
+}
+
+
+/* Start a hash prefix cache for the keyblock KEYBLOCK.  Until the
+ * cache is closed, signature checks over KEYBLOCK reuse the hashed
+ * primary key and user IDs.  The caller must not change these
+ * packets while the cache is open.  Returns NULL on memory shortage,
+ * in which case things work as before.  */
+sig_prefix_cache_t
+sig_prefix_cache_open (kbnode_t keyblock)
+{
+  sig_prefix_cache_t cache;
+
+  log_assert (keyblock->pkt->pkttype == PKT_PUBLIC_KEY);
+
+  cache = (sig_prefix_cache_t) xtrycalloc (1, sizeof *cache);
+  if (!cache)
+    return NULL;
+  cache->keyblock = keyblock;
+  cache->prev = prefix_caches;
+  prefix_caches = cache;
+  return cache;
+}
+
+
+/* Release the hash prefix cache CACHE.  NULL is allowed.  */
+void
+sig_prefix_cache_close (sig_prefix_cache_t cache)
+{
+  sig_prefix_cache_t *pp;
+  struct sig_prefix_md *p, *pnext;
+
+  if (!cache)
+    return;
+
+  for (pp = &prefix_caches; *pp; pp = &(*pp)->prev)
+    if (*pp == cache)
+      {
+        *pp = cache->prev;
+        break;
+      }
+
+  for (p = cache->mds; p; p = pnext)
+    {
+      pnext = p->next;
+      gcry_md_close (p->md);
+      xfree (p);
+    }
+  xfree (cache);
+}
+
+
+/* Add a new entry for ALGO and UID to CACHE.  BASE is the entry with
+ * only the primary key hashed, or NULL to create that one.  */
+static struct sig_prefix_md *
+new_prefix_md (sig_prefix_cache_t cache, struct sig_prefix_md *base,
+               PKT_user_id *uid, PKT_signature *sig)
+{
+  struct sig_prefix_md *p;
+  gpg_error_t err;
+
+  p = (struct sig_prefix_md*) xtrycalloc (1, sizeof *p);
+  if (!p)
+    return NULL;
+
+  if (base)
+    {
+      err = gcry_md_copy (&p->md, base->md);
+      if (!err)
+        hash_uid_packet (uid, p->md, sig);
+    }
+  else
+    {
+      err = gcry_md_open (&p->md, sig->digest_algo, 0);
+      if (!err)
+        hash_public_key (p->md, cache->keyblock->pkt->pkt.public_key);
+    }
+  if (err)
+    {
+      xfree (p);
+      return NULL;
+    }
+
+  p->algo = sig->digest_algo;
+  p->uid = base? uid : NULL;
+  p->v4 = base? (sig->version >= 4) : 0;
+  p->next = cache->mds;
+  cache->mds = p;
+  return p;
+}
+
+
+/* Return at R_MD a new hash context for SIG with the primary key of
+ * the keyblock KB and, if UID is not NULL, the user ID UID hashed.
+ * The context is taken from a prefix cache if one is open for KB.  */
+static gpg_error_t
+open_prefix_md (kbnode_t kb, PKT_user_id *uid, PKT_signature *sig,
+                gcry_md_hd_t *r_md)
+{
+  sig_prefix_cache_t cache;
+  struct sig_prefix_md *p, *base = NULL;
+  int v4 = uid? (sig->version >= 4) : 0;
+  gpg_error_t err;
+
+  cache = find_prefix_cache (kb);
+  if (cache)
+    {
+      for (p = cache->mds; p; p = p->next)
+        {
+          if (p->algo != sig->digest_algo)
+            continue;
+          if (p->uid == uid && p->v4 == v4)
+            {
+              cache_stats.prefix++;
+              return gcry_md_copy (r_md, p->md);
+            }
+          if (!p->uid)
+            base = p;
+        }
+
+      if (!base)
+        base = new_prefix_md (cache, NULL, NULL, sig);
+      else
+        cache_stats.prefix++;
+      p = base;
+      if (p && uid)
+        p = new_prefix_md (cache, base, uid, sig);
+      if (p)
+        return gcry_md_copy (r_md, p->md);
+      /* On memory shortage fall through to the uncached code.  */
+    }
+
+  err = gcry_md_open (r_md, sig->digest_algo, 0);
+  if (err)
+    return err;
+  hash_public_key (*r_md, kb->pkt->pkt.public_key);
+  if (uid)
+    hash_uid_packet (uid, *r_md, sig);
+  return 0;
+}
+
+
 static void
 cache_sig_result ( PKT_signature *sig, int result )
 {
@@ -899,28 +1108,30 @@ check_signature_over_key_or_uid (ctrl_t ctrl, PKT_public_key *signer,
         }
     }
 
-  /* We checked above that we supported this algo, so an error here is
-     a bug.  */
-  if (gcry_md_open (&md, sig->digest_algo, 0))
-    BUG ();
-
-  /* Hash the relevant data.  */
+  /* Hash the relevant data.  We checked above that we supported
+     this algo, so an error here is a bug.  */
 
   if (/* Direct key signature.  */
       sig->sig_class == 0x1f
       /* Primary key revocation.  */
-      || sig->sig_class == 0x20)
+      || sig->sig_class == 0x20
+      /* Primary key binding (made by a subkey).  */
+      || sig->sig_class == 0x19)
     {
       log_assert (packet->pkttype == PKT_PUBLIC_KEY);
-      hash_public_key (md, packet->pkt.public_key);
-      rc = check_signature_end_simple (signer, sig, md);
-    }
-  else if (/* Primary key binding (made by a subkey).  */
-      sig->sig_class == 0x19)
-    {
-      log_assert (packet->pkttype == PKT_PUBLIC_KEY);
-      hash_public_key (md, packet->pkt.public_key);
-      hash_public_key (md, signer);
+      if (packet->pkt.public_key == pripk)
+        {
+          if (open_prefix_md (kb, NULL, sig, &md))
+            BUG ();
+        }
+      else
+        {
+          if (gcry_md_open (&md, sig->digest_algo, 0))
+            BUG ();
+          hash_public_key (md, packet->pkt.public_key);
+        }
+      if (sig->sig_class == 0x19)
+        hash_public_key (md, signer);
       rc = check_signature_end_simple (signer, sig, md);
     }
   else if (/* Subkey binding.  */
@@ -929,7 +1140,8 @@ check_signature_over_key_or_uid (ctrl_t ctrl, PKT_public_key *signer,
            || sig->sig_class == 0x28)
     {
       log_assert (packet->pkttype == PKT_PUBLIC_SUBKEY);
-      hash_public_key (md, pripk);
+      if (open_prefix_md (kb, NULL, sig, &md))
+        BUG ();
       hash_public_key (md, packet->pkt.public_key);
       rc = check_signature_end_simple (signer, sig, md);
     }
@@ -942,8 +1154,8 @@ check_signature_over_key_or_uid (ctrl_t ctrl, PKT_public_key *signer,
            || sig->sig_class == 0x30)
     {
       log_assert (packet->pkttype == PKT_USER_ID);
-      hash_public_key (md, pripk);
-      hash_uid_packet (packet->pkt.user_id, md, sig);
+      if (open_prefix_md (kb, packet->pkt.user_id, sig, &md))
+        BUG ();
       rc = check_signature_end_simple (signer, sig, md);
     }
   else
@@ -1164,3 +1376,385 @@ check_key_signature2 (ctrl_t ctrl,
 
   return rc;
 }
+
+
+/* Check the signatures on the user ID UIDNODE of the keyblock ROOT in
+ * one go.  These are the signature packets directly following
+ * UIDNODE.  If SELF_ONLY is set, only self-signatures are checked.
+ * The primary key and the user ID are hashed only once per digest
+ * algorithm.  The results are cached in the signature packets for
+ * the following check_key_signature calls; thus nothing is done if
+ * --no-sig-cache is active.  Returns the number of good
+ * signatures.  */
+int
+check_uid_signatures (ctrl_t ctrl, kbnode_t root, kbnode_t uidnode,
+                      int self_only)
+{
+  PKT_public_key *pk = root->pkt->pkt.public_key;
+  sig_prefix_cache_t opened = NULL;
+  kbnode_t n;
+  int good = 0;
+
+  log_assert (root->pkt->pkttype == PKT_PUBLIC_KEY);
+  log_assert (uidnode->pkt->pkttype == PKT_USER_ID);
+
+  if (opt.no_sig_cache)
+    return 0;
+
+  /* Keep using a cache of the caller, which may already have the
+     primary key hashed.  */
+  if (!find_prefix_cache (root))
+    opened = sig_prefix_cache_open (root);
+  for (n = uidnode->next; n && n->pkt->pkttype == PKT_SIGNATURE; n = n->next)
+    {
+      PKT_signature *sig = n->pkt->pkt.signature;
+
+      if (!IS_UID_SIG (sig) && !IS_UID_REV (sig))
+        continue;
+      if (self_only && keyid_cmp (pk_keyid (pk), sig->keyid))
+        continue;
+      if (!check_key_signature (ctrl, root, n, NULL))
+        good++;
+    }
+  sig_prefix_cache_close (opened);
+
+  return good;
+}
+
+
+/* A signature over a key or user ID to be checked by a sig_batch.  */
+struct sig_job
+{
+  PKT_signature *sig;
+  PKT_public_key *signer;
+  PKT_public_key *pripk;  /* The primary key of the keyblock.  */
+  PKT_public_key *subpk;  /* The subkey for a subkey binding.  */
+  PKT_user_id *uid;       /* The user ID for a certification.  */
+  gpg_error_t rc;
+  int store;              /* Store the result in the sigcache.  */
+  byte cachekey[SIGCACHE_KEYLEN];
+};
+
+/* Signature checks over many keyblocks are independent public key
+   operations.  A batch collects them and runs them on several
+   threads; the results are then put into the signature packets so
+   that the following check_key_signature calls only need to look at
+   the cached status.  Except for the sigcache lookups the jobs do
+   not touch any global state.  */
+struct sig_batch_s
+{
+  struct sig_job *jobs;
+  unsigned int njobs;
+  unsigned int maxjobs;
+  unsigned int next;      /* The next job to run.  */
+#ifdef HAVE_PTHREAD
+  pthread_t *threads;
+  unsigned int nthreads;
+#endif
+};
+
+#ifdef HAVE_PTHREAD
+/* Protects the job index of a running batch and the sigcache.  */
+static pthread_mutex_t sig_batch_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+/* Maximum number of threads used for a batch.  */
+#define SIG_BATCH_MAX_THREADS 16
+
+
+/* Return the number of threads to use for a batch.  */
+static unsigned int
+sig_batch_threads (void)
+{
+  return get_worker_threads (SIG_BATCH_MAX_THREADS);
+}
+
+
+static void
+sig_batch_lock_acquire (void)
+{
+#ifdef HAVE_PTHREAD
+  pthread_mutex_lock (&sig_batch_lock);
+#endif
+}
+
+static void
+sig_batch_lock_release (void)
+{
+#ifdef HAVE_PTHREAD
+  pthread_mutex_unlock (&sig_batch_lock);
+#endif
+}
+
+
+/* Create a new signature check batch.  */
+sig_batch_t
+sig_batch_new (void)
+{
+  return (sig_batch_t) xcalloc (1, sizeof (struct sig_batch_s));
+}
+
+
+/* Release BATCH.  NULL is allowed.  The batch must not be running.  */
+void
+sig_batch_release (sig_batch_t batch)
+{
+  if (!batch)
+    return;
+  xfree (batch->jobs);
+  xfree (batch);
+}
+
+
+/* Return true if the signature SIG can be checked by a batch job.  */
+static int
+sig_job_possible (PKT_signature *sig)
+{
+  const struct weakhash *weak;
+
+  if (sig->flags.checked)
+    return 0;  /* Status already known.  */
+  if (openpgp_pk_test_algo ((pubkey_algo_t) (sig->pubkey_algo))
+      || openpgp_md_test_algo ((digest_algo_t) (sig->digest_algo)))
+    return 0;
+  for (weak = opt.weak_digests; weak; weak = weak->next)
+    if (sig->digest_algo == weak->algo)
+      return 0;  /* The regular check prints a note.  */
+  return 1;
+}
+
+
+/* Add all signatures of KEYBLOCK which can be checked without a key
+ * lookup to BATCH.  These are the self-signatures and the
+ * certifications by a key which GET_SIGNER returns for the key ID of
+ * the signature; GET_SIGNER is called with OPAQUE and may return NULL.
+ * Signatures are only added if the caller is able to use the cached
+ * status, i.e. not with --no-sig-cache.  The keyblock must not be
+ * changed until sig_batch_finish has been called.  */
+void
+sig_batch_add_keyblock (sig_batch_t batch, kbnode_t keyblock,
+                        sig_batch_signer_t get_signer, void *opaque)
+{
+  PKT_public_key *pripk;
+  PKT_user_id *uid = NULL;
+  PKT_public_key *subpk = NULL;
+  u32 *pri_kid;
+  kbnode_t node, n;
+
+  if (opt.no_sig_cache || keyblock->pkt->pkttype != PKT_PUBLIC_KEY)
+    return;
+
+  pripk = keyblock->pkt->pkt.public_key;
+  pri_kid = pk_keyid (pripk);
+
+  for (node = keyblock->next; node; node = node->next)
+    {
+      PKT_signature *sig;
+      PKT_public_key *signer = NULL;
+      struct sig_job *job;
+      int is_self;
+
+      if (node->pkt->pkttype == PKT_USER_ID)
+        {
+          uid = node->pkt->pkt.user_id;
+          continue;
+        }
+      if (node->pkt->pkttype == PKT_PUBLIC_SUBKEY)
+        {
+          subpk = node->pkt->pkt.public_key;
+          pk_keyid (subpk);
+          continue;
+        }
+      if (node->pkt->pkttype != PKT_SIGNATURE)
+        continue;
+
+      sig = node->pkt->pkt.signature;
+      if (!sig_job_possible (sig))
+        continue;
+      is_self = !keyid_cmp (pri_kid, sig->keyid);
+
+      /* Mirror the choice of the signer and the hashed data in
+         check_key_signature2.  */
+      if (IS_UID_SIG (sig) || IS_UID_REV (sig))
+        {
+          if (!uid)
+            continue;
+          if (is_self)
+            signer = pripk;
+          else if (get_signer)
+            {
+              /* A certification by one of our subkeys is looked up
+                 in the keyblock first; leave that to the regular
+                 code.  */
+              for (n = keyblock->next; n; n = n->next)
+                if (n->pkt->pkttype == PKT_PUBLIC_SUBKEY
+                    && !keyid_cmp (pk_keyid (n->pkt->pkt.public_key),
+                                   sig->keyid))
+                  break;
+              if (!n)
+                signer = get_signer (opaque, sig->keyid);
+            }
+        }
+      else if (sig->sig_class == 0x18 || sig->sig_class == 0x28)
+        {
+          if (!subpk || (sig->sig_class == 0x18 && !is_self))
+            continue;
+          signer = pripk;
+        }
+      else if (sig->sig_class == 0x1f || (sig->sig_class == 0x20 && is_self))
+        signer = pripk;
+
+      if (!signer)
+        continue;
+
+      if (batch->njobs == batch->maxjobs)
+        {
+          batch->maxjobs = batch->maxjobs? 2 * batch->maxjobs : 64;
+          batch->jobs = (struct sig_job*)
+            xrealloc (batch->jobs, batch->maxjobs * sizeof *batch->jobs);
+        }
+      job = batch->jobs + batch->njobs++;
+      memset (job, 0, sizeof *job);
+      job->sig = sig;
+      job->signer = signer;
+      job->pripk = pripk;
+      if (sig->sig_class == 0x18 || sig->sig_class == 0x28)
+        job->subpk = subpk;
+      else if (IS_UID_SIG (sig) || IS_UID_REV (sig))
+        job->uid = uid;
+    }
+}
+
+
+/* Run the public key operation of JOB.  */
+static void
+sig_job_run (struct sig_job *job)
+{
+  PKT_signature *sig = job->sig;
+  PKT_public_key *pk = job->signer;
+  gcry_md_hd_t md;
+  gcry_mpi_t result;
+  int have_cachekey, cached;
+
+  if (gcry_md_open (&md, sig->digest_algo, 0))
+    {
+      job->rc = GPG_ERR_GENERAL;
+      return;
+    }
+  hash_public_key (md, job->pripk);
+  if (job->subpk)
+    hash_public_key (md, job->subpk);
+  if (job->uid)
+    hash_uid_packet (job->uid, md, sig);
+  hash_sig_trailer (sig, md);
+
+  sig_batch_lock_acquire ();
+  have_cachekey = sigcache_make_key (pk, sig, md, job->cachekey);
+  cached = have_cachekey && sigcache_lookup (job->cachekey, &job->rc);
+  sig_batch_lock_release ();
+
+  if (!cached)
+    {
+      result = encode_md_value (pk, md, sig->digest_algo);
+      if (!result)
+        job->rc = GPG_ERR_GENERAL;
+      else
+        {
+          job->rc = pk_verify ((pubkey_algo_t) (pk->pubkey_algo), result,
+                               sig->data, pk->pkey);
+          gcry_mpi_release (result);
+          job->store = have_cachekey;
+        }
+    }
+  gcry_md_close (md);
+}
+
+
+/* Take the next job of BATCH and run it until none is left.  */
+static void *
+sig_batch_worker (void *arg)
+{
+  sig_batch_t batch = (sig_batch_t) arg;
+  unsigned int idx;
+
+  for (;;)
+    {
+      sig_batch_lock_acquire ();
+      idx = batch->next < batch->njobs? batch->next++ : batch->njobs;
+      sig_batch_lock_release ();
+      if (idx == batch->njobs)
+        break;
+      sig_job_run (batch->jobs + idx);
+    }
+  return NULL;
+}
+
+
+/* Start checking the signatures of BATCH.  Until sig_batch_finish
+ * has been called the caller may only do things which neither change
+ * the involved keyblocks and signer keys nor use the sigcache, like
+ * reading the next keyblocks from the keydb.  */
+void
+sig_batch_start (sig_batch_t batch)
+{
+#ifdef HAVE_PTHREAD
+  unsigned int i, n;
+
+  batch->next = 0;
+  n = sig_batch_threads ();
+  if (n > batch->njobs)
+    n = batch->njobs;
+  if (n > 1)
+    {
+      batch->threads = (pthread_t*) xcalloc (n, sizeof *batch->threads);
+      for (i = 0; i < n; i++)
+        if (pthread_create (batch->threads + i, NULL,
+                            sig_batch_worker, batch))
+          break;
+      batch->nthreads = i;
+      if (i)
+        return;
+      xfree (batch->threads);
+      batch->threads = NULL;
+    }
+#endif
+
+  /* Run the jobs in the calling thread.  */
+  batch->next = 0;
+  sig_batch_worker (batch);
+}
+
+
+/* Wait for the jobs of BATCH and cache the results in the signature
+ * packets.  Afterwards the batch is empty and may be used again.  */
+void
+sig_batch_finish (sig_batch_t batch)
+{
+  struct sig_job *job;
+  unsigned int i;
+
+#ifdef HAVE_PTHREAD
+  for (i = 0; i < batch->nthreads; i++)
+    pthread_join (batch->threads[i], NULL);
+  xfree (batch->threads);
+  batch->threads = NULL;
+  batch->nthreads = 0;
+#endif
+
+  for (i = 0; i < batch->njobs; i++)
+    {
+      job = batch->jobs + i;
+      if (job->store)
+        sigcache_store (job->cachekey, job->signer, job->rc);
+      if (!job->rc && job->sig->flags.unknown_critical)
+        {
+          log_info (_("assuming bad signature from key %s"
+                      " due to an unknown critical bit\n"),
+                    keystr_from_pk (job->signer));
+          job->rc = GPG_ERR_BAD_SIGNATURE;
+        }
+      cache_sig_result (job->sig, job->rc);
+    }
+  batch->njobs = 0;
+  batch->next = 0;
+}
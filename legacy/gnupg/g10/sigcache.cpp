@@ -0,0 +1,640 @@
+/* sigcache.c - Persistent cache for signature verification results
+ * Copyright (C) 2017 The NeoPG developers
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* The flags.checked/valid bits of a signature packet only live as
+ * long as the process.  This module keeps the outcome of the public
+ * key operation in a file in the home directory so that listing or
+ * checking a large keyring does not redo thousands of verifications
+ * on every invocation.
+ *
+ * An entry is indexed by a SHA-256 hash over the signer's
+ * fingerprint, the final digest of the signed material (which covers
+ * the signed object and the hashed part of the signature packet) and
+ * the signature values.  Thus an entry can never be used for another
+ * key, another object or another signature; a changed keyblock simply
+ * yields different index hashes.  Entries are nevertheless dropped for all
+ * keys of a keyblock which is updated or deleted through keydb so
+ * that the file does not keep stale data.
+ *
+ * The file consists of a 16 byte header followed by fixed size
+ * records:
+ *
+ *   byte 0-31  SHA-256 index hash
+ *   byte 32-39 Key ID of the signing (sub)key
+ *   byte 40    1 = good signature, 2 = bad signature
+ *   byte 41-47 reserved
+ *
+ * New entries are appended at exit.  If entries were dropped or the
+ * file grew too large, it is rewritten using a temporary file.
+ * Concurrent processes may lose each other's entries, which is fine
+ * for a cache.
+ *
+ * The module has no lock of its own.  The threads of a sig_batch
+ * (sig-check.c) call sigcache_make_key and sigcache_lookup only with
+ * the sig_batch lock held.  All other calls are made by the main
+ * thread while no batch is running; see sig_batch_start.  */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "gpg.h"
+#include "../common/util.h"
+#include "options.h"
+#include "packet.h"
+#include "keydb.h"
+#include "main.h"
+#include "../common/i18n.h"
+#include "../common/host2net.h"
+
+#if defined(HAVE_DOSISH_SYSTEM) || defined(__CYGWIN__)
+#define MY_O_BINARY  O_BINARY
+#else
+#define MY_O_BINARY  0
+#endif
+
+#define SIGCACHE_MAGIC        "GPGsigC"
+#define SIGCACHE_VERSION      1
+#define SIGCACHE_HEADER_SIZE  16
+#define SIGCACHE_RECORD_SIZE  48
+
+/* Number of entries after which the file is compacted to the entries
+ * used or added by this process.  */
+#define SIGCACHE_MAX_ENTRIES  (1024*1024)
+
+#define SIGCACHE_GOOD  1
+#define SIGCACHE_BAD   2
+
+/* An entry of the in-core table.  Entries are kept in one array and
+ * chained by index; 0 terminates a chain.  */
+struct sigcache_entry
+{
+  unsigned int next;      /* Next entry in the hash chain.  */
+  unsigned int kid_next;  /* Next entry with the same key id bucket.  */
+  u32 kid[2];             /* Key ID of the signing key.  */
+  byte result;            /* SIGCACHE_GOOD, SIGCACHE_BAD or 0 if dropped. */
+  byte used;              /* Looked up or added by this process.  */
+  byte is_new;            /* Not yet written to the file.  */
+  byte hash[SIGCACHE_KEYLEN];
+};
+
+static struct
+{
+  int loaded;             /* The file has been read.  */
+  int disabled;           /* Do not use the cache at all.  */
+  int need_rewrite;       /* Entries were dropped.  */
+  char *fname;
+  struct sigcache_entry *entries;  /* Index 0 is not used.  */
+  unsigned int nentries;  /* Including the unused slot.  */
+  unsigned int nalloced;
+  unsigned int *buckets;  /* Hash index.  */
+  unsigned int *kid_buckets;       /* Key ID index.  */
+  unsigned int nbuckets;  /* Power of two.  */
+  unsigned int nnew;      /* Number of entries to append.  */
+} sigcache;
+
+static struct
+{
+  unsigned int loaded;
+  unsigned int lookups;
+  unsigned int hits;
+  unsigned int stored;
+  unsigned int dropped;
+} sigcache_stats;
+
+
+static void sigcache_flush (void);
+
+
+static inline unsigned int
+hash_bucket (const byte *hash)
+{
+  return buf32_to_uint (hash) & (sigcache.nbuckets - 1);
+}
+
+static inline unsigned int
+kid_bucket (const u32 *kid)
+{
+  return (kid[0] ^ kid[1]) & (sigcache.nbuckets - 1);
+}
+
+
+/* Grow the table so that it has room for at least one more entry.
+ * Returns false on memory shortage.  */
+static int
+grow_table (void)
+{
+  struct sigcache_entry *e;
+  unsigned int i, n;
+
+  if (sigcache.nentries < sigcache.nalloced)
+    return 1;
+
+  n = sigcache.nalloced? sigcache.nalloced * 2 : 1024;
+  e = (struct sigcache_entry*) xtryrealloc (sigcache.entries, n * sizeof *e);
+  if (!e)
+    return 0;
+  sigcache.entries = e;
+  sigcache.nalloced = n;
+  if (!sigcache.nentries)
+    {
+      memset (&sigcache.entries[0], 0, sizeof sigcache.entries[0]);
+      sigcache.nentries = 1;
+    }
+
+  /* Keep the load factor of the index at most 1.  */
+  if (n > sigcache.nbuckets)
+    {
+      xfree (sigcache.buckets);
+      xfree (sigcache.kid_buckets);
+      sigcache.nbuckets = n;
+      sigcache.buckets = (unsigned int*) xtrycalloc (n, sizeof (unsigned int));
+      sigcache.kid_buckets = (unsigned int*) xtrycalloc (n,
+                                                        sizeof (unsigned int));
+      if (!sigcache.buckets || !sigcache.kid_buckets)
+        {
+          xfree (sigcache.buckets);
+          xfree (sigcache.kid_buckets);
+          sigcache.buckets = sigcache.kid_buckets = NULL;
+          sigcache.nbuckets = 0;
+          return 0;
+        }
+      for (i = 1; i < sigcache.nentries; i++)
+        {
+          e = sigcache.entries + i;
+          e->next = sigcache.buckets[hash_bucket (e->hash)];
+          sigcache.buckets[hash_bucket (e->hash)] = i;
+          e->kid_next = sigcache.kid_buckets[kid_bucket (e->kid)];
+          sigcache.kid_buckets[kid_bucket (e->kid)] = i;
+        }
+    }
+  return 1;
+}
+
+
+static struct sigcache_entry *
+find_entry (const byte *hash)
+{
+  unsigned int i;
+
+  if (!sigcache.nbuckets)
+    return NULL;
+  for (i = sigcache.buckets[hash_bucket (hash)]; i;
+       i = sigcache.entries[i].next)
+    if (!memcmp (sigcache.entries[i].hash, hash, SIGCACHE_KEYLEN))
+      return sigcache.entries + i;
+  return NULL;
+}
+
+
+/* Add a new entry or update an existing one.  Returns the entry or
+ * NULL on memory shortage.  */
+static struct sigcache_entry *
+put_entry (const byte *hash, const u32 *kid, int result)
+{
+  struct sigcache_entry *e;
+  unsigned int idx;
+
+  e = find_entry (hash);
+  if (e)
+    {
+      e->result = result;
+      return e;
+    }
+
+  if (!grow_table () || !sigcache.nbuckets)
+    return NULL;
+  idx = sigcache.nentries++;
+  e = sigcache.entries + idx;
+  memset (e, 0, sizeof *e);
+  memcpy (e->hash, hash, SIGCACHE_KEYLEN);
+  e->kid[0] = kid[0];
+  e->kid[1] = kid[1];
+  e->result = result;
+  e->next = sigcache.buckets[hash_bucket (hash)];
+  sigcache.buckets[hash_bucket (hash)] = idx;
+  e->kid_next = sigcache.kid_buckets[kid_bucket (kid)];
+  sigcache.kid_buckets[kid_bucket (kid)] = idx;
+  return e;
+}
+
+
+/* Read the cache file into the table.  This is done on first use.  */
+static void
+load_cache (void)
+{
+  struct stat st;
+  byte *buffer = NULL;
+  size_t nbytes, n;
+  ssize_t nread;
+  int fd;
+
+  if (sigcache.loaded)
+    return;
+  sigcache.loaded = 1;
+  atexit (sigcache_flush);
+
+  sigcache.fname = make_filename (gnupg_homedir (),
+                                  "sigcache" EXTSEP_S "db", NULL);
+
+  fd = open (sigcache.fname, O_RDONLY | MY_O_BINARY);
+  if (fd == -1)
+    {
+      if (errno != ENOENT)
+        {
+          log_info (_("can't open '%s': %s\n"),
+                    sigcache.fname, strerror (errno));
+          sigcache.disabled = 1;
+        }
+      return;
+    }
+
+  if (fstat (fd, &st) || st.st_size < SIGCACHE_HEADER_SIZE)
+    goto invalid;
+
+  nbytes = st.st_size;
+  buffer = (byte*) xtrymalloc (nbytes);
+  if (!buffer)
+    goto leave;
+  for (n = 0; n < nbytes; n += nread)
+    {
+      do
+        nread = read (fd, buffer + n, nbytes - n);
+      while (nread == -1 && errno == EINTR);
+      if (nread <= 0)
+        goto invalid;
+    }
+
+  if (memcmp (buffer, SIGCACHE_MAGIC, 8)
+      || buf32_to_uint (buffer + 8) != SIGCACHE_VERSION)
+    goto invalid;
+
+  for (n = SIGCACHE_HEADER_SIZE; n + SIGCACHE_RECORD_SIZE <= nbytes;
+       n += SIGCACHE_RECORD_SIZE)
+    {
+      const byte *rec = buffer + n;
+      u32 kid[2];
+
+      if (rec[40] != SIGCACHE_GOOD && rec[40] != SIGCACHE_BAD)
+        continue;
+      kid[0] = buf32_to_u32 (rec + 32);
+      kid[1] = buf32_to_u32 (rec + 36);
+      if (!put_entry (rec, kid, rec[40]))
+        break;
+      sigcache_stats.loaded++;
+    }
+  /* A partial trailing record is the result of an interrupted write;
+     get rid of it.  */
+  if (n != nbytes)
+    sigcache.need_rewrite = 1;
+  goto leave;
+
+ invalid:
+  log_info ("sigcache: ignoring invalid file '%s'\n", sigcache.fname);
+  sigcache.need_rewrite = 1;
+
+ leave:
+  xfree (buffer);
+  close (fd);
+  if (DBG_CACHE)
+    log_debug ("sigcache: loaded %u entries from '%s'\n",
+               sigcache_stats.loaded, sigcache.fname);
+}
+
+
+static void
+build_record (byte *rec, const struct sigcache_entry *e)
+{
+  memset (rec, 0, SIGCACHE_RECORD_SIZE);
+  memcpy (rec, e->hash, SIGCACHE_KEYLEN);
+  rec[32] = e->kid[0] >> 24;
+  rec[33] = e->kid[0] >> 16;
+  rec[34] = e->kid[0] >>  8;
+  rec[35] = e->kid[0];
+  rec[36] = e->kid[1] >> 24;
+  rec[37] = e->kid[1] >> 16;
+  rec[38] = e->kid[1] >>  8;
+  rec[39] = e->kid[1];
+  rec[40] = e->result;
+}
+
+
+static int
+write_all (int fd, const byte *buffer, size_t length)
+{
+  ssize_t n;
+
+  while (length)
+    {
+      do
+        n = write (fd, buffer, length);
+      while (n == -1 && errno == EINTR);
+      if (n <= 0)
+        return -1;
+      buffer += n;
+      length -= n;
+    }
+  return 0;
+}
+
+
+/* Write the entries selected by ONLY_NEW and ONLY_USED to FD.  */
+static int
+write_entries (int fd, int only_new, int only_used)
+{
+  byte buffer[SIGCACHE_RECORD_SIZE * 256];
+  size_t n = 0;
+  unsigned int i;
+
+  for (i = 1; i < sigcache.nentries; i++)
+    {
+      struct sigcache_entry *e = sigcache.entries + i;
+
+      if (!e->result || (only_new && !e->is_new) || (only_used && !e->used))
+        continue;
+      build_record (buffer + n, e);
+      n += SIGCACHE_RECORD_SIZE;
+      if (n == sizeof buffer)
+        {
+          if (write_all (fd, buffer, n))
+            return -1;
+          n = 0;
+        }
+    }
+  if (n && write_all (fd, buffer, n))
+    return -1;
+  return 0;
+}
+
+
+/* Write out new entries.  This is called at exit.  */
+static void
+sigcache_flush (void)
+{
+  byte header[SIGCACHE_HEADER_SIZE];
+  char *tmpname;
+  int fd;
+
+  if (!sigcache.loaded || sigcache.disabled || !sigcache.fname)
+    return;
+  if (!sigcache.nnew && !sigcache.need_rewrite)
+    return;
+
+  if (!sigcache.need_rewrite
+      && sigcache.nentries - 1 <= SIGCACHE_MAX_ENTRIES)
+    {
+      struct stat st;
+
+      fd = open (sigcache.fname, O_WRONLY | O_APPEND | MY_O_BINARY);
+      if (fd != -1)
+        {
+          /* Only append if the file still has a valid layout; another
+             process may have replaced it meanwhile.  */
+          if (!fstat (fd, &st) && st.st_size >= SIGCACHE_HEADER_SIZE
+              && !((st.st_size - SIGCACHE_HEADER_SIZE)
+                   % SIGCACHE_RECORD_SIZE))
+            {
+              if (write_entries (fd, 1, 0))
+                log_info ("sigcache: error writing '%s': %s\n",
+                          sigcache.fname, strerror (errno));
+              close (fd);
+              return;
+            }
+          close (fd);
+        }
+    }
+
+  /* Rewrite the whole file.  Make sure not to create a home
+     directory just for the cache.  */
+  tmpname = xtryasprintf ("%s.%d.tmp", sigcache.fname, (int)getpid ());
+  if (!tmpname)
+    return;
+  fd = open (tmpname, O_WRONLY | O_CREAT | O_TRUNC | MY_O_BINARY, 0600);
+  if (fd == -1)
+    {
+      if (errno != ENOENT && !opt.quiet)
+        log_info (_("can't create '%s': %s\n"), tmpname, strerror (errno));
+      xfree (tmpname);
+      return;
+    }
+  memset (header, 0, sizeof header);
+  memcpy (header, SIGCACHE_MAGIC, 8);
+  header[11] = SIGCACHE_VERSION;
+  if (write_all (fd, header, sizeof header)
+      || write_entries (fd, 0,
+                        sigcache.nentries - 1 > SIGCACHE_MAX_ENTRIES))
+    {
+      log_info ("sigcache: error writing '%s': %s\n",
+                tmpname, strerror (errno));
+      close (fd);
+      gnupg_remove (tmpname);
+    }
+  else if (close (fd) || rename (tmpname, sigcache.fname))
+    {
+      log_info (_("renaming '%s' to '%s' failed: %s\n"),
+                tmpname, sigcache.fname, strerror (errno));
+      gnupg_remove (tmpname);
+    }
+  xfree (tmpname);
+}
+
+
+/* Return true if the persistent cache shall be used.  */
+static int
+sigcache_enabled (void)
+{
+  if (opt.no_sig_cache || opt.dry_run)
+    return 0;
+  load_cache ();
+  return !sigcache.disabled;
+}
+
+
+/* Compute the index hash for a verification of SIG with PK over the
+ * completed hash context DIGEST and store it at HASH, which must
+ * provide SIGCACHE_KEYLEN bytes.  Returns false if no index can be
+ * computed.  A sig_batch thread must hold the sig_batch lock because
+ * the file is loaded on first use.  */
+int
+sigcache_make_key (PKT_public_key *pk, PKT_signature *sig,
+                   gcry_md_hd_t digest, byte *hash)
+{
+  gcry_md_hd_t md;
+  byte fpr[MAX_FINGERPRINT_LEN];
+  const byte *dgst;
+  size_t fprlen;
+  int i, nsig;
+
+  if (!sigcache_enabled ())
+    return 0;
+
+  nsig = pubkey_get_nsig ((pubkey_algo_t) (sig->pubkey_algo));
+  dgst = gcry_md_read (digest, sig->digest_algo);
+  if (!nsig || !dgst)
+    return 0;
+
+  if (gcry_md_open (&md, GCRY_MD_SHA256, 0))
+    return 0;
+
+  fingerprint_from_pk (pk, fpr, &fprlen);
+  gcry_md_putc (md, pk->pubkey_algo);
+  gcry_md_putc (md, fprlen);
+  gcry_md_write (md, fpr, fprlen);
+  gcry_md_putc (md, sig->digest_algo);
+  gcry_md_write (md, dgst, gcry_md_get_algo_dlen (sig->digest_algo));
+  for (i = 0; i < nsig; i++)
+    {
+      byte *buf;
+      size_t n;
+
+      if (!sig->data[i])
+        {
+          gcry_md_close (md);
+          return 0;
+        }
+      if (gcry_mpi_get_flag (sig->data[i], GCRYMPI_FLAG_OPAQUE))
+        {
+          unsigned int nbits;
+          const byte *p = (const byte*) gcry_mpi_get_opaque (sig->data[i],
+                                                            &nbits);
+
+          gcry_md_putc (md, 0);
+          gcry_md_write (md, p, (nbits + 7) / 8);
+        }
+      else if (!gcry_mpi_aprint (GCRYMPI_FMT_PGP, &buf, &n, sig->data[i]))
+        {
+          gcry_md_putc (md, 1);
+          gcry_md_write (md, buf, n);
+          xfree (buf);
+        }
+      else
+        {
+          gcry_md_close (md);
+          return 0;
+        }
+    }
+  memcpy (hash, gcry_md_read (md, GCRY_MD_SHA256), SIGCACHE_KEYLEN);
+  gcry_md_close (md);
+  return 1;
+}
+
+
+/* Look up the index HASH.  Returns true if a result is available and
+ * stores the verification result at R_RC.  A sig_batch thread must
+ * hold the sig_batch lock.  */
+int
+sigcache_lookup (const byte *hash, gpg_error_t *r_rc)
+{
+  struct sigcache_entry *e;
+
+  sigcache_stats.lookups++;
+  e = find_entry (hash);
+  if (!e || !e->result)
+    return 0;
+
+  sigcache_stats.hits++;
+  e->used = 1;
+  *r_rc = e->result == SIGCACHE_GOOD? 0 : GPG_ERR_BAD_SIGNATURE;
+  return 1;
+}
+
+
+/* Store the result RC of the verification identified by HASH which
+ * was made by PK.  Only definite results are cached.  */
+void
+sigcache_store (const byte *hash, PKT_public_key *pk, gpg_error_t rc)
+{
+  struct sigcache_entry *e;
+  u32 kid[2];
+
+  if (rc && rc != GPG_ERR_BAD_SIGNATURE)
+    return;
+
+  keyid_from_pk (pk, kid);
+  e = put_entry (hash, kid, rc? SIGCACHE_BAD : SIGCACHE_GOOD);
+  if (!e)
+    return;
+  e->used = 1;
+  if (!e->is_new)
+    {
+      e->is_new = 1;
+      sigcache.nnew++;
+    }
+  sigcache_stats.stored++;
+}
+
+
+/* Drop all entries for signatures made by one of the keys of the
+ * keyblock KEYBLOCK.  This is called by keydb when a keyblock is
+ * changed or deleted.  */
+void
+sigcache_invalidate_keyblock (kbnode_t keyblock)
+{
+  kbnode_t node;
+  unsigned int i;
+  u32 kid[2];
+
+  if (!sigcache_enabled () || !sigcache.nbuckets)
+    return;
+
+  for (node = keyblock; node; node = node->next)
+    {
+      if (node->pkt->pkttype != PKT_PUBLIC_KEY
+          && node->pkt->pkttype != PKT_PUBLIC_SUBKEY)
+        continue;
+      keyid_from_pk (node->pkt->pkt.public_key, kid);
+      for (i = sigcache.kid_buckets[kid_bucket (kid)]; i;
+           i = sigcache.entries[i].kid_next)
+        {
+          struct sigcache_entry *e = sigcache.entries + i;
+
+          if (e->result && e->kid[0] == kid[0] && e->kid[1] == kid[1])
+            {
+              if (DBG_CACHE)
+                log_debug ("sigcache: dropping entry for key %s\n",
+                           keystr (kid));
+              e->result = 0;
+              sigcache.need_rewrite = 1;
+              sigcache_stats.dropped++;
+            }
+        }
+    }
+}
+
+
+void
+sigcache_dump_stats (void)
+{
+  unsigned int rate;
+
+  rate = sigcache_stats.lookups
+    ? (unsigned int)((100.0 * sigcache_stats.hits) / sigcache_stats.lookups)
+    : 0;
+  log_info ("sig_cache: persistent loaded=%u lookups=%u hits=%u (%u%%)"
+            " stored=%u dropped=%u\n",
+            sigcache_stats.loaded, sigcache_stats.lookups,
+            sigcache_stats.hits, rate,
+            sigcache_stats.stored, sigcache_stats.dropped);
+}
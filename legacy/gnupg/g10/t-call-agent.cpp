@@ -0,0 +1,403 @@
+/* t-call-agent.c - Tests for the pipelined agent requests.
+ * Copyright (C) 2018 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* This test forks a fake agent which answers HAVEKEY --list and
+   KEYINFO and runs the snapshot and the pipelined KEYINFO requests of
+   call-agent.c against it.  The module is included so that the
+   static functions can be called and the commands and responses on
+   the connection can be counted.  */
+
+#define TEST_MAIN call_agent_main
+#include "test.cpp"
+
+#include <assuan.h>
+#include "../common/util.h"
+
+/* The number of commands written and the number of OK or ERR
+   responses read on the agent connection.  */
+static int lines_written;
+static int lines_completed;
+/* The largest number of commands written but not yet completed at
+   the time a response is read.  */
+static int max_outstanding;
+
+static gpg_error_t
+counting_write_line (assuan_context_t ctx, const char *line)
+{
+  gpg_error_t err;
+
+  err = assuan_write_line (ctx, line);
+  if (!err)
+    lines_written++;
+  return err;
+}
+
+static gpg_error_t
+counting_read_response (assuan_context_t ctx, char **line, int *linelen)
+{
+  gpg_error_t err;
+
+  if (lines_written - lines_completed > max_outstanding)
+    max_outstanding = lines_written - lines_completed;
+  err = assuan_client_read_response (ctx, line, linelen);
+  if (!err && (has_leading_keyword (*line, "OK")
+               || has_leading_keyword (*line, "ERR")))
+    lines_completed++;
+  return err;
+}
+
+#define assuan_write_line counting_write_line
+#define assuan_client_read_response counting_read_response
+#include "call-agent.cpp"
+#undef assuan_write_line
+#undef assuan_client_read_response
+
+
+/* The number of secret keys of the fake agent.  */
+#define NKEYS 100
+
+/* The mode of the fake agent for HAVEKEY --list.  */
+enum { HAVEKEY_OKAY, HAVEKEY_OLD, HAVEKEY_BAD_LENGTH };
+static int havekey_mode;
+
+
+/* Store the keygrip of the test key with index IDX at GRIP.  Keys
+   with an odd index are secret keys of the fake agent.  */
+static void
+make_grip (int idx, unsigned char *grip)
+{
+  int i;
+
+  for (i=0; i < 20; i++)
+    grip[i] = (i == 19)? idx : (0x5a ^ i);
+}
+
+
+static int
+grip_index (const unsigned char *grip)
+{
+  return grip[19];
+}
+
+
+
+/*
+
+       F A K E   A G E N T
+
+*/
+
+/* MODE <n> - Set the mode for HAVEKEY --list.  */
+static gpg_error_t
+cmd_mode (assuan_context_t ctx, char *line)
+{
+  (void)ctx;
+  havekey_mode = atoi (line);
+  return 0;
+}
+
+
+/* HAVEKEY --list - Return the secret keygrips in reverse order.  */
+static gpg_error_t
+cmd_havekey (assuan_context_t ctx, char *line)
+{
+  gpg_error_t err;
+  unsigned char grip[20];
+  int i;
+
+  if (strcmp (line, "--list") || havekey_mode == HAVEKEY_OLD)
+    return GPG_ERR_ASS_PARAMETER;
+  for (i=NKEYS-1; i >= 0; i--)
+    if ((i & 1))
+      {
+        make_grip (i, grip);
+        err = assuan_send_data (ctx, grip, 20);
+        if (err)
+          return err;
+      }
+  if (havekey_mode == HAVEKEY_BAD_LENGTH)
+    return assuan_send_data (ctx, grip, 10);
+  return 0;
+}
+
+
+/* KEYINFO <hexgrip> - Depending on the key index return an error, a
+   clear key on disk, or a key on a card.  Status lines which do not
+   belong to the key are mixed in.  */
+static gpg_error_t
+cmd_keyinfo (assuan_context_t ctx, char *line)
+{
+  unsigned char grip[20];
+  unsigned char other[20];
+  char hexother[41];
+  char buf[200];
+  int idx;
+
+  if (hex2bin (line, grip, 20) < 0)
+    return GPG_ERR_INV_DATA;
+  idx = grip_index (grip);
+
+  assuan_write_status (ctx, "PROGRESS", "keyinfo ? 1 2");
+  switch (idx % 3)
+    {
+    case 0:
+      return GPG_ERR_NO_SECKEY;
+    case 1:
+      snprintf (buf, sizeof buf, "%s D - - - C", line);
+      assuan_write_status (ctx, "KEYINFO", buf);
+      make_grip (idx + 1, other);
+      bin2hex (other, 20, hexother);
+      snprintf (buf, sizeof buf, "%s D - - - P", hexother);
+      assuan_write_status (ctx, "KEYINFO", buf);
+      break;
+    case 2:
+      snprintf (buf, sizeof buf, "%s T D2760001240102000005000000%02X"
+                " OPENPGP.1 - -", line, idx);
+      assuan_write_status (ctx, "KEYINFO", buf);
+      break;
+    }
+  assuan_write_status (ctx, "PROGRESS", "keyinfo ? 2 2");
+  return 0;
+}
+
+
+static void
+fake_agent (assuan_context_t ctx)
+{
+  int rc;
+
+  rc = assuan_init_pipe_server (ctx, NULL);
+  if (!rc)
+    rc = assuan_register_command (ctx, "MODE", cmd_mode, NULL);
+  if (!rc)
+    rc = assuan_register_command (ctx, "HAVEKEY", cmd_havekey, NULL);
+  if (!rc)
+    rc = assuan_register_command (ctx, "KEYINFO", cmd_keyinfo, NULL);
+  if (rc)
+    {
+      printf ("fake agent: init failed: %s\n", gpg_strerror (rc));
+      _exit (1);
+    }
+
+  while (!assuan_accept (ctx))
+    assuan_process (ctx);
+  assuan_release (ctx);
+  _exit (0);
+}
+
+
+
+/*
+
+       T E S T S
+
+*/
+
+static gpg_error_t
+set_havekey_mode (int mode)
+{
+  char line[20];
+
+  snprintf (line, sizeof line, "MODE %d", mode);
+  return assuan_transact (agent_ctx, line, NULL, NULL, NULL, NULL,
+                          NULL, NULL);
+}
+
+
+/* Return true if the snapshot lists exactly the secret test keys.  */
+static int
+snapshot_matches (void)
+{
+  unsigned char grip[20];
+  int i;
+
+  for (i=0; i < NKEYS + 2; i++)
+    {
+      make_grip (i, grip);
+      if (!!snapshot_has_keygrip (grip) != (i < NKEYS && (i & 1)))
+        return 0;
+    }
+  return 1;
+}
+
+
+static void
+test_havekey_list (void)
+{
+  TEST_GROUP ("HAVEKEY --list");
+
+  TEST ("set mode", set_havekey_mode (HAVEKEY_OKAY), 0);
+  TEST ("load snapshot", agent_load_secret_keygrips (NULL), 0);
+  TEST_P ("snapshot valid", secret_keygrips.valid);
+  TEST ("number of keygrips", (int)secret_keygrips.ngrips, NKEYS / 2);
+  TEST_P ("snapshot is sorted and complete", snapshot_matches ());
+
+  /* A nested call keeps the snapshot.  */
+  TEST ("nested load", agent_load_secret_keygrips (NULL), 0);
+  agent_release_secret_keygrips ();
+  TEST_P ("snapshot kept", secret_keygrips.valid);
+  agent_release_secret_keygrips ();
+  TEST_P ("snapshot released", !secret_keygrips.valid);
+
+  /* A record which is not 20 bytes is rejected.  */
+  TEST ("set mode", set_havekey_mode (HAVEKEY_BAD_LENGTH), 0);
+  TEST ("bad length", agent_load_secret_keygrips (NULL),
+        GPG_ERR_INV_RESPONSE);
+  TEST_P ("no snapshot", !secret_keygrips.valid && !secret_keygrips.grips);
+  agent_release_secret_keygrips ();
+
+  /* An old agent fails the request.  */
+  TEST ("set mode", set_havekey_mode (HAVEKEY_OLD), 0);
+  TEST_P ("old agent", agent_load_secret_keygrips (NULL) != 0);
+  TEST_P ("no snapshot", !secret_keygrips.valid);
+  agent_release_secret_keygrips ();
+  TEST ("connection kept", set_havekey_mode (HAVEKEY_OKAY), 0);
+}
+
+
+/* Prefetch the key infos of the first NGRIPS test keys and check the
+   results and the number of commands in flight.  */
+static int
+check_prefetch (int ngrips)
+{
+  unsigned char *grips;
+  char hexgrip[41];
+  char *serialno;
+  int cleartext;
+  gpg_error_t err;
+  int i, okay = 1;
+
+  grips = (unsigned char *) xmalloc (20 * ngrips);
+  for (i=0; i < ngrips; i++)
+    make_grip (i, grips + 20*i);
+
+  lines_written = lines_completed = max_outstanding = 0;
+  agent_release_keyinfo_prefetch ();
+  err = prefetch_keyinfo (grips, ngrips);
+  xfree (grips);
+  if (err)
+    return 0;
+
+  if (lines_written != ngrips || lines_completed != ngrips)
+    okay = 0;
+  if (max_outstanding != (ngrips < PIPELINE_WINDOW? ngrips : PIPELINE_WINDOW))
+    okay = 0;
+
+  /* Take the results in reverse order; none may need the agent.  */
+  for (i=ngrips-1; i >= 0; i--)
+    {
+      unsigned char grip[20];
+
+      make_grip (i, grip);
+      bin2hex (grip, 20, hexgrip);
+      err = agent_get_keyinfo (NULL, hexgrip, &serialno, &cleartext);
+      switch (i % 3)
+        {
+        case 0:
+          if (err != GPG_ERR_NO_SECKEY)
+            okay = 0;
+          break;
+        case 1:
+          if (err || serialno || !cleartext)
+            okay = 0;
+          break;
+        case 2:
+          if (err || !serialno || cleartext
+              || strtoul (serialno + 26, NULL, 16) != i)
+            okay = 0;
+          break;
+        }
+      xfree (serialno);
+    }
+  if (keyinfo_prefetch || lines_written != ngrips)
+    okay = 0;
+  return okay;
+}
+
+
+/* Prefetch the key infos of three test keys and drop them like at
+   the end of a listing.  The key info must then come from the
+   agent.  */
+static int
+check_release (void)
+{
+  unsigned char grips[60];
+  char hexgrip[41];
+  char *serialno;
+  int i, okay;
+
+  for (i=0; i < 3; i++)
+    make_grip (i, grips + 20*i);
+  if (prefetch_keyinfo (grips, 3))
+    return 0;
+  agent_release_keyinfo_prefetch ();
+  if (keyinfo_prefetch)
+    return 0;
+
+  bin2hex (grips + 40, 20, hexgrip);
+  okay = (!agent_get_keyinfo (NULL, hexgrip, &serialno, NULL)
+          && serialno && strtoul (serialno + 26, NULL, 16) == 2);
+  xfree (serialno);
+  return okay;
+}
+
+
+static void
+test_keyinfo_pipeline (void)
+{
+  TEST_GROUP ("pipelined KEYINFO");
+
+  TEST_P ("two keys", check_prefetch (2));
+  TEST_P ("one window", check_prefetch (PIPELINE_WINDOW));
+  TEST_P ("several windows", check_prefetch (NKEYS));
+  TEST_P ("released", check_release ());
+  TEST_P ("connection kept", agent_ctx != NULL);
+}
+
+
+static void
+do_test (int argc, char *argv[])
+{
+  gpg_error_t err;
+  assuan_context_t ctx;
+  int no_close_fds[2];
+  const char *loc;
+
+  (void) argc;
+  (void) argv;
+
+  no_close_fds[0] = 2;
+  no_close_fds[1] = -1;
+
+  err = assuan_new (&ctx);
+  if (err)
+    ABORT ("assuan_new failed");
+  err = assuan_pipe_connect (ctx, NULL, &loc, no_close_fds, NULL, NULL,
+                             ASSUAN_PIPE_CONNECT_FDPASSING);
+  if (err)
+    ABORT ("assuan_pipe_connect failed");
+  if (loc[0] == 's')
+    fake_agent (ctx);
+
+  agent_ctx = ctx;
+  test_havekey_list ();
+  test_keyinfo_pipeline ();
+
+  drop_agent_connection ();
+}
@@ -0,0 +1,218 @@
+/* t-sigcache.c - Tests for the persistent signature cache.
+ * Copyright (C) 2018 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* The module is included so that the file can be written and read
+   again within one process.  The cache file is in a temporary home
+   directory.  */
+
+#define TEST_MAIN sigcache_main
+#include "test.cpp"
+
+#include "sigcache.cpp"
+
+/* The number of entries for key B; more than the first table.  */
+#define NMANY 3000
+
+static PKT_public_key pk_a;
+static PKT_public_key pk_b;
+
+
+/* Store the index hash number IDX at HASH.  */
+static void
+make_hash (unsigned int idx, byte *hash)
+{
+  int i;
+
+  for (i=0; i < SIGCACHE_KEYLEN; i++)
+    hash[i] = idx >> (8 * (i % 4)) ^ i;
+}
+
+
+/* Return the result of the lookup of hash number IDX: -1 if there is
+   none, else the cached error code.  */
+static int
+lookup (unsigned int idx)
+{
+  byte hash[SIGCACHE_KEYLEN];
+  gpg_error_t rc;
+
+  make_hash (idx, hash);
+  if (!sigcache_lookup (hash, &rc))
+    return -1;
+  return rc;
+}
+
+
+static void
+store (unsigned int idx, PKT_public_key *pk, gpg_error_t rc)
+{
+  byte hash[SIGCACHE_KEYLEN];
+
+  make_hash (idx, hash);
+  sigcache_store (hash, pk, rc);
+}
+
+
+/* Return true if all entries of key B are cached as good.  */
+static int
+have_many (void)
+{
+  unsigned int i;
+
+  for (i=0; i < NMANY; i++)
+    if (lookup (1000 + i))
+      return 0;
+  return 1;
+}
+
+
+/* Write the cache like at exit and read it again like a new
+   process.  */
+static void
+reopen (void)
+{
+  sigcache_flush ();
+  xfree (sigcache.fname);
+  xfree (sigcache.entries);
+  xfree (sigcache.buckets);
+  xfree (sigcache.kid_buckets);
+  memset (&sigcache, 0, sizeof sigcache);
+  memset (&sigcache_stats, 0, sizeof sigcache_stats);
+  load_cache ();
+}
+
+
+/* Return the size of the cache file in records or -1.  */
+static int
+file_records (void)
+{
+  struct stat st;
+
+  if (stat (sigcache.fname, &st))
+    return -1;
+  return (st.st_size - SIGCACHE_HEADER_SIZE) / SIGCACHE_RECORD_SIZE;
+}
+
+
+static void
+test_store (void)
+{
+  unsigned int i;
+
+  TEST_GROUP ("store and lookup");
+
+  TEST ("empty", lookup (1), -1);
+  store (1, &pk_a, 0);
+  store (2, &pk_a, GPG_ERR_BAD_SIGNATURE);
+  store (3, &pk_b, 0);
+  store (4, &pk_b, GPG_ERR_GENERAL);
+  TEST ("good", lookup (1), 0);
+  TEST ("bad", lookup (2), GPG_ERR_BAD_SIGNATURE);
+  TEST ("other key", lookup (3), 0);
+  TEST ("no definite result", lookup (4), -1);
+  store (1, &pk_a, GPG_ERR_BAD_SIGNATURE);
+  TEST ("update", lookup (1), GPG_ERR_BAD_SIGNATURE);
+  store (1, &pk_a, 0);
+
+  for (i=0; i < NMANY; i++)
+    store (1000 + i, &pk_b, 0);
+  TEST_P ("grown table", have_many ());
+}
+
+
+static void
+test_reopen (void)
+{
+  TEST_GROUP ("reopen");
+
+  reopen ();
+  TEST ("written", file_records (), 3 + NMANY);
+  TEST ("loaded", sigcache_stats.loaded, 3 + NMANY);
+  TEST ("good", lookup (1), 0);
+  TEST ("bad", lookup (2), GPG_ERR_BAD_SIGNATURE);
+  TEST ("no definite result", lookup (4), -1);
+  TEST_P ("many", have_many ());
+
+  /* A new entry is appended.  */
+  store (5, &pk_a, 0);
+  reopen ();
+  TEST ("appended", file_records (), 4 + NMANY);
+  TEST ("new entry", lookup (5), 0);
+}
+
+
+static void
+test_invalidate (void)
+{
+  PACKET pkt;
+  struct kbnode_struct node;
+
+  TEST_GROUP ("invalidate");
+
+  memset (&pkt, 0, sizeof pkt);
+  pkt.pkttype = PKT_PUBLIC_KEY;
+  pkt.pkt.public_key = &pk_a;
+  memset (&node, 0, sizeof node);
+  node.pkt = &pkt;
+
+  sigcache_invalidate_keyblock (&node);
+  TEST ("good dropped", lookup (1), -1);
+  TEST ("bad dropped", lookup (2), -1);
+  TEST ("new dropped", lookup (5), -1);
+  TEST ("other key kept", lookup (3), 0);
+  TEST_P ("many kept", have_many ());
+
+  /* The file is rewritten without the dropped entries.  */
+  reopen ();
+  TEST ("rewritten", file_records (), 1 + NMANY);
+  TEST ("still dropped", lookup (1), -1);
+  TEST ("still kept", lookup (3), 0);
+  TEST_P ("many still kept", have_many ());
+}
+
+
+static void
+do_test (int argc, char *argv[])
+{
+  char template_[] = "/tmp/t-sigcache.XXXXXX";
+  char *homedir;
+
+  (void) argc;
+  (void) argv;
+
+  homedir = mkdtemp (template_);
+  if (!homedir)
+    ABORT ("mkdtemp failed");
+  gnupg_set_homedir (homedir);
+
+  pk_a.keyid[0] = 0x11111111;
+  pk_a.keyid[1] = 0x22222222;
+  pk_b.keyid[0] = 0x33333333;
+  pk_b.keyid[1] = 0x44444444;
+
+  load_cache ();
+  test_store ();
+  test_reopen ();
+  test_invalidate ();
+
+  /* Nothing is left to write at exit.  */
+  sigcache.disabled = 1;
+  gnupg_remove (sigcache.fname);
+  rmdir (homedir);
+}
@@ -228,6 +228,7 @@ import_ownertrust (ctrl_t ctrl, const char *fname )
 
     if (any)
       {
+        certgraph_notice_key (NULL);
         revalidation_mark (ctrl);
         rc = tdbio_sync ();
         if (rc)
@@ -27,6 +27,9 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
+#ifdef HAVE_MMAP
+# include <sys/mman.h>
+#endif
 
 #include "gpg.h"
 #include "../common/status.h"
@@ -48,34 +51,68 @@
 #define MY_O_BINARY  0
 #endif
 
+/* Maximum number of records written back with one call.  */
+#define TDBIO_MAX_RUN 256
+
 /*
- * Yes, this is a very simple implementation. We should really
- * use a page aligned buffer and read complete pages.
- * To implement a simple trannsaction system, this is sufficient.
+ * The record cache.  The entries are kept in an array and found
+ * through an open addressed hash table indexed by the record number.
+ * Records read from the file are cached as well, and the cache grows
+ * with the size of the trustdb, so a trust check reads each record of
+ * its working set only once.  Clean entries are evicted with the clock
+ * algorithm.  Dirty entries are written back by tdbio_sync, with one
+ * pwrite for each run of consecutive records.  Other processes may
+ * change the trustdb while we do not hold the lock; the clean entries
+ * are thus dropped whenever the lock is taken.
  */
-typedef struct cache_ctrl_struct *CACHE_CTRL;
-struct cache_ctrl_struct
+struct cache_item
 {
-  CACHE_CTRL next;
+  unsigned long recno;
   struct {
-    unsigned used:1;
     unsigned dirty:1;
+    unsigned ref:1;   /* Used since the clock hand passed by.  */
   } flags;
-  unsigned long recno;
   char data[TRUST_RECORD_LEN];
 };
 
-/* Size of the cache.  The SOFT value is the general one.  While in a
-   transaction this may not be sufficient and thus we may increase it
-   then up to the HARD limit.  */
-#define MAX_CACHE_ENTRIES_SOFT	200
-#define MAX_CACHE_ENTRIES_HARD	10000
+/* Size limits of the cache.  The limit for the cache is derived from
+   the size of the trustdb but kept in this range.  While in a
+   transaction the cache may grow up to the HARD limit.  */
+#define CACHE_ENTRIES_MIN	256
+#define CACHE_ENTRIES_MAX	65536
+#define CACHE_ENTRIES_HARD	(CACHE_ENTRIES_MAX + 10000)
+
+/* The cache is controlled by these variables.  The used entries are
+   ITEMS[0] to ITEMS[NUSED-1]; SLOTS has the indices of the used
+   entries or -1.  */
+static struct
+{
+  struct cache_item *items;
+  unsigned int nitems;
+  unsigned int nused;
+  unsigned int limit;
+  unsigned int hand;
+  int *slots;
+  unsigned int nslots;   /* A power of 2 and at least 2*NITEMS.  */
+  unsigned int shift;    /* 32 - log2(NSLOTS).  */
+} cache;
+static int cache_is_dirty;
 
+/* Statistics for the record cache.  */
+static struct
+{
+  unsigned int reads;    /* Calls to tdbio_read_record.  */
+  unsigned int hits;     /* ... served from the cache.  */
+  unsigned int mapped;   /* ... served from the mapped file.  */
+  unsigned int evicted;  /* Evicted clean entries.  */
+  unsigned int dropped;  /* Clean entries dropped when locking.  */
+  unsigned int writes;   /* Write calls for the write-back.  */
+  unsigned int written;  /* Records written back.  */
+} cache_stats;
 
-/* The cache is controlled by these variables.  */
-static CACHE_CTRL cache_list;
-static int cache_entries;
-static int cache_is_dirty;
+/* The trustdb mapped into memory if --trustdb-mmap is used.  */
+static const byte *db_map;
+static size_t db_map_len;
 
 
 /* An object to pass information to cmp_krec_fpr. */
@@ -112,6 +149,7 @@ static int in_transaction;
 
 static void open_db (void);
 static void create_hashtable (ctrl_t ctrl, TRUSTREC *vr, int type);
+static void cache_drop_clean (void);
 
 
 
@@ -119,7 +157,9 @@ static void create_hashtable (ctrl_t ctrl, TRUSTREC *vr, int type);
  * Take a lock on the trustdb file name.  I a lock file can't be
  * created the function terminates the process.  Excvept for a
  * different return code the function does nothing if the lock has
- * already been taken.
+ * already been taken.  Another process may have modified the trustdb
+ * while we did not hold the lock, thus the clean entries of the
+ * record cache are dropped when the lock is actually taken.
  *
  * Returns: True if lock already exists, False if the lock has
  *          actually been taken.
@@ -138,6 +178,7 @@ take_write_lock (void)
         log_fatal ( _("can't lock '%s'\n"), db_name );
       else
         is_locked = 1;
+      cache_drop_clean ();
       return 0;
     }
   else
@@ -160,6 +201,135 @@ release_write_lock (void)
  ************* record cache **********
  *************************************/
 
+/* Return the hash table slot for RECNO.  */
+static inline unsigned int
+cache_hash (unsigned long recno)
+{
+  return ((u32)recno * 2654435761U) >> cache.shift;
+}
+
+
+/* Return the index of the entry for RECNO or -1.  */
+static int
+cache_find (unsigned long recno)
+{
+  unsigned int i;
+  int idx;
+
+  if (!cache.nslots)
+    return -1;
+  for (i = cache_hash (recno); (idx = cache.slots[i]) != -1;
+       i = (i + 1) & (cache.nslots - 1))
+    if (cache.items[idx].recno == recno)
+      return idx;
+  return -1;
+}
+
+
+/* Enter the entry IDX into the hash table.  */
+static void
+cache_link (int idx)
+{
+  unsigned int i;
+
+  for (i = cache_hash (cache.items[idx].recno); cache.slots[i] != -1;
+       i = (i + 1) & (cache.nslots - 1))
+    ;
+  cache.slots[i] = idx;
+}
+
+
+/* Remove the entry IDX from the hash table.  The following entries
+   of the probe sequence are moved up so that no tombstones are
+   needed.  */
+static void
+cache_unlink (int idx)
+{
+  unsigned int mask = cache.nslots - 1;
+  unsigned int i, j, k;
+
+  for (i = cache_hash (cache.items[idx].recno); cache.slots[i] != idx;
+       i = (i + 1) & mask)
+    ;
+  for (j = (i + 1) & mask; cache.slots[j] != -1; j = (j + 1) & mask)
+    {
+      k = cache_hash (cache.items[cache.slots[j]].recno);
+      /* Keep the entry if its home slot is cyclically in (i,j].  */
+      if (i <= j ? (i < k && k <= j) : (i < k || k <= j))
+        continue;
+      cache.slots[i] = cache.slots[j];
+      i = j;
+    }
+  cache.slots[i] = -1;
+}
+
+
+/* Grow the cache to NITEMS entries.  */
+static void
+cache_grow (unsigned int nitems)
+{
+  unsigned int nslots, i;
+
+  cache.items = (struct cache_item *) xrealloc (cache.items,
+                                                nitems * sizeof *cache.items);
+  cache.nitems = nitems;
+  if (cache.nslots >= 2 * nitems)
+    return;
+
+  for (nslots = 64, cache.shift = 32 - 6; nslots < 2 * nitems; nslots *= 2)
+    cache.shift--;
+  xfree (cache.slots);
+  cache.slots = (int *) xmalloc (nslots * sizeof *cache.slots);
+  cache.nslots = nslots;
+  for (i = 0; i < nslots; i++)
+    cache.slots[i] = -1;
+  for (i = 0; i < cache.nused; i++)
+    cache_link (i);
+}
+
+
+/* Remove all clean entries from the cache.  The dirty entries are
+   moved to the front of ITEMS.  */
+static void
+cache_drop_clean (void)
+{
+  unsigned int i, n;
+
+  for (i = n = 0; i < cache.nused; i++)
+    if (cache.items[i].flags.dirty)
+      {
+        if (i != n)
+          cache.items[n] = cache.items[i];
+        n++;
+      }
+  if (n == cache.nused)
+    return;
+  cache_stats.dropped += cache.nused - n;
+  cache.nused = n;
+  cache.hand = 0;
+  for (i = 0; i < cache.nslots; i++)
+    cache.slots[i] = -1;
+  for (i = 0; i < cache.nused; i++)
+    cache_link (i);
+}
+
+
+/* Set the limit for the cache size for a trustdb with NRECORDS
+   records.  */
+static void
+cache_set_limit (unsigned long nrecords)
+{
+  unsigned long limit = nrecords + nrecords / 8;
+
+  if (limit < CACHE_ENTRIES_MIN)
+    limit = CACHE_ENTRIES_MIN;
+  else if (limit > CACHE_ENTRIES_MAX)
+    limit = CACHE_ENTRIES_MAX;
+  if (limit > cache.limit)
+    cache.limit = limit;
+}
+
+
 /*
  * Get the data from the record cache and return a pointer into that
  * cache.  Caller should copy the returned data.  NULL is returned on
@@ -168,225 +338,261 @@ release_write_lock (void)
 static const char *
 get_record_from_cache (unsigned long recno)
 {
-  CACHE_CTRL r;
+  int idx = cache_find (recno);
 
-  for (r = cache_list; r; r = r->next)
-    {
-      if (r->flags.used && r->recno == recno)
-        return r->data;
-    }
-  return NULL;
+  if (idx == -1)
+    return NULL;
+  cache.items[idx].flags.ref = 1;
+  return cache.items[idx].data;
+}
+
+
+/* Compare function to sort the cache entries by record number.  */
+static int
+cmp_cache_recno (const void *a, const void *b)
+{
+  unsigned long ra = cache.items[*(const int *)a].recno;
+  unsigned long rb = cache.items[*(const int *)b].recno;
+
+  return ra < rb? -1 : ra > rb;
 }
 
 
 /*
- * Write a cached item back to the trustdb file.
+ * Write the N cache entries with the indices IDX, which are
+ * consecutive records, back to the trustdb file.
  *
  * Returns: 0 on success or an error code.
  */
 static int
-write_cache_item (CACHE_CTRL r)
+write_cache_run (const int *idx, int n)
 {
   gpg_error_t err;
-  int n;
+  unsigned long recno = cache.items[idx[0]].recno;
+  ssize_t nwritten;
+  int i;
 
-  if (lseek (db_fd, r->recno * TRUST_RECORD_LEN, SEEK_SET) == -1)
+  char buffer[TDBIO_MAX_RUN * TRUST_RECORD_LEN];
+
+  for (i = 0; i < n; i++)
+    memcpy (buffer + i * TRUST_RECORD_LEN, cache.items[idx[i]].data,
+            TRUST_RECORD_LEN);
+#ifndef HAVE_DOSISH_SYSTEM
+  nwritten = pwrite (db_fd, buffer, n * TRUST_RECORD_LEN,
+                     (off_t)recno * TRUST_RECORD_LEN);
+#else
+  if (lseek (db_fd, recno * TRUST_RECORD_LEN, SEEK_SET) == -1)
     {
       err = gpg_error_from_syserror ();
       log_error (_("trustdb rec %lu: lseek failed: %s\n"),
-                 r->recno, strerror (errno));
+                 recno, strerror (errno));
       return err;
     }
-  n = write (db_fd, r->data, TRUST_RECORD_LEN);
-  if (n != TRUST_RECORD_LEN)
+  nwritten = write (db_fd, buffer, n * TRUST_RECORD_LEN);
+#endif
+  if (nwritten != n * TRUST_RECORD_LEN)
     {
       err = gpg_error_from_syserror ();
       log_error (_("trustdb rec %lu: write failed (n=%d): %s\n"),
-                 r->recno, n, strerror (errno) );
+                 recno, (int)nwritten, strerror (errno) );
       return err;
     }
-  r->flags.dirty = 0;
+
+  cache_stats.writes++;
+  cache_stats.written += n;
+  for (i = 0; i < n; i++)
+    cache.items[idx[i]].flags.dirty = 0;
   return 0;
 }
 
 
 /*
- * Put data into the cache.  This function may flush
- * some cache entries if the cache is filled up.
+ * Write all dirty cache entries back to the trustdb file.  The caller
+ * must hold the write lock.
  *
  * Returns: 0 on success or an error code.
  */
 static int
-put_record_into_cache (unsigned long recno, const char *data)
+write_dirty_records (void)
 {
-  CACHE_CTRL r, unused;
-  int dirty_count = 0;
-  int clean_count = 0;
+  int *idx;
+  int n, i, start, rc = 0;
 
-  /* See whether we already cached this one.  */
-  for (unused = NULL, r = cache_list; r; r = r->next)
-    {
-      if (!r->flags.used)
-        {
-          if (!unused)
-            unused = r;
-	}
-      else if (r->recno == recno)
-        {
-          if (!r->flags.dirty)
-            {
-              /* Hmmm: should we use a copy and compare? */
-              if (memcmp (r->data, data, TRUST_RECORD_LEN))
-                {
-                  r->flags.dirty = 1;
-                  cache_is_dirty = 1;
-		}
-	    }
-          memcpy (r->data, data, TRUST_RECORD_LEN);
-          return 0;
-	}
-      if (r->flags.used)
-        {
-          if (r->flags.dirty)
-            dirty_count++;
-          else
-            clean_count++;
-	}
-    }
+  idx = (int *) xmalloc (cache.nused * sizeof *idx + 1);
+  for (n = 0, i = 0; i < (int)cache.nused; i++)
+    if (cache.items[i].flags.dirty)
+      idx[n++] = i;
+  qsort (idx, n, sizeof *idx, cmp_cache_recno);
 
-  /* Not in the cache: add a new entry. */
-  if (unused)
+  for (start = 0; !rc && start < n; start = i)
     {
-      /* Reuse this entry. */
-      r = unused;
-      r->flags.used = 1;
-      r->recno = recno;
-      memcpy (r->data, data, TRUST_RECORD_LEN);
-      r->flags.dirty = 1;
-      cache_is_dirty = 1;
-      cache_entries++;
-      return 0;
+      for (i = start + 1;
+           i < n && i - start < TDBIO_MAX_RUN
+             && (cache.items[idx[i]].recno
+                 == cache.items[idx[i-1]].recno + 1);
+           i++)
+        ;
+      rc = write_cache_run (idx + start, i - start);
     }
 
-  /* See whether we reached the limit. */
-  if (cache_entries < MAX_CACHE_ENTRIES_SOFT)
-    {
-      /* No: Put into cache.  */
-      r = (CACHE_CTRL) xmalloc (sizeof *r);
-      r->flags.used = 1;
-      r->recno = recno;
-      memcpy (r->data, data, TRUST_RECORD_LEN);
-      r->flags.dirty = 1;
-      r->next = cache_list;
-      cache_list = r;
-      cache_is_dirty = 1;
-      cache_entries++;
-      return 0;
-    }
+  xfree (idx);
+  return rc;
+}
 
-  /* Cache is full: discard some clean entries.  */
-  if (clean_count)
-    {
-      int n;
 
-      /* We discard a third of the clean entries.  */
-      n = clean_count / 3;
-      if (!n)
-        n = 1;
+/* Return the index of the clean entry to evict or -1.  */
+static int
+cache_victim (void)
+{
+  struct cache_item *r;
+  unsigned int n;
 
-      for (unused = NULL, r = cache_list; r; r = r->next)
+  for (n = 0; n < 2 * cache.nused; n++)
+    {
+      r = cache.items + cache.hand;
+      cache.hand = (cache.hand + 1) % cache.nused;
+      if (r->flags.dirty)
+        continue;
+      if (r->flags.ref)
         {
-          if (r->flags.used && !r->flags.dirty)
-            {
-              if (!unused)
-                unused = r;
-              r->flags.used = 0;
-              cache_entries--;
-              if (!--n)
-                break;
-	    }
+          r->flags.ref = 0;
+          continue;
 	}
+      return r - cache.items;
+    }
+  return -1;
+}
 
-      /* Now put into the cache.  */
-      log_assert (unused);
-      r = unused;
-      r->flags.used = 1;
-      r->recno = recno;
-      memcpy (r->data, data, TRUST_RECORD_LEN);
-      r->flags.dirty = 1;
-      cache_is_dirty = 1;
-      cache_entries++;
-      return 0;
+
+/*
+ * Return a new cache entry for RECNO.  This may evict a clean entry.
+ * If there is no clean entry and MAY_FLUSH is set, the dirty entries
+ * are written back first.  Returns -1 with *R_ERR set to 0 if no
+ * entry is available and with an error code on error.
+ */
+static int
+cache_new_entry (unsigned long recno, int may_flush, gpg_error_t *r_err)
+{
+  unsigned int nitems;
+  int idx;
+
+  *r_err = 0;
+  if (!cache.limit)
+    cache_set_limit (0);
+  if (cache.nused == cache.nitems && cache.nitems < cache.limit)
+    {
+      nitems = cache.nitems? 2 * cache.nitems : CACHE_ENTRIES_MIN;
+      if (nitems > cache.limit)
+        nitems = cache.limit;
+      cache_grow (nitems);
     }
 
-  /* No clean entries: We have to flush some dirty entries.  */
-  if (in_transaction)
+  if (cache.nused < cache.nitems)
+    idx = cache.nused++;
+  else
     {
-      /* But we can't do this while in a transaction.  Thus we
-       * increase the cache size instead.  */
-      if (cache_entries < MAX_CACHE_ENTRIES_HARD)
+      int evict = 1;
+
+      idx = cache_victim ();
+      if (idx == -1 && !may_flush)
+        return -1;
+      if (idx == -1 && in_transaction)
         {
-          if (opt.debug && !(cache_entries % 100))
+          /* We can't write back while in a transaction.  Thus we
+           * increase the cache size instead.  */
+          if (cache.nitems >= CACHE_ENTRIES_HARD)
+            {
+              log_info (_("trustdb transaction too large\n"));
+              *r_err = GPG_ERR_RESOURCE_LIMIT;
+              return -1;
+            }
+          if (opt.debug)
             log_debug ("increasing tdbio cache size\n");
-          r = (CACHE_CTRL) xmalloc (sizeof *r);
-          r->flags.used = 1;
-          r->recno = recno;
-          memcpy (r->data, data, TRUST_RECORD_LEN);
-          r->flags.dirty = 1;
-          r->next = cache_list;
-          cache_list = r;
-          cache_is_dirty = 1;
-          cache_entries++;
-          return 0;
-	}
-      /* Hard limit for the cache size reached.  */
-      log_info (_("trustdb transaction too large\n"));
-      return GPG_ERR_RESOURCE_LIMIT;
+          cache_grow (cache.nitems + 1000);
+          idx = cache.nused++;
+          evict = 0;
+        }
+      else if (idx == -1)
+        {
+          int did_lock = !take_write_lock ();
+
+          *r_err = write_dirty_records ();
+          if (did_lock)
+            release_write_lock ();
+          if (*r_err)
+            return -1;
+          idx = cache_victim ();
+          log_assert (idx != -1);
+        }
+      if (evict)
+        {
+          cache_unlink (idx);
+          cache_stats.evicted++;
+        }
     }
 
-  if (dirty_count)
-    {
-      int n;
+  memset (&cache.items[idx].flags, 0, sizeof cache.items[idx].flags);
+  cache.items[idx].recno = recno;
+  cache_link (idx);
+  return idx;
+}
 
-      /* Discard some dirty entries. */
-      n = dirty_count / 5;
-      if (!n)
-        n = 1;
 
-      take_write_lock ();
-      for (unused = NULL, r = cache_list; r; r = r->next)
+/*
+ * Put data into the cache.  This function may flush
+ * some cache entries if the cache is filled up.
+ *
+ * Returns: 0 on success or an error code.
+ */
+static int
+put_record_into_cache (unsigned long recno, const char *data)
+{
+  struct cache_item *r;
+  gpg_error_t err;
+  int idx;
+
+  /* See whether we already cached this one.  */
+  idx = cache_find (recno);
+  if (idx != -1)
+    {
+      r = cache.items + idx;
+      if (!r->flags.dirty)
         {
-          if (r->flags.used && r->flags.dirty)
+          if (memcmp (r->data, data, TRUST_RECORD_LEN))
             {
-              int rc;
-
-              rc = write_cache_item (r);
-              if (rc)
-                return rc;
-              if (!unused)
-                unused = r;
-              r->flags.used = 0;
-              cache_entries--;
-              if (!--n)
-                break;
-	    }
-	}
-      release_write_lock ();
-
-      /* Now put into the cache.  */
-      log_assert (unused);
-      r = unused;
-      r->flags.used = 1;
-      r->recno = recno;
+              r->flags.dirty = 1;
+              cache_is_dirty = 1;
+            }
+        }
       memcpy (r->data, data, TRUST_RECORD_LEN);
-      r->flags.dirty = 1;
-      cache_is_dirty = 1;
-      cache_entries++;
+      r->flags.ref = 1;
       return 0;
     }
 
-  /* We should never reach this.  */
-  BUG();
+  /* Not in the cache: add a new entry. */
+  idx = cache_new_entry (recno, 1, &err);
+  if (idx == -1)
+    return err;
+  r = cache.items + idx;
+  memcpy (r->data, data, TRUST_RECORD_LEN);
+  r->flags.dirty = 1;
+  r->flags.ref = 1;
+  cache_is_dirty = 1;
+  return 0;
+}
+
+
+/* Put the record RECNO just read from the file into the cache unless
+   this requires a write back.  */
+static void
+put_clean_record_into_cache (unsigned long recno, const byte *data)
+{
+  gpg_error_t err;
+  int idx;
+
+  idx = cache_new_entry (recno, 0, &err);
+  if (idx != -1)
+    memcpy (cache.items[idx].data, data, TRUST_RECORD_LEN);
 }
 
 
@@ -404,8 +610,8 @@ tdbio_is_dirty()
 int
 tdbio_sync()
 {
-    CACHE_CTRL r;
     int did_lock = 0;
+    int rc;
 
     if( db_fd == -1 )
 	open_db();
@@ -418,13 +624,9 @@ tdbio_sync()
     if (!take_write_lock ())
         did_lock = 1;
 
-    for( r = cache_list; r; r = r->next ) {
-	if( r->flags.used && r->flags.dirty ) {
-	    int rc = write_cache_item( r );
-	    if( rc )
-		return rc;
-	}
-    }
+    rc = write_dirty_records ();
+    if (rc)
+      return rc;
     cache_is_dirty = 0;
     if (did_lock)
         release_write_lock ();
@@ -432,7 +634,42 @@ tdbio_sync()
     return 0;
 }
 
-
+
+/* Print statistics for the record cache.  */
+void
+tdbio_dump_stats (void)
+{
+  log_info ("tdbio cache: entries=%u/%u reads=%u hits=%u mapped=%u"
+            " evicted=%u dropped=%u writes=%u records=%u\n",
+            cache.nused, cache.limit, cache_stats.reads, cache_stats.hits,
+            cache_stats.mapped, cache_stats.evicted, cache_stats.dropped,
+            cache_stats.writes, cache_stats.written);
+}
+
+
+#ifdef HAVE_MMAP
+/* Map the trustdb into memory or, if it has grown, map it again.  On
+   error we silently fall back to pread.  */
+static void
+map_db (void)
+{
+  struct stat st;
+  void *map;
+
+  if (fstat (db_fd, &st) || (size_t)st.st_size <= db_map_len
+      || (off_t)(size_t)st.st_size != st.st_size)
+    return;
+  map = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, db_fd, 0);
+  if (map == MAP_FAILED)
+    return;
+  if (db_map)
+    munmap ((void *)db_map, db_map_len);
+  db_map = (const byte *)map;
+  db_map_len = st.st_size;
+}
+#endif /*HAVE_MMAP*/
+
+
 /********************************************************
  **************** cached I/O functions ******************
  ********************************************************/
@@ -690,6 +927,13 @@ open_db ()
     log_fatal( _("can't open '%s': %s\n"), db_name, strerror(errno) );
   register_secured_file (db_name);
 
+  {
+    struct stat st;
+
+    if (!fstat (db_fd, &st))
+      cache_set_limit (st.st_size / TRUST_RECORD_LEN);
+  }
+
   /* Read the version record. */
   if (tdbio_read_record (0, &rec, RECTYPE_VER ) )
     log_fatal( _("%s: invalid trustdb\n"), db_name );
@@ -1351,9 +1595,25 @@ tdbio_read_record (unsigned long recnum, TRUSTREC *rec, int expected)
   if (db_fd == -1)
     open_db ();
 
+  cache_stats.reads++;
   buf = (const byte*) get_record_from_cache( recnum );
-  if (!buf)
+  if (buf)
+    cache_stats.hits++;
+#ifdef HAVE_MMAP
+  else if (opt.trustdb_mmap
+           && ((recnum + 1) * TRUST_RECORD_LEN <= db_map_len
+               || (map_db (), (recnum + 1) * TRUST_RECORD_LEN <= db_map_len)))
+    {
+      buf = db_map + recnum * TRUST_RECORD_LEN;
+      cache_stats.mapped++;
+    }
+#endif
+  else
     {
+#ifndef HAVE_DOSISH_SYSTEM
+      n = pread (db_fd, readbuf, TRUST_RECORD_LEN,
+                 (off_t)recnum * TRUST_RECORD_LEN);
+#else
       if (lseek (db_fd, recnum * TRUST_RECORD_LEN, SEEK_SET) == -1)
         {
           err = gpg_error_from_syserror ();
@@ -1361,6 +1621,7 @@ tdbio_read_record (unsigned long recnum, TRUSTREC *rec, int expected)
           return err;
 	}
       n = read (db_fd, readbuf, TRUST_RECORD_LEN);
+#endif
       if (!n)
         {
           return -1; /* eof */
@@ -1372,6 +1633,7 @@ tdbio_read_record (unsigned long recnum, TRUSTREC *rec, int expected)
                      n, strerror(errno));
           return err;
 	}
+      put_clean_record_into_cache (recnum, readbuf);
       buf = readbuf;
     }
   rec->recnum = recnum;
@@ -1702,6 +1964,7 @@ tdbio_new_recnum (ctrl_t ctrl)
       if (rc)
         log_fatal (_("%s: failed to append a record: %s\n"),
                    db_name,	gpg_strerror (rc));
+      cache_set_limit (recnum + 1);
     }
 
   return recnum ;
@@ -105,6 +105,7 @@ unsigned long tdbio_read_nextcheck (void);
 int tdbio_write_nextcheck (ctrl_t ctrl, unsigned long stamp);
 int tdbio_is_dirty(void);
 int tdbio_sync(void);
+void tdbio_dump_stats (void);
 int tdbio_delete_record (ctrl_t ctrl, unsigned long recnum);
 unsigned long tdbio_new_recnum (ctrl_t ctrl);
 gpg_error_t tdbio_search_trust_byfpr (const byte *fingerprint, TRUSTREC *rec);
@@ -148,7 +148,7 @@ exit_tests (int force)
 /* Prepend FNAME with the srcdir environment variable's value and
    return a malloced filename.  Caller must release the returned
    string using test_free.  */
-char *
+static char *
 prepend_srcdir (const char *fname)
 {
   static const char *srcdir;
@@ -165,7 +165,7 @@ prepend_srcdir (const char *fname)
 }
 
 
-void
+static void
 test_free (void *a)
 {
   if (a)
@@ -173,8 +173,14 @@ test_free (void *a)
 }
 
 
+/* A test which is linked into a test driver defines TEST_MAIN to
+   the name the driver calls.  */
+#ifndef TEST_MAIN
+#define TEST_MAIN main
+#endif
+
 int
-main (int argc, char *argv[])
+TEST_MAIN (int argc, char *argv[])
 {
   const char *s;
 
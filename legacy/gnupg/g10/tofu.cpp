@@ -29,6 +29,9 @@
 #include <stdarg.h>
 #include <sqlite3.h>
 #include <time.h>
+#ifdef HAVE_PTHREAD
+# include <pthread.h>
+#endif
 
 #include "gpg.h"
 #include "../common/types.h"
@@ -55,6 +58,38 @@
  * indicate that a lot of history is available.  */
 #define FULL_TRUST_THRESHOLD  21
 
+/* The size of SQLite's page cache for the TOFU DB in KiB.  */
+#define TOFU_DB_CACHE_SIZE  8192
+
+
+/* The statistics of a binding as shown by show_statistics.  */
+struct binding_stats
+{
+  unsigned long signature_count;
+  unsigned long signature_first_seen;
+  unsigned long signature_most_recent;
+  unsigned long signature_days;
+  unsigned long encryption_count;
+  unsigned long encryption_first_done;
+  unsigned long encryption_most_recent;
+  unsigned long encryption_days;
+};
+
+/* A binding of the key in the bindings cache (see prefetch_bindings)
+ * together with its signature and encryption statistics.  */
+struct binding_row
+{
+  struct binding_row *next;
+
+  /* The columns policy, conflict and effective_policy in the format
+   * returned by strings_collect_cb.  */
+  strlist_t policy;
+
+  struct binding_stats stats;
+
+  char email[1];
+};
+
 
 /* A struct with data pertaining to the tofu DB.  There is one such
    struct per session and it is cached in session's ctrl structure.
@@ -82,8 +117,29 @@ struct tofu_dbs_s
     sqlite3_stmt *register_already_seen;
     sqlite3_stmt *register_signature;
     sqlite3_stmt *register_encryption;
+    sqlite3_stmt *prefetch_bindings;
+    sqlite3_stmt *prefetch_data_version;
+    sqlite3_stmt *queue_signature;
+    sqlite3_stmt *queue_encryption;
   } s;
 
+  /* The write-behind queue or NULL.  */
+  struct tofu_queue_s *queue;
+
+  /* All bindings of the key with the fingerprint FINGERPRINT as read
+   * by prefetch_bindings.  The rows are valid as long as neither this
+   * connection (CHANGES) nor another process (DATA_VERSION) modified
+   * the DB.  If IN_BATCH is set, the rows were read in the current
+   * batch transaction, which locks out other writers.  */
+  struct
+  {
+    char *fingerprint;
+    struct binding_row *rows;
+    int changes;
+    long data_version;
+    int in_batch;
+  } bindings;
+
   int in_batch_transaction;
   int in_transaction;
   time_t batch_update_started;
@@ -111,6 +167,10 @@ struct tofu_dbs_s
 /* Local prototypes.  */
 static gpg_error_t end_transaction (ctrl_t ctrl, int only_batch);
 static char *email_from_user_id (const char *user_id);
+static void bindings_cache_clear (tofu_dbs_t dbs);
+static void queue_open (tofu_dbs_t dbs, const char *filename);
+static void queue_close (tofu_dbs_t dbs);
+static void queue_drain (tofu_dbs_t dbs);
 static int show_statistics (tofu_dbs_t dbs,
                             const char *fingerprint, const char *email,
                             enum tofu_policy policy,
@@ -292,6 +352,7 @@ end_transaction (ctrl_t ctrl, int only_batch)
            * batch mode.  */
           dbs->in_batch_transaction = 0;
           dbs->in_transaction = 0;
+          dbs->bindings.in_batch = 0;
 
           rc = gpgsql_stepx (dbs->db, &dbs->s.savepoint_batch_commit,
                              NULL, NULL, &err,
@@ -341,6 +402,9 @@ rollback_transaction (ctrl_t ctrl)
   log_assert (dbs);
   log_assert (dbs->in_transaction > 0);
 
+  /* The rows might describe changes that we are about to undo.  */
+  bindings_cache_clear (dbs);
+
   /* Be careful to not undo any progress made by closed transactions in
      batch mode.  */
   rc = gpgsql_exec_printf (dbs->db, NULL, NULL, &err,
@@ -845,6 +909,24 @@ initdb (sqlite3 *db)
           sqlite3_free (err);
         }
     }
+  if (! rc)
+    {
+      /* The statistics only look at the time stamps of a binding's
+       * signatures and encryptions.  These indexes cover those
+       * queries so that they don't need to touch the tables.  */
+      rc = sqlite3_exec (db,
+                         "create index if not exists signatures_binding_time"
+                         " on signatures (binding, time);\n"
+                         "create index if not exists encryptions_binding_time"
+                         " on encryptions (binding, time);\n",
+                         NULL, NULL, &err);
+      if (rc)
+        {
+	  log_error (_("error initializing TOFU database: %s\n"), err);
+          print_further_info ("create statistics indexes");
+          sqlite3_free (err);
+        }
+    }
   if (! rc)
     {
       /* The effective policy for a binding.  If a key is ultimately
@@ -967,6 +1049,27 @@ opendbs (ctrl_t ctrl)
           sqlite3_busy_handler (db, busy_handler, ctrl);
         }
 
+      /* Use a write-ahead log so that readers don't block on a writer
+       * and a commit needs only one sync.  This is a persistent
+       * property of the DB; if it can't be switched (e.g., on a
+       * network file system), we just continue with the rollback
+       * journal.  */
+      if (db)
+        {
+          char *err = NULL;
+
+          rc = gpgsql_exec_printf (db, NULL, NULL, &err,
+                                   "pragma journal_mode = wal;\n"
+                                   "pragma synchronous = normal;\n"
+                                   "pragma cache_size = -%d;\n",
+                                   TOFU_DB_CACHE_SIZE);
+          if (rc)
+            {
+              log_info ("TOFU: error tuning the database: %s\n", err);
+              sqlite3_free (err);
+            }
+        }
+
       if (db && initdb (db))
         {
           sqlite3_close (db);
@@ -978,6 +1081,7 @@ opendbs (ctrl_t ctrl)
           ctrl->tofu.dbs = (tofu_dbs_t) xmalloc_clear (sizeof *ctrl->tofu.dbs);
           ctrl->tofu.dbs->db = db;
           ctrl->tofu.dbs->want_lock_file = xasprintf ("%s-want-lock", filename);
+          queue_open (ctrl->tofu.dbs, filename);
         }
 
       xfree (filename);
@@ -1004,12 +1108,17 @@ tofu_closedbs (ctrl_t ctrl)
 
   end_transaction (ctrl, 2);
 
+  /* Write out the queued records.  The batch transaction must be
+   * closed for this.  */
+  queue_close (dbs);
+
   /* Arghh, that is a surprising use of the struct.  */
   for (statements = (sqlite3_stmt**) (void *) &dbs->s;
        (void *) statements < (void *) &(&dbs->s)[1];
        statements ++)
     sqlite3_finalize (*statements);
 
+  bindings_cache_clear (dbs);
   sqlite3_close (dbs->db);
   xfree (dbs->want_lock_file);
   xfree (dbs);
@@ -1198,6 +1307,809 @@ strings_collect_cb2 (void *cookie, int argc, char **argv, char **azColName,
 
 }
 
+/* Release the bindings cache of DBS.  */
+static void
+bindings_cache_clear (tofu_dbs_t dbs)
+{
+  struct binding_row *row;
+
+  while ((row = dbs->bindings.rows))
+    {
+      dbs->bindings.rows = row->next;
+      free_strlist (row->policy);
+      xfree (row);
+    }
+  xfree (dbs->bindings.fingerprint);
+  dbs->bindings.fingerprint = NULL;
+  dbs->bindings.in_batch = 0;
+}
+
+/* Process rows that contain the columns:
+
+     <email, policy, conflict, effective policy,
+      signature count, first, most recent, days,
+      encryption count, first, most recent, days>.  */
+static int
+bindings_collect_cb (void *cookie, int argc, char **argv,
+                     char **azColName, sqlite3_stmt *stmt)
+{
+  struct binding_row **rowsp = (binding_row**) cookie;
+  struct binding_row *row;
+  unsigned long *stats[8];
+  int i;
+
+  (void) azColName;
+  (void) stmt;
+
+  log_assert (argc == 12);
+
+  row = (binding_row*) xmalloc_clear (sizeof *row
+                                      + strlen (argv[0] ? argv[0] : ""));
+  strcpy (row->email, argv[0] ? argv[0] : "");
+  row->next = *rowsp;
+  *rowsp = row;
+
+  strings_collect_cb (&row->policy, 3, argv + 1, NULL);
+
+  stats[0] = &row->stats.signature_count;
+  stats[1] = &row->stats.signature_first_seen;
+  stats[2] = &row->stats.signature_most_recent;
+  stats[3] = &row->stats.signature_days;
+  stats[4] = &row->stats.encryption_count;
+  stats[5] = &row->stats.encryption_first_done;
+  stats[6] = &row->stats.encryption_most_recent;
+  stats[7] = &row->stats.encryption_days;
+  for (i = 0; i < 8; i ++)
+    if (string_to_ulong (stats[i], argv[4 + i] ? argv[4 + i] : "0",
+                         0, __LINE__))
+      return 1; /* Abort.  */
+
+  return 0;
+}
+
+/* Read all bindings of the key FINGERPRINT together with their
+ * signature and encryption statistics into the bindings cache of DBS.
+ * This replaces one query for the policy and four queries for the
+ * statistics of each of the key's user ids with a single query for
+ * the whole key.  Returns 0 on success.  */
+static int
+prefetch_bindings (tofu_dbs_t dbs, const char *fingerprint)
+{
+  int rc;
+  char *err = NULL;
+  long data_version = 0;
+  struct binding_row *rows = NULL;
+
+  bindings_cache_clear (dbs);
+
+  /* Get the version before reading the rows so that a concurrent
+   * commit can only make us throw away valid rows.  */
+  if (! dbs->in_batch_transaction)
+    {
+      rc = gpgsql_stepx (dbs->db, &dbs->s.prefetch_data_version,
+                         get_single_long_cb2, &data_version, &err,
+                         "pragma data_version;", GPGSQL_ARG_END);
+      if (rc)
+        goto leave;
+    }
+
+  rc = gpgsql_stepx
+    (dbs->db, &dbs->s.prefetch_bindings,
+     bindings_collect_cb, &rows, &err,
+     "select email, policy, conflict, effective_policy,\n"
+     "  (select count (*) from signatures where binding = b.oid),\n"
+     "  (select coalesce (min (time), 0) from signatures\n"
+     "    where binding = b.oid),\n"
+     "  (select coalesce (max (time), 0) from signatures\n"
+     "    where binding = b.oid),\n"
+     "  (select count (distinct round (time / (24 * 60 * 60)))\n"
+     "    from signatures where binding = b.oid),\n"
+     "  (select count (*) from encryptions where binding = b.oid),\n"
+     "  (select coalesce (min (time), 0) from encryptions\n"
+     "    where binding = b.oid),\n"
+     "  (select coalesce (max (time), 0) from encryptions\n"
+     "    where binding = b.oid),\n"
+     "  (select count (distinct round (time / (24 * 60 * 60)))\n"
+     "    from encryptions where binding = b.oid)\n"
+     " from bindings b where fingerprint = ?;",
+     GPGSQL_ARG_STRING, fingerprint, GPGSQL_ARG_END);
+
+ leave:
+  dbs->bindings.rows = rows;
+  if (rc)
+    {
+      if (DBG_TRUST)
+        log_debug ("TOFU: Error prefetching the bindings of %s: %s\n",
+                   fingerprint, err);
+      sqlite3_free (err);
+      bindings_cache_clear (dbs);
+      return rc;
+    }
+
+  dbs->bindings.fingerprint = xstrdup (fingerprint);
+  dbs->bindings.changes = sqlite3_total_changes (dbs->db);
+  dbs->bindings.data_version = data_version;
+  dbs->bindings.in_batch = dbs->in_batch_transaction;
+  return 0;
+}
+
+/* Look up the binding <FINGERPRINT, EMAIL> in the bindings cache of
+ * DBS, reading the key's bindings if they are not cached or stale.
+ * Returns the row or NULL if the binding is not in the DB; in both
+ * cases R_KNOWN is set.  If the cache could not be filled, R_KNOWN is
+ * cleared and the caller has to query the DB itself.  */
+static struct binding_row *
+lookup_binding (tofu_dbs_t dbs, const char *fingerprint, const char *email,
+                int *r_known)
+{
+  struct binding_row *row;
+  int valid;
+
+  *r_known = 0;
+
+  valid = (dbs->bindings.fingerprint
+           && ! strcmp (dbs->bindings.fingerprint, fingerprint)
+           && dbs->bindings.changes == sqlite3_total_changes (dbs->db));
+  if (valid && ! (dbs->bindings.in_batch && dbs->in_batch_transaction))
+    {
+      long data_version = 0;
+      char *err = NULL;
+
+      if (gpgsql_stepx (dbs->db, &dbs->s.prefetch_data_version,
+                        get_single_long_cb2, &data_version, &err,
+                        "pragma data_version;", GPGSQL_ARG_END))
+        {
+          sqlite3_free (err);
+          valid = 0;
+        }
+      else
+        valid = (! dbs->bindings.in_batch
+                 && data_version == dbs->bindings.data_version);
+    }
+
+  if (! valid && prefetch_bindings (dbs, fingerprint))
+    return NULL;
+
+  *r_known = 1;
+  for (row = dbs->bindings.rows; row; row = row->next)
+    if (! strcmp (row->email, email))
+      return row;
+  return NULL;
+}
+
+
+/* The write-behind queue.  tofu_register_signature and
+ * tofu_register_encryption don't write the records themselves but
+ * queue them.  A thread with its own connection to the DB writes the
+ * queue in large transactions so that the callers don't wait for the
+ * DB.  Readers of the statistics combine the cached bindings with the
+ * queue (queue_merge_stats) or write out the queue first
+ * (queue_drain).  */
+
+/* Write the queue if it has this many records...  */
+#define TOFU_QUEUE_FLUSH  256
+/* ...or if its oldest record has waited this many seconds.  */
+#define TOFU_QUEUE_DELAY  1
+/* Number of buckets of the hash table of queued signatures.  */
+#define TOFU_QUEUE_BUCKETS  521
+
+/* A signature or encryption waiting to be written to the DB.  */
+struct queued_write
+{
+  struct queued_write *next;
+  struct queued_write *hash_next;
+  unsigned int hash;
+  int is_signature;
+  long long time;
+
+  /* Only for signatures.  */
+  long long sig_time;
+  const char *sig_digest;
+  const char *origin;
+
+  const char *email;
+  char fingerprint[1];
+};
+
+/* Write ITEM using the connection DB.  SIG_STMT and ENC_STMT are the
+ * connection's cached statements.  A signature that is already in the
+ * DB is silently skipped.  */
+static int
+queue_write_item (sqlite3 *db, sqlite3_stmt **sig_stmt,
+                  sqlite3_stmt **enc_stmt, struct queued_write *item,
+                  char **err)
+{
+  if (item->is_signature)
+    return gpgsql_stepx
+      (db, sig_stmt, NULL, NULL, err,
+       "insert or ignore into signatures\n"
+       " (binding, sig_digest, origin, sig_time, time)\n"
+       " select oid, ?, ?, ?, ? from bindings\n"
+       "  where fingerprint = ? and email = ?\n"
+       "   and not exists (select 1 from signatures\n"
+       "     where binding = bindings.oid\n"
+       "      and sig_time = ? and sig_digest = ?);",
+       GPGSQL_ARG_STRING, item->sig_digest, GPGSQL_ARG_STRING, item->origin,
+       GPGSQL_ARG_LONG_LONG, item->sig_time,
+       GPGSQL_ARG_LONG_LONG, item->time,
+       GPGSQL_ARG_STRING, item->fingerprint, GPGSQL_ARG_STRING, item->email,
+       GPGSQL_ARG_LONG_LONG, item->sig_time,
+       GPGSQL_ARG_STRING, item->sig_digest,
+       GPGSQL_ARG_END);
+  else
+    return gpgsql_stepx
+      (db, enc_stmt, NULL, NULL, err,
+       "insert into encryptions (binding, time)\n"
+       " select oid, ? from bindings\n"
+       "  where fingerprint = ? and email = ?;",
+       GPGSQL_ARG_LONG_LONG, item->time,
+       GPGSQL_ARG_STRING, item->fingerprint, GPGSQL_ARG_STRING, item->email,
+       GPGSQL_ARG_END);
+}
+
+static unsigned int
+queue_hash (const char *fingerprint, const char *email,
+            const char *sig_digest, long long sig_time)
+{
+  unsigned int h = (unsigned int) sig_time;
+  const char *strings[3];
+  const char *p;
+  int i;
+
+  strings[0] = fingerprint;
+  strings[1] = email;
+  strings[2] = sig_digest;
+  for (i = 0; i < 3; i ++)
+    for (p = strings[i]; *p; p ++)
+      h = h * 33 + (unsigned char) *p;
+  return h;
+}
+
+#ifdef HAVE_PTHREAD
+
+struct tofu_queue_s
+{
+  /* Protects all fields below except DB and its statements.  */
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+
+  /* Held by the thread while it writes records, i.e., while the
+   * records are neither in ITEMS nor visible in the DB.  */
+  pthread_mutex_t write_lock;
+
+  pthread_t thread;
+  int have_thread;
+  int stop;
+
+  /* The records that have not yet been taken by a writer in
+   * registration order.  */
+  struct queued_write *items;
+  struct queued_write **tail;
+  int count;
+  time_t oldest;
+
+  /* All queued signatures including those that are being written.  */
+  struct queued_write *hash[TOFU_QUEUE_BUCKETS];
+
+  /* Used by the thread.  */
+  char *filename;
+  char *want_lock_file;
+  sqlite3 *db;
+  sqlite3_stmt *sig_stmt;
+  sqlite3_stmt *enc_stmt;
+};
+
+/* Remove the written records ITEMS from the hash table and release
+ * them.  Must be called with Q->LOCK held.  */
+static void
+queue_forget (struct tofu_queue_s *q, struct queued_write *items)
+{
+  struct queued_write *item, **pp;
+
+  while ((item = items))
+    {
+      items = item->next;
+      if (item->is_signature)
+        {
+          for (pp = &q->hash[item->hash % TOFU_QUEUE_BUCKETS];
+               *pp != item; pp = &(*pp)->hash_next)
+            ;
+          *pp = item->hash_next;
+        }
+      xfree (item);
+    }
+}
+
+/* Write out all queued records using the thread's connection.  */
+static void
+queue_write (struct tofu_queue_s *q)
+{
+  struct queued_write *items, *item;
+  char *err = NULL;
+  int rc;
+
+  if (! q->db)
+    {
+      if (sqlite3_open (q->filename, &q->db))
+        {
+          log_error (_("error opening TOFU database '%s': %s\n"),
+                     q->filename, sqlite3_errmsg (q->db));
+          sqlite3_close (q->db);
+          q->db = NULL;
+          goto drop;
+        }
+      sqlite3_busy_timeout (q->db, 100);
+    }
+
+  /* Get the DB lock before taking the records so that readers never
+   * wait for the lock owner while holding WRITE_LOCK.  If the main
+   * thread is in a batch transaction, ask it to yield.  */
+  while ((rc = sqlite3_exec (q->db, "begin immediate transaction;",
+                             NULL, NULL, &err)) == SQLITE_BUSY)
+    {
+      estream_t fp;
+
+      sqlite3_free (err);
+      err = NULL;
+      fp = es_fopen (q->want_lock_file, "w");
+      if (fp)
+        es_fclose (fp);
+      gnupg_usleep (100000);
+    }
+  if (rc)
+    {
+      log_error (_("error beginning transaction on TOFU database: %s\n"),
+                 err);
+      sqlite3_free (err);
+      goto drop;
+    }
+
+  pthread_mutex_lock (&q->write_lock);
+  pthread_mutex_lock (&q->lock);
+  items = q->items;
+  q->items = NULL;
+  q->tail = &q->items;
+  q->count = 0;
+  pthread_mutex_unlock (&q->lock);
+
+  for (item = items; item; item = item->next)
+    if (queue_write_item (q->db, &q->sig_stmt, &q->enc_stmt, item, &err))
+      {
+        log_error (_("error updating TOFU database: %s\n"), err);
+        print_further_info ("writing the queue");
+        sqlite3_free (err);
+        err = NULL;
+      }
+
+  if (sqlite3_exec (q->db, "commit transaction;", NULL, NULL, &err))
+    {
+      log_error (_("error committing transaction on TOFU database: %s\n"),
+                 err);
+      sqlite3_free (err);
+      sqlite3_exec (q->db, "rollback;", NULL, NULL, NULL);
+    }
+
+  pthread_mutex_lock (&q->lock);
+  queue_forget (q, items);
+  pthread_mutex_unlock (&q->lock);
+  pthread_mutex_unlock (&q->write_lock);
+  return;
+
+ drop:
+  /* Don't retry forever.  */
+  pthread_mutex_lock (&q->write_lock);
+  pthread_mutex_lock (&q->lock);
+  items = q->items;
+  q->items = NULL;
+  q->tail = &q->items;
+  q->count = 0;
+  queue_forget (q, items);
+  pthread_mutex_unlock (&q->lock);
+  pthread_mutex_unlock (&q->write_lock);
+}
+
+static void *
+queue_thread (void *arg)
+{
+  struct tofu_queue_s *q = (struct tofu_queue_s *) arg;
+  struct timespec abstime;
+
+  pthread_mutex_lock (&q->lock);
+  for (;;)
+    {
+      if (! q->count && q->stop)
+        break;
+
+      if (! q->count)
+        pthread_cond_wait (&q->cond, &q->lock);
+      else if (q->count < TOFU_QUEUE_FLUSH && ! q->stop
+               && time (NULL) < q->oldest + TOFU_QUEUE_DELAY)
+        {
+          abstime.tv_sec = q->oldest + TOFU_QUEUE_DELAY;
+          abstime.tv_nsec = 0;
+          pthread_cond_timedwait (&q->cond, &q->lock, &abstime);
+        }
+      else
+        {
+          pthread_mutex_unlock (&q->lock);
+          queue_write (q);
+          pthread_mutex_lock (&q->lock);
+        }
+    }
+  pthread_mutex_unlock (&q->lock);
+
+  return NULL;
+}
+
+/* Create the queue for DBS, which uses the DB FILENAME.  */
+static void
+queue_open (tofu_dbs_t dbs, const char *filename)
+{
+  struct tofu_queue_s *q;
+
+  q = (struct tofu_queue_s *) xmalloc_clear (sizeof *q);
+  pthread_mutex_init (&q->lock, NULL);
+  pthread_mutex_init (&q->write_lock, NULL);
+  pthread_cond_init (&q->cond, NULL);
+  q->tail = &q->items;
+  q->filename = xstrdup (filename);
+  q->want_lock_file = xstrdup (dbs->want_lock_file);
+
+  dbs->queue = q;
+}
+
+/* Write out the queue, stop its thread and release it.  */
+static void
+queue_close (tofu_dbs_t dbs)
+{
+  struct tofu_queue_s *q = dbs->queue;
+
+  if (! q)
+    return;
+
+  if (q->have_thread)
+    {
+      pthread_mutex_lock (&q->lock);
+      q->stop = 1;
+      pthread_cond_signal (&q->cond);
+      pthread_mutex_unlock (&q->lock);
+      pthread_join (q->thread, NULL);
+    }
+  else
+    queue_drain (dbs);
+
+  if (q->db)
+    {
+      sqlite3_finalize (q->sig_stmt);
+      sqlite3_finalize (q->enc_stmt);
+      sqlite3_close (q->db);
+    }
+  pthread_mutex_destroy (&q->lock);
+  pthread_mutex_destroy (&q->write_lock);
+  pthread_cond_destroy (&q->cond);
+  xfree (q->filename);
+  xfree (q->want_lock_file);
+  xfree (q);
+  dbs->queue = NULL;
+}
+
+/* Queue a signature (if SIG_DIGEST is not NULL) or an encryption for
+ * the binding <FINGERPRINT, EMAIL>.  Returns 0 if the record was
+ * queued and -1 if the caller has to write it itself.  */
+static int
+queue_push (tofu_dbs_t dbs, const char *fingerprint, const char *email,
+            const char *sig_digest, const char *origin, time_t sig_time,
+            time_t now)
+{
+  struct tofu_queue_s *q = dbs->queue;
+  struct queued_write *item;
+  size_t n;
+  char *p;
+
+  if (! q)
+    return -1;
+
+  pthread_mutex_lock (&q->lock);
+  if (! q->have_thread)
+    {
+      if (pthread_create (&q->thread, NULL, queue_thread, q))
+        {
+          pthread_mutex_unlock (&q->lock);
+          return -1;
+        }
+      q->have_thread = 1;
+    }
+  pthread_mutex_unlock (&q->lock);
+
+  n = strlen (fingerprint) + strlen (email) + 1;
+  if (sig_digest)
+    n += strlen (sig_digest) + strlen (origin) + 2;
+  item = (struct queued_write *) xmalloc_clear (sizeof *item + n);
+  p = stpcpy (item->fingerprint, fingerprint) + 1;
+  item->email = p;
+  p = stpcpy (p, email) + 1;
+  item->time = now;
+  if (sig_digest)
+    {
+      item->is_signature = 1;
+      item->sig_time = sig_time;
+      item->sig_digest = p;
+      p = stpcpy (p, sig_digest) + 1;
+      item->origin = p;
+      strcpy (p, origin);
+      item->hash = queue_hash (fingerprint, email, sig_digest, sig_time);
+    }
+
+  pthread_mutex_lock (&q->lock);
+  if (item->is_signature)
+    {
+      item->hash_next = q->hash[item->hash % TOFU_QUEUE_BUCKETS];
+      q->hash[item->hash % TOFU_QUEUE_BUCKETS] = item;
+    }
+  if (! q->count)
+    q->oldest = time (NULL);
+  *q->tail = item;
+  q->tail = &item->next;
+  if (++ q->count == TOFU_QUEUE_FLUSH)
+    pthread_cond_signal (&q->cond);
+  pthread_mutex_unlock (&q->lock);
+
+  return 0;
+}
+
+/* Return true if the signature <SIG_DIGEST, SIG_TIME> on the binding
+ * <FINGERPRINT, EMAIL> is queued or being written.  */
+static int
+queue_has_signature (tofu_dbs_t dbs, const char *fingerprint,
+                     const char *email, const char *sig_digest,
+                     time_t sig_time)
+{
+  struct tofu_queue_s *q = dbs->queue;
+  struct queued_write *item;
+  unsigned int h;
+  int found = 0;
+
+  if (! q)
+    return 0;
+
+  h = queue_hash (fingerprint, email, sig_digest, sig_time);
+  pthread_mutex_lock (&q->lock);
+  for (item = q->hash[h % TOFU_QUEUE_BUCKETS]; item; item = item->hash_next)
+    if (item->hash == h && item->sig_time == sig_time
+        && ! strcmp (item->sig_digest, sig_digest)
+        && ! strcmp (item->fingerprint, fingerprint)
+        && ! strcmp (item->email, email))
+      {
+        found = 1;
+        break;
+      }
+  pthread_mutex_unlock (&q->lock);
+
+  return found;
+}
+
+/* Keep the thread from writing records until queue_unlock_writes is
+ * called.  Afterwards, every record is either in the queue or visible
+ * in the DB.  */
+static void
+queue_lock_writes (tofu_dbs_t dbs)
+{
+  if (dbs->queue)
+    pthread_mutex_lock (&dbs->queue->write_lock);
+}
+
+static void
+queue_unlock_writes (tofu_dbs_t dbs)
+{
+  if (dbs->queue)
+    pthread_mutex_unlock (&dbs->queue->write_lock);
+}
+
+/* Take the queued records.  */
+static struct queued_write *
+queue_take (struct tofu_queue_s *q)
+{
+  struct queued_write *items;
+
+  pthread_mutex_lock (&q->lock);
+  items = q->items;
+  q->items = NULL;
+  q->tail = &q->items;
+  q->count = 0;
+  pthread_mutex_unlock (&q->lock);
+
+  return items;
+}
+
+/* Release the records ITEMS taken by queue_take.  */
+static void
+queue_release (struct tofu_queue_s *q, struct queued_write *items)
+{
+  pthread_mutex_lock (&q->lock);
+  queue_forget (q, items);
+  pthread_mutex_unlock (&q->lock);
+}
+
+/* Iterate over the queued records.  Must be called between
+ * queue_lock_writes and queue_unlock_writes.  */
+static struct queued_write *
+queue_first (tofu_dbs_t dbs)
+{
+  struct queued_write *items;
+
+  if (! dbs->queue)
+    return NULL;
+
+  /* The main thread is the only one adding records, thus the list
+   * can't change under us once we have read its head.  */
+  pthread_mutex_lock (&dbs->queue->lock);
+  items = dbs->queue->items;
+  pthread_mutex_unlock (&dbs->queue->lock);
+
+  return items;
+}
+
+#else /*!HAVE_PTHREAD*/
+
+/* Without threads, there is no queue and the records are written
+ * immediately.  */
+static void
+queue_open (tofu_dbs_t dbs, const char *filename)
+{
+  (void) dbs;
+  (void) filename;
+}
+
+static void
+queue_close (tofu_dbs_t dbs)
+{
+  (void) dbs;
+}
+
+static int
+queue_push (tofu_dbs_t dbs, const char *fingerprint, const char *email,
+            const char *sig_digest, const char *origin, time_t sig_time,
+            time_t now)
+{
+  (void) dbs;
+  (void) fingerprint;
+  (void) email;
+  (void) sig_digest;
+  (void) origin;
+  (void) sig_time;
+  (void) now;
+  return -1;
+}
+
+static int
+queue_has_signature (tofu_dbs_t dbs, const char *fingerprint,
+                     const char *email, const char *sig_digest,
+                     time_t sig_time)
+{
+  (void) dbs;
+  (void) fingerprint;
+  (void) email;
+  (void) sig_digest;
+  (void) sig_time;
+  return 0;
+}
+
+static void
+queue_lock_writes (tofu_dbs_t dbs)
+{
+  (void) dbs;
+}
+
+static void
+queue_unlock_writes (tofu_dbs_t dbs)
+{
+  (void) dbs;
+}
+
+static struct queued_write *
+queue_take (struct tofu_queue_s *q)
+{
+  (void) q;
+  return NULL;
+}
+
+static void
+queue_release (struct tofu_queue_s *q, struct queued_write *items)
+{
+  (void) q;
+  (void) items;
+}
+
+static struct queued_write *
+queue_first (tofu_dbs_t dbs)
+{
+  (void) dbs;
+  return NULL;
+}
+
+#endif /*!HAVE_PTHREAD*/
+
+/* Write out the queued records using the main connection.  This is
+ * used before reading the statistics directly from the DB.  A batch
+ * the thread has already taken is committed before we return: taking
+ * the write lock waits for it.  The lock is released before we write
+ * because the thread gets the DB lock before the write lock.  */
+static void
+queue_drain (tofu_dbs_t dbs)
+{
+  struct queued_write *items, *item;
+  char *err = NULL;
+
+  if (! dbs->queue)
+    return;
+
+  queue_lock_writes (dbs);
+  items = queue_take (dbs->queue);
+  queue_unlock_writes (dbs);
+  for (item = items; item; item = item->next)
+    if (queue_write_item (dbs->db, &dbs->s.queue_signature,
+                          &dbs->s.queue_encryption, item, &err))
+      {
+        log_error (_("error updating TOFU database: %s\n"), err);
+        print_further_info ("writing the queue");
+        sqlite3_free (err);
+        err = NULL;
+      }
+  queue_release (dbs->queue, items);
+}
+
+/* Add the queued records of the binding <FINGERPRINT, EMAIL> to the
+ * statistics STATS, which were read from the DB.  Must be called
+ * between queue_lock_writes and queue_unlock_writes.  Returns 0 on
+ * success.  Returns -1 if a queued record is older than the most
+ * recent one in STATS; then the number of days can't be computed
+ * without the DB.  */
+static int
+queue_merge_stats (tofu_dbs_t dbs, const char *fingerprint,
+                   const char *email, struct binding_stats *stats)
+{
+  struct queued_write *item;
+  unsigned long *count, *first, *last, *days;
+  unsigned long t;
+
+  for (item = queue_first (dbs); item; item = item->next)
+    {
+      if (strcmp (item->fingerprint, fingerprint)
+          || strcmp (item->email, email))
+        continue;
+
+      if (item->is_signature)
+        {
+          count = &stats->signature_count;
+          first = &stats->signature_first_seen;
+          last = &stats->signature_most_recent;
+          days = &stats->signature_days;
+        }
+      else
+        {
+          count = &stats->encryption_count;
+          first = &stats->encryption_first_done;
+          last = &stats->encryption_most_recent;
+          days = &stats->encryption_days;
+        }
+
+      t = (unsigned long) item->time;
+      if (! *count)
+        {
+          *first = t;
+          *days = 1;
+        }
+      else if (t < *last)
+        return -1;
+      else if (t / (24 * 60 * 60) != *last / (24 * 60 * 60))
+        (*days) ++;
+      *last = t;
+      (*count) ++;
+    }
+
+  return 0;
+}
+
 /* Auxiliary data structure to collect statistics about
    signatures.  */
 struct signature_stats
@@ -1640,6 +2552,7 @@ ask_about_binding (ctrl_t ctrl,
     }
 
   /* Get the stats for all the keys in CONFLICT_SET.  */
+  queue_drain (dbs);
   strlist_rev (&conflict_set);
   for (iter = conflict_set; iter && ! rc; iter = iter->next)
     {
@@ -2335,18 +3248,30 @@ get_policy (ctrl_t ctrl, tofu_dbs_t dbs, PKT_public_key *pk,
   char *conflict = NULL;
   strlist_t conflict_set = NULL;
   int conflict_set_count;
+  struct binding_row *row;
+  int known;
 
   /* Check if the <FINGERPRINT, EMAIL> binding is known
      (TOFU_POLICY_NONE cannot appear in the DB.  Thus, if POLICY is
      still TOFU_POLICY_NONE after executing the query, then the
      result set was empty.)  */
-  rc = gpgsql_stepx (dbs->db, &dbs->s.get_policy_select_policy_and_conflict,
-                      strings_collect_cb2, &results, &err,
-                      "select policy, conflict, effective_policy from bindings\n"
-                      " where fingerprint = ? and email = ?",
-                      GPGSQL_ARG_STRING, fingerprint,
-                      GPGSQL_ARG_STRING, email,
-                      GPGSQL_ARG_END);
+  row = lookup_binding (dbs, fingerprint, email, &known);
+  if (known)
+    {
+      strlist_t sl;
+
+      for (sl = row ? row->policy : NULL; sl; sl = sl->next)
+        append_to_strlist (&results, sl->d);
+      rc = 0;
+    }
+  else
+    rc = gpgsql_stepx (dbs->db, &dbs->s.get_policy_select_policy_and_conflict,
+                        strings_collect_cb2, &results, &err,
+                        "select policy, conflict, effective_policy from bindings\n"
+                        " where fingerprint = ? and email = ?",
+                        GPGSQL_ARG_STRING, fingerprint,
+                        GPGSQL_ARG_STRING, email,
+                        GPGSQL_ARG_END);
   if (rc)
     {
       log_error (_("error reading TOFU database: %s\n"), err);
@@ -2998,12 +3923,48 @@ show_statistics (tofu_dbs_t dbs,
   unsigned long encryption_days = 0;
 
   int show_warning = 0;
+  struct binding_row *row;
+  int known;
 
   if (only_status_fd && ! is_status_enabled ())
     return 0;
 
   fingerprint_pp = format_hexfingerprint (fingerprint, NULL, 0);
 
+  /* The queue may not be written while we combine it with the
+   * cached rows.  */
+  queue_lock_writes (dbs);
+  row = lookup_binding (dbs, fingerprint, email, &known);
+  if (known)
+    {
+      struct binding_stats stats;
+
+      /* If the binding is not in the DB, there are no stats.  */
+      if (row)
+        stats = row->stats;
+      else
+        memset (&stats, 0, sizeof stats);
+
+      known = ! queue_merge_stats (dbs, fingerprint, email, &stats);
+      if (known)
+        {
+          signature_count = stats.signature_count;
+          signature_first_seen = stats.signature_first_seen;
+          signature_most_recent = stats.signature_most_recent;
+          signature_days = stats.signature_days;
+          encryption_count = stats.encryption_count;
+          encryption_first_done = stats.encryption_first_done;
+          encryption_most_recent = stats.encryption_most_recent;
+          encryption_days = stats.encryption_days;
+        }
+    }
+  queue_unlock_writes (dbs);
+  if (known)
+    goto have_stats;
+
+  /* The queries below only see what is in the DB.  */
+  queue_drain (dbs);
+
   /* Get the signature stats.  */
   rc = gpgsql_exec_printf
     (dbs->db, strings_collect_cb, &strlist, &err,
@@ -3112,6 +4073,7 @@ show_statistics (tofu_dbs_t dbs,
       strlist = NULL;
     }
 
+ have_stats:
   if (!outfp)
     write_status_text_and_buffer (STATUS_TOFU_USER, fingerprint,
                                   email, strlen (email), 0);
@@ -3382,7 +4344,13 @@ tofu_register_signature (ctrl_t ctrl,
 
       /* If we've already seen this signature before, then don't add
          it again.  */
-      rc = gpgsql_stepx
+      if (queue_has_signature (dbs, fingerprint, email, sig_digest, sig_time))
+        {
+          c = 1;
+          rc = 0;
+        }
+      else
+        rc = gpgsql_stepx
         (dbs->db, &dbs->s.register_already_seen,
          get_single_unsigned_long_cb2, &c, &err,
          "select count (*)\n"
@@ -3435,7 +4403,11 @@ tofu_register_signature (ctrl_t ctrl,
 
           log_assert (c == 0);
 
-          rc = gpgsql_stepx
+          if (! queue_push (dbs, fingerprint, email, sig_digest, origin,
+                            sig_time, now))
+            rc = 0;
+          else
+            rc = gpgsql_stepx
             (dbs->db, &dbs->s.register_signature, NULL, NULL, &err,
              "insert into signatures\n"
              " (binding, sig_digest, origin, sig_time, time)\n"
@@ -3575,7 +4547,10 @@ tofu_register_encryption (ctrl_t ctrl,
 
       free_strlist (conflict_set);
 
-      rc = gpgsql_stepx
+      if (! queue_push (dbs, fingerprint, email, NULL, NULL, 0, now))
+        rc = 0;
+      else
+        rc = gpgsql_stepx
         (dbs->db, &dbs->s.register_encryption, NULL, NULL, &err,
          "insert into encryptions\n"
          " (binding, time)\n"
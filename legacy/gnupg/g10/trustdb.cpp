@@ -755,6 +755,7 @@ tdb_update_ownertrust (ctrl_t ctrl, PKT_public_key *pk, unsigned int new_trust )
         {
           rec.r.trust.ownertrust = new_trust;
           write_record (ctrl, &rec);
+          certgraph_notice_key (pk_keyid (pk));
           tdb_revalidation_mark (ctrl);
           do_sync ();
         }
@@ -772,6 +773,7 @@ tdb_update_ownertrust (ctrl_t ctrl, PKT_public_key *pk, unsigned int new_trust )
       fingerprint_from_pk (pk, rec.r.trust.fingerprint, &dummy);
       rec.r.trust.ownertrust = new_trust;
       write_record (ctrl, &rec);
+      certgraph_notice_key (pk_keyid (pk));
       tdb_revalidation_mark (ctrl);
       do_sync ();
     }
@@ -870,6 +872,7 @@ tdb_clear_ownertrusts (ctrl_t ctrl, PKT_public_key *pk)
           rec.r.trust.ownertrust = 0;
           rec.r.trust.min_ownertrust = 0;
           write_record (ctrl, &rec);
+          certgraph_notice_key (pk_keyid (pk));
           tdb_revalidation_mark (ctrl);
           do_sync ();
           return 1;
@@ -1789,6 +1792,260 @@ search_skipfnc (void *opaque, u32 *kid, int dummy_uid_no)
 }
 
 
+/*
+ * Prepare KEYBLOCK and validate its user IDs against KLIST.  Returns
+ * true if the keyblock has signed user IDs and shall be kept by the
+ * caller.
+ */
+static int
+consider_keyblock (ctrl_t ctrl, kbnode_t keyblock, KeyHashTable full_trust,
+                   struct key_item *klist, u32 curtime, u32 *next_expire)
+{
+  PKT_public_key *pk;
+  KBNODE node;
+
+  /* prepare the keyblock for further processing */
+  merge_keys_and_selfsig (ctrl, keyblock);
+  clear_kbnode_flags (keyblock);
+  pk = keyblock->pkt->pkt.public_key;
+  if (pk->has_expired || pk->flags.revoked)
+    {
+      /* it does not make sense to look further at those keys */
+      mark_keyblock_seen (full_trust, keyblock);
+      return 0;
+    }
+
+  if (!validate_one_keyblock (ctrl, keyblock, klist, curtime, next_expire))
+    return 0;
+
+  if (pk->expiredate && pk->expiredate >= curtime
+      && pk->expiredate < *next_expire)
+    *next_expire = pk->expiredate;
+
+  /* Optimization - if all uids are fully trusted, then we
+     never need to consider this key as a candidate again. */
+
+  for (node=keyblock; node; node = node->next)
+    if (node->pkt->pkttype == PKT_USER_ID && !(node->flag & 4))
+      break;
+
+  if(node==NULL)
+    mark_keyblock_seen (full_trust, keyblock);
+
+  return 1;
+}
+
+
+/* Number of keyblocks read while the signatures of the previous
+   ones are being checked.  */
+#define VALIDATE_BATCH_SIZE 64
+
+/* A key of the current klist and its public key.  */
+struct signer_item
+{
+  struct signer_item *next;
+  u32 kid[2];
+  int looked_up;
+  PKT_public_key *pk;
+};
+
+/* State of the validation of one depth.  The keyblocks are collected
+   in batches.  The signatures of a batch are checked by a sig_batch
+   while the next batch is read from the keydb; the keyblocks are then
+   validated in the order they were read.  */
+struct validate_ctx_s
+{
+  ctrl_t ctrl;
+  KeyHashTable full_trust;
+  struct key_item *klist;
+  u32 curtime;
+  u32 *next_expire;
+  struct signer_item **signers;
+  sig_batch_t batch;
+  kbnode_t reading[VALIDATE_BATCH_SIZE];
+  int nreading;
+  kbnode_t checking[VALIDATE_BATCH_SIZE];
+  int nchecking;
+  struct key_array *keys;
+  size_t nkeys, maxkeys;
+};
+typedef struct validate_ctx_s *validate_ctx_t;
+
+
+static void
+validate_ctx_init (validate_ctx_t vc, ctrl_t ctrl, KeyHashTable full_trust,
+                   struct key_item *klist, u32 curtime, u32 *next_expire)
+{
+  struct key_item *k;
+  struct signer_item *si;
+  int i;
+
+  memset (vc, 0, sizeof *vc);
+  vc->ctrl = ctrl;
+  vc->full_trust = full_trust;
+  vc->klist = klist;
+  vc->curtime = curtime;
+  vc->next_expire = next_expire;
+  vc->batch = sig_batch_new ();
+  vc->maxkeys = 1000;
+  vc->keys = (key_array*) xmalloc ((vc->maxkeys+1) * sizeof *vc->keys);
+
+  vc->signers = (signer_item**) xmalloc_clear (KEY_HASH_TABLE_SIZE
+                                               * sizeof *vc->signers);
+  for (k = klist; k; k = k->next)
+    {
+      i = k->kid[1] % KEY_HASH_TABLE_SIZE;
+      si = (signer_item*) xmalloc_clear (sizeof *si);
+      si->kid[0] = k->kid[0];
+      si->kid[1] = k->kid[1];
+      si->next = vc->signers[i];
+      vc->signers[i] = si;
+    }
+}
+
+
+/* Release VC.  Unless the key array has been taken by
+   validate_ctx_finish it is released too.  */
+static void
+validate_ctx_release (validate_ctx_t vc)
+{
+  struct signer_item *si, *si2;
+  int i;
+
+  if (vc->nchecking)
+    sig_batch_finish (vc->batch);
+  for (i = 0; i < vc->nchecking; i++)
+    release_kbnode (vc->checking[i]);
+  for (i = 0; i < vc->nreading; i++)
+    release_kbnode (vc->reading[i]);
+  vc->nchecking = vc->nreading = 0;
+  sig_batch_release (vc->batch);
+  vc->batch = NULL;
+
+  if (vc->keys)
+    {
+      vc->keys[vc->nkeys].keyblock = NULL;
+      release_key_array (vc->keys);
+      vc->keys = NULL;
+    }
+
+  if (vc->signers)
+    {
+      for (i = 0; i < KEY_HASH_TABLE_SIZE; i++)
+        for (si = vc->signers[i]; si; si = si2)
+          {
+            si2 = si->next;
+            if (si->pk)
+              free_public_key (si->pk);
+            xfree (si);
+          }
+      xfree (vc->signers);
+      vc->signers = NULL;
+    }
+}
+
+
+/* Callback for sig_batch_add_keyblock to return the public key of a
+   key in klist.  */
+static PKT_public_key *
+validate_ctx_signer (void *opaque, u32 *kid)
+{
+  validate_ctx_t vc = (validate_ctx_t)opaque;
+  struct signer_item *si;
+
+  for (si = vc->signers[kid[1] % KEY_HASH_TABLE_SIZE]; si; si = si->next)
+    if (si->kid[0] == kid[0] && si->kid[1] == kid[1])
+      break;
+  if (!si)
+    return NULL;
+
+  if (!si->looked_up)
+    {
+      si->looked_up = 1;
+      si->pk = (PKT_public_key*) xmalloc_clear (sizeof *si->pk);
+      if (get_pubkey (vc->ctrl, si->pk, kid))
+        {
+          free_public_key (si->pk);
+          si->pk = NULL;
+        }
+    }
+  return si->pk;
+}
+
+
+/* Validate the keyblocks whose signatures have been checked and
+   start checking the signatures of the keyblocks read since then.  */
+static void
+validate_ctx_flush (validate_ctx_t vc)
+{
+  kbnode_t keyblock;
+  u32 kid[2];
+  int i;
+
+  if (vc->nchecking)
+    sig_batch_finish (vc->batch);
+  for (i = 0; i < vc->nchecking; i++)
+    {
+      keyblock = vc->checking[i];
+      vc->checking[i] = NULL;
+
+      /* A key may show up more than once; the search would have
+         skipped it after it was marked.  */
+      keyid_from_pk (keyblock->pkt->pkt.public_key, kid);
+      if (!test_key_hash_table (vc->full_trust, kid)
+          && consider_keyblock (vc->ctrl, keyblock, vc->full_trust,
+                                vc->klist, vc->curtime, vc->next_expire))
+        {
+          if (vc->nkeys == vc->maxkeys) {
+            vc->maxkeys += 1000;
+            vc->keys = (key_array*) xrealloc (vc->keys, ((vc->maxkeys+1)
+                                                         * sizeof *vc->keys));
+          }
+          vc->keys[vc->nkeys++].keyblock = keyblock;
+        }
+      else
+        release_kbnode (keyblock);
+    }
+  vc->nchecking = 0;
+
+  for (i = 0; i < vc->nreading; i++)
+    {
+      vc->checking[i] = vc->reading[i];
+      sig_batch_add_keyblock (vc->batch, vc->checking[i],
+                              validate_ctx_signer, vc);
+    }
+  vc->nchecking = vc->nreading;
+  vc->nreading = 0;
+  if (vc->nchecking)
+    sig_batch_start (vc->batch);
+}
+
+
+/* Queue KEYBLOCK for validation.  */
+static void
+validate_ctx_push (validate_ctx_t vc, kbnode_t keyblock)
+{
+  vc->reading[vc->nreading++] = keyblock;
+  if (vc->nreading == VALIDATE_BATCH_SIZE)
+    validate_ctx_flush (vc);
+}
+
+
+/* Validate all queued keyblocks and return the key array.  */
+static struct key_array *
+validate_ctx_finish (validate_ctx_t vc)
+{
+  struct key_array *keys;
+
+  validate_ctx_flush (vc);
+  validate_ctx_flush (vc);
+  keys = vc->keys;
+  keys[vc->nkeys].keyblock = NULL;
+  vc->keys = NULL;
+  return keys;
+}
+
+
 /*
  * Scan all keys and return a key_array of all suitable keys from
  * kllist.  The caller has to pass keydb handle so that we don't use
@@ -1800,50 +2057,42 @@ static struct key_array *
 validate_key_list (ctrl_t ctrl, KEYDB_HANDLE hd, KeyHashTable full_trust,
                    struct key_item *klist, u32 curtime, u32 *next_expire)
 {
-  KBNODE keyblock = NULL;
+  struct validate_ctx_s vc;
   struct key_array *keys = NULL;
-  size_t nkeys, maxkeys;
+  KBNODE keyblock = NULL;
   int rc;
   KEYDB_SEARCH_DESC desc;
 
-  maxkeys = 1000;
-  keys = (key_array*) xmalloc ((maxkeys+1) * sizeof *keys);
-  nkeys = 0;
-
   rc = keydb_search_reset (hd);
   if (rc)
     {
       log_error ("keydb_search_reset failed: %s\n", gpg_strerror (rc));
-      xfree (keys);
       return NULL;
     }
 
+  validate_ctx_init (&vc, ctrl, full_trust, klist, curtime, next_expire);
+
   memset (&desc, 0, sizeof desc);
   desc.mode = KEYDB_SEARCH_MODE_FIRST;
   desc.skipfnc = search_skipfnc;
   desc.skipfncvalue = full_trust;
   rc = keydb_search (hd, &desc, 1, NULL);
   if (rc == GPG_ERR_NOT_FOUND)
-    {
-      keys[nkeys].keyblock = NULL;
-      return keys;
-    }
+    goto ready;
   if (rc)
     {
       log_error ("keydb_search(first) failed: %s\n", gpg_strerror (rc));
-      goto die;
+      goto leave;
     }
 
   desc.mode = KEYDB_SEARCH_MODE_NEXT; /* change mode */
   do
     {
-      PKT_public_key *pk;
-
       rc = keydb_get_keyblock (hd, &keyblock);
       if (rc)
         {
           log_error ("keydb_get_keyblock failed: %s\n", gpg_strerror (rc));
-	  goto die;
+	  goto leave;
         }
 
       if ( keyblock->pkt->pkttype != PKT_PUBLIC_KEY)
@@ -1855,61 +2104,122 @@ validate_key_list (ctrl_t ctrl, KEYDB_HANDLE hd, KeyHashTable full_trust,
           continue;
         }
 
-      /* prepare the keyblock for further processing */
-      merge_keys_and_selfsig (ctrl, keyblock);
-      clear_kbnode_flags (keyblock);
-      pk = keyblock->pkt->pkt.public_key;
-      if (pk->has_expired || pk->flags.revoked)
-        {
-          /* it does not make sense to look further at those keys */
-          mark_keyblock_seen (full_trust, keyblock);
-        }
-      else if (validate_one_keyblock (ctrl, keyblock, klist,
-                                      curtime, next_expire))
-        {
-	  KBNODE node;
+      validate_ctx_push (&vc, keyblock);
+      keyblock = NULL;
+    }
+  while (!(rc = keydb_search (hd, &desc, 1, NULL)));
 
-          if (pk->expiredate && pk->expiredate >= curtime
-              && pk->expiredate < *next_expire)
-            *next_expire = pk->expiredate;
+  if (rc && rc != GPG_ERR_NOT_FOUND)
+    {
+      log_error ("keydb_search_next failed: %s\n", gpg_strerror (rc));
+      goto leave;
+    }
 
-          if (nkeys == maxkeys) {
-            maxkeys += 1000;
-            keys = (key_array*) xrealloc (keys, (maxkeys+1) * sizeof *keys);
-          }
-          keys[nkeys++].keyblock = keyblock;
+ ready:
+  keys = validate_ctx_finish (&vc);
 
-	  /* Optimization - if all uids are fully trusted, then we
-	     never need to consider this key as a candidate again. */
+ leave:
+  validate_ctx_release (&vc);
+  return keys;
+}
 
-	  for (node=keyblock; node; node = node->next)
-	    if (node->pkt->pkttype == PKT_USER_ID && !(node->flag & 4))
-	      break;
 
-	  if(node==NULL)
-	    mark_keyblock_seen (full_trust, keyblock);
+struct collect_candidate_parm_s
+{
+  KeyHashTable full_trust;
+  KeyHashTable seen;
+  struct key_item *list;
+};
 
-          keyblock = NULL;
-        }
+/* Callback for certgraph_enum_signees.  */
+static void
+collect_candidate (void *opaque, u32 *kid)
+{
+  struct collect_candidate_parm_s *parm =
+    (struct collect_candidate_parm_s *)opaque;
+  struct key_item *k;
 
-      release_kbnode (keyblock);
-      keyblock = NULL;
-    }
-  while (!(rc = keydb_search (hd, &desc, 1, NULL)));
+  if (test_key_hash_table (parm->full_trust, kid)
+      || test_key_hash_table (parm->seen, kid))
+    return;
+  add_key_hash_table (parm->seen, kid);
 
-  if (rc && rc != GPG_ERR_NOT_FOUND)
+  k = new_key_item ();
+  k->kid[0] = kid[0];
+  k->kid[1] = kid[1];
+  k->next = parm->list;
+  parm->list = k;
+}
+
+/*
+ * Same as validate_key_list but only the keys certified by a key in
+ * KLIST according to the certification graph are looked at.
+ */
+static struct key_array *
+validate_key_list_graph (ctrl_t ctrl, KEYDB_HANDLE hd,
+                         KeyHashTable full_trust, struct key_item *klist,
+                         u32 curtime, u32 *next_expire)
+{
+  struct collect_candidate_parm_s parm;
+  struct validate_ctx_s vc;
+  KBNODE keyblock = NULL;
+  struct key_array *keys = NULL;
+  struct key_item *k;
+  int rc = 0;
+  u32 kid[2];
+
+  parm.full_trust = full_trust;
+  parm.seen = new_key_hash_table ();
+  parm.list = NULL;
+  for (k = klist; k; k = k->next)
+    certgraph_enum_signees (k->kid, collect_candidate, &parm);
+  release_key_hash_table (parm.seen);
+
+  validate_ctx_init (&vc, ctrl, full_trust, klist, curtime, next_expire);
+
+  for (k = parm.list; k; k = k->next)
     {
-      log_error ("keydb_search_next failed: %s\n", gpg_strerror (rc));
-      goto die;
+      rc = keydb_search_reset (hd);
+      if (rc)
+        {
+          log_error ("keydb_search_reset failed: %s\n", gpg_strerror (rc));
+          goto leave;
+        }
+
+      /* A key may be stored in more than one keyring and the key ID
+         may also match a subkey; thus look at all matches.  */
+      while (!(rc = keydb_search_kid (hd, k->kid)))
+        {
+          rc = keydb_get_keyblock (hd, &keyblock);
+          if (rc)
+            {
+              log_error ("keydb_get_keyblock failed: %s\n",
+                         gpg_strerror (rc));
+              goto leave;
+            }
+
+          if (keyblock->pkt->pkttype == PKT_PUBLIC_KEY
+              && (keyid_from_pk (keyblock->pkt->pkt.public_key, kid),
+                  kid[0] == k->kid[0] && kid[1] == k->kid[1])
+              && !test_key_hash_table (full_trust, kid))
+            validate_ctx_push (&vc, keyblock);
+          else
+            release_kbnode (keyblock);
+          keyblock = NULL;
+        }
+      if (rc != GPG_ERR_NOT_FOUND)
+        {
+          log_error ("keydb_search_kid failed: %s\n", gpg_strerror (rc));
+          goto leave;
+        }
     }
 
-  keys[nkeys].keyblock = NULL;
-  return keys;
+  keys = validate_ctx_finish (&vc);
 
- die:
-  keys[nkeys].keyblock = NULL;
-  release_key_array (keys);
-  return NULL;
+ leave:
+  validate_ctx_release (&vc);
+  release_key_items (parm.list);
+  return keys;
 }
 
 /* Caller must sync */
@@ -1995,6 +2305,9 @@ validate_keys (ctrl_t ctrl, int interactive)
   int ot_unknown, ot_undefined, ot_never, ot_marginal, ot_full, ot_ultimate;
   KeyHashTable stored,used,full_trust;
   u32 start_time, next_expire;
+  unsigned long created = 0;
+  int use_graph = 0;
+  int scanned = 0;
 
   kdb = keydb_new ();
   if (!kdb)
@@ -2002,6 +2315,30 @@ validate_keys (ctrl_t ctrl, int interactive)
 
   start_time = make_timestamp ();
   next_expire = 0xffffffff; /* set next expire to the year 2106 */
+
+  /* The certification graph tells which keys need to be looked at;
+     without it we fall back to scanning all keys for each depth.  An
+     explicit --update-trustdb always rebuilds the graph.  */
+  if (opt.trust_model != TM_TOFU)
+    {
+      read_trust_options (ctrl, NULL, &created, NULL, NULL, NULL, NULL, NULL);
+      use_graph = !certgraph_open (interactive, &scanned);
+    }
+
+  if (use_graph && !interactive && !scanned
+      && tdbio_db_matches_options ()
+      && certgraph_unaffected (created, start_time))
+    {
+      /* None of the changed keys is able to change a validity; thus
+         the stored validity values are still correct.  */
+      if (opt.verbose)
+        log_info (_("no changes affecting the trustdb\n"));
+      next_expire = certgraph_next_expire ();
+      certgraph_checkpoint (created, next_expire);
+      keydb_release (kdb);
+      goto checked;
+    }
+
   stored = new_key_hash_table ();
   used = new_key_hash_table ();
   full_trust = new_key_hash_table ();
@@ -2125,8 +2462,12 @@ validate_keys (ctrl_t ctrl, int interactive)
         }
 
       /* Find all keys which are signed by a key in kdlist */
-      keys = validate_key_list (ctrl, kdb, full_trust, klist,
-				start_time, &next_expire);
+      if (use_graph)
+        keys = validate_key_list_graph (ctrl, kdb, full_trust, klist,
+                                        start_time, &next_expire);
+      else
+        keys = validate_key_list (ctrl, kdb, full_trust, klist,
+                                  start_time, &next_expire);
       if (!keys)
         {
           log_error ("validate_key_list failed\n");
@@ -2206,9 +2547,29 @@ validate_keys (ctrl_t ctrl, int interactive)
   release_key_array (keys);
   if (klist != utk_list)
     release_key_items (klist);
+  if (use_graph)
+    {
+      if (!rc && !quit)
+        {
+          int i;
+
+          /* Remember the keys which served as signers so that the
+             next check can tell whether a change matters.  */
+          for (i=0; i < KEY_HASH_TABLE_SIZE; i++)
+            for (k=used[i]; k; k = k->next)
+              certgraph_add_signer (k->kid, 0);
+          for (k=utk_list; k; k = k->next)
+            certgraph_add_signer (k->kid, 1);
+          certgraph_checkpoint (created, next_expire);
+        }
+      else
+        certgraph_close ();
+    }
   release_key_hash_table (full_trust);
   release_key_hash_table (used);
   release_key_hash_table (stored);
+
+ checked:
   if (!rc && !quit) /* mark trustDB as checked */
     {
       int rc2;
@@ -173,4 +173,18 @@ void import_ownertrust (ctrl_t ctrl, const char *fname);
 /*-- pkclist.c --*/
 int edit_ownertrust (ctrl_t ctrl, PKT_public_key *pk, int mode);
 
+/*-- certgraph.c --*/
+gpg_error_t certgraph_open (int full_scan, int *r_scanned);
+int certgraph_unaffected (u32 tdb_created, u32 curtime);
+u32 certgraph_next_expire (void);
+void certgraph_enum_signees (u32 *signer,
+                             void (*fnc)(void *opaque, u32 *kid),
+                             void *opaque);
+void certgraph_add_signer (u32 *kid, int utk);
+void certgraph_checkpoint (u32 tdb_created, u32 next_expire);
+void certgraph_close (void);
+void certgraph_notice_keyblock (kbnode_t keyblock);
+void certgraph_notice_key (u32 *kid);
+void certgraph_notice_written (void);
+
 #endif /*G10_TRUSTDB_H*/
@@ -74,6 +74,15 @@ keybox_is_writable (void *token)
   return r? !access (r->fname, W_OK) : 0;
 }
 
+/* Return the file name of the keybox registered as TOKEN.  */
+const char *
+keybox_get_token_fname (void *token)
+{
+  KB_NAME r = (KB_NAME) token;
+
+  return r? r->fname : NULL;
+}
+
 
 
 static KEYBOX_HANDLE
@@ -41,6 +41,22 @@ struct sn_array_s {
 };
 
 
+/* Build a hash index of the mail addresses if a search has at least
+   this many descriptions of mode KEYDB_SEARCH_MODE_MAIL.  */
+#define MAIL_INDEX_MIN 16
+
+/* A hash index of the mail addresses of the descriptions of a
+   search.  This allows resolving many recipients with one scan
+   without comparing each user ID with each address.  */
+struct mail_index_s {
+  unsigned int nbuckets;  /* A power of 2.  */
+  int *buckets;           /* First description per bucket or -1.  */
+  int *next;              /* Next description in the bucket or -1.  */
+  const char **names;     /* The address of each description.  */
+  size_t *namelens;
+};
+
+
 #define get32(a) buf32_to_ulong ((a))
 #define get16(a) buf16_to_ulong ((a))
 
@@ -708,6 +724,187 @@ has_mail (KEYBOXBLOB blob, const char *name, int substr)
 }
 
 
+static unsigned int
+mail_index_hash (const void *name, size_t namelen)
+{
+  const unsigned char *s = (const unsigned char *) name;
+  unsigned int h = 0;
+
+  for (; namelen; namelen--, s++)
+    h = h * 33 + ascii_tolower (*s);
+  return h;
+}
+
+
+static void
+release_mail_index (struct mail_index_s *index)
+{
+  if (!index)
+    return;
+  xfree (index->buckets);
+  xfree (index->next);
+  xfree (index->names);
+  xfree (index->namelens);
+  xfree (index);
+}
+
+
+/* Create an index of the mail address searches in DESC.  Returns NULL
+   if there are too few of them to be worth it or on error; in both
+   cases the descriptions are compared one by one.  */
+static struct mail_index_s *
+make_mail_index (KEYBOX_SEARCH_DESC *desc, size_t ndesc)
+{
+  struct mail_index_s *index;
+  size_t n, nmail;
+  unsigned int i;
+
+  for (n = nmail = 0; n < ndesc; n++)
+    if (desc[n].mode == KEYDB_SEARCH_MODE_MAIL)
+      nmail++;
+  if (nmail < MAIL_INDEX_MIN)
+    return NULL;
+
+  index = (struct mail_index_s *) xtrycalloc (1, sizeof *index);
+  if (!index)
+    return NULL;
+  for (index->nbuckets = 64; index->nbuckets < 2 * nmail;)
+    index->nbuckets *= 2;
+  index->buckets = (int *) xtrymalloc (index->nbuckets * sizeof (int));
+  index->next = (int *) xtrymalloc (ndesc * sizeof (int));
+  index->names = (const char **) xtrycalloc (ndesc, sizeof (char *));
+  index->namelens = (size_t *) xtrycalloc (ndesc, sizeof (size_t));
+  if (!index->buckets || !index->next || !index->names || !index->namelens)
+    {
+      release_mail_index (index);
+      return NULL;
+    }
+
+  for (i = 0; i < index->nbuckets; i++)
+    index->buckets[i] = -1;
+  /* Insert in reverse order so that each chain lists the
+     descriptions in their original order.  */
+  for (n = ndesc; n-- > 0;)
+    {
+      const char *name = desc[n].u.name;
+      size_t namelen;
+
+      index->next[n] = -1;
+      if (desc[n].mode != KEYDB_SEARCH_MODE_MAIL || !name)
+        continue;
+
+      /* Same hack as in has_mail.  */
+      if (*name == '<')
+        name++;
+      namelen = strlen (name);
+      if (namelen && name[namelen-1] == '>')
+        namelen--;
+      if (!namelen)
+        continue;
+
+      index->names[n] = name;
+      index->namelens[n] = namelen;
+      i = mail_index_hash (name, namelen) & (index->nbuckets - 1);
+      index->next[n] = index->buckets[i];
+      index->buckets[i] = n;
+    }
+
+  return index;
+}
+
+
+/* Look up the mail addresses of the user IDs of the OpenPGP BLOB in
+   INDEX.  This mirrors blob_cmp_mail.  If an address matches, the
+   index of the description is stored at R_N and the 1-based number of
+   the user ID is returned; otherwise 0 is returned.  */
+static int
+blob_probe_mail_index (KEYBOXBLOB blob, struct mail_index_s *index,
+                       size_t *r_n)
+{
+  const unsigned char *buffer;
+  size_t length;
+  size_t pos, off, len;
+  size_t nkeys, keyinfolen;
+  size_t nuids, uidinfolen;
+  size_t nserial;
+  int idx, n;
+
+  buffer = _keybox_get_blob_image (blob, &length);
+  if (length < 40)
+    return 0; /* blob too short */
+
+  /*keys*/
+  nkeys = get16 (buffer + 16);
+  keyinfolen = get16 (buffer + 18 );
+  if (keyinfolen < 28)
+    return 0; /* invalid blob */
+  pos = 20 + keyinfolen*nkeys;
+  if (pos+2 > length)
+    return 0; /* out of bounds */
+
+  /*serial*/
+  nserial = get16 (buffer+pos);
+  pos += 2 + nserial;
+  if (pos+4 > length)
+    return 0; /* out of bounds */
+
+  /* user ids*/
+  nuids = get16 (buffer + pos);  pos += 2;
+  uidinfolen = get16 (buffer + pos);  pos += 2;
+  if (uidinfolen < 12)
+    return 0; /* invalid blob */
+  if (pos + uidinfolen*nuids > length)
+    return 0; /* out of bounds */
+
+  for (idx=0; idx < nuids; idx++)
+    {
+      size_t mypos = pos;
+      size_t mylen;
+
+      mypos += idx*uidinfolen;
+      off = get32 (buffer+mypos);
+      len = get32 (buffer+mypos+4);
+      if (off+len > length)
+        return 0; /* error: better stop here - out of bounds */
+
+      mypos = off;
+      mylen = len;
+      for ( ; len && buffer[off] != '<'; len--, off++)
+        ;
+      if (len < 2 || buffer[off] != '<')
+        {
+          off = mypos;
+          len = mylen;
+          if (!is_valid_mailbox_mem (buffer+off, len))
+            continue; /* Not a mail address. */
+        }
+      else
+        {
+          off++;
+          len--;
+          for (mypos=off; len && buffer[mypos] != '>'; len--, mypos++)
+            ;
+          if (!len || buffer[mypos] != '>' || off == mypos)
+            continue; /* Not a proper mail address.  */
+          len = mypos - off;
+        }
+
+      if (len < 1)
+        continue;
+      n = index->buckets[mail_index_hash (buffer+off, len)
+                         & (index->nbuckets - 1)];
+      for (; n != -1; n = index->next[n])
+        if (index->namelens[n] == len
+            && !ascii_memcasecmp (buffer+off, index->names[n], len))
+          {
+            *r_n = n;
+            return idx+1; /* found */
+          }
+    }
+  return 0; /* not found */
+}
+
+
 static void
 release_sn_array (struct sn_array_s *array, size_t size)
 {
@@ -785,6 +982,7 @@ keybox_search (KEYBOX_HANDLE hd, KEYBOX_SEARCH_DESC *desc, size_t ndesc,
   int need_words, any_skip;
   KEYBOXBLOB blob = NULL;
   struct sn_array_s *sn_array = NULL;
+  struct mail_index_s *mail_index = NULL;
   int pk_no, uid_no;
 
   if (!hd)
@@ -900,12 +1098,18 @@ keybox_search (KEYBOX_HANDLE hd, KEYBOX_SEARCH_DESC *desc, size_t ndesc,
         }
     }
 
+  /* Large batches of mail address searches, as done when resolving
+     many recipients at once, are matched using a hash index.  */
+  if (want_blobtype == KEYBOX_BLOBTYPE_PGP)
+    mail_index = make_mail_index (desc, ndesc);
 
   pk_no = uid_no = 0;
   for (;;)
     {
       unsigned int blobflags;
       int blobtype;
+      size_t nend, mail_n;
+      int mail_uid_no;
 
       _keybox_release_blob (blob); blob = NULL;
       rc = _keybox_read_blob (&blob, hd->fp, NULL);
@@ -928,7 +1132,18 @@ keybox_search (KEYBOX_HANDLE hd, KEYBOX_SEARCH_DESC *desc, size_t ndesc,
       if (!hd->ephemeral && (blobflags & 2))
         continue; /* Not in ephemeral mode but blob is flagged ephemeral.  */
 
-      for (n=0; n < ndesc; n++)
+      /* With a mail index only the descriptions before the one found
+         by the index need to be compared.  */
+      nend = ndesc;
+      mail_uid_no = 0;
+      if (mail_index)
+        {
+          mail_uid_no = blob_probe_mail_index (blob, mail_index, &mail_n);
+          if (mail_uid_no)
+            nend = mail_n;
+        }
+
+      for (n=0; n < nend; n++)
         {
           switch (desc[n].mode)
             {
@@ -941,6 +1156,8 @@ keybox_search (KEYBOX_HANDLE hd, KEYBOX_SEARCH_DESC *desc, size_t ndesc,
                 goto found;
               break;
             case KEYDB_SEARCH_MODE_MAIL:
+              if (mail_index)
+                break; /* Already checked.  */
               uid_no = has_mail (blob, desc[n].u.name, 0);
               if (uid_no)
                 goto found;
@@ -1009,6 +1226,11 @@ keybox_search (KEYBOX_HANDLE hd, KEYBOX_SEARCH_DESC *desc, size_t ndesc,
               goto found;
             }
 	}
+      if (mail_uid_no)
+        {
+          uid_no = mail_uid_no;
+          goto found;
+        }
       continue;
     found:
       /* Record which DESC we matched on.  Note this value is only
@@ -1047,11 +1269,58 @@ keybox_search (KEYBOX_HANDLE hd, KEYBOX_SEARCH_DESC *desc, size_t ndesc,
 
   if (sn_array)
     release_sn_array (sn_array, ndesc);
+  release_mail_index (mail_index);
 
   return rc;
 }
 
 
+/* Check which of the NDESC user ID searches in DESC are matched by
+   the blob found by the last successful search.  For each description
+   the 1-based number of the matching user ID is stored at the
+   corresponding slot of R_UID_NO, or 0 if the description does not
+   match or is not a user ID search.  This allows a caller which
+   searched for many names at once to assign each found keyblock to
+   all names it matches.  */
+gpg_error_t
+keybox_match_found (KEYBOX_HANDLE hd, KEYBOX_SEARCH_DESC *desc, size_t ndesc,
+                    int *r_uid_no)
+{
+  size_t n;
+
+  if (!hd)
+    return GPG_ERR_INV_VALUE;
+  if (!hd->found.blob)
+    return GPG_ERR_NOTHING_FOUND;
+  if (blob_get_type (hd->found.blob) != KEYBOX_BLOBTYPE_PGP)
+    return GPG_ERR_WRONG_BLOB_TYPE;
+
+  for (n=0; n < ndesc; n++)
+    {
+      switch (desc[n].mode)
+        {
+        case KEYDB_SEARCH_MODE_EXACT:
+          r_uid_no[n] = has_username (hd->found.blob, desc[n].u.name, 0);
+          break;
+        case KEYDB_SEARCH_MODE_MAIL:
+          r_uid_no[n] = has_mail (hd->found.blob, desc[n].u.name, 0);
+          break;
+        case KEYDB_SEARCH_MODE_MAILSUB:
+          r_uid_no[n] = has_mail (hd->found.blob, desc[n].u.name, 1);
+          break;
+        case KEYDB_SEARCH_MODE_SUBSTR:
+          r_uid_no[n] = has_username (hd->found.blob, desc[n].u.name, 1);
+          break;
+        default:
+          r_uid_no[n] = 0;
+          break;
+        }
+    }
+
+  return 0;
+}
+
+
 
 
 /*
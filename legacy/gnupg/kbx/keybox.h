@@ -59,6 +59,7 @@ typedef enum
 gpg_error_t keybox_register_file (const char *fname, int secret,
                                   void **r_token);
 int keybox_is_writable (void *token);
+const char *keybox_get_token_fname (void *token);
 
 KEYBOX_HANDLE keybox_new_openpgp (void *token, int secret);
 KEYBOX_HANDLE keybox_new_x509 (void *token, int secret);
@@ -86,6 +87,9 @@ gpg_error_t keybox_search (KEYBOX_HANDLE hd,
                            KEYBOX_SEARCH_DESC *desc, size_t ndesc,
                            keybox_blobtype_t want_blobtype,
                            size_t *r_descindex, unsigned long *r_skipped);
+gpg_error_t keybox_match_found (KEYBOX_HANDLE hd,
+                                KEYBOX_SEARCH_DESC *desc, size_t ndesc,
+                                int *r_uid_no);
 
 off_t keybox_offset (KEYBOX_HANDLE hd);
 gpg_error_t keybox_seek (KEYBOX_HANDLE hd, off_t offset);
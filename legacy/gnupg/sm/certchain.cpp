@@ -58,6 +58,35 @@ struct chain_item_s
 typedef struct chain_item_s *chain_item_t;
 
 
+/* The results of gpgsm_validate_chain are kept in a cache which is
+   organized as VALIDATION_CACHE_SETS sets of VALIDATION_CACHE_WAYS
+   entries.  The set is selected by the fingerprint of the target
+   certificate.  */
+#define VALIDATION_CACHE_SETS 128
+#define VALIDATION_CACHE_WAYS 8
+
+struct validation_cache_item_s
+{
+  int used;                   /* The item is valid.  */
+  unsigned char fpr[20];      /* Fingerprint of the target certificate.  */
+  unsigned int flags;         /* The VALIDATE_FLAG_* used for the check.  */
+  unsigned int mode;          /* The CRL/OCSP mode; see validation_mode. */
+  ksba_isotime_t checktime;   /* The check time if the chain model
+                                 was used or empty.  */
+  int rc;                     /* The result of the validation.  */
+  unsigned int retflags;      /* The flags returned by the validation.  */
+  ksba_isotime_t exptime;     /* The expiration time of the chain.  */
+  time_t expires;             /* The item is not used after this time.  */
+  time_t last_used;           /* For replacing the oldest item.  */
+};
+static struct validation_cache_item_s
+  validation_cache[VALIDATION_CACHE_SETS][VALIDATION_CACHE_WAYS];
+
+/* The state of the keyboxes and trustlists when the cache was last
+   flushed.  */
+static unsigned long validation_cache_stamp;
+
+
 static int is_root_cert (ksba_cert_t cert,
                          const char *issuerdn, const char *subjectdn);
 
@@ -1770,6 +1799,150 @@ do_validate_chain (ctrl_t ctrl, ksba_cert_t cert, const ksba_isotime_t checktime
 }
 
 
+/* Return a value describing the state of all keyboxes and the
+   trustlists of the agent.  */
+static unsigned long
+get_validation_stamp (void)
+{
+  unsigned long stamp;
+  char *fname;
+
+  stamp = sm_keydb_change_stamp ();
+  fname = make_filename (gnupg_homedir (), "trustlist.txt", NULL);
+  stamp = gpgsm_mix_file_stamp (stamp, fname);
+  xfree (fname);
+  fname = make_filename (gnupg_sysconfdir (), "trustlist.txt", NULL);
+  stamp = gpgsm_mix_file_stamp (stamp, fname);
+  xfree (fname);
+  return stamp;
+}
+
+
+/* Flush the validation cache if a keybox or a trustlist has been
+   changed since the last call.  */
+static void
+check_validation_cache_stamp (void)
+{
+  unsigned long stamp = get_validation_stamp ();
+
+  if (stamp != validation_cache_stamp)
+    {
+      if (DBG_CACHE)
+        log_debug ("validation cache: flushed\n");
+      memset (validation_cache, 0, sizeof validation_cache);
+      validation_cache_stamp = stamp;
+    }
+}
+
+
+/* Return the CRL/OCSP mode of the session.  It is part of the key
+   of the validation cache because it affects the result.  */
+static unsigned int
+validation_mode (ctrl_t ctrl)
+{
+  return ((ctrl->offline? 1:0)
+          | (ctrl->use_ocsp? 2:0)
+          | (opt.no_crl_check? 4:0));
+}
+
+
+/* Look up the result for the certificate with fingerprint FPR in the
+   validation cache.  On success the item is returned.  */
+static struct validation_cache_item_s *
+validation_cache_get (ctrl_t ctrl, const unsigned char *fpr,
+                      const ksba_isotime_t checktime, unsigned int flags)
+{
+  struct validation_cache_item_s *item;
+  time_t current = gnupg_get_time ();
+  int i;
+
+  check_validation_cache_stamp ();
+  item = validation_cache[fpr[19] % VALIDATION_CACHE_SETS];
+  for (i=0; i < VALIDATION_CACHE_WAYS; i++, item++)
+    {
+      if (!item->used || memcmp (item->fpr, fpr, 20)
+          || item->flags != flags || item->mode != validation_mode (ctrl))
+        continue;
+      if ((item->retflags & VALIDATE_FLAG_CHAIN_MODEL)
+          && strcmp (item->checktime, checktime? checktime : ""))
+        continue;
+      if (item->expires <= current)
+        {
+          item->used = 0;
+          continue;
+        }
+      item->last_used = current;
+      return item;
+    }
+  return NULL;
+}
+
+
+/* Store the result of a validation in the validation cache.  Only
+   results which do not depend on the user or on transient errors are
+   stored.  */
+static void
+validation_cache_put (ctrl_t ctrl, const unsigned char *fpr,
+                      const ksba_isotime_t checktime, unsigned int flags,
+                      int rc, unsigned int retflags,
+                      const ksba_isotime_t exptime)
+{
+  struct validation_cache_item_s *set, *item;
+  time_t current = gnupg_get_time ();
+  time_t expires;
+  int i;
+
+  if (rc && rc != GPG_ERR_CERT_REVOKED)
+    return;
+
+  /* The result is valid until the first certificate in the chain
+     expires.  The time to live bounds the use of older CRL and OCSP
+     results because dirmngr does not tell us their lifetime.  */
+  expires = current + opt.validation_cache_ttl;
+  if (*exptime && !rc)
+    {
+      time_t t = isotime2epoch (exptime);
+
+      if (t != (time_t)(-1) && t < expires)
+        expires = t;
+    }
+  if (expires <= current)
+    return;
+
+  /* The validation may have modified the keybox.  */
+  check_validation_cache_stamp ();
+
+  set = validation_cache[fpr[19] % VALIDATION_CACHE_SETS];
+  item = NULL;
+  for (i=0; i < VALIDATION_CACHE_WAYS; i++)
+    {
+      if (set[i].used && !memcmp (set[i].fpr, fpr, 20)
+          && set[i].flags == flags)
+        {
+          item = set + i;
+          break;
+        }
+      if (!item
+          || (item->used
+              && (!set[i].used || set[i].last_used < item->last_used)))
+        item = set + i;
+    }
+
+  memset (item, 0, sizeof *item);
+  item->used = 1;
+  memcpy (item->fpr, fpr, 20);
+  item->flags = flags;
+  item->mode = validation_mode (ctrl);
+  if ((retflags & VALIDATE_FLAG_CHAIN_MODEL) && checktime)
+    gnupg_copy_time (item->checktime, checktime);
+  item->rc = rc;
+  item->retflags = retflags;
+  gnupg_copy_time (item->exptime, exptime);
+  item->expires = expires;
+  item->last_used = current;
+}
+
+
 /* Validate a certificate chain.  For a description see
    do_validate_chain.  This function is a wrapper to handle a root
    certificate with the chain_model flag set.  If RETFLAGS is not
@@ -1781,7 +1954,13 @@ do_validate_chain (ctrl_t ctrl, ksba_cert_t cert, const ksba_isotime_t checktime
    creation time of the signature.  If your are verifying a
    certificate, set it nil (i.e. the empty string).  If the creation
    date of the signature is not known use the special date
-   "19700101T000000" which is treated in a special way here. */
+   "19700101T000000" which is treated in a special way here.
+
+   If the option --validation-cache-ttl is used, results are kept in
+   a cache for the given number of seconds but not beyond the
+   expiration of the chain.  The cache is flushed whenever a keybox
+   or a trustlist changes.  It is not used in list mode because the
+   diagnostics are wanted there.  */
 int
 gpgsm_validate_chain (ctrl_t ctrl, ksba_cert_t cert, const ksba_isotime_t checktime,
                       ksba_isotime_t r_exptime,
@@ -1791,6 +1970,9 @@ gpgsm_validate_chain (ctrl_t ctrl, ksba_cert_t cert, const ksba_isotime_t checkt
   int rc;
   struct rootca_flags_s rootca_flags;
   unsigned int dummy_retflags;
+  unsigned char fpr[20];
+  int use_cache;
+  ksba_isotime_t exptime;
 
   if (!retflags)
     retflags = &dummy_retflags;
@@ -1806,10 +1988,30 @@ gpgsm_validate_chain (ctrl_t ctrl, ksba_cert_t cert, const ksba_isotime_t checkt
      RETFLAGS.  */
   *retflags = (flags & VALIDATE_FLAG_CHAIN_MODEL);
 
+  use_cache = (opt.validation_cache_ttl && !listmode
+               && !opt.no_chain_validation
+               && gpgsm_get_fingerprint (cert, GCRY_MD_SHA1, fpr, NULL));
+  if (use_cache)
+    {
+      struct validation_cache_item_s *item;
+
+      item = validation_cache_get (ctrl, fpr, checktime, flags);
+      if (item)
+        {
+          if (DBG_CACHE)
+            log_debug ("validation cache: hit\n");
+          if (r_exptime)
+            gnupg_copy_time (r_exptime, item->exptime);
+          *retflags = item->retflags;
+          rc = item->rc;
+          goto leave;
+        }
+    }
+
   memset (&rootca_flags, 0, sizeof rootca_flags);
 
   rc = do_validate_chain (ctrl, cert, checktime,
-                          r_exptime, listmode, listfp, flags,
+                          exptime, listmode, listfp, flags,
                           &rootca_flags);
   if (!rc && (flags & VALIDATE_FLAG_STEED))
     {
@@ -1821,12 +2023,19 @@ gpgsm_validate_chain (ctrl_t ctrl, ksba_cert_t cert, const ksba_isotime_t checkt
     {
       do_list (0, listmode, listfp, _("switching to chain model"));
       rc = do_validate_chain (ctrl, cert, checktime,
-                              r_exptime, listmode, listfp,
-                              (flags |= VALIDATE_FLAG_CHAIN_MODEL),
+                              exptime, listmode, listfp,
+                              (flags | VALIDATE_FLAG_CHAIN_MODEL),
                               &rootca_flags);
       *retflags |= VALIDATE_FLAG_CHAIN_MODEL;
     }
 
+  if (r_exptime)
+    gnupg_copy_time (r_exptime, exptime);
+  if (use_cache)
+    validation_cache_put (ctrl, fpr, checktime, flags,
+                          rc, *retflags, exptime);
+
+ leave:
   if (opt.verbose)
     do_list (0, listmode, listfp, _("validation model used: %s"),
              (*retflags & VALIDATE_FLAG_STEED)?
@@ -29,6 +29,7 @@
 #include "gpgsm.h"
 #include <gcrypt.h>
 #include <ksba.h>
+#include <npth.h>
 
 #include "keydb.h"
 #include "../common/i18n.h"
@@ -48,9 +49,53 @@ struct decrypt_filter_parm_s
   char helpblock[16];  /* needed because there is no block buffering in
                           libgcrypt (yet) */
   int  helpblocklen;
+  struct decrypt_pipeline_s *pipeline; /* NULL or the decryption stage.  */
 };
 
 
+/* The number and the size of the buffers passed to the decryption
+   thread.  The size must be a multiple of all cipher block lengths.  */
+#define DECRYPT_CHUNKS     4
+#define DECRYPT_CHUNK_SIZE (256*1024)
+
+enum decrypt_chunk_state
+  {
+    CHUNK_FREE = 0,
+    CHUNK_FILLING,   /* The filter is copying ciphertext into it.  */
+    CHUNK_QUEUED,    /* Waiting for or under decryption.  */
+    CHUNK_DONE       /* Holds plaintext.  */
+  };
+
+struct decrypt_chunk_s
+{
+  enum decrypt_chunk_state state;
+  unsigned char *buf;  /* Allocated on first use.  */
+  size_t len;          /* Number of valid bytes in BUF.  */
+  size_t outpos;       /* Number of plaintext bytes already returned.  */
+};
+
+/* The decryption stage.  The filter running in the parser copies the
+   ciphertext into the chunks and returns the plaintext of earlier
+   chunks while a worker thread decrypts the queued chunks in order.
+   The last chunk is held back until END_DATA so that the padding can
+   be removed.  */
+struct decrypt_pipeline_s
+{
+  struct decrypt_filter_parm_s *parm;
+  npth_mutex_t lock;
+  npth_cond_t cond;
+  npth_t thread;
+  int thread_started;
+  int stop;             /* Tell the worker to terminate.  */
+  gpg_error_t err;      /* First error of the worker.  */
+  int fill;             /* Index of the chunk to fill next.  */
+  int next;             /* Index of the chunk to decrypt next.  */
+  int out;              /* Index of the chunk to output next.  */
+  struct decrypt_chunk_s chunks[DECRYPT_CHUNKS];
+};
+typedef struct decrypt_pipeline_s *decrypt_pipeline_t;
+
+
 
 /* Decrypt the session key and fill in the parm structure.  The
    algo and the IV is expected to be already in PARM. */
@@ -238,6 +283,304 @@ decrypt_filter (void *arg,
 }
 
 
+/* Return true if a chunk after the output chunk holds a full block,
+   which means that the output chunk does not hold the last block.
+   An incomplete block at the end does not count because it is
+   ignored.  Must be called with the lock held.  */
+static int
+pipeline_has_later_data (decrypt_pipeline_t pl)
+{
+  int i;
+  struct decrypt_chunk_s *c;
+
+  for (i=1; i < DECRYPT_CHUNKS; i++)
+    {
+      c = &pl->chunks[(pl->out + i) % DECRYPT_CHUNKS];
+      if (c->state != CHUNK_FREE && c->len >= pl->parm->blklen)
+        return 1;
+    }
+  return 0;
+}
+
+
+/* The decryption thread.  */
+static void *
+decrypt_pipeline_worker (void *arg)
+{
+  decrypt_pipeline_t pl = (decrypt_pipeline_t) arg;
+  struct decrypt_chunk_s *c;
+  gpg_error_t err;
+
+  npth_mutex_lock (&pl->lock);
+  for (;;)
+    {
+      c = &pl->chunks[pl->next];
+      if (c->state == CHUNK_QUEUED)
+        {
+          /* Only this thread touches a queued chunk and the cipher
+             handle; thus we can decrypt outside of the lock and let
+             the parser run in parallel.  */
+          npth_mutex_unlock (&pl->lock);
+          npth_unprotect ();
+          err = gcry_cipher_decrypt (pl->parm->hd, c->buf, c->len, NULL, 0);
+          npth_protect ();
+          npth_mutex_lock (&pl->lock);
+          if (err && !pl->err)
+            pl->err = err;
+          c->state = CHUNK_DONE;
+          pl->next = (pl->next + 1) % DECRYPT_CHUNKS;
+          npth_cond_broadcast (&pl->cond);
+        }
+      else if (pl->stop)
+        break;
+      else
+        npth_cond_wait (&pl->cond, &pl->lock);
+    }
+  npth_mutex_unlock (&pl->lock);
+  return NULL;
+}
+
+
+/* The filter used with a decryption stage.  See decrypt_filter for
+   the arguments.  Either input is consumed or output is returned;
+   if all chunks are busy the function waits for the worker.  */
+static gpg_error_t
+decrypt_pipeline_filter (void *arg,
+                         const void *inbuf, size_t inlen, size_t *inused,
+                         void *outbuf, size_t maxoutlen, size_t *outlen)
+{
+  decrypt_pipeline_t pl = ((struct decrypt_filter_parm_s *) arg)->pipeline;
+  struct decrypt_chunk_s *c;
+  gpg_error_t err = 0;
+  size_t n;
+
+  *inused = 0;
+  *outlen = 0;
+  if (!inlen)
+    return GPG_ERR_BUG;
+
+  npth_mutex_lock (&pl->lock);
+  for (;;)
+    {
+      if (pl->err)
+        {
+          err = pl->err;
+          break;
+        }
+
+      c = &pl->chunks[pl->out];
+      if (c->state == CHUNK_DONE && pipeline_has_later_data (pl))
+        {
+          n = c->len - c->outpos;
+          if (n > maxoutlen)
+            n = maxoutlen;
+          memcpy (outbuf, c->buf + c->outpos, n);
+          c->outpos += n;
+          *outlen = n;
+          if (c->outpos == c->len)
+            {
+              c->state = CHUNK_FREE;
+              c->len = c->outpos = 0;
+              pl->out = (pl->out + 1) % DECRYPT_CHUNKS;
+            }
+          break;
+        }
+
+      c = &pl->chunks[pl->fill];
+      if (c->state == CHUNK_FREE || c->state == CHUNK_FILLING)
+        {
+          if (!c->buf)
+            {
+              c->buf = (unsigned char*) xtrymalloc (DECRYPT_CHUNK_SIZE);
+              if (!c->buf)
+                {
+                  err = gpg_error_from_syserror ();
+                  break;
+                }
+            }
+          n = DECRYPT_CHUNK_SIZE - c->len;
+          if (n > inlen)
+            n = inlen;
+          memcpy (c->buf + c->len, inbuf, n);
+          c->len += n;
+          c->state = CHUNK_FILLING;
+          *inused = n;
+          if (c->len == DECRYPT_CHUNK_SIZE)
+            {
+              c->state = CHUNK_QUEUED;
+              pl->fill = (pl->fill + 1) % DECRYPT_CHUNKS;
+              npth_cond_broadcast (&pl->cond);
+            }
+          break;
+        }
+
+      npth_cond_wait (&pl->cond, &pl->lock);
+    }
+  npth_mutex_unlock (&pl->lock);
+  return err;
+}
+
+
+/* Stop the worker of the decryption stage PL and wait for it.  */
+static void
+decrypt_pipeline_stop (decrypt_pipeline_t pl)
+{
+  if (!pl->thread_started)
+    return;
+  npth_mutex_lock (&pl->lock);
+  pl->stop = 1;
+  npth_cond_broadcast (&pl->cond);
+  npth_mutex_unlock (&pl->lock);
+  npth_join (pl->thread, NULL);
+  pl->thread_started = 0;
+}
+
+
+/* Decrypt the remaining data of the decryption stage PL and write it
+   to WRITER, except for the last block which is stored in the
+   parameter block for the padding check.  The filter must already
+   have been removed from WRITER.  */
+static gpg_error_t
+decrypt_pipeline_finish (decrypt_pipeline_t pl, ksba_writer_t writer)
+{
+  struct decrypt_filter_parm_s *parm = pl->parm;
+  struct decrypt_chunk_s *c;
+  gpg_error_t err;
+  size_t n;
+  int i;
+
+  npth_mutex_lock (&pl->lock);
+  c = &pl->chunks[pl->fill];
+  if (c->state == CHUNK_FILLING)
+    {
+      /* As with decrypt_filter, an incomplete block is ignored.  */
+      c->len -= c->len % parm->blklen;
+      c->state = c->len? CHUNK_QUEUED : CHUNK_FREE;
+      npth_cond_broadcast (&pl->cond);
+    }
+  npth_mutex_unlock (&pl->lock);
+  decrypt_pipeline_stop (pl);
+  if (pl->err)
+    return pl->err;
+
+  for (i=0; i < DECRYPT_CHUNKS; i++)
+    {
+      c = &pl->chunks[pl->out];
+      if (c->state != CHUNK_DONE)
+        break;
+      n = c->len - c->outpos;
+      if (!pipeline_has_later_data (pl))
+        {
+          n -= parm->blklen;
+          memcpy (parm->lastblock, c->buf + c->len - parm->blklen,
+                  parm->blklen);
+          parm->any_data = 1;
+        }
+      err = ksba_writer_write (writer, c->buf + c->outpos, n);
+      if (err)
+        return err;
+      c->state = CHUNK_FREE;
+      c->len = c->outpos = 0;
+      pl->out = (pl->out + 1) % DECRYPT_CHUNKS;
+    }
+  return 0;
+}
+
+
+static void
+decrypt_pipeline_release (decrypt_pipeline_t pl)
+{
+  int i;
+
+  if (!pl)
+    return;
+  decrypt_pipeline_stop (pl);
+  for (i=0; i < DECRYPT_CHUNKS; i++)
+    xfree (pl->chunks[i].buf);
+  npth_cond_destroy (&pl->cond);
+  npth_mutex_destroy (&pl->lock);
+  xfree (pl);
+}
+
+
+/* Create a decryption stage for PARM and start its worker thread.  */
+static gpg_error_t
+decrypt_pipeline_new (struct decrypt_filter_parm_s *parm,
+                      decrypt_pipeline_t *r_pipeline)
+{
+  gpg_error_t err;
+  decrypt_pipeline_t pl;
+  npth_attr_t tattr;
+
+  *r_pipeline = NULL;
+
+  pl = (decrypt_pipeline_t) xtrycalloc (1, sizeof *pl);
+  if (!pl)
+    return gpg_error_from_syserror ();
+  pl->parm = parm;
+  npth_mutex_init (&pl->lock, NULL);
+  npth_cond_init (&pl->cond, NULL);
+
+  npth_attr_init (&tattr);
+  npth_attr_setdetachstate (&tattr, NPTH_CREATE_JOINABLE);
+  err = npth_create (&pl->thread, &tattr, decrypt_pipeline_worker, pl);
+  npth_attr_destroy (&tattr);
+  if (err)
+    {
+      err = gpg_error_from_errno (err);
+      log_error ("error spawning decryption thread: %s\n",
+                 gpg_strerror (err));
+      decrypt_pipeline_release (pl);
+      return err;
+    }
+  pl->thread_started = 1;
+
+  *r_pipeline = pl;
+  return 0;
+}
+
+/* Remove the filter from WRITER and write the rest of the plaintext
+   with the padding removed.  */
+static gpg_error_t
+decrypt_finish (struct decrypt_filter_parm_s *parm, ksba_writer_t writer)
+{
+  gpg_error_t err;
+
+  ksba_writer_set_filter (writer, NULL, NULL);
+  if (parm->pipeline)
+    {
+      err = decrypt_pipeline_finish (parm->pipeline, writer);
+      if (err)
+        return err;
+    }
+  if (parm->any_data)
+    { /* write the last block with padding removed */
+      int i, npadding = parm->lastblock[parm->blklen-1];
+      if (!npadding || npadding > parm->blklen)
+        {
+          log_error ("invalid padding with value %d\n", npadding);
+          return GPG_ERR_INV_DATA;
+        }
+      err = ksba_writer_write (writer,
+                               parm->lastblock,
+                               parm->blklen - npadding);
+      if (err)
+        return err;
+
+      for (i=parm->blklen - npadding; i < parm->blklen; i++)
+        {
+          if (parm->lastblock[i] != npadding)
+            {
+              log_error ("inconsistent padding\n");
+              return GPG_ERR_INV_DATA;
+            }
+        }
+    }
+  return 0;
+}
+
+
+
 
 /* Perform a decrypt operation.  */
 int
@@ -511,8 +854,14 @@ gpgsm_decrypt (ctrl_t ctrl, int in_fd, estream_t out_fp)
                   else
                     { /* setup the bulk decrypter */
                       any_key = 1;
+                      /* Decrypt in a separate thread if possible so
+                         that parsing and decryption overlap.  */
+                      if (!dfparm.pipeline)
+                        decrypt_pipeline_new (&dfparm, &dfparm.pipeline);
                       ksba_writer_set_filter (writer,
-                                              decrypt_filter,
+                                              (dfparm.pipeline
+                                               ? decrypt_pipeline_filter
+                                               : decrypt_filter),
                                               &dfparm);
 
                       if (is_de_vs)
@@ -533,32 +882,9 @@ gpgsm_decrypt (ctrl_t ctrl, int in_fd, estream_t out_fp)
         }
       else if (stopreason == KSBA_SR_END_DATA)
         {
-          ksba_writer_set_filter (writer, NULL, NULL);
-          if (dfparm.any_data)
-            { /* write the last block with padding removed */
-              int i, npadding = dfparm.lastblock[dfparm.blklen-1];
-              if (!npadding || npadding > dfparm.blklen)
-                {
-                  log_error ("invalid padding with value %d\n", npadding);
-                  rc = GPG_ERR_INV_DATA;
-                  goto leave;
-                }
-              rc = ksba_writer_write (writer,
-                                      dfparm.lastblock,
-                                      dfparm.blklen - npadding);
-              if (rc)
-                goto leave;
-
-              for (i=dfparm.blklen - npadding; i < dfparm.blklen; i++)
-                {
-                  if (dfparm.lastblock[i] != npadding)
-                    {
-                      log_error ("inconsistent padding\n");
-                      rc = GPG_ERR_INV_DATA;
-                      goto leave;
-                    }
-                }
-            }
+          rc = decrypt_finish (&dfparm, writer);
+          if (rc)
+            goto leave;
         }
 
     }
@@ -585,6 +911,7 @@ gpgsm_decrypt (ctrl_t ctrl, int in_fd, estream_t out_fp)
   gnupg_ksba_destroy_writer (b64writer);
   sm_keydb_release (kh);
   es_fclose (in_fp);
+  decrypt_pipeline_release (dfparm.pipeline);
   if (dfparm.hd)
     gcry_cipher_close (dfparm.hd);
   return rc;
@@ -0,0 +1,8 @@
+#include "gtest/gtest.h"
+
+  int decrypt_main(int argc, char* argv[]);
+
+TEST(GpgsmTest, decrypt) {
+    int result = decrypt_main(0, NULL);
+    ASSERT_EQ(result, 0);
+}
@@ -31,6 +31,7 @@
 #include "gpgsm.h"
 #include <gcrypt.h>
 #include <assuan.h> /* malloc hooks */
+#include <npth.h>
 
 #include "passphrase.h"
 #include "../kbx/keybox.h" /* malloc hooks */
@@ -172,6 +173,7 @@ enum cmd_and_opt_values {
   oWithEphemeralKeys,
   oSkipVerify,
   oValidationModel,
+  oValidationCacheTTL,
   oEncryptTo,
   oNoEncryptTo,
   oLoggerFD,
@@ -268,6 +270,7 @@ static ARGPARSE_OPTS opts[] = {
   ARGPARSE_s_n (oEnableOCSP,  "enable-ocsp", N_("check validity using OCSP")),
 
   ARGPARSE_s_s (oValidationModel, "validation-model", "@"),
+  ARGPARSE_s_u (oValidationCacheTTL, "validation-cache-ttl", "@"),
 
   ARGPARSE_s_i (oIncludeCerts, "include-certs",
                 N_("|N|number of certificates to include") ),
@@ -735,6 +738,20 @@ parse_validation_model (const char *model)
 }
 
 
+/* Initialize nPth for the decryption thread.  The main thread holds
+   the nPth lock except while it is blocked in a system call.  */
+static void
+thread_init (void)
+{
+  npth_init ();
+  gpgrt_set_syscall_clamp (npth_unprotect, npth_protect);
+  /* Libgcrypt has already been initialized without the clamp.  */
+#if GCRYPT_VERSION_NUMBER >= 0x010800 /* 1.8.0 */
+  gcry_control (GCRYCTL_REINIT_SYSCALL_CLAMP, 0, 0);
+#endif
+}
+
+
 int
 gpgsm_main ( int argc, char **argv)
 {
@@ -787,6 +804,7 @@ gpgsm_main ( int argc, char **argv)
   /* Make sure that our subsystems are ready.  */
   i18n_init ();
   init_common_subsystems (&argc, &argv);
+  thread_init ();
 
   gcry_control (GCRYCTL_USE_SECURE_RNDPOOL);
 
@@ -1237,6 +1255,9 @@ gpgsm_main ( int argc, char **argv)
         case oNoCommonCertsImport: no_common_certs_import = 1; break;
 
         case oValidationModel: parse_validation_model (pargs.r.ret_str); break;
+        case oValidationCacheTTL:
+          opt.validation_cache_ttl = pargs.r.ret_ulong;
+          break;
 
         case oIgnoreCertExtension:
           add_to_strlist (&opt.ignored_cert_extensions, pargs.r.ret_str);
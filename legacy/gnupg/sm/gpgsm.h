@@ -109,6 +109,8 @@ struct
   int no_policy_check;      /* ignore certificate policies */
   int no_chain_validation;  /* Bypass all cert chain validity tests */
   int ignore_expiration;    /* Ignore the notAfter validity checks. */
+  unsigned long validation_cache_ttl; /* Keep chain validation results
+                                         for this many seconds.  */
 
   int auto_issuer_key_retrieve; /* try to retrieve a missing issuer key. */
 
@@ -395,6 +397,7 @@ gpg_error_t transform_sigval (const unsigned char *sigval, size_t sigvallen,
                               int mdalgo,
                               unsigned char **r_newsigval,
                               size_t *r_newsigvallen);
+unsigned long gpgsm_mix_file_stamp (unsigned long stamp, const char *fname);
 
 
 
@@ -48,11 +48,16 @@ struct resource_item {
   } u;
   void *token;
   dotlock_t lockhandle;
+  char *fname;
 };
 
 static struct resource_item all_resources[MAX_KEYDB_RESOURCES];
 static int used_resources;
 
+/* Counter incremented for each modification of a keybox done by this
+   process.  See sm_keydb_change_stamp.  */
+static unsigned long change_counter;
+
 /* Whether we have successfully registered any resource.  */
 static int any_registered;
 
@@ -349,6 +354,7 @@ sm_keydb_add_resource (ctrl_t ctrl, const char *url, int force, int *auto_create
             all_resources[used_resources].type = rt;
             all_resources[used_resources].u.kr = NULL; /* Not used here */
             all_resources[used_resources].token = token;
+            all_resources[used_resources].fname = xstrdup (filename);
 
             all_resources[used_resources].lockhandle
               = dotlock_create (filename, 0);
@@ -752,6 +758,7 @@ sm_keydb_set_flags (KEYDB_HANDLE hd, int which, int idx, unsigned int value)
       break;
     }
 
+  change_counter++;
   return err;
 }
 
@@ -793,6 +800,7 @@ sm_keydb_insert_cert (KEYDB_HANDLE hd, ksba_cert_t cert)
       break;
     }
 
+  change_counter++;
   unlock_all (hd);
   return rc;
 }
@@ -831,6 +839,7 @@ sm_keydb_update_cert (KEYDB_HANDLE hd, ksba_cert_t cert)
       break;
     }
 
+  change_counter++;
   unlock_all (hd);
   return rc;
 }
@@ -866,12 +875,29 @@ sm_keydb_delete (KEYDB_HANDLE hd, int unlock)
       break;
     }
 
+  change_counter++;
   if (unlock)
     unlock_all (hd);
   return rc;
 }
 
 
+/* Return a value which changes whenever one of the registered
+   keyboxes is modified.  Changes done by this process are counted
+   directly; changes by other processes are detected using the state
+   of the files.  */
+unsigned long
+sm_keydb_change_stamp (void)
+{
+  unsigned long stamp = change_counter;
+  int i;
+
+  for (i=0; i < used_resources; i++)
+    stamp = gpgsm_mix_file_stamp (stamp, all_resources[i].fname);
+  return stamp;
+}
+
+
 
 /*
  * Locate the default writable key resource, so that the next
@@ -50,6 +50,7 @@ int sm_keydb_insert_cert (KEYDB_HANDLE hd, ksba_cert_t cert);
 int sm_keydb_update_cert (KEYDB_HANDLE hd, ksba_cert_t cert);
 
 int sm_keydb_delete (KEYDB_HANDLE hd, int unlock);
+unsigned long sm_keydb_change_stamp (void);
 
 int sm_keydb_locate_writable (KEYDB_HANDLE hd, const char *reserved);
 
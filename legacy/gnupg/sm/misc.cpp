@@ -24,6 +24,8 @@
 #include <string.h>
 #include <ctype.h>
 #include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 #ifdef HAVE_LOCALE_H
 #include <locale.h>
 #endif
@@ -189,3 +191,28 @@ transform_sigval (const unsigned char *sigval, size_t sigvallen, int mdalgo,
 
   return err;
 }
+
+
+/* Mix the state of the file FNAME into STAMP and return the new
+   value.  The device, inode, size and time stamps of the file are
+   used so that modifications by other processes are detected.  A
+   missing file yields a distinct value as well.  */
+unsigned long
+gpgsm_mix_file_stamp (unsigned long stamp, const char *fname)
+{
+  struct stat st;
+  unsigned long values[5];
+  int i;
+
+  if (stat (fname, &st))
+    return (stamp ^ 1) * 0x01000193UL;
+
+  values[0] = (unsigned long)st.st_dev;
+  values[1] = (unsigned long)st.st_ino;
+  values[2] = (unsigned long)st.st_size;
+  values[3] = (unsigned long)st.st_mtime;
+  values[4] = (unsigned long)st.st_ctime;
+  for (i=0; i < DIM (values); i++)
+    stamp = (stamp ^ values[i]) * 0x01000193UL;
+  return stamp;
+}
@@ -0,0 +1,228 @@
+/* t-decrypt.c - Regression tests for the bulk decryption
+ * Copyright (C) 2018 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* The tests include the module so that they can run the filters
+   without a CMS object.  The content is written to the filters in
+   pieces of varying sizes like the CMS parser does.  The result of
+   the decryption thread must be the same as that of decrypt_filter,
+   also for truncated input.  */
+#include "decrypt.cpp"
+
+#define pass()  do { ; } while(0)
+#define fail(a)  do { fprintf (stderr, "%s:%d: test %d failed\n",\
+                               __FILE__,__LINE__, (a));          \
+                     exit (1);                                   \
+                   } while(0)
+
+static const char key[32] = "0123456789abcdef0123456789abcdef";
+static const char iv[16] = "fedcba9876543210";
+
+
+/* Encrypt PTLEN bytes of a test pattern with ALGO in CBC mode and
+   the padding of CMS.  The returned buffer holds the plaintext in
+   the first PTLEN bytes and the ciphertext of length R_CTLEN after
+   it.  The last byte of each plaintext block is not a valid padding
+   value, so that truncated content fails the padding check.  */
+static unsigned char *
+make_content (int algo, size_t ptlen, size_t *r_ctlen)
+{
+  gcry_cipher_hd_t hd;
+  unsigned char *buf, *ct;
+  size_t blklen, ctlen, i;
+
+  blklen = gcry_cipher_get_algo_blklen (algo);
+  ctlen = (ptlen / blklen + 1) * blklen;
+  buf = (unsigned char *) xmalloc (ptlen + ctlen);
+  ct = buf + ptlen;
+  for (i=0; i < ptlen; i++)
+    buf[i] = 0x40 + (i * 7 + (i >> 10)) % 64;
+  memcpy (ct, buf, ptlen);
+  memset (ct + ptlen, ctlen - ptlen, ctlen - ptlen);
+
+  if (gcry_cipher_open (&hd, algo, GCRY_CIPHER_MODE_CBC, 0)
+      || gcry_cipher_setkey (hd, key, gcry_cipher_get_algo_keylen (algo))
+      || gcry_cipher_setiv (hd, iv, blklen)
+      || gcry_cipher_encrypt (hd, ct, ctlen, NULL, 0))
+    fail (0);
+  gcry_cipher_close (hd);
+  *r_ctlen = ctlen;
+  return buf;
+}
+
+
+/* Wait until the worker of PL has decrypted all queued chunks.  */
+static void
+wait_for_worker (decrypt_pipeline_t pl)
+{
+  npth_mutex_lock (&pl->lock);
+  while (pl->chunks[pl->next].state == CHUNK_QUEUED)
+    npth_cond_wait (&pl->cond, &pl->lock);
+  npth_mutex_unlock (&pl->lock);
+}
+
+
+/* Decrypt CTLEN bytes at CT with ALGO, either with or without the
+   decryption thread.  The plaintext is stored at R_OUT and R_OUTLEN
+   also on error.  An incomplete block at the end is written byte by
+   byte after the worker caught up, so that the filter sees it while
+   the chunk before it is ready for output.  */
+static gpg_error_t
+run_decrypt (int algo, int use_thread, const unsigned char *ct, size_t ctlen,
+             unsigned char **r_out, size_t *r_outlen)
+{
+  struct decrypt_filter_parm_s dfparm;
+  ksba_writer_t writer;
+  gpg_error_t err = 0;
+  size_t off, n, full;
+  int i;
+
+  memset (&dfparm, 0, sizeof dfparm);
+  dfparm.algo = algo;
+  dfparm.mode = GCRY_CIPHER_MODE_CBC;
+  dfparm.blklen = gcry_cipher_get_algo_blklen (algo);
+  if (gcry_cipher_open (&dfparm.hd, algo, dfparm.mode, 0)
+      || gcry_cipher_setkey (dfparm.hd, key, gcry_cipher_get_algo_keylen (algo))
+      || gcry_cipher_setiv (dfparm.hd, iv, dfparm.blklen))
+    fail (0);
+  if (use_thread && decrypt_pipeline_new (&dfparm, &dfparm.pipeline))
+    fail (0);
+  if (ksba_writer_new (&writer) || ksba_writer_set_mem (writer, 1024))
+    fail (0);
+  ksba_writer_set_filter (writer,
+                          use_thread? decrypt_pipeline_filter : decrypt_filter,
+                          &dfparm);
+
+  full = ctlen - ctlen % dfparm.blklen;
+  for (off=0, i=0; off < full && !err; off += n, i++)
+    {
+      n = 1 + (i * 7919) % 20000;
+      if (n > full - off)
+        n = full - off;
+      err = ksba_writer_write (writer, ct + off, n);
+    }
+  if (dfparm.pipeline)
+    wait_for_worker (dfparm.pipeline);
+  for (; off < ctlen && !err; off++)
+    err = ksba_writer_write (writer, ct + off, 1);
+  if (!err)
+    err = decrypt_finish (&dfparm, writer);
+
+  *r_out = (unsigned char *) ksba_writer_snatch_mem (writer, r_outlen);
+  ksba_writer_release (writer);
+  decrypt_pipeline_release (dfparm.pipeline);
+  gcry_cipher_close (dfparm.hd);
+  return err;
+}
+
+
+/* Decrypt the content of PTLEN bytes with and without the thread.
+   Only the first CTLEN bytes of the ciphertext are used if CTLEN is
+   not 0; that must fail like without the thread.  */
+static void
+check_decrypt (int algo, size_t ptlen, size_t ctlen, int what)
+{
+  unsigned char *content, *out, *ref;
+  size_t fullctlen, outlen, reflen;
+  gpg_error_t err, referr;
+
+  content = make_content (algo, ptlen, &fullctlen);
+  if (!ctlen)
+    ctlen = fullctlen;
+  if (ctlen > fullctlen)
+    fail (what);
+
+  err = run_decrypt (algo, 1, content + ptlen, ctlen, &out, &outlen);
+  referr = run_decrypt (algo, 0, content + ptlen, ctlen, &ref, &reflen);
+  if (err != referr || outlen != reflen || memcmp (out, ref, outlen))
+    fail (what);
+  if (ctlen == fullctlen)
+    {
+      if (err || outlen != ptlen || memcmp (out, content, ptlen))
+        fail (what);
+    }
+  else if (ctlen >= gcry_cipher_get_algo_blklen (algo)
+           && err != GPG_ERR_INV_DATA)
+    fail (what);
+
+  xfree (content);
+  xfree (out);
+  xfree (ref);
+}
+
+
+static void
+test_boundaries (int algo)
+{
+  size_t blklen = gcry_cipher_get_algo_blklen (algo);
+  size_t sizes[] = { 0, 1, blklen - 1, blklen,
+                     DECRYPT_CHUNK_SIZE - blklen - 1,
+                     DECRYPT_CHUNK_SIZE - blklen,
+                     DECRYPT_CHUNK_SIZE - 1,
+                     DECRYPT_CHUNK_SIZE,
+                     DECRYPT_CHUNK_SIZE + 1,
+                     2*DECRYPT_CHUNK_SIZE - 1,
+                     2*DECRYPT_CHUNK_SIZE + 3*blklen + 5,
+                     DECRYPT_CHUNKS*DECRYPT_CHUNK_SIZE - 1,
+                     DECRYPT_CHUNKS*DECRYPT_CHUNK_SIZE,
+                     (DECRYPT_CHUNKS+1)*DECRYPT_CHUNK_SIZE + 1000 };
+  int i;
+
+  for (i=0; i < DIM (sizes); i++)
+    check_decrypt (algo, sizes[i], 0, i);
+}
+
+
+/* Truncate the ciphertext at and shortly after chunk boundaries.  */
+static void
+test_truncated (int algo)
+{
+  size_t blklen = gcry_cipher_get_algo_blklen (algo);
+  size_t ptlen = 3*DECRYPT_CHUNK_SIZE + 100;
+  size_t offsets[] = { 0, 1, blklen - 1, blklen, blklen + 1 };
+  size_t k;
+  int i;
+
+  check_decrypt (algo, ptlen, blklen - 1, 1);
+  check_decrypt (algo, ptlen, 5*blklen + 3, 2);
+  for (k=1; k <= 2; k++)
+    for (i=0; i < DIM (offsets); i++)
+      {
+        check_decrypt (algo, ptlen, k*DECRYPT_CHUNK_SIZE + offsets[i],
+                       100 * k + i);
+        check_decrypt (algo, ptlen, k*DECRYPT_CHUNK_SIZE - blklen
+                       + offsets[i], 100 * k + 10 + i);
+      }
+}
+
+
+int
+decrypt_main (int argc, char **argv)
+{
+  (void)argc;
+  (void)argv;
+
+  if (npth_init ())
+    return 1;
+
+  test_boundaries (GCRY_CIPHER_AES128);
+  test_boundaries (GCRY_CIPHER_3DES);
+  test_truncated (GCRY_CIPHER_AES128);
+  test_truncated (GCRY_CIPHER_3DES);
+  return 0;
+}
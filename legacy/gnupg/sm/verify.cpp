@@ -35,6 +35,9 @@
 #include "../common/i18n.h"
 #include "../common/compliance.h"
 
+/* The size of the buffer used to hash detached data.  */
+#define HASH_DATA_BUFSIZE (64*1024)
+
 static char *
 strtimestamp_r (ksba_isotime_t atime)
 {
@@ -55,20 +58,27 @@ hash_data (int fd, gcry_md_hd_t md)
 {
   gpg_error_t err = 0;
   estream_t fp;
-  char buffer[4096];
+  char *buffer;
   int nread;
 
+  /* All enabled digests are computed in one pass over the data; a
+     large buffer keeps the per-call overhead low for big files.  */
+  buffer = (char*) xtrymalloc (HASH_DATA_BUFSIZE);
+  if (!buffer)
+    return gpg_error_from_syserror ();
+
   fp = es_fdopen_nc (fd, "rb");
   if (!fp)
     {
       err = gpg_error_from_syserror ();
       log_error ("fdopen(%d) failed: %s\n", fd, gpg_strerror (err));
+      xfree (buffer);
       return err;
     }
 
   do
     {
-      nread = es_fread (buffer, 1, DIM(buffer), fp);
+      nread = es_fread (buffer, 1, HASH_DATA_BUFSIZE, fp);
       gcry_md_write (md, buffer, nread);
     }
   while (nread);
@@ -78,6 +88,7 @@ hash_data (int fd, gcry_md_hd_t md)
       log_error ("read error on fd %d: %s\n", fd, gpg_strerror (err));
     }
   es_fclose (fp);
+  xfree (buffer);
   return err;
 }
 
@@ -237,6 +237,139 @@ _assuan_read_line (assuan_context_t ctx)
 }
 
 
+/* Check whether LINE of length LINELEN is the header of a binary
+   frame.  Returns 0 if not, 1 if it is and stores the length of the
+   frame at R_LENGTH, or -1 for a header with an invalid length.
+   Binary frames are only recognized if the binary-data option has
+   been negotiated.  */
+int
+_assuan_parse_binary_header (assuan_context_t ctx,
+                             const char *line, int linelen,
+                             size_t *r_length)
+{
+  size_t length = 0;
+  int i;
+
+  *r_length = 0;
+  if (!ctx->flags.binary_data
+      || linelen < 3 || line[0] != 'B' || line[1] != ' ')
+    return 0;
+
+  for (i = 2; i < linelen; i++)
+    {
+      if (line[i] < '0' || line[i] > '9')
+        return -1;
+      length = length * 10 + (line[i] - '0');
+      if (length > BINARY_FRAME_MAX)
+        return -1;
+    }
+  if (!length)
+    return -1;
+
+  *r_length = length;
+  return 1;
+}
+
+
+/* Move up to LENGTH bytes of data buffered in the attic to BUFFER or
+   drop them if BUFFER is NULL.  Returns the number of bytes taken.  */
+static size_t
+take_from_attic (assuan_context_t ctx, char *buffer, size_t length)
+{
+  size_t n = ctx->inbound.attic.linelen;
+
+  if (!n)
+    return 0;
+  if (n > length)
+    n = length;
+  if (buffer)
+    memcpy (buffer, ctx->inbound.attic.line, n);
+  ctx->inbound.attic.linelen -= n;
+  memmove (ctx->inbound.attic.line, ctx->inbound.attic.line + n,
+           ctx->inbound.attic.linelen);
+  ctx->inbound.attic.pending =
+    memrchr (ctx->inbound.attic.line, '\n',
+             ctx->inbound.attic.linelen) ? 1 : 0;
+  return n;
+}
+
+
+/* Read up to LENGTH raw bytes of a binary frame into BUFFER, or drop
+   them if BUFFER is NULL.  Data already buffered in the attic is
+   consumed first.  If UNTIL_BLOCK is set, return as soon as a read
+   would block.  The number of bytes read is stored at R_NREAD.
+   Returns 0 on success or an assuan error code.  */
+static gpg_error_t
+read_binary (assuan_context_t ctx, char *buffer, size_t length,
+             int until_block, size_t *r_nread)
+{
+  char scratch[LINELENGTH];
+  size_t n;
+
+  n = take_from_attic (ctx, buffer, length);
+  *r_nread = n;
+  if (buffer)
+    buffer += n;
+  length -= n;
+
+  while (length)
+    {
+      ssize_t nread;
+
+      if (ctx->inbound.eof)
+        return GPG_ERR_ASS_INCOMPLETE_LINE;
+
+      n = buffer ? length : (length < sizeof scratch ? length : sizeof scratch);
+      nread = ctx->engine.readfnc (ctx, buffer ? buffer : scratch, n);
+      if (nread < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          if (until_block && errno == EAGAIN)
+            return 0;
+          return gpg_error_from_syserror ();
+        }
+      if (!nread)
+        {
+          ctx->inbound.eof = 1;
+          _assuan_log_control_channel (ctx, 0, "eof", NULL, 0, NULL, 0);
+          return GPG_ERR_ASS_INCOMPLETE_LINE;
+        }
+      if (buffer)
+        buffer += nread;
+      length -= nread;
+      *r_nread += nread;
+    }
+
+  return 0;
+}
+
+
+/* Read exactly LENGTH raw bytes following a binary frame header into
+   BUFFER.  If BUFFER is NULL the bytes are read and discarded.  Data
+   already buffered in the attic is consumed first.  Returns 0 on
+   success or an assuan error code.  */
+gpg_error_t
+_assuan_read_binary (assuan_context_t ctx, void *buffer, size_t length)
+{
+  size_t nread;
+
+  return read_binary (ctx, (char*) buffer, length, 0, &nread);
+}
+
+
+/* Like _assuan_read_binary but for a non-blocking connection: stop
+   when a read would block and store the number of bytes read so far
+   at R_NREAD.  The caller continues with the rest of the frame when
+   the connection is readable again.  */
+gpg_error_t
+_assuan_read_binary_some (assuan_context_t ctx, void *buffer, size_t length,
+                          size_t *r_nread)
+{
+  return read_binary (ctx, (char*) buffer, length, 1, r_nread);
+}
+
+
 /* Read the next line from the client or server and return a pointer
    in *LINE to a buffer holding the line.  LINELEN is the length of
    *LINE.  The buffer is valid until the next read operation on it.
@@ -352,6 +485,47 @@ assuan_write_line (assuan_context_t ctx, const char *line)
 
 
 
+/* Write out BUFFER of length SIZE as binary frames.  Any pending data
+   line is flushed first to keep the order.  */
+static int
+write_binary_data (assuan_context_t ctx, const char *buffer, size_t size)
+{
+  _assuan_cookie_write_flush (ctx);
+  if (ctx->outbound.data.error)
+    return 0;
+
+  while (size)
+    {
+      char header[30];
+      size_t n = size > BINARY_FRAME_MAX ? BINARY_FRAME_MAX : size;
+      int headerlen;
+      unsigned int monitor_result;
+
+      headerlen = snprintf (header, sizeof header, "B %lu", (unsigned long)n);
+
+      monitor_result = 0;
+      if (ctx->io_monitor)
+	monitor_result = ctx->io_monitor (ctx, ctx->io_monitor_data, 1,
+					  header, headerlen);
+      if (!(monitor_result & ASSUAN_IO_MONITOR_NOLOG))
+        _assuan_log_control_channel (ctx, 1, NULL, header, headerlen,
+                                     NULL, 0);
+
+      header[headerlen++] = '\n';
+      if (!(monitor_result & ASSUAN_IO_MONITOR_IGNORE)
+          && (writen (ctx, header, headerlen) || writen (ctx, buffer, n)))
+        {
+          ctx->outbound.data.error = gpg_error_from_syserror ();
+          return 0;
+        }
+      buffer += n;
+      size -= n;
+    }
+
+  return 1;
+}
+
+
 /* Write out the data in buffer as datalines with line wrapping and
    percent escaping.  This function is used for GNU's custom streams. */
 int
@@ -365,6 +539,10 @@ _assuan_cookie_write_data (void *cookie, const char *buffer, size_t orig_size)
   if (ctx->outbound.data.error)
     return 0;
 
+  /* Large chunks are sent unescaped if the peer agreed to it.  */
+  if (ctx->flags.binary_data && size >= BINARY_FRAME_MIN)
+    return write_binary_data (ctx, buffer, size) ? (int) orig_size : 0;
+
   line = ctx->outbound.data.line;
   linelen = ctx->outbound.data.linelen;
   line += linelen;
@@ -50,6 +50,13 @@
 
 #define LINELENGTH ASSUAN_LINELENGTH
 
+/* With the binary-data option, data chunks of at least
+   BINARY_FRAME_MIN bytes are sent as a "B <n>" line followed by N raw
+   bytes instead of escaped "D" lines.  No frame is larger than
+   BINARY_FRAME_MAX.  */
+#define BINARY_FRAME_MIN 512
+#define BINARY_FRAME_MAX (4*1024*1024)
+
 
 struct cmdtbl_s
 {
@@ -88,6 +95,7 @@ struct assuan_context_s
     unsigned int convey_comments : 1;
     unsigned int no_logging : 1;
     unsigned int force_close : 1;
+    unsigned int binary_data : 1;
   } flags;
 
   /* If set, this is called right before logging an I/O line.  */
@@ -151,6 +159,13 @@ struct assuan_context_s
       int linelen ;
       int pending; /* i.e. at least one line is available in the attic */
     } attic;
+    struct {
+      char *buffer;  /* Holds a received binary frame as a "D" line.  */
+      size_t size;   /* Allocated size of BUFFER.  */
+      int linelen;   /* Length of the line in BUFFER.  */
+      int active;    /* Set if the last response was a binary frame.  */
+      size_t remaining; /* Rest of a frame for assuan_inquire_ext.  */
+    } binary;
   } inbound;
 
   struct {
@@ -278,6 +293,14 @@ gpg_error_t _assuan_register_std_commands (assuan_context_t ctx);
 
 /*-- assuan-buffer.c --*/
 gpg_error_t _assuan_read_line (assuan_context_t ctx);
+int _assuan_parse_binary_header (assuan_context_t ctx,
+                                 const char *line, int linelen,
+                                 size_t *r_length);
+gpg_error_t _assuan_read_binary (assuan_context_t ctx,
+                                 void *buffer, size_t length);
+gpg_error_t _assuan_read_binary_some (assuan_context_t ctx,
+                                      void *buffer, size_t length,
+                                      size_t *r_nread);
 int _assuan_cookie_write_data (void *cookie, const char *buffer, size_t size);
 int _assuan_cookie_write_flush (void *cookie);
 gpg_error_t _assuan_write_line (assuan_context_t ctx, const char *prefix,
@@ -79,7 +79,11 @@ static const char std_help_option[] =
   "trailing spaces around <NAME> and <VALUE> are allowed but should be\n"
   "ignored.  For compatibility reasons, <NAME> may be prefixed with two\n"
   "dashes.  The use of the equal sign is optional but suggested if\n"
-  "<VALUE> is given.";
+  "<VALUE> is given.\n"
+  "\n"
+  "The option \"binary-data\" is handled by Assuan itself: it enables\n"
+  "the transfer of large data chunks as \"B <N>\" lines followed by N\n"
+  "raw bytes.  The server confirms it with a BINARY-DATA status line.";
 static gpg_error_t
 std_handler_option (assuan_context_t ctx, char *line)
 {
@@ -128,6 +132,14 @@ std_handler_option (assuan_context_t ctx, char *line)
 			 set_error (ctx, GPG_ERR_ASS_SYNTAX,
 				    "option should not begin with one dash"));
 
+  if (!strcmp (key, "binary-data"))
+    {
+      gpg_error_t err = assuan_write_status (ctx, "BINARY-DATA", "");
+      if (!err)
+        ctx->flags.binary_data = 1;
+      return PROCESS_DONE (ctx, err);
+    }
+
   if (ctx->option_handler_fnc)
     return PROCESS_DONE (ctx, ctx->option_handler_fnc (ctx, key, value));
   return PROCESS_DONE (ctx, 0);
@@ -739,6 +751,10 @@ process_next (assuan_context_t ctx)
 {
   gpg_error_t rc;
 
+  /* The rest of a binary frame for an inquiry is not a line.  */
+  if (ctx->in_inquire && ctx->inbound.binary.remaining)
+    return _assuan_inquire_ext_cb (ctx);
+
   /* What the next thing to do is depends on the current state.
      However, we will always first read the next line.  The client is
      required to write full lines without blocking long after starting
@@ -97,6 +97,62 @@ put_membuf (assuan_context_t ctx,
   mb->len += len;
 }
 
+/* Make room for a binary frame of LENGTH bytes in the buffer MB.  If
+   this fails or the frame is too large, MB is put into an error state
+   and the frame needs to be discarded.  */
+static void
+reserve_binary_membuf (assuan_context_t ctx, struct membuf *mb, size_t length)
+{
+  if (!mb->out_of_core && !mb->too_large
+      && mb->maxlen && mb->len + length > mb->maxlen)
+    mb->too_large = 1;
+
+  if (!mb->out_of_core && !mb->too_large && mb->len + length >= mb->size)
+    {
+      char *p;
+
+      mb->size = mb->len + length + 1024;
+      /* we need to allocate one byte more for get_membuf */
+      p = (char*) _assuan_realloc (ctx, mb->buf, mb->size + 1);
+      if (!p)
+        mb->out_of_core = 1;
+      else
+        mb->buf = p;
+    }
+}
+
+/* Read a binary frame of LENGTH bytes directly into the buffer MB.
+   The frame is still read if the buffer is already in an error state
+   so that the connection stays in sync.  */
+static gpg_error_t
+read_binary_membuf (assuan_context_t ctx, struct membuf *mb, size_t length)
+{
+  reserve_binary_membuf (ctx, mb, length);
+  if (mb->out_of_core || mb->too_large)
+    return _assuan_read_binary (ctx, NULL, length);
+
+  mb->len += length;
+  return _assuan_read_binary (ctx, mb->buf + mb->len - length, length);
+}
+
+/* Read the rest of the binary frame for assuan_inquire_ext into the
+   buffer MB as far as possible without blocking.  The frame is
+   complete if CTX->INBOUND.BINARY.REMAINING is zero.  */
+static gpg_error_t
+continue_binary_membuf (assuan_context_t ctx, struct membuf *mb)
+{
+  gpg_error_t rc;
+  size_t nread;
+  int discard = mb->out_of_core || mb->too_large;
+
+  rc = _assuan_read_binary_some (ctx, discard? NULL : mb->buf + mb->len,
+                                 ctx->inbound.binary.remaining, &nread);
+  if (!discard)
+    mb->len += nread;
+  ctx->inbound.binary.remaining -= nread;
+  return rc;
+}
+
 static void *
 get_membuf (assuan_context_t ctx, struct membuf *mb, size_t *len)
 {
@@ -151,6 +207,7 @@ assuan_inquire (assuan_context_t ctx, const char *keyword,
   unsigned char *line, *p;
   int linelen;
   int nodataexpected;
+  size_t length;
 
   if (r_buffer)
     *r_buffer = NULL;
@@ -206,6 +263,25 @@ assuan_inquire (assuan_context_t ctx, const char *keyword,
           rc = GPG_ERR_ASS_CANCELED;
           goto out;
         }
+      switch (_assuan_parse_binary_header (ctx, (char*) line, linelen,
+                                           &length))
+        {
+        case 0:
+          break;
+        case 1:
+          if (nodataexpected)
+            {
+              rc = GPG_ERR_ASS_UNEXPECTED_CMD;
+              goto out;
+            }
+          rc = read_binary_membuf (ctx, &mb, length);
+          if (rc)
+            goto out;
+          continue;
+        default:
+          rc = GPG_ERR_ASS_SYNTAX;
+          goto out;
+        }
       if ((line[0] != 'D' && line[0] != 'd')
           || line[1] != ' ' || nodataexpected)
         {
@@ -264,6 +340,7 @@ _assuan_inquire_release (assuan_context_t ctx)
 {
   if (ctx->in_inquire)
     {
+      ctx->inbound.binary.remaining = 0;
       if (ctx->inquire_membuf)
 	{
 	  free_membuf (ctx, (membuf*) (ctx->inquire_membuf));
@@ -282,11 +359,19 @@ _assuan_inquire_ext_cb (assuan_context_t ctx)
   int linelen;
   struct membuf *mb;
   unsigned char *p;
+  size_t length;
 
   line = (unsigned char *) ctx->inbound.line;
   linelen = ctx->inbound.linelen;
   mb = (membuf*) ctx->inquire_membuf;
 
+  if (ctx->inbound.binary.remaining)
+    {
+      /* The connection became readable in the middle of a frame.  */
+      rc = continue_binary_membuf (ctx, mb);
+      goto binary_frame;
+    }
+
   if ((line[0] == 'C' || line[0] == 'c')
       && (line[1] == 'A' || line[1] == 'a')
       && (line[2] == 'N' || line[2] == 'n'))
@@ -303,6 +388,28 @@ _assuan_inquire_ext_cb (assuan_context_t ctx)
       goto out;
     }
 
+  /* On a non-blocking connection only the part of a binary frame
+     which is already available is read; process_next calls us again
+     for the rest.  */
+  switch (_assuan_parse_binary_header (ctx, (char*) line, linelen, &length))
+    {
+    case 0:
+      break;
+    case 1:
+      if (mb == NULL)
+        {
+          rc = GPG_ERR_ASS_UNEXPECTED_CMD;
+          goto out;
+        }
+      reserve_binary_membuf (ctx, mb, length);
+      ctx->inbound.binary.remaining = length;
+      rc = continue_binary_membuf (ctx, mb);
+      goto binary_frame;
+    default:
+      rc = GPG_ERR_ASS_SYNTAX;
+      goto out;
+    }
+
   if ((line[0] != 'D' && line[0] != 'd') || line[1] != ' ' || mb == NULL)
     {
       rc = GPG_ERR_ASS_UNEXPECTED_CMD;
@@ -339,7 +446,14 @@ _assuan_inquire_ext_cb (assuan_context_t ctx)
 
   return 0;
 
+ binary_frame:
+  if (!rc && !ctx->inbound.binary.remaining && mb->too_large)
+    rc = GPG_ERR_ASS_TOO_MUCH_DATA;
+  if (!rc)
+    return 0;
+
  out:
+  ctx->inbound.binary.remaining = 0;
   {
     size_t buf_len = 0;
     unsigned char *buf = NULL;
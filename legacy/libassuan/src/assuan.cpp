@@ -164,6 +164,11 @@ assuan_release (assuan_context_t ctx)
   TRACE (ctx, ASSUAN_LOG_CTX, "assuan_release", ctx);
 
   _assuan_reset (ctx);
+  if (ctx->inbound.binary.buffer)
+    {
+      wipememory (ctx->inbound.binary.buffer, ctx->inbound.binary.size);
+      _assuan_free (ctx, ctx->inbound.binary.buffer);
+    }
   /* None of the members that are our responsibility requires
      deallocation.  To avoid sensitive data in the line buffers we
      wipe them out, though.  Note that we can't wipe the entire
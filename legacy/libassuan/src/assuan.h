@@ -241,6 +241,10 @@ typedef unsigned int assuan_flag_t;
 #define ASSUAN_NO_LOGGING 5
 /* This flag forces a connection close.  */
 #define ASSUAN_FORCE_CLOSE 6
+/* This flag enables the binary framing of data lines.  It is set by
+   the server when the client sends "OPTION binary-data" and by the
+   client via assuan_enable_binary_data.  */
+#define ASSUAN_BINARY_DATA 7
 
 /* For context CTX, set the flag FLAG to VALUE.  Values for flags
    are usually 1 or 0 but certain flags might allow for other values;
@@ -443,6 +447,9 @@ gpg_error_t assuan_client_parse_response (assuan_context_t ctx,
 					  assuan_response_t *response,
 					  int *off);
 
+/* Ask the server to use binary framed data lines.  */
+gpg_error_t assuan_enable_binary_data (assuan_context_t ctx);
+
 /*-- assuan-client.c --*/
 gpg_error_t
 assuan_transact (assuan_context_t ctx,
@@ -23,6 +23,7 @@
 #endif
 
 #include <stdlib.h>
+#include <string.h>
 
 #include "assuan-defs.h"
 #include "debug.h"
@@ -67,7 +68,45 @@ _assuan_client_release (assuan_context_t ctx)
 }
 
 
-/* This function also does deescaping for data lines.  */
+/* Read the binary frame of LENGTH bytes announced by the last line
+   into the binary buffer of CTX.  The frame is stored like a data
+   line, i.e. prefixed with "D " and with a hidden terminator.  */
+static gpg_error_t
+read_binary_response (assuan_context_t ctx, size_t length)
+{
+  gpg_error_t rc;
+  size_t needed = length + 3;
+
+  if (ctx->inbound.binary.size < needed)
+    {
+      char *buffer = (char*) _assuan_malloc (ctx, needed);
+
+      if (!buffer)
+        return gpg_error_from_syserror ();
+      if (ctx->inbound.binary.buffer)
+        {
+          wipememory (ctx->inbound.binary.buffer, ctx->inbound.binary.size);
+          _assuan_free (ctx, ctx->inbound.binary.buffer);
+        }
+      ctx->inbound.binary.buffer = buffer;
+      ctx->inbound.binary.size = needed;
+    }
+
+  rc = _assuan_read_binary (ctx, ctx->inbound.binary.buffer + 2, length);
+  if (rc)
+    return rc;
+
+  ctx->inbound.binary.buffer[0] = 'D';
+  ctx->inbound.binary.buffer[1] = ' ';
+  ctx->inbound.binary.buffer[length + 2] = 0;
+  ctx->inbound.binary.linelen = length + 2;
+  ctx->inbound.binary.active = 1;
+  return 0;
+}
+
+
+/* This function also does deescaping for data lines.  Binary frames
+   are returned as data lines.  */
 gpg_error_t
 assuan_client_read_response (assuan_context_t ctx,
 			     char **line_r, int *linelen_r)
@@ -75,9 +114,11 @@ assuan_client_read_response (assuan_context_t ctx,
   gpg_error_t rc;
   char *line = NULL;
   int linelen = 0;
+  size_t length;
 
   *line_r = NULL;
   *linelen_r = 0;
+  ctx->inbound.binary.active = 0;
 
   do
     {
@@ -93,6 +134,21 @@ assuan_client_read_response (assuan_context_t ctx,
     }
   while (!linelen);
 
+  switch (_assuan_parse_binary_header (ctx, line, linelen, &length))
+    {
+    case 0:
+      break;
+    case 1:
+      rc = read_binary_response (ctx, length);
+      if (rc)
+        return rc;
+      *line_r = ctx->inbound.binary.buffer;
+      *linelen_r = ctx->inbound.binary.linelen;
+      return 0;
+    default:
+      return GPG_ERR_ASS_INV_RESPONSE;
+    }
+
   /* For data lines, we deescape immediately.  The user will never
      have to worry about it.  */
   if (linelen >= 1 && line[0] == 'D' && line[1] == ' ')
@@ -262,8 +318,16 @@ assuan_transact (assuan_context_t ctx,
   if (rc)
     return rc; /* error reading from server */
 
-  line = ctx->inbound.line + off;
-  linelen = ctx->inbound.linelen - off;
+  if (ctx->inbound.binary.active)
+    {
+      line = ctx->inbound.binary.buffer + off;
+      linelen = ctx->inbound.binary.linelen - off;
+    }
+  else
+    {
+      line = ctx->inbound.line + off;
+      linelen = ctx->inbound.linelen - off;
+    }
 
   if (response == ASSUAN_RESPONSE_ERROR)
     rc = atoi (line);
@@ -333,3 +397,43 @@ assuan_transact (assuan_context_t ctx,
 
   return rc;
 }
+
+
+/* Status callback for assuan_enable_binary_data.  */
+static gpg_error_t
+binary_data_status_cb (void *opaque, const char *line)
+{
+  int *r_confirmed = (int*) opaque;
+
+  if (!strcmp (line, "BINARY-DATA"))
+    *r_confirmed = 1;
+  return 0;
+}
+
+
+/* Ask the server to send and accept large data chunks as binary
+   frames instead of escaped data lines.  Binary framing is only used
+   if the server confirms the option; servers which do not know about
+   it either reject the option or silently ignore it.  In both cases
+   GPG_ERR_NOT_SUPPORTED is returned and the connection continues to
+   use data lines.  */
+gpg_error_t
+assuan_enable_binary_data (assuan_context_t ctx)
+{
+  gpg_error_t err;
+  int confirmed = 0;
+
+  if (!ctx || ctx->is_server)
+    return GPG_ERR_ASS_INV_VALUE;
+
+  err = assuan_transact (ctx, "OPTION binary-data", NULL, NULL, NULL, NULL,
+                         binary_data_status_cb, &confirmed);
+  if (err)
+    return err == GPG_ERR_UNKNOWN_OPTION
+      ? GPG_ERR_NOT_SUPPORTED : err;
+  if (!confirmed)
+    return GPG_ERR_NOT_SUPPORTED;
+
+  ctx->flags.binary_data = 1;
+  return 0;
+}
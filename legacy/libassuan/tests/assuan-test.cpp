@@ -3,6 +3,12 @@
 #include "gtest/gtest.h"
 
   int fdpassing_main(int argc, char* argv[]);
+  int binarydata_main(int argc, char* argv[]);
+
+TEST(AssuanTest, binarydata) {
+    int result = binarydata_main(0, NULL);
+    ASSERT_EQ(result, 0);
+}
 
 TEST(AssuanTest, fdpassing) {
     int result = fdpassing_main(0, NULL);
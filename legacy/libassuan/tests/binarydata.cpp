@@ -0,0 +1,546 @@
+/* binarydata - Check the binary framing of data lines.
+   Copyright (C) 2018 g10 Code GmbH
+
+   This file is part of Assuan.
+
+   Assuan is free software; you can redistribute it and/or modify it
+   under the terms of the GNU Lesser General Public License as
+   published by the Free Software Foundation; either version 3 of
+   the License, or (at your option) any later version.
+
+   Assuan is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+   This test forks an assuan server and transfers data in both
+   directions, first with plain data lines and then with the
+   binary-data option.  With --verbose the throughput is shown.
+   A second server uses a non-blocking connection and
+   assuan_inquire_ext, so that it sees the binary frames in pieces.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/time.h>
+
+#include "../src/assuan.h"
+#include "common.h"
+
+
+/* Size of a transfer and the size of the chunks passed to
+   assuan_send_data.  */
+#define TRANSFER_SIZE (8*1024*1024)
+#define CHUNK_SIZE    (64*1024)
+
+
+/* Return the value of the test pattern at offset OFF.  The pattern
+   contains all the characters which need escaping in data lines.  */
+static unsigned char
+pattern (size_t off)
+{
+  return (off * 7 + (off >> 8)) & 0xff;
+}
+
+
+static int
+check_pattern (const unsigned char *buffer, size_t off, size_t length)
+{
+  size_t i;
+
+  for (i=0; i < length; i++)
+    if (buffer[i] != pattern (off + i))
+      return -1;
+  return 0;
+}
+
+
+static gpg_error_t
+send_pattern (assuan_context_t ctx, size_t length)
+{
+  static unsigned char buffer[CHUNK_SIZE];
+  gpg_error_t err;
+  size_t off, n, i;
+
+  for (off=0; off < length; off += n)
+    {
+      n = length - off < CHUNK_SIZE ? length - off : CHUNK_SIZE;
+      for (i=0; i < n; i++)
+        buffer[i] = pattern (off + i);
+      err = assuan_send_data (ctx, buffer, n);
+      if (err)
+        return err;
+    }
+  return 0;
+}
+
+
+
+/*
+
+       S E R V E R
+
+*/
+
+/* SEND <n> - Return N bytes of the test pattern.  */
+static gpg_error_t
+cmd_send (assuan_context_t ctx, char *line)
+{
+  return send_pattern (ctx, strtoul (line, NULL, 10));
+}
+
+
+/* If set, the server uses a non-blocking connection.  */
+static int nonblock_server;
+
+/* The length expected by cmd_recv_ext.  */
+static size_t recv_ext_length;
+
+
+/* RECV <n> [<maxlen>] - Inquire N bytes of the test pattern.  */
+static gpg_error_t
+cmd_recv (assuan_context_t ctx, char *line)
+{
+  gpg_error_t err;
+  unsigned char *buffer;
+  size_t length, buflen, maxlen;
+  char *endp;
+
+  length = strtoul (line, &endp, 10);
+  maxlen = strtoul (endp, NULL, 10);
+
+  err = assuan_inquire (ctx, "DATA", &buffer, &buflen, maxlen);
+  if (err)
+    return err;
+  if (buflen != length || check_pattern (buffer, 0, buflen))
+    err = GPG_ERR_ASS_GENERAL;
+  xfree (buffer);
+  return err;
+}
+
+
+/* Completion callback for cmd_recv_ext.  */
+static gpg_error_t
+recv_ext_cb (void *opaque, gpg_error_t rc, unsigned char *buffer,
+             size_t buflen)
+{
+  assuan_context_t ctx = (assuan_context_t) opaque;
+
+  if (!rc && (buflen != recv_ext_length || check_pattern (buffer, 0, buflen)))
+    rc = GPG_ERR_ASS_GENERAL;
+  free (buffer);
+  return assuan_process_done (ctx, rc);
+}
+
+
+/* RECV <n> - Like cmd_recv but for the non-blocking server.  */
+static gpg_error_t
+cmd_recv_ext (assuan_context_t ctx, char *line)
+{
+  gpg_error_t err;
+
+  recv_ext_length = strtoul (line, NULL, 10);
+  err = assuan_inquire_ext (ctx, "DATA", 0, recv_ext_cb, ctx);
+  if (err)
+    return assuan_process_done (ctx, err);
+  return 0;
+}
+
+
+static gpg_error_t
+register_commands (assuan_context_t ctx)
+{
+  static struct
+  {
+    const char *name;
+    gpg_error_t (*handler) (assuan_context_t, char *line);
+  } table[] =
+      {
+	{ "SEND", cmd_send },
+	{ "RECV", cmd_recv },
+	{ NULL, NULL }
+      };
+  int i;
+  gpg_error_t rc;
+
+  if (nonblock_server)
+    return assuan_register_command (ctx, "RECV", cmd_recv_ext, NULL);
+
+  for (i=0; table[i].name; i++)
+    {
+      rc = assuan_register_command (ctx, table[i].name, table[i].handler, NULL);
+      if (rc)
+        return rc;
+    }
+  return 0;
+}
+
+
+/* Run the commands of CTX on a non-blocking connection.  */
+static void
+process_nonblock (assuan_context_t ctx)
+{
+  assuan_fd_t fds[2];
+  struct pollfd pfd;
+  gpg_error_t rc;
+  int done = 0;
+
+  if (assuan_get_active_fds (ctx, 0, fds, DIM (fds)) < 1
+      || fcntl (fds[0], F_SETFL, fcntl (fds[0], F_GETFL) | O_NONBLOCK))
+    log_fatal ("can't make the connection non-blocking\n");
+
+  pfd.fd = fds[0];
+  pfd.events = POLLIN;
+  while (!done)
+    {
+      if (poll (&pfd, 1, -1) < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          log_fatal ("poll failed: %s\n", strerror (errno));
+        }
+      rc = assuan_process_next (ctx, &done);
+      if (rc)
+        {
+          log_error ("assuan_process_next failed: %s\n", gpg_strerror (rc));
+          break;
+        }
+    }
+}
+
+
+static void
+server (void)
+{
+  int rc;
+  assuan_context_t ctx;
+
+  log_info ("server started\n");
+
+  rc = assuan_new (&ctx);
+  if (rc)
+    log_fatal ("assuan_new failed: %s\n", gpg_strerror (rc));
+
+  rc = assuan_init_pipe_server (ctx, NULL);
+  if (rc)
+    log_fatal ("assuan_init_pipe_server failed: %s\n", gpg_strerror (rc));
+
+  rc = register_commands (ctx);
+  if (rc)
+    log_fatal ("register_commands failed: %s\n", gpg_strerror(rc));
+
+  if (debug)
+    assuan_set_log_stream (ctx, stderr);
+
+  for (;;)
+    {
+      rc = assuan_accept (ctx);
+      if (rc)
+        {
+          if (rc != -1)
+            log_error ("assuan_accept failed: %s\n", gpg_strerror (rc));
+          break;
+        }
+
+      if (nonblock_server)
+        {
+          process_nonblock (ctx);
+          continue;
+        }
+      rc = assuan_process (ctx);
+      if (rc)
+        log_error ("assuan_process failed: %s\n", gpg_strerror (rc));
+    }
+
+  assuan_release (ctx);
+}
+
+
+
+
+/*
+
+       C L I E N T
+
+*/
+
+struct recv_parm_s
+{
+  size_t off;
+  int bad;
+};
+
+
+static gpg_error_t
+data_cb (void *opaque, const void *buffer, size_t length)
+{
+  struct recv_parm_s *parm = (struct recv_parm_s *) opaque;
+
+  if (!buffer)
+    return 0;
+  if (check_pattern ((const unsigned char*) buffer, parm->off, length))
+    parm->bad = 1;
+  parm->off += length;
+  return 0;
+}
+
+
+struct inq_parm_s
+{
+  assuan_context_t ctx;
+  size_t length;
+};
+
+
+static gpg_error_t
+inq_cb (void *opaque, const char *line)
+{
+  struct inq_parm_s *parm = (struct inq_parm_s *) opaque;
+
+  if (strcmp (line, "DATA"))
+    return GPG_ERR_ASS_UNKNOWN_INQUIRE;
+  return send_pattern (parm->ctx, parm->length);
+}
+
+
+static double
+timestamp (void)
+{
+  struct timeval tv;
+
+  gettimeofday (&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+
+/* Run the transfers in both directions and return 0 on success.  */
+static int
+run_transfers (assuan_context_t ctx, const char *mode)
+{
+  gpg_error_t err;
+  char command[50];
+  struct recv_parm_s recv_parm;
+  struct inq_parm_s inq_parm;
+  double t;
+
+  memset (&recv_parm, 0, sizeof recv_parm);
+  snprintf (command, sizeof command, "SEND %d", TRANSFER_SIZE);
+  t = timestamp ();
+  err = assuan_transact (ctx, command, data_cb, &recv_parm,
+                         NULL, NULL, NULL, NULL);
+  t = timestamp () - t;
+  if (err)
+    {
+      log_error ("%s: SEND failed: %s\n", mode, gpg_strerror (err));
+      return -1;
+    }
+  if (recv_parm.bad || recv_parm.off != TRANSFER_SIZE)
+    {
+      log_error ("%s: received data does not match\n", mode);
+      return -1;
+    }
+  log_info ("%s: server to client: %.1f MB/s\n", mode,
+            TRANSFER_SIZE / (1024.0 * 1024.0) / (t > 0 ? t : 1e-6));
+
+  inq_parm.ctx = ctx;
+  inq_parm.length = TRANSFER_SIZE;
+  snprintf (command, sizeof command, "RECV %d", TRANSFER_SIZE);
+  t = timestamp ();
+  err = assuan_transact (ctx, command, NULL, NULL, inq_cb, &inq_parm,
+                         NULL, NULL);
+  t = timestamp () - t;
+  if (err)
+    {
+      log_error ("%s: RECV failed: %s\n", mode, gpg_strerror (err));
+      return -1;
+    }
+  log_info ("%s: client to server: %.1f MB/s\n", mode,
+            TRANSFER_SIZE / (1024.0 * 1024.0) / (t > 0 ? t : 1e-6));
+
+  /* Too much data must be rejected without losing sync.  */
+  snprintf (command, sizeof command, "RECV %d %d", TRANSFER_SIZE, CHUNK_SIZE);
+  err = assuan_transact (ctx, command, NULL, NULL, inq_cb, &inq_parm,
+                         NULL, NULL);
+  if (err != GPG_ERR_ASS_TOO_MUCH_DATA)
+    {
+      log_error ("%s: RECV with limit did not fail as expected: %s\n",
+                 mode, gpg_strerror (err));
+      return -1;
+    }
+
+  /* Small transfers are still sent as data lines.  */
+  memset (&recv_parm, 0, sizeof recv_parm);
+  err = assuan_transact (ctx, "SEND 100", data_cb, &recv_parm,
+                         NULL, NULL, NULL, NULL);
+  if (err || recv_parm.bad || recv_parm.off != 100)
+    {
+      log_error ("%s: short SEND failed: %s\n", mode, gpg_strerror (err));
+      return -1;
+    }
+
+  return 0;
+}
+
+
+/* Client main.  If true is returned, a disconnect has not been done. */
+static int
+client (assuan_context_t ctx)
+{
+  gpg_error_t err;
+
+  log_info ("client started. Servers's pid is %ld\n",
+            (long)assuan_get_pid (ctx));
+
+  if (run_transfers (ctx, "data lines"))
+    return -1;
+
+  err = assuan_enable_binary_data (ctx);
+  if (err)
+    {
+      log_error ("enabling binary data failed: %s\n", gpg_strerror (err));
+      return -1;
+    }
+  if (!assuan_get_flag (ctx, ASSUAN_BINARY_DATA))
+    {
+      log_error ("binary data flag not set\n");
+      return -1;
+    }
+
+  if (run_transfers (ctx, "binary data"))
+    return -1;
+
+  assuan_release (ctx);
+  return 0;
+}
+
+
+/* Client main for the non-blocking server.  */
+static int
+client_nonblock (assuan_context_t ctx)
+{
+  gpg_error_t err;
+  struct inq_parm_s inq_parm;
+  char command[50];
+  int i;
+
+  log_info ("client started. Servers's pid is %ld\n",
+            (long)assuan_get_pid (ctx));
+
+  err = assuan_enable_binary_data (ctx);
+  if (err)
+    {
+      log_error ("enabling binary data failed: %s\n", gpg_strerror (err));
+      return -1;
+    }
+
+  /* The frames are larger than the socket buffer and the server
+     reads them in several pieces.  Short transfers use data lines.  */
+  inq_parm.ctx = ctx;
+  for (i=0; i < 2; i++)
+    {
+      inq_parm.length = i? 100 : TRANSFER_SIZE;
+      snprintf (command, sizeof command, "RECV %lu",
+                (unsigned long)inq_parm.length);
+      err = assuan_transact (ctx, command, NULL, NULL, inq_cb, &inq_parm,
+                             NULL, NULL);
+      if (err)
+        {
+          log_error ("non-blocking: %s failed: %s\n",
+                     command, gpg_strerror (err));
+          return -1;
+        }
+    }
+
+  assuan_release (ctx);
+  return 0;
+}
+
+
+
+
+/*
+
+     M A I N
+
+*/
+int
+binarydata_main (int argc, char **argv)
+{
+  int last_argc = -1;
+  assuan_context_t ctx;
+  gpg_error_t err;
+  int no_close_fds[2];
+  const char *loc;
+
+  if (argc)
+    {
+      log_set_prefix (*argv);
+      argc--; argv++;
+    }
+  while (argc && last_argc != argc )
+    {
+      last_argc = argc;
+      if (!strcmp (*argv, "--verbose"))
+        {
+          verbose = 1;
+          argc--; argv++;
+        }
+      else if (!strcmp (*argv, "--debug"))
+        {
+          verbose = debug = 1;
+          argc--; argv++;
+        }
+    }
+
+  assuan_set_assuan_log_prefix (log_prefix);
+
+  no_close_fds[0] = 2;
+  no_close_fds[1] = -1;
+
+  for (nonblock_server = 0; nonblock_server < 2; nonblock_server++)
+    {
+      err = assuan_new (&ctx);
+      if (err)
+        log_fatal ("assuan_new failed: %s\n", gpg_strerror (err));
+
+      err = assuan_pipe_connect (ctx, NULL, &loc, no_close_fds,
+                                 NULL, NULL, 1);
+      if (err)
+        {
+          log_error ("assuan_pipe_connect failed: %s\n", gpg_strerror (err));
+          assuan_release (ctx);
+          errorcount++;
+        }
+      else if (loc[0] == 's')
+        {
+          server ();
+          assuan_release (ctx);
+          log_info ("server finished\n");
+          /* Do not return into the test driver of the parent.  */
+          _exit (errorcount ? 1 : 0);
+        }
+      else
+        {
+          if (nonblock_server? client_nonblock (ctx) : client (ctx))
+            {
+              log_info ("waiting for server to terminate...\n");
+              assuan_release (ctx);
+              errorcount++;
+            }
+          log_info ("client finished\n");
+        }
+    }
+
+  return errorcount ? 1 : 0;
+}
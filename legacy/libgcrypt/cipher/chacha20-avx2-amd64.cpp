@@ -0,0 +1,215 @@
+/* chacha20-avx2-amd64.c  -  AVX2 implementation of ChaCha20
+ *
+ * This file is part of Libgcrypt.
+ *
+ * Libgcrypt is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser general Public License as
+ * published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * Libgcrypt is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Eight blocks are computed in parallel; each YMM register holds the
+ * same state word of all eight blocks.  Remaining blocks are passed
+ * to the SSSE3 kernel.  The caller has to check for HWF_INTEL_AVX2.  */
+
+#include <config.h>
+
+#if defined(__x86_64__) && defined(HAVE_CPU_ARCH_X86) && \
+    defined(HAVE_GCC_ATTRIBUTE_TARGET) && defined(ENABLE_AVX2_SUPPORT) && \
+    defined(USE_CHACHA20)
+
+#include <immintrin.h>
+
+#include "types.h"
+#include "g10lib.h"
+#include "bufhelp.h"
+
+#define CHACHA20_BLOCK_SIZE 64
+#define CHACHA20_PARALLEL   8
+
+unsigned int _gcry_chacha20_amd64_ssse3_blocks (u32 *state, const byte *src,
+                                                byte *dst, size_t bytes);
+unsigned int _gcry_chacha20_amd64_avx2_blocks (u32 *state, const byte *src,
+                                               byte *dst, size_t bytes);
+
+
+#define ATTR_AVX2 __attribute__ ((target ("avx2")))
+
+#define ROTL(v, c) \
+  _mm256_or_si256 (_mm256_slli_epi32 ((v), (c)), \
+                   _mm256_srli_epi32 ((v), 32 - (c)))
+
+#define QROUND(a, b, c, d)                                              \
+  do {                                                                  \
+    a = _mm256_add_epi32 (a, b); d = _mm256_xor_si256 (d, a);           \
+    d = _mm256_shuffle_epi8 (d, rot16);                                 \
+    c = _mm256_add_epi32 (c, d); b = _mm256_xor_si256 (b, c);           \
+    b = ROTL (b, 12);                                                   \
+    a = _mm256_add_epi32 (a, b); d = _mm256_xor_si256 (d, a);           \
+    d = _mm256_shuffle_epi8 (d, rot8);                                  \
+    c = _mm256_add_epi32 (c, d); b = _mm256_xor_si256 (b, c);           \
+    b = ROTL (b, 7);                                                    \
+  } while (0)
+
+/* Transpose the words A, B, C and D within each 128 bit lane.  After
+ * that, Vk holds the words of block K in the low lane and those of
+ * block K+4 in the high lane.  */
+#define TRANSPOSE4(a, b, c, d)                                          \
+  do {                                                                  \
+    __m256i t0_ = _mm256_unpacklo_epi32 (a, b);                         \
+    __m256i t1_ = _mm256_unpacklo_epi32 (c, d);                         \
+    __m256i t2_ = _mm256_unpackhi_epi32 (a, b);                         \
+    __m256i t3_ = _mm256_unpackhi_epi32 (c, d);                         \
+    a = _mm256_unpacklo_epi64 (t0_, t1_);                               \
+    b = _mm256_unpackhi_epi64 (t0_, t1_);                               \
+    c = _mm256_unpacklo_epi64 (t2_, t3_);                               \
+    d = _mm256_unpackhi_epi64 (t2_, t3_);                               \
+  } while (0)
+
+/* Write 32 bytes at byte offset OFF of block BLK.  */
+#define OUT32(blk, off, v)                                              \
+  do {                                                                  \
+    size_t o_ = (blk) * CHACHA20_BLOCK_SIZE + (off);                    \
+    __m256i v_ = (v);                                                   \
+    if (src)                                                            \
+      v_ = _mm256_xor_si256 (v_,                                        \
+                             _mm256_loadu_si256 ((const __m256i *)(src + o_))); \
+    _mm256_storeu_si256 ((__m256i *)(dst + o_), v_);                    \
+  } while (0)
+
+/* Combine the transposed words 0..7 (in A) and 8..15 (in B) of the
+ * block pair K/K+4 and write them out.  */
+#define OUT_PAIR(k, a0, a1, b0, b1)                                     \
+  do {                                                                  \
+    OUT32 ((k), 0, _mm256_permute2x128_si256 (a0, a1, 0x20));           \
+    OUT32 ((k), 32, _mm256_permute2x128_si256 (b0, b1, 0x20));          \
+    OUT32 ((k) + 4, 0, _mm256_permute2x128_si256 (a0, a1, 0x31));       \
+    OUT32 ((k) + 4, 32, _mm256_permute2x128_si256 (b0, b1, 0x31));      \
+  } while (0)
+
+
+ATTR_AVX2 unsigned int
+_gcry_chacha20_amd64_avx2_blocks (u32 *state, const byte *src, byte *dst,
+                                  size_t bytes)
+{
+  const __m256i rot16 = _mm256_set_epi8 (13, 12, 15, 14, 9, 8, 11, 10,
+                                         5, 4, 7, 6, 1, 0, 3, 2,
+                                         13, 12, 15, 14, 9, 8, 11, 10,
+                                         5, 4, 7, 6, 1, 0, 3, 2);
+  const __m256i rot8 = _mm256_set_epi8 (14, 13, 12, 15, 10, 9, 8, 11,
+                                        6, 5, 4, 7, 2, 1, 0, 3,
+                                        14, 13, 12, 15, 10, 9, 8, 11,
+                                        6, 5, 4, 7, 2, 1, 0, 3);
+  unsigned int burn = 0;
+  int used = 0;
+
+  while (bytes >= CHACHA20_PARALLEL * CHACHA20_BLOCK_SIZE)
+    {
+      __m256i x0, x1, x2, x3, x4, x5, x6, x7;
+      __m256i x8, x9, x10, x11, x12, x13, x14, x15;
+      __m256i c12, c13;
+      u32 ctr = state[12];
+      u32 hi = state[13];
+      int i;
+
+      /* The 64 bit block counter in words 12 and 13.  */
+      c12 = _mm256_set_epi32 (ctr + 7, ctr + 6, ctr + 5, ctr + 4,
+                              ctr + 3, ctr + 2, ctr + 1, ctr);
+      c13 = _mm256_set_epi32 (hi + (ctr + 7 < ctr), hi + (ctr + 6 < ctr),
+                              hi + (ctr + 5 < ctr), hi + (ctr + 4 < ctr),
+                              hi + (ctr + 3 < ctr), hi + (ctr + 2 < ctr),
+                              hi + (ctr + 1 < ctr), hi);
+
+      x0 = _mm256_set1_epi32 (state[0]);
+      x1 = _mm256_set1_epi32 (state[1]);
+      x2 = _mm256_set1_epi32 (state[2]);
+      x3 = _mm256_set1_epi32 (state[3]);
+      x4 = _mm256_set1_epi32 (state[4]);
+      x5 = _mm256_set1_epi32 (state[5]);
+      x6 = _mm256_set1_epi32 (state[6]);
+      x7 = _mm256_set1_epi32 (state[7]);
+      x8 = _mm256_set1_epi32 (state[8]);
+      x9 = _mm256_set1_epi32 (state[9]);
+      x10 = _mm256_set1_epi32 (state[10]);
+      x11 = _mm256_set1_epi32 (state[11]);
+      x12 = c12;
+      x13 = c13;
+      x14 = _mm256_set1_epi32 (state[14]);
+      x15 = _mm256_set1_epi32 (state[15]);
+
+      for (i = 0; i < 20; i += 2)
+        {
+          QROUND (x0, x4, x8, x12);
+          QROUND (x1, x5, x9, x13);
+          QROUND (x2, x6, x10, x14);
+          QROUND (x3, x7, x11, x15);
+
+          QROUND (x0, x5, x10, x15);
+          QROUND (x1, x6, x11, x12);
+          QROUND (x2, x7, x8, x13);
+          QROUND (x3, x4, x9, x14);
+        }
+
+      x0 = _mm256_add_epi32 (x0, _mm256_set1_epi32 (state[0]));
+      x1 = _mm256_add_epi32 (x1, _mm256_set1_epi32 (state[1]));
+      x2 = _mm256_add_epi32 (x2, _mm256_set1_epi32 (state[2]));
+      x3 = _mm256_add_epi32 (x3, _mm256_set1_epi32 (state[3]));
+      x4 = _mm256_add_epi32 (x4, _mm256_set1_epi32 (state[4]));
+      x5 = _mm256_add_epi32 (x5, _mm256_set1_epi32 (state[5]));
+      x6 = _mm256_add_epi32 (x6, _mm256_set1_epi32 (state[6]));
+      x7 = _mm256_add_epi32 (x7, _mm256_set1_epi32 (state[7]));
+      x8 = _mm256_add_epi32 (x8, _mm256_set1_epi32 (state[8]));
+      x9 = _mm256_add_epi32 (x9, _mm256_set1_epi32 (state[9]));
+      x10 = _mm256_add_epi32 (x10, _mm256_set1_epi32 (state[10]));
+      x11 = _mm256_add_epi32 (x11, _mm256_set1_epi32 (state[11]));
+      x12 = _mm256_add_epi32 (x12, c12);
+      x13 = _mm256_add_epi32 (x13, c13);
+      x14 = _mm256_add_epi32 (x14, _mm256_set1_epi32 (state[14]));
+      x15 = _mm256_add_epi32 (x15, _mm256_set1_epi32 (state[15]));
+
+      TRANSPOSE4 (x0, x1, x2, x3);
+      TRANSPOSE4 (x4, x5, x6, x7);
+      TRANSPOSE4 (x8, x9, x10, x11);
+      TRANSPOSE4 (x12, x13, x14, x15);
+
+      OUT_PAIR (0, x0, x4, x8, x12);
+      OUT_PAIR (1, x1, x5, x9, x13);
+      OUT_PAIR (2, x2, x6, x10, x14);
+      OUT_PAIR (3, x3, x7, x11, x15);
+
+      state[12] = ctr + CHACHA20_PARALLEL;
+      state[13] += (state[12] < ctr);
+
+      bytes -= CHACHA20_PARALLEL * CHACHA20_BLOCK_SIZE;
+      dst += CHACHA20_PARALLEL * CHACHA20_BLOCK_SIZE;
+      src += (src) ? CHACHA20_PARALLEL * CHACHA20_BLOCK_SIZE : 0;
+
+      /* Register spills may have left key stream on the stack.  */
+      burn = 16 * 32;
+      used = 1;
+    }
+
+  /* Clear the key stream from the vector registers; this also avoids
+   * the SSE/AVX transition penalty in the SSSE3 code.  */
+  if (used)
+    _mm256_zeroall ();
+
+  if (bytes >= CHACHA20_BLOCK_SIZE)
+    {
+      unsigned int nburn = _gcry_chacha20_amd64_ssse3_blocks (state, src,
+                                                              dst, bytes);
+      burn = nburn > burn ? nburn : burn;
+    }
+
+  return burn;
+}
+
+#endif /*__x86_64__ && HAVE_GCC_ATTRIBUTE_TARGET && ENABLE_AVX2_SUPPORT*/
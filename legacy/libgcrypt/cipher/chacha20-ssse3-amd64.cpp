@@ -0,0 +1,181 @@
+/* chacha20-ssse3-amd64.c  -  SSSE3 implementation of ChaCha20
+ *
+ * This file is part of Libgcrypt.
+ *
+ * Libgcrypt is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser general Public License as
+ * published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * Libgcrypt is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Four blocks are computed in parallel; each XMM register holds the
+ * same state word of all four blocks.  The code uses compiler
+ * intrinsics and only this kernel is compiled for SSSE3, so the
+ * caller has to check for HWF_INTEL_SSSE3.  */
+
+#include <config.h>
+
+#if defined(__x86_64__) && defined(HAVE_CPU_ARCH_X86) && \
+    defined(HAVE_GCC_ATTRIBUTE_TARGET) && defined(USE_CHACHA20)
+
+#include <immintrin.h>
+
+#include "types.h"
+#include "g10lib.h"
+#include "bufhelp.h"
+
+#define CHACHA20_BLOCK_SIZE 64
+#define CHACHA20_PARALLEL   4
+
+unsigned int _gcry_chacha20_blocks_ref (u32 *state, const byte *src,
+                                        byte *dst, size_t bytes);
+unsigned int _gcry_chacha20_amd64_ssse3_blocks (u32 *state, const byte *src,
+                                                byte *dst, size_t bytes);
+
+
+#define ATTR_SSSE3 __attribute__ ((target ("ssse3")))
+
+#define ROTL(v, c) \
+  _mm_or_si128 (_mm_slli_epi32 ((v), (c)), _mm_srli_epi32 ((v), 32 - (c)))
+
+#define QROUND(a, b, c, d)                                          \
+  do {                                                              \
+    a = _mm_add_epi32 (a, b); d = _mm_xor_si128 (d, a);             \
+    d = _mm_shuffle_epi8 (d, rot16);                                \
+    c = _mm_add_epi32 (c, d); b = _mm_xor_si128 (b, c);             \
+    b = ROTL (b, 12);                                               \
+    a = _mm_add_epi32 (a, b); d = _mm_xor_si128 (d, a);             \
+    d = _mm_shuffle_epi8 (d, rot8);                                 \
+    c = _mm_add_epi32 (c, d); b = _mm_xor_si128 (b, c);             \
+    b = ROTL (b, 7);                                                \
+  } while (0)
+
+/* Transpose the words A, B, C and D of four blocks and XOR the
+ * result at word offset 4*G into the four output blocks.  */
+#define OUT4(g, a, b, c, d)                                             \
+  do {                                                                  \
+    __m128i t0_ = _mm_unpacklo_epi32 (a, b);                            \
+    __m128i t1_ = _mm_unpacklo_epi32 (c, d);                            \
+    __m128i t2_ = _mm_unpackhi_epi32 (a, b);                            \
+    __m128i t3_ = _mm_unpackhi_epi32 (c, d);                            \
+    OUT1 (0, g, _mm_unpacklo_epi64 (t0_, t1_));                         \
+    OUT1 (1, g, _mm_unpackhi_epi64 (t0_, t1_));                         \
+    OUT1 (2, g, _mm_unpacklo_epi64 (t2_, t3_));                         \
+    OUT1 (3, g, _mm_unpackhi_epi64 (t2_, t3_));                         \
+  } while (0)
+
+#define OUT1(blk, g, v)                                                 \
+  do {                                                                  \
+    size_t o_ = (blk) * CHACHA20_BLOCK_SIZE + (g) * 16;                 \
+    __m128i v_ = (v);                                                   \
+    if (src)                                                            \
+      v_ = _mm_xor_si128 (v_, _mm_loadu_si128 ((const __m128i *)(src + o_))); \
+    _mm_storeu_si128 ((__m128i *)(dst + o_), v_);                       \
+  } while (0)
+
+
+ATTR_SSSE3 unsigned int
+_gcry_chacha20_amd64_ssse3_blocks (u32 *state, const byte *src, byte *dst,
+                                   size_t bytes)
+{
+  const __m128i rot16 = _mm_set_epi8 (13, 12, 15, 14, 9, 8, 11, 10,
+                                      5, 4, 7, 6, 1, 0, 3, 2);
+  const __m128i rot8 = _mm_set_epi8 (14, 13, 12, 15, 10, 9, 8, 11,
+                                     6, 5, 4, 7, 2, 1, 0, 3);
+  unsigned int burn = 0;
+
+  while (bytes >= CHACHA20_PARALLEL * CHACHA20_BLOCK_SIZE)
+    {
+      __m128i x0, x1, x2, x3, x4, x5, x6, x7;
+      __m128i x8, x9, x10, x11, x12, x13, x14, x15;
+      __m128i c12, c13;
+      u32 ctr = state[12];
+      int i;
+
+      /* The 64 bit block counter in words 12 and 13.  */
+      c12 = _mm_set_epi32 (ctr + 3, ctr + 2, ctr + 1, ctr);
+      c13 = _mm_set_epi32 (state[13] + (ctr + 3 < ctr),
+                           state[13] + (ctr + 2 < ctr),
+                           state[13] + (ctr + 1 < ctr),
+                           state[13]);
+
+      x0 = _mm_set1_epi32 (state[0]);
+      x1 = _mm_set1_epi32 (state[1]);
+      x2 = _mm_set1_epi32 (state[2]);
+      x3 = _mm_set1_epi32 (state[3]);
+      x4 = _mm_set1_epi32 (state[4]);
+      x5 = _mm_set1_epi32 (state[5]);
+      x6 = _mm_set1_epi32 (state[6]);
+      x7 = _mm_set1_epi32 (state[7]);
+      x8 = _mm_set1_epi32 (state[8]);
+      x9 = _mm_set1_epi32 (state[9]);
+      x10 = _mm_set1_epi32 (state[10]);
+      x11 = _mm_set1_epi32 (state[11]);
+      x12 = c12;
+      x13 = c13;
+      x14 = _mm_set1_epi32 (state[14]);
+      x15 = _mm_set1_epi32 (state[15]);
+
+      for (i = 0; i < 20; i += 2)
+        {
+          QROUND (x0, x4, x8, x12);
+          QROUND (x1, x5, x9, x13);
+          QROUND (x2, x6, x10, x14);
+          QROUND (x3, x7, x11, x15);
+
+          QROUND (x0, x5, x10, x15);
+          QROUND (x1, x6, x11, x12);
+          QROUND (x2, x7, x8, x13);
+          QROUND (x3, x4, x9, x14);
+        }
+
+      x0 = _mm_add_epi32 (x0, _mm_set1_epi32 (state[0]));
+      x1 = _mm_add_epi32 (x1, _mm_set1_epi32 (state[1]));
+      x2 = _mm_add_epi32 (x2, _mm_set1_epi32 (state[2]));
+      x3 = _mm_add_epi32 (x3, _mm_set1_epi32 (state[3]));
+      OUT4 (0, x0, x1, x2, x3);
+      x4 = _mm_add_epi32 (x4, _mm_set1_epi32 (state[4]));
+      x5 = _mm_add_epi32 (x5, _mm_set1_epi32 (state[5]));
+      x6 = _mm_add_epi32 (x6, _mm_set1_epi32 (state[6]));
+      x7 = _mm_add_epi32 (x7, _mm_set1_epi32 (state[7]));
+      OUT4 (1, x4, x5, x6, x7);
+      x8 = _mm_add_epi32 (x8, _mm_set1_epi32 (state[8]));
+      x9 = _mm_add_epi32 (x9, _mm_set1_epi32 (state[9]));
+      x10 = _mm_add_epi32 (x10, _mm_set1_epi32 (state[10]));
+      x11 = _mm_add_epi32 (x11, _mm_set1_epi32 (state[11]));
+      OUT4 (2, x8, x9, x10, x11);
+      x12 = _mm_add_epi32 (x12, c12);
+      x13 = _mm_add_epi32 (x13, c13);
+      x14 = _mm_add_epi32 (x14, _mm_set1_epi32 (state[14]));
+      x15 = _mm_add_epi32 (x15, _mm_set1_epi32 (state[15]));
+      OUT4 (3, x12, x13, x14, x15);
+
+      state[12] = ctr + CHACHA20_PARALLEL;
+      state[13] += (state[12] < ctr);
+
+      bytes -= CHACHA20_PARALLEL * CHACHA20_BLOCK_SIZE;
+      dst += CHACHA20_PARALLEL * CHACHA20_BLOCK_SIZE;
+      src += (src) ? CHACHA20_PARALLEL * CHACHA20_BLOCK_SIZE : 0;
+
+      /* Register spills may have left key stream on the stack.  */
+      burn = 16 * 16;
+    }
+
+  if (bytes >= CHACHA20_BLOCK_SIZE)
+    {
+      unsigned int nburn = _gcry_chacha20_blocks_ref (state, src, dst, bytes);
+      burn = nburn > burn ? nburn : burn;
+    }
+
+  return burn;
+}
+
+#endif /*__x86_64__ && HAVE_GCC_ATTRIBUTE_TARGET && USE_CHACHA20*/
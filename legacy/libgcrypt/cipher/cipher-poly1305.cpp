@@ -30,6 +30,12 @@
 #include "./poly1305-internal.h"
 
 
+/* Large requests are processed in chunks of this size so that the
+   data written by the stream cipher is still in the L1 cache when the
+   MAC reads it (and vice versa for decryption).  */
+#define POLY1305_AEAD_CHUNK_SIZE (8 * 1024)
+
+
 static inline int
 poly1305_bytecounter_add (u32 ctr[2], size_t add)
 {
@@ -164,9 +170,20 @@ _gcry_cipher_poly1305_encrypt (gcry_cipher_hd_t c,
       return GPG_ERR_INV_LENGTH;
     }
 
-  c->spec->stencrypt(&c->context.c, outbuf, (byte*)inbuf, inbuflen);
+  while (inbuflen)
+    {
+      size_t n = inbuflen;
+
+      if (n > POLY1305_AEAD_CHUNK_SIZE)
+        n = POLY1305_AEAD_CHUNK_SIZE;
+
+      c->spec->stencrypt(&c->context.c, outbuf, (byte*)inbuf, n);
+      _gcry_poly1305_update (&c->u_mode.poly1305.ctx, outbuf, n);
 
-  _gcry_poly1305_update (&c->u_mode.poly1305.ctx, outbuf, inbuflen);
+      outbuf += n;
+      inbuf += n;
+      inbuflen -= n;
+    }
 
   return 0;
 }
@@ -202,9 +219,21 @@ _gcry_cipher_poly1305_decrypt (gcry_cipher_hd_t c,
       return GPG_ERR_INV_LENGTH;
     }
 
-  _gcry_poly1305_update (&c->u_mode.poly1305.ctx, inbuf, inbuflen);
+  while (inbuflen)
+    {
+      size_t n = inbuflen;
+
+      if (n > POLY1305_AEAD_CHUNK_SIZE)
+        n = POLY1305_AEAD_CHUNK_SIZE;
+
+      _gcry_poly1305_update (&c->u_mode.poly1305.ctx, inbuf, n);
+      c->spec->stdecrypt(&c->context.c, outbuf, (byte*)inbuf, n);
+
+      outbuf += n;
+      inbuf += n;
+      inbuflen -= n;
+    }
 
-  c->spec->stdecrypt(&c->context.c, outbuf, (byte*)inbuf, inbuflen);
   return 0;
 }
 
@@ -103,7 +103,7 @@ _gcry_ecc_ecdsa_sign (gcry_mpi_t input, ECC_secret_key *skey,
           else
             k = _gcry_dsa_gen_k (skey->E.n, GCRY_STRONG_RANDOM);
 
-          _gcry_mpi_ec_mul_point (&I, k, &skey->E.G, ctx);
+          _gcry_mpi_ec_mul_base (&I, k, &skey->E.G, ctx);
           if (_gcry_mpi_ec_get_affine (x, NULL, &I, ctx))
             {
               if (DBG_CIPHER)
@@ -153,7 +153,7 @@ _gcry_ecc_ecdsa_verify (gcry_mpi_t input, ECC_public_key *pkey,
 {
   gpg_error_t err = 0;
   gcry_mpi_t hash, h, h1, h2, x;
-  mpi_point_struct Q, Q1, Q2;
+  mpi_point_struct Q;
   mpi_ec_t ctx;
   unsigned int nbits;
 
@@ -172,8 +172,6 @@ _gcry_ecc_ecdsa_verify (gcry_mpi_t input, ECC_public_key *pkey,
   h2 = mpi_alloc (0);
   x = mpi_alloc (0);
   point_init (&Q);
-  point_init (&Q1);
-  point_init (&Q2);
 
   ctx = _gcry_mpi_ec_p_internal_new (pkey->E.model, pkey->E.dialect, 0,
                                      pkey->E.p, pkey->E.a, pkey->E.b);
@@ -182,14 +180,10 @@ _gcry_ecc_ecdsa_verify (gcry_mpi_t input, ECC_public_key *pkey,
   mpi_invm (h, s, pkey->E.n);
   /* h1 = hash * s^(-1) (mod n) */
   mpi_mulm (h1, hash, h, pkey->E.n);
-  /* Q1 = [ hash * s^(-1) ]G  */
-  _gcry_mpi_ec_mul_point (&Q1, h1, &pkey->E.G, ctx);
   /* h2 = r * s^(-1) (mod n) */
   mpi_mulm (h2, r, h, pkey->E.n);
-  /* Q2 = [ r * s^(-1) ]Q */
-  _gcry_mpi_ec_mul_point (&Q2, h2, &pkey->Q, ctx);
   /* Q  = ([hash * s^(-1)]G) + ([r * s^(-1)]Q) */
-  _gcry_mpi_ec_add_points (&Q, &Q1, &Q2, ctx);
+  _gcry_mpi_ec_mul_point2 (&Q, h1, &pkey->E.G, h2, &pkey->Q, ctx);
 
   if (!mpi_cmp_ui (Q.z, 0))
     {
@@ -220,8 +214,6 @@ _gcry_ecc_ecdsa_verify (gcry_mpi_t input, ECC_public_key *pkey,
 
  leave:
   _gcry_mpi_ec_free (ctx);
-  point_free (&Q2);
-  point_free (&Q1);
   point_free (&Q);
   mpi_free (x);
   mpi_free (h2);
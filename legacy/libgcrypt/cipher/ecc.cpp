@@ -178,7 +178,7 @@ nist_generate_key (ECC_secret_key *sk, elliptic_curve_t *E, mpi_ec_t ctx,
 
 
   /* Compute Q.  */
-  _gcry_mpi_ec_mul_point (&Q, sk->d, &E->G, ctx);
+  _gcry_mpi_ec_mul_base (&Q, sk->d, &E->G, ctx);
 
   /* Copy the stuff to the key structures. */
   sk->E.model = E->model;
@@ -1438,7 +1438,7 @@ ecc_encrypt_raw (gcry_sexp_t *r_ciph, gcry_sexp_t s_data, gcry_sexp_t keyparms)
       }
 
     /* R = kG */
-    _gcry_mpi_ec_mul_point (&R, data, &pk.E.G, ec);
+    _gcry_mpi_ec_mul_base (&R, data, &pk.E.G, ec);
 
     if (_gcry_mpi_ec_get_affine (x, y, &R, ec))
       {
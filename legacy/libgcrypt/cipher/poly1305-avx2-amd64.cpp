@@ -0,0 +1,209 @@
+/* poly1305-avx2-amd64.c  -  AVX2 implementation of Poly1305
+ *
+ * This file is part of Libgcrypt.
+ *
+ * Libgcrypt is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser general Public License as
+ * published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * Libgcrypt is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* The message is split into four interleaved streams: the 64 bit
+ * lanes of the YMM registers accumulate the blocks 4i+j (j = 0..3)
+ * using r^4 as the multiplier.  At the end the lanes are multiplied
+ * with r^4, r^3, r^2 and r^1 respectively and summed up, which gives
+ * the same result as the sequential evaluation.  The limbs use the 26
+ * bit format of the reference implementation so that the state can
+ * be handed back and forth.  */
+
+#include <config.h>
+
+#include "types.h"
+#include "g10lib.h"
+#include "poly1305-internal.h"
+
+#ifdef POLY1305_USE_AVX2
+
+#include <immintrin.h>
+
+unsigned int _gcry_poly1305_amd64_avx2_blocks_4way (u32 h[5],
+                                                    const u32 rpow[4][5],
+                                                    const byte *m,
+                                                    size_t bytes);
+
+#define ATTR_AVX2 __attribute__ ((target ("avx2")))
+
+/* Load four blocks from M; the lanes hold blocks 0, 2, 1 and 3.  */
+#define LOAD4(m)                                                        \
+  do {                                                                  \
+    __m256i a_ = _mm256_loadu_si256 ((const __m256i *)(m));             \
+    __m256i b_ = _mm256_loadu_si256 ((const __m256i *)((m) + 32));      \
+    __m256i lo_ = _mm256_unpacklo_epi64 (a_, b_);                       \
+    __m256i hi_ = _mm256_unpackhi_epi64 (a_, b_);                       \
+    m0 = _mm256_and_si256 (lo_, mask26);                                \
+    m1 = _mm256_and_si256 (_mm256_srli_epi64 (lo_, 26), mask26);        \
+    m2 = _mm256_and_si256 (_mm256_or_si256 (_mm256_srli_epi64 (lo_, 52), \
+                                            _mm256_slli_epi64 (hi_, 12)), \
+                           mask26);                                     \
+    m3 = _mm256_and_si256 (_mm256_srli_epi64 (hi_, 14), mask26);        \
+    m4 = _mm256_or_si256 (_mm256_srli_epi64 (hi_, 40), hibit);          \
+  } while (0)
+
+#define MUL(a, b) _mm256_mul_epu32 ((a), (b))
+#define ADD(a, b) _mm256_add_epi64 ((a), (b))
+
+/* H = H * R with partial reduction.  S holds R * 5.  */
+#define MULMOD(r0, r1, r2, r3, r4, s1, s2, s3, s4)                      \
+  do {                                                                  \
+    __m256i d0_, d1_, d2_, d3_, d4_, c_;                                \
+    d0_ = ADD (ADD (ADD (MUL (h0, r0), MUL (h1, s4)),                   \
+                    ADD (MUL (h2, s3), MUL (h3, s2))), MUL (h4, s1));   \
+    d1_ = ADD (ADD (ADD (MUL (h0, r1), MUL (h1, r0)),                   \
+                    ADD (MUL (h2, s4), MUL (h3, s3))), MUL (h4, s2));   \
+    d2_ = ADD (ADD (ADD (MUL (h0, r2), MUL (h1, r1)),                   \
+                    ADD (MUL (h2, r0), MUL (h3, s4))), MUL (h4, s3));   \
+    d3_ = ADD (ADD (ADD (MUL (h0, r3), MUL (h1, r2)),                   \
+                    ADD (MUL (h2, r1), MUL (h3, r0))), MUL (h4, s4));   \
+    d4_ = ADD (ADD (ADD (MUL (h0, r4), MUL (h1, r3)),                   \
+                    ADD (MUL (h2, r2), MUL (h3, r1))), MUL (h4, r0));   \
+    c_ = _mm256_srli_epi64 (d0_, 26);                                   \
+    h0 = _mm256_and_si256 (d0_, mask26);                                \
+    d1_ = ADD (d1_, c_);                                                \
+    c_ = _mm256_srli_epi64 (d1_, 26);                                   \
+    h1 = _mm256_and_si256 (d1_, mask26);                                \
+    d2_ = ADD (d2_, c_);                                                \
+    c_ = _mm256_srli_epi64 (d2_, 26);                                   \
+    h2 = _mm256_and_si256 (d2_, mask26);                                \
+    d3_ = ADD (d3_, c_);                                                \
+    c_ = _mm256_srli_epi64 (d3_, 26);                                   \
+    h3 = _mm256_and_si256 (d3_, mask26);                                \
+    d4_ = ADD (d4_, c_);                                                \
+    c_ = _mm256_srli_epi64 (d4_, 26);                                   \
+    h4 = _mm256_and_si256 (d4_, mask26);                                \
+    h0 = ADD (h0, ADD (c_, _mm256_slli_epi64 (c_, 2)));                 \
+    c_ = _mm256_srli_epi64 (h0, 26);                                    \
+    h0 = _mm256_and_si256 (h0, mask26);                                 \
+    h1 = ADD (h1, c_);                                                  \
+  } while (0)
+
+#define TIMES5(v) ADD ((v), _mm256_slli_epi64 ((v), 2))
+
+
+/* Sum up the four lanes of V.  */
+static ATTR_AVX2 inline u64
+hsum (__m256i v)
+{
+  __m128i x = _mm_add_epi64 (_mm256_castsi256_si128 (v),
+                             _mm256_extracti128_si256 (v, 1));
+  return (u64)_mm_cvtsi128_si64 (x) + (u64)_mm_extract_epi64 (x, 1);
+}
+
+
+/* Process BYTES of message M, which must be a non-zero multiple of
+ * 64, and update the accumulator H.  RPOW holds r^1 to r^4.  */
+ATTR_AVX2 unsigned int
+_gcry_poly1305_amd64_avx2_blocks_4way (u32 h[5], const u32 rpow[4][5],
+                                       const byte *m, size_t bytes)
+{
+  const __m256i mask26 = _mm256_set1_epi64x (0x3ffffff);
+  const __m256i hibit = _mm256_set1_epi64x (1 << 24);
+  __m256i h0, h1, h2, h3, h4;
+  __m256i m0, m1, m2, m3, m4;
+  __m256i r0, r1, r2, r3, r4, s1, s2, s3, s4;
+  u64 t0, t1, t2, t3, t4, c;
+
+  /* r^4 in all lanes.  */
+  r0 = _mm256_set1_epi64x (rpow[3][0]);
+  r1 = _mm256_set1_epi64x (rpow[3][1]);
+  r2 = _mm256_set1_epi64x (rpow[3][2]);
+  r3 = _mm256_set1_epi64x (rpow[3][3]);
+  r4 = _mm256_set1_epi64x (rpow[3][4]);
+  s1 = TIMES5 (r1);
+  s2 = TIMES5 (r2);
+  s3 = TIMES5 (r3);
+  s4 = TIMES5 (r4);
+
+  /* The current accumulator goes into the lane of the first block.  */
+  LOAD4 (m);
+  h0 = ADD (m0, _mm256_set_epi64x (0, 0, 0, h[0]));
+  h1 = ADD (m1, _mm256_set_epi64x (0, 0, 0, h[1]));
+  h2 = ADD (m2, _mm256_set_epi64x (0, 0, 0, h[2]));
+  h3 = ADD (m3, _mm256_set_epi64x (0, 0, 0, h[3]));
+  h4 = ADD (m4, _mm256_set_epi64x (0, 0, 0, h[4]));
+  m += 64;
+  bytes -= 64;
+
+  while (bytes >= 64)
+    {
+      MULMOD (r0, r1, r2, r3, r4, s1, s2, s3, s4);
+      LOAD4 (m);
+      h0 = ADD (h0, m0);
+      h1 = ADD (h1, m1);
+      h2 = ADD (h2, m2);
+      h3 = ADD (h3, m3);
+      h4 = ADD (h4, m4);
+      m += 64;
+      bytes -= 64;
+    }
+
+  /* Multiply the lanes (blocks 0, 2, 1, 3) with r^4, r^2, r^3, r^1.  */
+#define RLANES(k) _mm256_set_epi64x (rpow[0][k], rpow[2][k], \
+                                     rpow[1][k], rpow[3][k])
+  r0 = RLANES (0);
+  r1 = RLANES (1);
+  r2 = RLANES (2);
+  r3 = RLANES (3);
+  r4 = RLANES (4);
+#undef RLANES
+  s1 = TIMES5 (r1);
+  s2 = TIMES5 (r2);
+  s3 = TIMES5 (r3);
+  s4 = TIMES5 (r4);
+  MULMOD (r0, r1, r2, r3, r4, s1, s2, s3, s4);
+
+  t0 = hsum (h0);
+  t1 = hsum (h1);
+  t2 = hsum (h2);
+  t3 = hsum (h3);
+  t4 = hsum (h4);
+
+  c = t0 >> 26;
+  t0 &= 0x3ffffff;
+  t1 += c;
+  c = t1 >> 26;
+  t1 &= 0x3ffffff;
+  t2 += c;
+  c = t2 >> 26;
+  t2 &= 0x3ffffff;
+  t3 += c;
+  c = t3 >> 26;
+  t3 &= 0x3ffffff;
+  t4 += c;
+  c = t4 >> 26;
+  t4 &= 0x3ffffff;
+  t0 += c * 5;
+  c = t0 >> 26;
+  t0 &= 0x3ffffff;
+  t1 += c;
+
+  h[0] = (u32)t0;
+  h[1] = (u32)t1;
+  h[2] = (u32)t2;
+  h[3] = (u32)t3;
+  h[4] = (u32)t4;
+
+  /* Do not leave the key powers in the vector registers.  */
+  _mm256_zeroall ();
+
+  return 10 * 32 + 6 * sizeof (u64);
+}
+
+#endif /* POLY1305_USE_AVX2 */
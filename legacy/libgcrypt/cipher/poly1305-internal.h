@@ -58,16 +58,18 @@
 #endif
 
 
-/* POLY1305_USE_AVX2 indicates whether to compile with AMD64 AVX2 code. */
+/* POLY1305_USE_AVX2 indicates whether to compile with AMD64 AVX2 code.
+ * The AVX2 kernel is written with compiler intrinsics and builds on
+ * the reference implementation, thus it is not available together
+ * with the SSE2 assembly.  */
 #undef POLY1305_USE_AVX2
-#if defined(__x86_64__) && (defined(HAVE_COMPATIBLE_GCC_AMD64_PLATFORM_AS) || \
-    defined(HAVE_COMPATIBLE_GCC_WIN64_PLATFORM_AS)) && \
-    defined(ENABLE_AVX2_SUPPORT)
+#if defined(__x86_64__) && defined(HAVE_CPU_ARCH_X86) && \
+    defined(HAVE_GCC_ATTRIBUTE_TARGET) && defined(ENABLE_AVX2_SUPPORT) && \
+    !defined(POLY1305_USE_SSE2)
 # define POLY1305_USE_AVX2 1
 # define POLY1305_AVX2_BLOCKSIZE 64
-# define POLY1305_AVX2_STATESIZE 328
+# define POLY1305_AVX2_STATESIZE 160
 # define POLY1305_AVX2_ALIGNMENT 32
-# define POLY1305_SYSV_FUNC_ABI 1
 #endif
 
 
@@ -77,19 +77,25 @@ static const poly1305_ops_t poly1305_default_ops = {
 
 #ifdef POLY1305_USE_AVX2
 
-void _gcry_poly1305_amd64_avx2_init_ext(void *state, const poly1305_key_t *key)
-                                       OPS_FUNC_ABI;
-unsigned int _gcry_poly1305_amd64_avx2_finish_ext(void *state, const byte *m,
-						  size_t remaining,
-						  byte mac[16]) OPS_FUNC_ABI;
-unsigned int _gcry_poly1305_amd64_avx2_blocks(void *ctx, const byte *m,
-					      size_t bytes) OPS_FUNC_ABI;
+/* The 4-way kernel from poly1305-avx2-amd64.c.  */
+unsigned int _gcry_poly1305_amd64_avx2_blocks_4way (u32 h[5],
+                                                    const u32 rpow[4][5],
+                                                    const byte *m,
+                                                    size_t bytes);
+
+static void poly1305_init_ext_avx2
+/**/                (void *state, const poly1305_key_t *key);
+static unsigned int poly1305_blocks_avx2
+/**/                (void *state, const byte *m, size_t bytes);
+static unsigned int poly1305_finish_ext_avx2
+/**/                (void *state, const byte * m,
+                     size_t remaining, byte mac[POLY1305_TAGLEN]);
 
 static const poly1305_ops_t poly1305_amd64_avx2_ops = {
   POLY1305_AVX2_BLOCKSIZE,
-  _gcry_poly1305_amd64_avx2_init_ext,
-  _gcry_poly1305_amd64_avx2_blocks,
-  _gcry_poly1305_amd64_avx2_finish_ext
+  poly1305_init_ext_avx2,
+  poly1305_blocks_avx2,
+  poly1305_finish_ext_avx2
 };
 
 #endif
@@ -372,6 +378,123 @@ poly1305_finish_ext_ref32 (void *state, const byte * m,
 #endif /* !POLY1305_USE_SSE2*/
 
 
+#ifdef POLY1305_USE_AVX2
+
+/* The AVX2 implementation keeps the state of the reference
+ * implementation and processes four blocks in parallel using the
+ * precomputed powers r^1 to r^4.  Messages shorter than four blocks
+ * and the final blocks are handled by the reference code.  */
+typedef struct poly1305_state_avx2_s
+{
+  poly1305_state_ref32_t ref;
+  u32 rpow[4][5];
+} poly1305_state_avx2_t;
+
+
+/* OUT = A * B with partial reduction; all in the 26 bit limb format
+ * of the reference implementation.  */
+static void
+poly1305_mul_ref32 (u32 out[5], const u32 a[5], const u32 b[5])
+{
+  u32 s1 = b[1] * 5, s2 = b[2] * 5, s3 = b[3] * 5, s4 = b[4] * 5;
+  u64 d0, d1, d2, d3, d4;
+  u32 c;
+
+  d0 = ((u64) a[0] * b[0]) + ((u64) a[1] * s4) + ((u64) a[2] * s3)
+    + ((u64) a[3] * s2) + ((u64) a[4] * s1);
+  d1 = ((u64) a[0] * b[1]) + ((u64) a[1] * b[0]) + ((u64) a[2] * s4)
+    + ((u64) a[3] * s3) + ((u64) a[4] * s2);
+  d2 = ((u64) a[0] * b[2]) + ((u64) a[1] * b[1]) + ((u64) a[2] * b[0])
+    + ((u64) a[3] * s4) + ((u64) a[4] * s3);
+  d3 = ((u64) a[0] * b[3]) + ((u64) a[1] * b[2]) + ((u64) a[2] * b[1])
+    + ((u64) a[3] * b[0]) + ((u64) a[4] * s4);
+  d4 = ((u64) a[0] * b[4]) + ((u64) a[1] * b[3]) + ((u64) a[2] * b[2])
+    + ((u64) a[3] * b[1]) + ((u64) a[4] * b[0]);
+
+  c = (u32) (d0 >> 26);
+  out[0] = (u32) d0 & 0x3ffffff;
+  d1 += c;
+  c = (u32) (d1 >> 26);
+  out[1] = (u32) d1 & 0x3ffffff;
+  d2 += c;
+  c = (u32) (d2 >> 26);
+  out[2] = (u32) d2 & 0x3ffffff;
+  d3 += c;
+  c = (u32) (d3 >> 26);
+  out[3] = (u32) d3 & 0x3ffffff;
+  d4 += c;
+  c = (u32) (d4 >> 26);
+  out[4] = (u32) d4 & 0x3ffffff;
+  out[0] += c * 5;
+  c = out[0] >> 26;
+  out[0] &= 0x3ffffff;
+  out[1] += c;
+}
+
+
+static void
+poly1305_init_ext_avx2 (void *state, const poly1305_key_t * key)
+{
+  poly1305_state_avx2_t *st = (poly1305_state_avx2_t *) state;
+
+  gcry_assert (sizeof (*st) <= POLY1305_AVX2_STATESIZE);
+
+  poly1305_init_ext_ref32 (&st->ref, key);
+
+  memcpy (st->rpow[0], st->ref.r, sizeof st->rpow[0]);
+  poly1305_mul_ref32 (st->rpow[1], st->rpow[0], st->rpow[0]);
+  poly1305_mul_ref32 (st->rpow[2], st->rpow[1], st->rpow[0]);
+  poly1305_mul_ref32 (st->rpow[3], st->rpow[1], st->rpow[1]);
+}
+
+
+static unsigned int
+poly1305_blocks_avx2 (void *state, const byte * m, size_t bytes)
+{
+  poly1305_state_avx2_t *st = (poly1305_state_avx2_t *) state;
+  size_t nbytes = bytes & ~(size_t)(POLY1305_AVX2_BLOCKSIZE - 1);
+  unsigned int burn = 0;
+  unsigned int nburn;
+
+  if (nbytes)
+    {
+      burn = _gcry_poly1305_amd64_avx2_blocks_4way (st->ref.h, st->rpow,
+                                                    m, nbytes);
+      m += nbytes;
+      bytes -= nbytes;
+    }
+  if (bytes)
+    {
+      nburn = poly1305_blocks_ref32 (&st->ref, m, bytes);
+      burn = nburn > burn ? nburn : burn;
+    }
+
+  return burn;
+}
+
+
+static unsigned int
+poly1305_finish_ext_avx2 (void *state, const byte * m,
+                          size_t remaining, byte mac[POLY1305_TAGLEN])
+{
+  poly1305_state_avx2_t *st = (poly1305_state_avx2_t *) state;
+  size_t nbytes = remaining & ~(size_t)(POLY1305_REF_BLOCKSIZE - 1);
+  unsigned int burn = 0;
+  unsigned int nburn;
+
+  if (nbytes)
+    burn = poly1305_blocks_ref32 (&st->ref, m, nbytes);
+  nburn = poly1305_finish_ext_ref32 (&st->ref, m + nbytes,
+                                     remaining - nbytes, mac);
+  burn = nburn > burn ? nburn : burn;
+  wipememory (st->rpow, sizeof st->rpow);
+
+  return burn;
+}
+
+#endif /* POLY1305_USE_AVX2 */
+
+
 
 
 
@@ -253,12 +253,160 @@ _gcry_mpi_point_snatch_set (mpi_point_t point,
 }
 
 
+/* Fast reduction modulo the NIST primes P-256 and P-384 (FIPS 186-4,
+   appendix D.2).  The input is split into 32 bit words C[] and each
+   word of the residue is a small signed sum of words of C.  */
+#define NIST_MAX_WORDS 12
+#define C(i) ((int64_t)c[(i)])
+
+static void
+nist_p256_sum (int64_t *acc, const u32 *c)
+{
+  acc[0] = C(0) + C(8) + C(9) - C(11) - C(12) - C(13) - C(14);
+  acc[1] = C(1) + C(9) + C(10) - C(12) - C(13) - C(14) - C(15);
+  acc[2] = C(2) + C(10) + C(11) - C(13) - C(14) - C(15);
+  acc[3] = C(3) + C(11) + C(11) + C(12) + C(12) + C(13) - C(8) - C(9) - C(15);
+  acc[4] = C(4) + C(12) + C(12) + C(13) + C(13) + C(14) - C(9) - C(10);
+  acc[5] = C(5) + C(13) + C(13) + C(14) + C(14) + C(15) - C(10) - C(11);
+  acc[6] = C(6) + C(13) + C(14) + C(14) + C(14) + C(15) + C(15) - C(8) - C(9);
+  acc[7] = C(7) + C(8) + C(15) + C(15) + C(15) - C(10) - C(11) - C(12) -
+           C(13);
+}
+
+static void
+nist_p384_sum (int64_t *acc, const u32 *c)
+{
+  acc[0] = C(0) + C(12) + C(20) + C(21) - C(23);
+  acc[1] = C(1) + C(13) + C(22) + C(23) - C(12) - C(20);
+  acc[2] = C(2) + C(14) + C(23) - C(13) - C(21);
+  acc[3] = C(3) + C(12) + C(15) + C(20) + C(21) - C(14) - C(22) - C(23);
+  acc[4] = C(4) + C(12) + C(13) + C(16) + C(20) + C(21) + C(21) + C(22) -
+           C(15) - C(23) - C(23);
+  acc[5] = C(5) + C(13) + C(14) + C(17) + C(21) + C(22) + C(22) + C(23) -
+           C(16);
+  acc[6] = C(6) + C(14) + C(15) + C(18) + C(22) + C(23) + C(23) - C(17);
+  acc[7] = C(7) + C(15) + C(16) + C(19) + C(23) - C(18);
+  acc[8] = C(8) + C(16) + C(17) + C(20) - C(19);
+  acc[9] = C(9) + C(17) + C(18) + C(21) - C(20);
+  acc[10] = C(10) + C(18) + C(19) + C(22) - C(21);
+  acc[11] = C(11) + C(19) + C(20) + C(23) - C(22);
+}
+
+#undef C
+
+/* The primes themselves, least significant word first.  */
+static const u32 nist_p256_words[8] =
+  { 0xffffffff, 0xffffffff, 0xffffffff, 0x00000000,
+    0x00000000, 0x00000000, 0x00000001, 0xffffffff };
+
+static const u32 nist_p384_words[12] =
+  { 0xffffffff, 0x00000000, 0x00000000, 0xffffffff,
+    0xfffffffe, 0xffffffff, 0xffffffff, 0xffffffff,
+    0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff };
+
+#if BITS_PER_MPI_LIMB == 64
+# define NIST_WORD(d,i)  ((u32)((d)[(i) / 2] >> (32 * ((i) & 1))))
+#elif BITS_PER_MPI_LIMB == 32
+# define NIST_WORD(d,i)  ((u32)((d)[(i)]))
+#endif
+
+
+/* Return 256 or 384 if P is the respective NIST prime, 0 otherwise.  */
+static int
+ec_nist_nbits (gcry_mpi_t p)
+{
+#ifdef NIST_WORD
+  const u32 *words;
+  unsigned int nbits = mpi_get_nbits (p);
+  int i;
+
+  if (nbits == 256)
+    words = nist_p256_words;
+  else if (nbits == 384)
+    words = nist_p384_words;
+  else
+    return 0;
+
+  if (p->sign || p->nlimbs * BITS_PER_MPI_LIMB != nbits)
+    return 0;
+  for (i = 0; i < nbits / 32; i++)
+    if (NIST_WORD (p->d, i) != words[i])
+      return 0;
+  return nbits;
+#else
+  (void)p;
+  return 0;
+#endif
+}
+
+
+/* W = W mod P for the NIST prime P described by EC.  W must be non
+   negative and less than P^2.  */
+static void
+ec_mod_nist (gcry_mpi_t w, mpi_ec_t ec)
+{
+#ifdef NIST_WORD
+  int nw = ec->t.nist_nbits / 32;
+  mpi_size_t n = ec->p->nlimbs;
+  u32 c[2 * NIST_MAX_WORDS];
+  int64_t acc[NIST_MAX_WORDS];
+  int64_t carry;
+  mpi_limb_t top;
+  mpi_ptr_t wp;
+  int i, k;
+
+  for (i = 0; i < 2 * nw; i++)
+    c[i] = (i / (BITS_PER_MPI_LIMB / 32) < w->nlimbs)? NIST_WORD (w->d, i) : 0;
+
+  if (nw == 8)
+    nist_p256_sum (acc, c);
+  else
+    nist_p384_sum (acc, c);
+
+  RESIZE_IF_NEEDED (w, n);
+  wp = w->d;
+  carry = 0;
+  for (k = 0; k < nw; k++)
+    {
+      acc[k] += carry;
+#if BITS_PER_MPI_LIMB == 64
+      if ((k & 1))
+        wp[k / 2] |= (mpi_limb_t)(u32)acc[k] << 32;
+      else
+        wp[k / 2] = (u32)acc[k];
+#else
+      wp[k] = (u32)acc[k];
+#endif
+      carry = acc[k] >> 32;
+    }
+
+  /* The value is now CARRY * 2^NBITS + WP with a small signed CARRY;
+     bring it into the range [0, P).  */
+  while (carry < 0)
+    carry += _gcry_mpih_add_n (wp, wp, ec->p->d, n);
+  top = carry;
+  if (top)
+    top -= _gcry_mpih_submul_1 (wp, ec->p->d, n, top);
+  while (top || _gcry_mpih_cmp (wp, ec->p->d, n) >= 0)
+    top -= _gcry_mpih_sub_n (wp, wp, ec->p->d, n);
+
+  w->nlimbs = n;
+  MPN_NORMALIZE (wp, w->nlimbs);
+#else
+  (void)w;
+  (void)ec;
+#endif
+}
+
+
 /* W = W mod P.  */
 static void
 ec_mod (gcry_mpi_t w, mpi_ec_t ec)
 {
   if (0 && ec->dialect == ECC_DIALECT_ED25519)
     _gcry_mpi_ec_ed25519_mod (w);
+  else if (ec->t.nist_nbits && !w->sign && w->nlimbs <= 2 * ec->p->nlimbs)
+    ec_mod_nist (w, ec);
   else if (ec->t.p_barrett)
     _gcry_mpi_mod_barrett (w, w, ec->t.p_barrett);
   else
@@ -345,6 +493,8 @@ _gcry_mpi_ec_get_reset (mpi_ec_t ec)
 {
   ec->t.valid.a_is_pminus3 = 0;
   ec->t.valid.two_inv_p = 0;
+  ec->t.nist_nbits = (ec->p && ec->model == MPI_EC_WEIERSTRASS)?
+                      ec_nist_nbits (ec->p) : 0;
 }
 
 
@@ -423,24 +573,6 @@ ec_p_init (mpi_ec_t ctx, enum gcry_mpi_ec_models model,
   /* Allocate scratch variables.  */
   for (i=0; i< DIM(ctx->t.scratch); i++)
     ctx->t.scratch[i] = mpi_alloc_like (ctx->p);
-
-  /* Prepare for fast reduction.  */
-  /* FIXME: need a test for NIST values.  However it does not gain us
-     any real advantage, for 384 bits it is actually slower than using
-     mpi_mulm.  */
-/*   ctx->nist_nbits = mpi_get_nbits (ctx->p); */
-/*   if (ctx->nist_nbits == 192) */
-/*     { */
-/*       for (i=0; i < 4; i++) */
-/*         ctx->s[i] = mpi_new (192); */
-/*       ctx->c    = mpi_new (192*2); */
-/*     } */
-/*   else if (ctx->nist_nbits == 384) */
-/*     { */
-/*       for (i=0; i < 10; i++) */
-/*         ctx->s[i] = mpi_new (384); */
-/*       ctx->c    = mpi_new (384*2); */
-/*     } */
 }
 
 
@@ -470,18 +602,6 @@ ec_deinit (void *opaque)
   for (i=0; i< DIM(ctx->t.scratch); i++)
     mpi_free (ctx->t.scratch[i]);
 
-/*   if (ctx->nist_nbits == 192) */
-/*     { */
-/*       for (i=0; i < 4; i++) */
-/*         mpi_free (ctx->s[i]); */
-/*       mpi_free (ctx->c); */
-/*     } */
-/*   else if (ctx->nist_nbits == 384) */
-/*     { */
-/*       for (i=0; i < 10; i++) */
-/*         mpi_free (ctx->s[i]); */
-/*       mpi_free (ctx->c); */
-/*     } */
 }
 
 
@@ -726,7 +846,8 @@ dup_point_weierstrass (mpi_point_t result, mpi_point_t point, mpi_ec_t ctx)
           /*                          T1: used for aZ^4. */
           ec_pow2 (l1, point->x, ctx);
           ec_mulm (l1, l1, mpi_const (MPI_C_THREE), ctx);
-          ec_powm (t1, point->z, mpi_const (MPI_C_FOUR), ctx);
+          ec_pow2 (t1, point->z, ctx);
+          ec_pow2 (t1, t1, ctx);
           ec_mulm (t1, t1, ctx->a, ctx);
           ec_addm (l1, l1, t1, ctx);
         }
@@ -926,28 +1047,34 @@ add_points_weierstrass (mpi_point_t result,
 
       /* l1 = x1 z2^2  */
       /* l2 = x2 z1^2  */
+      /* l4 = y1 z2^3  */
+      /* l5 = y2 z1^3  */
       if (z2_is_one)
-        mpi_set (l1, x1);
+        {
+          mpi_set (l1, x1);
+          mpi_set (l4, y1);
+        }
       else
         {
-          ec_pow2 (l1, z2, ctx);
-          ec_mulm (l1, l1, x1, ctx);
+          ec_pow2 (t1, z2, ctx);
+          ec_mulm (l1, t1, x1, ctx);
+          ec_mulm (t1, t1, z2, ctx);
+          ec_mulm (l4, t1, y1, ctx);
         }
       if (z1_is_one)
-        mpi_set (l2, x2);
+        {
+          mpi_set (l2, x2);
+          mpi_set (l5, y2);
+        }
       else
         {
-          ec_pow2 (l2, z1, ctx);
-          ec_mulm (l2, l2, x2, ctx);
+          ec_pow2 (t1, z1, ctx);
+          ec_mulm (l2, t1, x2, ctx);
+          ec_mulm (t1, t1, z1, ctx);
+          ec_mulm (l5, t1, y2, ctx);
         }
       /* l3 = l1 - l2 */
       ec_subm (l3, l1, l2, ctx);
-      /* l4 = y1 z2^3  */
-      ec_powm (l4, z2, mpi_const (MPI_C_THREE), ctx);
-      ec_mulm (l4, l4, y1, ctx);
-      /* l5 = y2 z1^3  */
-      ec_powm (l5, z1, mpi_const (MPI_C_THREE), ctx);
-      ec_mulm (l5, l5, y2, ctx);
       /* l6 = l4 - l5  */
       ec_subm (l6, l4, l5, ctx);
 
@@ -973,19 +1100,24 @@ add_points_weierstrass (mpi_point_t result,
           /* l8 = l4 + l5  */
           ec_addm (l8, l4, l5, ctx);
           /* z3 = z1 z2 l3  */
-          ec_mulm (z3, z1, z2, ctx);
+          if (z1_is_one)
+            mpi_set (z3, z2);
+          else if (z2_is_one)
+            mpi_set (z3, z1);
+          else
+            ec_mulm (z3, z1, z2, ctx);
           ec_mulm (z3, z3, l3, ctx);
           /* x3 = l6^2 - l7 l3^2  */
           ec_pow2 (t1, l6, ctx);
-          ec_pow2 (t2, l3, ctx);
-          ec_mulm (t2, t2, l7, ctx);
+          ec_pow2 (l2, l3, ctx);       /* l2 = l3^2, l2 is not needed anymore */
+          ec_mulm (t2, l2, l7, ctx);
           ec_subm (x3, t1, t2, ctx);
           /* l9 = l7 l3^2 - 2 x3  */
           ec_mul2 (t1, x3, ctx);
           ec_subm (l9, t2, t1, ctx);
           /* y3 = (l9 l6 - l8 l3^3)/2  */
           ec_mulm (l9, l9, l6, ctx);
-          ec_powm (t1, l3, mpi_const (MPI_C_THREE), ctx); /* fixme: Use saved value*/
+          ec_mulm (t1, l2, l3, ctx);
           ec_mulm (t1, t1, l8, ctx);
           ec_subm (y3, l9, t1, ctx);
           ec_mulm (y3, y3, ec_get_two_inv_p (ctx), ctx);
@@ -1462,6 +1594,404 @@ _gcry_mpi_ec_mul_point (mpi_point_t result,
 }
 
 
+/* Width of the windows used by the fixed base tables and of the
+   w-NAF recoding used by _gcry_mpi_ec_mul_point2.  */
+#define EC_BASE_WINDOW  4
+#define EC_WNAF_WIDTH   4
+
+/* Maximum number of base points for which we keep a table and the
+   number of multiplications with a base point after which its table
+   is computed.  Building a table costs about as much as four generic
+   multiplications; a process doing only one or two signatures should
+   not pay for it.  */
+#define EC_BASE_MAX_TABLES 8
+#define EC_BASE_MIN_USES   3
+
+/* A precomputed table for a fixed base point G.  For window J and
+   digit V in [1, 2^EC_BASE_WINDOW) entry (J, V-1) holds the affine
+   point V * 2^(EC_BASE_WINDOW * J) * G.  Tables are shared by all
+   contexts of the same curve and never released; they only hold
+   public values.  */
+struct ec_base_table_s
+{
+  struct ec_base_table_s *next;
+  gcry_mpi_t p, a, b;         /* The curve.  */
+  gcry_mpi_t gx, gy;          /* The affine base point.  */
+  unsigned int uses;          /* Number of lookups so far.  */
+  int failed;                 /* Building the table failed.  */
+  unsigned int nwindows;
+  gcry_mpi_t *x, *y;          /* NWINDOWS * (2^EC_BASE_WINDOW - 1) entries;
+                                 NULL until the table has been built.  */
+};
+
+static struct ec_base_table_s *ec_base_tables;
+static int ec_base_ntables;
+GPGRT_LOCK_DEFINE (ec_base_tables_lock);
+
+
+/* Compute the entries of TBL for the base point G.  Returns 0 on
+   success.  */
+static int
+ec_base_table_build (struct ec_base_table_s *tbl, mpi_point_t G, mpi_ec_t ctx)
+{
+  const unsigned int nentries = (1 << EC_BASE_WINDOW) - 1;
+  mpi_point_struct *pts;
+  mpi_point_struct base;
+  gcry_mpi_t *prod, *x, *y;
+  gcry_mpi_t inv, zinv, zz, t;
+  unsigned int i, j, n, nwindows;
+  int rc = -1;
+
+  /* Scalars are reduced modulo the group order which is at most one
+     bit longer than P.  */
+  nwindows = (mpi_get_nbits (ctx->p) + EC_BASE_WINDOW) / EC_BASE_WINDOW;
+  n = nwindows * nentries;
+  x = (gcry_mpi_t*) xtrycalloc (n, sizeof *x);
+  y = (gcry_mpi_t*) xtrycalloc (n, sizeof *y);
+  pts = (mpi_point_struct*) xtrycalloc (n, sizeof *pts);
+  prod = (gcry_mpi_t*) xtrycalloc (n, sizeof *prod);
+  if (!x || !y || !pts || !prod)
+    {
+      xfree (prod);
+      xfree (pts);
+      xfree (x);
+      xfree (y);
+      return -1;
+    }
+
+  /* Compute all entries in projective coordinates.  */
+  point_init (&base);
+  point_set (&base, G);
+  for (j = 0; j < nwindows; j++)
+    {
+      mpi_point_struct *row = pts + j * nentries;
+
+      point_init (&row[0]);
+      point_set (&row[0], &base);
+      for (i = 1; i < nentries; i++)
+        {
+          point_init (&row[i]);
+          _gcry_mpi_ec_add_points (&row[i], &row[i-1], &base, ctx);
+        }
+      for (i = 0; i < EC_BASE_WINDOW; i++)
+        _gcry_mpi_ec_dup_point (&base, &base, ctx);
+    }
+  point_free (&base);
+
+  /* Convert them to affine coordinates using a single inversion
+     (Montgomery's trick).  */
+  for (i = 0; i < n; i++)
+    {
+      if (!mpi_cmp_ui (pts[i].z, 0))
+        break;  /* A point at infinity; G is not a proper generator.  */
+      prod[i] = mpi_alloc_like (ctx->p);
+      if (i)
+        ec_mulm (prod[i], prod[i-1], pts[i].z, ctx);
+      else
+        mpi_set (prod[i], pts[i].z);
+    }
+  if (i == n)
+    {
+      inv = mpi_new (0);
+      zinv = mpi_new (0);
+      zz = mpi_new (0);
+      t = mpi_new (0);
+      ec_invm (inv, prod[n-1], ctx);
+      for (i = n; i-- > 0; )
+        {
+          if (i)
+            {
+              ec_mulm (zinv, inv, prod[i-1], ctx);
+              ec_mulm (inv, inv, pts[i].z, ctx);
+            }
+          else
+            mpi_set (zinv, inv);
+          /* The entries are allocated with exactly the size of P so
+             that mpi_set_cond can be used to select them.  */
+          ec_pow2 (zz, zinv, ctx);
+          ec_mulm (t, pts[i].x, zz, ctx);
+          x[i] = mpi_alloc (ctx->p->nlimbs);
+          mpi_set (x[i], t);
+          ec_mulm (zz, zz, zinv, ctx);
+          ec_mulm (t, pts[i].y, zz, ctx);
+          y[i] = mpi_alloc (ctx->p->nlimbs);
+          mpi_set (y[i], t);
+        }
+      mpi_free (t);
+      mpi_free (zz);
+      mpi_free (zinv);
+      mpi_free (inv);
+
+      tbl->nwindows = nwindows;
+      tbl->x = x;
+      tbl->y = y;
+      rc = 0;
+    }
+  else
+    {
+      xfree (x);
+      xfree (y);
+    }
+
+  for (i = 0; i < n; i++)
+    {
+      mpi_free (prod[i]);
+      point_free (&pts[i]);
+    }
+  xfree (prod);
+  xfree (pts);
+  return rc;
+}
+
+
+/* Return the fixed base table for the affine point G on the curve
+   described by CTX if it is available or worth building now.
+   Returns NULL if the generic method shall be used.  */
+static struct ec_base_table_s *
+ec_get_base_table (mpi_point_t G, mpi_ec_t ctx)
+{
+  struct ec_base_table_s *tbl;
+
+  if (ctx->model != MPI_EC_WEIERSTRASS || !ctx->a || !ctx->b
+      || mpi_cmp_ui (G->z, 1))
+    return NULL;
+
+  if (gpgrt_lock_lock (&ec_base_tables_lock))
+    return NULL;
+  for (tbl = ec_base_tables; tbl; tbl = tbl->next)
+    if (!mpi_cmp (tbl->gx, G->x) && !mpi_cmp (tbl->gy, G->y)
+        && !mpi_cmp (tbl->p, ctx->p) && !mpi_cmp (tbl->a, ctx->a)
+        && !mpi_cmp (tbl->b, ctx->b))
+      break;
+  if (!tbl && ec_base_ntables < EC_BASE_MAX_TABLES)
+    {
+      tbl = (struct ec_base_table_s*) xtrycalloc (1, sizeof *tbl);
+      if (tbl)
+        {
+          tbl->p = mpi_copy (ctx->p);
+          tbl->a = mpi_copy (ctx->a);
+          tbl->b = mpi_copy (ctx->b);
+          tbl->gx = mpi_copy (G->x);
+          tbl->gy = mpi_copy (G->y);
+          tbl->next = ec_base_tables;
+          ec_base_tables = tbl;
+          ec_base_ntables++;
+        }
+    }
+  if (tbl && !tbl->x && !tbl->failed && ++tbl->uses >= EC_BASE_MIN_USES)
+    tbl->failed = !!ec_base_table_build (tbl, G, ctx);
+  if (tbl && !tbl->x)
+    tbl = NULL;
+  gpgrt_lock_unlock (&ec_base_tables_lock);
+
+  return tbl;
+}
+
+
+/* RESULT = SCALAR * G where G is a fixed base point, usually the
+   generator of the curve.  SCALAR is assumed to be secret; it is a
+   private key or a nonce, which is not always stored in secure
+   memory.  For short Weierstrass curves this uses a table of
+   precomputed multiples of G which is cached across contexts; this
+   trades the doublings of the generic method for a table lookup per
+   window.  The table is scanned in full and an addition is done for
+   every window so that the sequence of operations and the memory
+   access pattern do not depend on the scalar.  All other cases are
+   handed to the constant time method of _gcry_mpi_ec_mul_point.
+   Public scalars should use _gcry_mpi_ec_mul_point2.  */
+void
+_gcry_mpi_ec_mul_base (mpi_point_t result,
+                       gcry_mpi_t scalar, mpi_point_t G,
+                       mpi_ec_t ctx)
+{
+  const unsigned int nentries = (1 << EC_BASE_WINDOW) - 1;
+  struct ec_base_table_s *tbl;
+  mpi_point_struct sel, tmp;
+  unsigned int j, i, v, bit;
+
+  if (ctx->model != MPI_EC_WEIERSTRASS || mpi_has_sign (scalar)
+      || !(tbl = ec_get_base_table (G, ctx))
+      || mpi_get_nbits (scalar) > tbl->nwindows * EC_BASE_WINDOW)
+    {
+      if (mpi_is_secure (scalar))
+        _gcry_mpi_ec_mul_point (result, scalar, G, ctx);
+      else
+        {
+          /* _gcry_mpi_ec_mul_point selects its method by the
+             location of the scalar.  */
+          gcry_mpi_t k = mpi_copy (scalar);
+
+          mpi_set_flag (k, GCRYMPI_FLAG_SECURE);
+          _gcry_mpi_ec_mul_point (result, k, G, ctx);
+          mpi_free (k);
+        }
+      return;
+    }
+
+  mpi_set_ui (result->x, 1);
+  mpi_set_ui (result->y, 1);
+  mpi_set_ui (result->z, 0);
+
+  sel.x = mpi_alloc (ctx->p->nlimbs);
+  sel.y = mpi_alloc (ctx->p->nlimbs);
+  sel.z = mpi_alloc_set_ui (1);
+  point_init (&tmp);
+  point_resize (result, ctx);
+  point_resize (&tmp, ctx);
+
+  for (j = 0; j < tbl->nwindows; j++)
+    {
+      v = 0;
+      for (i = 0; i < EC_BASE_WINDOW; i++)
+        {
+          bit = j * EC_BASE_WINDOW + i;
+          v |= mpi_test_bit (scalar, bit) << i;
+        }
+
+      for (i = 0; i < nentries; i++)
+        {
+          mpi_set_cond (sel.x, tbl->x[j * nentries + i], (i + 1 == v));
+          mpi_set_cond (sel.y, tbl->y[j * nentries + i], (i + 1 == v));
+        }
+      _gcry_mpi_ec_add_points (&tmp, result, &sel, ctx);
+      point_swap_cond (result, &tmp, (v != 0), ctx);
+    }
+
+  point_free (&tmp);
+  point_free (&sel);
+}
+
+
+/* Store the width-EC_WNAF_WIDTH non-adjacent form of the non-negative
+   SCALAR at NAF, least significant digit first, and return the number
+   of digits.  NAF must have room for nbits(SCALAR)+1 digits.  */
+static unsigned int
+ec_wnaf (signed char *naf, gcry_mpi_t scalar)
+{
+  gcry_mpi_t k = mpi_copy (scalar);
+  unsigned int n = 0;
+  int d;
+
+  while (mpi_cmp_ui (k, 0))
+    {
+      d = 0;
+      if (mpi_test_bit (k, 0))
+        {
+          d = k->d[0] & ((1 << EC_WNAF_WIDTH) - 1);
+          if (d >= (1 << (EC_WNAF_WIDTH - 1)))
+            {
+              d -= 1 << EC_WNAF_WIDTH;
+              mpi_add_ui (k, k, -d);
+            }
+          else
+            mpi_sub_ui (k, k, d);
+        }
+      naf[n++] = d;
+      mpi_rshift (k, k, 1);
+    }
+  mpi_free (k);
+  return n;
+}
+
+
+/* RESULT = U1 * P1 + U2 * P2.  This is the operation needed to verify
+   signatures.  For short Weierstrass curves and public non-negative
+   scalars both products are computed in one pass over interleaved
+   w-NAF representations of the scalars (Shamir's trick) so that the
+   doublings are shared.  */
+void
+_gcry_mpi_ec_mul_point2 (mpi_point_t result,
+                         gcry_mpi_t u1, mpi_point_t p1,
+                         gcry_mpi_t u2, mpi_point_t p2,
+                         mpi_ec_t ctx)
+{
+  const unsigned int nodd = 1 << (EC_WNAF_WIDTH - 2);
+  mpi_point_struct tab[2][2][1 << (EC_WNAF_WIDTH - 2)];
+  mpi_point_struct twice;
+  signed char *naf1, *naf2;
+  unsigned int n1, n2, nmax;
+  mpi_point_t pts[2];
+  int i, j, d;
+
+  if (ctx->model != MPI_EC_WEIERSTRASS
+      || mpi_is_secure (u1) || mpi_is_secure (u2)
+      || mpi_has_sign (u1) || mpi_has_sign (u2))
+    goto generic;
+
+  n1 = mpi_get_nbits (u1) + 1;
+  n2 = mpi_get_nbits (u2) + 1;
+  naf1 = (signed char*) xtrymalloc (n1 + n2);
+  if (!naf1)
+    goto generic;
+  naf2 = naf1 + n1;
+  n1 = ec_wnaf (naf1, u1);
+  n2 = ec_wnaf (naf2, u2);
+  nmax = n1 > n2? n1 : n2;
+
+  /* TAB[k][0][i] = (2i+1) * Pk and TAB[k][1][i] = -(2i+1) * Pk.  */
+  pts[0] = p1;
+  pts[1] = p2;
+  point_init (&twice);
+  for (j = 0; j < 2; j++)
+    {
+      _gcry_mpi_ec_dup_point (&twice, pts[j], ctx);
+      for (i = 0; i < nodd; i++)
+        {
+          point_init (&tab[j][0][i]);
+          point_init (&tab[j][1][i]);
+          if (i)
+            _gcry_mpi_ec_add_points (&tab[j][0][i], &tab[j][0][i-1],
+                                     &twice, ctx);
+          else
+            point_set (&tab[j][0][i], pts[j]);
+          point_set (&tab[j][1][i], &tab[j][0][i]);
+          ec_subm (tab[j][1][i].y, ctx->p, tab[j][1][i].y, ctx);
+        }
+    }
+  point_free (&twice);
+
+  mpi_set_ui (result->x, 1);
+  mpi_set_ui (result->y, 1);
+  mpi_set_ui (result->z, 0);
+  for (i = nmax - 1; i >= 0; i--)
+    {
+      _gcry_mpi_ec_dup_point (result, result, ctx);
+      d = (unsigned int)i < n1? naf1[i] : 0;
+      if (d > 0)
+        _gcry_mpi_ec_add_points (result, result, &tab[0][0][d/2], ctx);
+      else if (d < 0)
+        _gcry_mpi_ec_add_points (result, result, &tab[0][1][-d/2], ctx);
+      d = (unsigned int)i < n2? naf2[i] : 0;
+      if (d > 0)
+        _gcry_mpi_ec_add_points (result, result, &tab[1][0][d/2], ctx);
+      else if (d < 0)
+        _gcry_mpi_ec_add_points (result, result, &tab[1][1][-d/2], ctx);
+    }
+
+  for (j = 0; j < 2; j++)
+    for (i = 0; i < nodd; i++)
+      {
+        point_free (&tab[j][0][i]);
+        point_free (&tab[j][1][i]);
+      }
+  xfree (naf1);
+  return;
+
+ generic:
+  {
+    mpi_point_struct q1, q2;
+
+    point_init (&q1);
+    point_init (&q2);
+    _gcry_mpi_ec_mul_point (&q1, u1, p1, ctx);
+    _gcry_mpi_ec_mul_point (&q2, u2, p2, ctx);
+    _gcry_mpi_ec_add_points (result, &q1, &q2, ctx);
+    point_free (&q1);
+    point_free (&q2);
+  }
+}
+
+
 /* Return true if POINT is on the curve described by CTX.  */
 int
 _gcry_mpi_ec_curve_point (gcry_mpi_point_t point, mpi_ec_t ctx)
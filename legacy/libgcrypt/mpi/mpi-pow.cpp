@@ -390,6 +390,365 @@ mul_mod (mpi_ptr_t xp, mpi_size_t *xsize_p,
 
 #define SIZE_PRECOMP ((1 << (5 - 1)))
 
+
+/*
+ * Montgomery exponentiation for odd moduli.
+ *
+ * All values are kept as exactly N limbs in Montgomery
+ * representation X*R mod M with R = 2^(N*BITS_PER_MPI_LIMB).  The
+ * reduction after each product is done with REDC, which needs only
+ * limb multiplications instead of the division based
+ * _gcry_mpih_divrem used by mul_mod.  RSA, DSA and ElGamal moduli are
+ * all odd, so this covers every exponentiation done on their behalf.
+ */
+struct mont_ctx
+{
+  mpi_ptr_t mp;                 /* The modulus, N limbs.  */
+  mpi_size_t n;
+  mpi_limb_t minv;              /* -MP^-1 mod 2^BITS_PER_MPI_LIMB.  */
+  mpi_ptr_t tp;                 /* Product scratch, 2 * N + 1 limbs.  */
+  mpi_ptr_t tspace;             /* Squaring scratch, 2 * N limbs.  */
+  struct karatsuba_ctx karactx;
+};
+
+
+/* Return -M0^-1 mod 2^BITS_PER_MPI_LIMB for an odd M0.  */
+static mpi_limb_t
+mont_inverse_limb (mpi_limb_t m0)
+{
+  mpi_limb_t inv = m0;          /* Correct to 3 bits for an odd M0.  */
+  int bits;
+
+  for (bits = 3; bits < BITS_PER_MPI_LIMB; bits *= 2)
+    inv *= 2 - m0 * inv;
+  return (mpi_limb_t)0 - inv;
+}
+
+
+/* RP = TP * R^-1 mod M.  TP has 2 * N + 1 limbs and is destroyed.
+ * The final conditional subtraction is done without branching on the
+ * data.  RP may not overlap TP.  */
+static void
+mont_redc (struct mont_ctx *ctx, mpi_ptr_t rp, mpi_ptr_t tp)
+{
+  mpi_size_t n = ctx->n;
+  mpi_size_t i;
+  mpi_limb_t cy, c, x, borrow, mask;
+
+  c = 0;
+  for (i = 0; i < n; i++)
+    {
+      cy = _gcry_mpih_addmul_1 (tp + i, ctx->mp, n, tp[i] * ctx->minv);
+      x = tp[i + n] + c;
+      c = x < c;
+      x += cy;
+      c += x < cy;
+      tp[i + n] = x;
+    }
+
+  /* The value C:TP[N..2N-1] is below 2M; subtract M once if needed.  */
+  borrow = _gcry_mpih_sub_n (rp, tp + n, ctx->mp, n);
+  mask = ((mpi_limb_t)0) - ((borrow ^ 1) | c);
+  mask = ~mask;
+  for (i = 0; i < n; i++)
+    rp[i] ^= mask & (rp[i] ^ tp[n + i]);
+}
+
+
+/* RP = AP * BP * R^-1 mod M.  RP may be identical to AP or BP.  */
+static void
+mont_mul (struct mont_ctx *ctx, mpi_ptr_t rp, mpi_ptr_t ap, mpi_ptr_t bp)
+{
+  mpi_size_t n = ctx->n;
+
+  if (ap == bp)
+    {
+      if (n < KARATSUBA_THRESHOLD)
+        _gcry_mpih_sqr_n_basecase (ctx->tp, ap, n);
+      else
+        _gcry_mpih_sqr_n (ctx->tp, ap, n, ctx->tspace);
+    }
+  else if (n < KARATSUBA_THRESHOLD)
+    _gcry_mpih_mul (ctx->tp, ap, n, bp, n);
+  else
+    _gcry_mpih_mul_karatsuba_case (ctx->tp, ap, n, bp, n, &ctx->karactx);
+  ctx->tp[2 * n] = 0;
+  mont_redc (ctx, rp, ctx->tp);
+}
+
+
+/* RP = (XP * R) mod M where XP has XSIZE limbs.  MNP is the modulus
+ * shifted left by SHIFT bits, as required by _gcry_mpih_divrem.  SP
+ * is scratch space of at least N + XSIZE + 1 limbs.  */
+static void
+mont_to (struct mont_ctx *ctx, mpi_ptr_t rp, mpi_ptr_t xp, mpi_size_t xsize,
+         mpi_ptr_t mnp, int shift, mpi_ptr_t sp)
+{
+  mpi_size_t n = ctx->n;
+  mpi_size_t ssize = n + xsize;
+
+  MPN_ZERO (sp, n);
+  if (shift)
+    {
+      sp[ssize] = _gcry_mpih_lshift (sp + n, xp, xsize, shift);
+      if (sp[ssize])
+        ssize++;
+    }
+  else
+    MPN_COPY (sp + n, xp, xsize);
+
+  _gcry_mpih_divrem (sp + n, 0, sp, ssize, mnp, n);
+  if (shift)
+    _gcry_mpih_rshift (rp, sp, n, shift);
+  else
+    MPN_COPY (rp, sp, n);
+}
+
+
+/* Return the bits POS+COUNT-1 .. POS of the exponent EP.  COUNT is
+ * less than BITS_PER_MPI_LIMB; bits above ESIZE limbs read as 0.  */
+static mpi_limb_t
+exponent_bits (mpi_ptr_t ep, mpi_size_t esize, unsigned int pos, int count)
+{
+  mpi_size_t i = pos / BITS_PER_MPI_LIMB;
+  unsigned int off = pos % BITS_PER_MPI_LIMB;
+  mpi_limb_t v;
+
+  v = ep[i] >> off;
+  if (off + count > BITS_PER_MPI_LIMB && i + 1 < esize)
+    v |= ep[i + 1] << (BITS_PER_MPI_LIMB - off);
+  return v & ((((mpi_limb_t)1) << count) - 1);
+}
+
+
+/* Copy entry IDX of the N-limb table TABLE with NENTRIES entries to
+ * RP.  Every entry is read so that the memory access pattern does not
+ * depend on IDX.  */
+static void
+mont_table_select (mpi_ptr_t rp, mpi_ptr_t table, mpi_size_t n,
+                   unsigned int nentries, mpi_limb_t idx)
+{
+  unsigned int k;
+  mpi_size_t i;
+  mpi_limb_t mask;
+
+  MPN_ZERO (rp, n);
+  for (k = 0; k < nentries; k++)
+    {
+      mask = ((mpi_limb_t)0) - (mpi_limb_t)(k == idx);
+      for (i = 0; i < n; i++)
+        rp[i] |= table[k * n + i] & mask;
+    }
+}
+
+
+/****************
+ * RES = BASE ^ EXPO mod MOD for an odd MOD and a non-zero EXPO.
+ *
+ * A secret exponent (stored in secure memory) is processed with a
+ * fixed window and a constant-time table lookup, so that the sequence
+ * of squarings and multiplications and the accessed memory do not
+ * depend on the exponent bits.  Public exponents use a sliding window
+ * over odd powers; short ones like 65537 get a window size of 1,
+ * which is plain square-and-multiply without any precomputation.
+ */
+static void
+powm_mont (gcry_mpi_t res, gcry_mpi_t base, gcry_mpi_t expo, gcry_mpi_t mod)
+{
+  struct mont_ctx ctx;
+  mpi_ptr_t ep = expo->d;
+  mpi_size_t esize = expo->nlimbs;
+  mpi_size_t n = mod->nlimbs;
+  mpi_size_t bsize;
+  int esec = mpi_is_secure (expo);
+  int sec = esec || mpi_is_secure (base) || mpi_is_secure (mod);
+  int negative_result;
+  int mod_shift_cnt;
+  int c;
+  unsigned int nbits, W, nentries;
+  unsigned int sp_nlimbs;
+  mpi_ptr_t mnp, sp, bp, table, accp, tmpp;
+  mpi_size_t rsize;
+  int i;
+
+  MPN_NORMALIZE (ep, esize);
+  count_leading_zeros (c, ep[esize - 1]);
+  nbits = esize * BITS_PER_MPI_LIMB - c;
+
+  if (esec)
+    {
+      if (nbits > 512)
+        W = 5;
+      else if (nbits > 256)
+        W = 4;
+      else if (nbits > 64)
+        W = 3;
+      else
+        W = 2;
+    }
+  else
+    {
+      if (nbits > 512)
+        W = 5;
+      else if (nbits > 256)
+        W = 4;
+      else if (nbits > 128)
+        W = 3;
+      else if (nbits > 32)
+        W = 2;
+      else
+        W = 1;
+    }
+  /* Fixed windows use all 2^W digits, sliding windows only the odd
+     ones.  */
+  nentries = esec ? (1 << W) : (1 << (W - 1));
+
+  memset (&ctx, 0, sizeof ctx);
+  ctx.n = n;
+  ctx.mp = mpi_alloc_limb_space (n, sec);
+  MPN_COPY (ctx.mp, mod->d, n);
+  ctx.minv = mont_inverse_limb (ctx.mp[0]);
+  ctx.tp = mpi_alloc_limb_space (2 * n + 1, sec);
+  ctx.tspace = mpi_alloc_limb_space (2 * n, sec);
+
+  /* The normalized modulus is only needed for the conversion into
+     the Montgomery domain.  */
+  mnp = mpi_alloc_limb_space (n, sec);
+  count_leading_zeros (mod_shift_cnt, mod->d[n - 1]);
+  if (mod_shift_cnt)
+    _gcry_mpih_lshift (mnp, mod->d, n, mod_shift_cnt);
+  else
+    MPN_COPY (mnp, mod->d, n);
+
+  bsize = base->nlimbs;
+  sp_nlimbs = (bsize > n ? bsize : n) + n + 1;
+  sp = mpi_alloc_limb_space (sp_nlimbs, sec);
+  bp = mpi_alloc_limb_space (n, sec);
+  table = mpi_alloc_limb_space (nentries * n, sec);
+  accp = mpi_alloc_limb_space (n, sec);
+  tmpp = mpi_alloc_limb_space (n, sec);
+
+  negative_result = (ep[0] & 1) && base->sign;
+
+  /* BP = BASE * R mod M; this also reduces a BASE larger than M.  */
+  {
+    mpi_ptr_t xp = base->d;
+    MPN_NORMALIZE (xp, bsize);
+    if (bsize)
+      mont_to (&ctx, bp, xp, bsize, mnp, mod_shift_cnt, sp);
+    else
+      MPN_ZERO (bp, n);
+  }
+
+  if (esec)
+    {
+      mpi_limb_t one = 1;
+      unsigned int k, nwin, pos;
+
+      /* TABLE[k] = BASE^k * R mod M.  */
+      mont_to (&ctx, table, &one, 1, mnp, mod_shift_cnt, sp);
+      MPN_COPY (table + n, bp, n);
+      for (k = 2; k < nentries; k++)
+        mont_mul (&ctx, table + k * n, table + (k - 1) * n, bp);
+
+      nwin = (nbits + W - 1) / W;
+      pos = (nwin - 1) * W;
+      mont_table_select (accp, table, n, nentries,
+                         exponent_bits (ep, esize, pos, W));
+      while (pos)
+        {
+          pos -= W;
+          for (k = 0; k < W; k++)
+            mont_mul (&ctx, accp, accp, accp);
+          mont_table_select (tmpp, table, n, nentries,
+                             exponent_bits (ep, esize, pos, W));
+          mont_mul (&ctx, accp, accp, tmpp);
+        }
+    }
+  else
+    {
+      unsigned int k;
+      int started = 0;
+
+      /* TABLE[k] = BASE^(2k+1) * R mod M.  */
+      MPN_COPY (table, bp, n);
+      if (nentries > 1)
+        {
+          mont_mul (&ctx, tmpp, bp, bp);
+          for (k = 1; k < nentries; k++)
+            mont_mul (&ctx, table + k * n, table + (k - 1) * n, tmpp);
+        }
+
+      i = nbits - 1;
+      while (i >= 0)
+        {
+          int l;
+          mpi_limb_t digit;
+
+          if (!exponent_bits (ep, esize, i, 1))
+            {
+              mont_mul (&ctx, accp, accp, accp);
+              i--;
+              continue;
+            }
+
+          /* Find the longest window ending in a one bit.  */
+          l = i - (int)W + 1;
+          if (l < 0)
+            l = 0;
+          while (!exponent_bits (ep, esize, l, 1))
+            l++;
+          digit = exponent_bits (ep, esize, l, i - l + 1);
+
+          if (started)
+            {
+              for (k = 0; k < (unsigned int)(i - l + 1); k++)
+                mont_mul (&ctx, accp, accp, accp);
+              mont_mul (&ctx, accp, accp, table + (digit >> 1) * n);
+            }
+          else
+            {
+              MPN_COPY (accp, table + (digit >> 1) * n, n);
+              started = 1;
+            }
+          i = l - 1;
+        }
+    }
+
+  /* Leave the Montgomery domain.  */
+  MPN_ZERO (sp, 2 * n + 1);
+  MPN_COPY (sp, accp, n);
+  mont_redc (&ctx, accp, sp);
+
+  rsize = n;
+  MPN_NORMALIZE (accp, rsize);
+  if (negative_result && rsize)
+    {
+      _gcry_mpih_sub (accp, mod->d, n, accp, rsize);
+      rsize = n;
+      MPN_NORMALIZE (accp, rsize);
+      res->sign = mod->sign;
+    }
+  else
+    res->sign = 0;
+
+  RESIZE_IF_NEEDED (res, n);
+  MPN_COPY (res->d, accp, rsize);
+  res->nlimbs = rsize;
+
+  _gcry_mpih_release_karatsuba_ctx (&ctx.karactx);
+  _gcry_mpi_free_limb_space (ctx.mp, sec ? n : 0);
+  _gcry_mpi_free_limb_space (ctx.tp, sec ? 2 * n + 1 : 0);
+  _gcry_mpi_free_limb_space (ctx.tspace, sec ? 2 * n : 0);
+  _gcry_mpi_free_limb_space (mnp, sec ? n : 0);
+  _gcry_mpi_free_limb_space (sp, sec ? sp_nlimbs : 0);
+  _gcry_mpi_free_limb_space (bp, sec ? n : 0);
+  _gcry_mpi_free_limb_space (table, sec ? nentries * n : 0);
+  _gcry_mpi_free_limb_space (accp, sec ? n : 0);
+  _gcry_mpi_free_limb_space (tmpp, sec ? n : 0);
+}
+
+
 /****************
  * RES = BASE ^ EXPO mod MOD
  *
@@ -474,6 +833,14 @@ _gcry_mpi_powm (gcry_mpi_t res,
       goto leave;
     }
 
+  /* Odd moduli are handled by Montgomery multiplication, which avoids
+     the long division after every product.  */
+  if ((mod->d[0] & 1))
+    {
+      powm_mont (res, base, expo, mod);
+      goto leave;
+    }
+
   /* Normalize MOD (i.e. make its most significant bit set) as
      required by mpn_divrem.  This will make the intermediate values
      in the calculation slightly larger, but the correct result is
@@ -75,6 +75,10 @@ gpg_error_t _gcry_rngdrbg_add_bytes (const void *buf, size_t buflen,
                                       int quality);
 void _gcry_rngdrbg_randomize (void *buffer, size_t length,
                               enum gcry_random_level level);
+int  _gcry_rngdrbg_randomize_local (void *buffer, size_t length,
+                                    void (*seed_fnc) (void *buffer,
+                                                      size_t length));
+void _gcry_rngdrbg_invalidate_local (void);
 gpg_error_t _gcry_rngdrbg_selftest (selftest_report_func_t report);
 
 /*-- random-system.c --*/
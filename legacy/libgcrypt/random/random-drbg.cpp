@@ -151,6 +151,9 @@
 #include <stdint.h>
 
 #include <config.h>
+#ifdef HAVE_PTHREAD
+# include <pthread.h>
+#endif
 
 #include "g10lib.h"
 #include "random.h"
@@ -325,6 +328,9 @@ struct drbg_state_s
   const struct drbg_state_ops_s *d_ops;
   const struct drbg_core_s *core;
   struct drbg_test_data_s *test_data;
+  /* If set, the seed is taken from this function instead of the
+   * entropy gatherer.  Used by the per-thread instances.  */
+  void (*seed_fnc) (void *buffer, size_t length);
 };
 
 enum drbg_prefixes
@@ -615,6 +621,12 @@ drbg_get_entropy (drbg_state_t drbg, unsigned char *buffer,
   if (drbg->test_data && drbg->test_data->fail_seed_source)
     return -1;
 
+  if (drbg->seed_fnc)
+    {
+      drbg->seed_fnc (buffer, len);
+      return 0;
+    }
+
   read_cb_buffer = buffer;
   read_cb_size = len;
   read_cb_len = 0;
@@ -1793,6 +1805,225 @@ _drbg_init_internal (u32 flags, drbg_string_t *pers)
   return ret;
 }
 
+#ifdef HAVE_PTHREAD
+/*
+ * Per-thread DRBG instances
+ *
+ * Taking the global RNG lock for every nonce or session key does not
+ * scale with the number of threads.  Thus each thread gets its own
+ * DRBG of the default type which is seeded from the master generator
+ * (via SEED_FNC) and afterwards runs without any locking.  An instance
+ * is reseeded from the master after a fork, after DRBG_LOCAL_RESEED
+ * bytes of output, and when the master has been re-initialized or got
+ * new entropy (see _gcry_rngdrbg_invalidate_local).  Small requests
+ * are served from a buffer which is refilled with a single generate
+ * call; consumed bytes are wiped.
+ */
+#define DRBG_LOCAL_BUFSIZE 256
+#define DRBG_LOCAL_SMALL   32
+#define DRBG_LOCAL_RESEED  (1024*1024)
+
+struct drbg_local_s
+{
+  struct drbg_state_s drbg;
+  pid_t pid;                  /* Process which seeded the instance.  */
+  unsigned int generation;    /* DRBG_LOCAL_GENERATION at seed time.  */
+  size_t nbytes;              /* Bytes generated since the last seed.  */
+  size_t bufpos;              /* Start of the unused bytes in BUF.  */
+  unsigned char buf[DRBG_LOCAL_BUFSIZE];
+};
+typedef struct drbg_local_s *drbg_local_t;
+
+static pthread_key_t drbg_local_key;
+static pthread_once_t drbg_local_once = PTHREAD_ONCE_INIT;
+static int drbg_local_key_okay;
+
+/* Incremented to force a reseed of all per-thread instances.  */
+static volatile unsigned int drbg_local_generation;
+
+/* Statistics; protected by DRBG_LOCK_VAR.  */
+static struct
+{
+  unsigned long instances;   /* Instances created.  */
+  unsigned long reseeds;     /* Reseeds from the master.  */
+  unsigned long forks;       /* Reseeds due to a fork.  */
+  unsigned long long bytes;  /* Bytes generated by retired seeds.  */
+} drbg_local_stats;
+
+
+static void
+drbg_local_account (drbg_local_t loc, int is_fork, int is_new)
+{
+  drbg_lock ();
+  if (is_new)
+    drbg_local_stats.instances++;
+  else
+    drbg_local_stats.reseeds++;
+  if (is_fork)
+    drbg_local_stats.forks++;
+  drbg_local_stats.bytes += loc->nbytes;
+  drbg_unlock ();
+}
+
+
+static void
+drbg_local_destroy (void *opaque)
+{
+  drbg_local_t loc = (drbg_local_t) opaque;
+
+  if (!loc)
+    return;
+  drbg_lock ();
+  drbg_local_stats.bytes += loc->nbytes;
+  drbg_unlock ();
+  drbg_uninstantiate (&loc->drbg);
+  wipememory (loc, sizeof *loc);
+  xfree (loc);
+}
+
+
+static void
+drbg_local_key_init (void)
+{
+  if (!pthread_key_create (&drbg_local_key, drbg_local_destroy))
+    drbg_local_key_okay = 1;
+}
+
+
+/* Return the instance of the calling thread, creating it if needed.
+ * Returns NULL if no instance can be provided.  */
+static drbg_local_t
+drbg_local_get (void (*seed_fnc) (void *buffer, size_t length))
+{
+  drbg_local_t loc;
+  int coreref;
+
+  pthread_once (&drbg_local_once, drbg_local_key_init);
+  if (!drbg_local_key_okay)
+    return NULL;
+
+  loc = (drbg_local_t) pthread_getspecific (drbg_local_key);
+  if (loc)
+    return loc;
+
+  if (drbg_algo_available (DRBG_DEFAULT_TYPE, &coreref))
+    return NULL;
+  loc = (drbg_local_t) xtrycalloc_secure (1, sizeof *loc);
+  if (!loc)
+    return NULL;
+  loc->drbg.seed_fnc = seed_fnc;
+  loc->generation = drbg_local_generation;
+  if (drbg_instantiate (&loc->drbg, NULL, coreref, 0))
+    {
+      xfree (loc);
+      return NULL;
+    }
+  if (pthread_setspecific (drbg_local_key, loc))
+    {
+      drbg_uninstantiate (&loc->drbg);
+      xfree (loc);
+      return NULL;
+    }
+  loc->pid = getpid ();
+  loc->bufpos = DRBG_LOCAL_BUFSIZE;
+  drbg_local_account (loc, 0, 1);
+  return loc;
+}
+
+
+/* Fill BUFFER with LENGTH random bytes from the DRBG of the calling
+ * thread.  SEED_FNC is used to seed that DRBG from the master
+ * generator; it is called without any lock held.  Returns 0 on
+ * success or -1 if the caller shall fall back to the master
+ * generator.  */
+int
+_gcry_rngdrbg_randomize_local (void *buffer, size_t length,
+                               void (*seed_fnc) (void *buffer, size_t length))
+{
+  drbg_local_t loc;
+  unsigned char *p = (unsigned char *) buffer;
+  pid_t pid;
+  int is_fork;
+  size_t n;
+
+  if (!length)
+    return 0;
+
+  loc = drbg_local_get (seed_fnc);
+  if (!loc)
+    return -1;
+
+  pid = getpid ();
+  is_fork = (loc->pid != pid);
+  if (is_fork || loc->generation != drbg_local_generation
+      || loc->nbytes >= DRBG_LOCAL_RESEED)
+    {
+      /* Buffered bytes may have been seen by the parent process.  */
+      wipememory (loc->buf, sizeof loc->buf);
+      loc->bufpos = DRBG_LOCAL_BUFSIZE;
+      loc->generation = drbg_local_generation;
+      if (drbg_reseed (&loc->drbg, NULL))
+        return -1;
+      drbg_local_account (loc, is_fork, 0);
+      loc->pid = pid;
+      loc->nbytes = 0;
+    }
+
+  if (length > DRBG_LOCAL_SMALL)
+    {
+      if (drbg_generate_long (&loc->drbg, p, (unsigned int)length, NULL))
+        return -1;
+      loc->nbytes += length;
+      return 0;
+    }
+
+  while (length)
+    {
+      if (loc->bufpos == DRBG_LOCAL_BUFSIZE)
+        {
+          if (drbg_generate (&loc->drbg, loc->buf, DRBG_LOCAL_BUFSIZE, NULL))
+            return -1;
+          loc->nbytes += DRBG_LOCAL_BUFSIZE;
+          loc->bufpos = 0;
+        }
+      n = DRBG_LOCAL_BUFSIZE - loc->bufpos;
+      if (n > length)
+        n = length;
+      memcpy (p, loc->buf + loc->bufpos, n);
+      wipememory (loc->buf + loc->bufpos, n);
+      loc->bufpos += n;
+      p += n;
+      length -= n;
+    }
+  return 0;
+}
+
+#else /*!HAVE_PTHREAD*/
+
+int
+_gcry_rngdrbg_randomize_local (void *buffer, size_t length,
+                               void (*seed_fnc) (void *buffer, size_t length))
+{
+  (void)buffer;
+  (void)length;
+  (void)seed_fnc;
+  return -1;
+}
+
+#endif /*!HAVE_PTHREAD*/
+
+
+/* Force a reseed of all per-thread DRBG instances before their next
+ * use.  This is called when the master generator got new entropy.  */
+void
+_gcry_rngdrbg_invalidate_local (void)
+{
+#ifdef HAVE_PTHREAD
+  drbg_local_generation++;
+#endif
+}
+
+
 /************* calls available to common RNG code **************/
 
 /*
@@ -1855,6 +2086,7 @@ _gcry_rngdrbg_reinit (const char *flagstr, gcry_buffer_t *pers, int npers)
       else
         ret = _drbg_init_internal (flags, NULL);
       drbg_unlock ();
+      _gcry_rngdrbg_invalidate_local ();
     }
   return ret;
 }
@@ -1875,8 +2107,14 @@ _gcry_rngdrbg_close_fds (void)
 void
 _gcry_rngdrbg_dump_stats (void)
 {
-  /* Not yet implemented.  */
-  /* Maybe dumping of reseed counter? */
+#ifdef HAVE_PTHREAD
+  drbg_lock ();
+  log_info ("rndlocal stat: instances=%lu reseeds=%lu forks=%lu"
+            " retired-bytes=%llu\n",
+            drbg_local_stats.instances, drbg_local_stats.reseeds,
+            drbg_local_stats.forks, drbg_local_stats.bytes);
+  drbg_unlock ();
+#endif
 }
 
 /* This function returns true if no real RNG is available or the
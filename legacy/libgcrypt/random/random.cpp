@@ -63,6 +63,17 @@ static struct
 GPGRT_LOCK_DEFINE (nonce_buffer_lock);
 
 
+/* Return true if requests which do not need to come directly from the
+   master generator shall be served by the per-thread DRBGs.  This is
+   not done in FIPS mode and not if the system RNG has been requested
+   explicitly.  */
+static int
+use_local_rng (void)
+{
+  return !fips_mode () && !rng_types.system;
+}
+
+
 
 /* ---  Functions  --- */
 
@@ -277,7 +288,11 @@ _gcry_random_dump_stats (void)
   if (fips_mode ())
     _gcry_rngdrbg_dump_stats ();
   else
-    _gcry_rngcsprng_dump_stats ();
+    {
+      _gcry_rngcsprng_dump_stats ();
+      if (use_local_rng ())
+        _gcry_rngdrbg_dump_stats ();
+    }
 }
 
 
@@ -349,19 +364,30 @@ _gcry_random_add_bytes (const void *buf, size_t buflen, int quality)
   if (fips_mode ())
     return 0; /* No need for this in fips mode.  */
   else if (rng_types.standard)
-    return _gcry_rngcsprng_add_bytes (buf, buflen, quality);
+    {
+      gpg_error_t err = _gcry_rngcsprng_add_bytes (buf, buflen, quality);
+      if (!err)
+        _gcry_rngdrbg_invalidate_local ();
+      return err;
+    }
   else if (rng_types.fips)
     return 0;
   else if (rng_types.system)
     return 0;
   else /* default */
-    return _gcry_rngcsprng_add_bytes (buf, buflen, quality);
+    {
+      gpg_error_t err = _gcry_rngcsprng_add_bytes (buf, buflen, quality);
+      if (!err)
+        _gcry_rngdrbg_invalidate_local ();
+      return err;
+    }
 }
 
 
-/* Helper function.  */
+/* Helper function to run the master generator.  */
 static void
-do_randomize (void *buffer, size_t length, enum gcry_random_level level)
+do_randomize_master (void *buffer, size_t length,
+                     enum gcry_random_level level)
 {
   if (fips_mode ())
     _gcry_rngdrbg_randomize (buffer, length, level);
@@ -375,6 +401,25 @@ do_randomize (void *buffer, size_t length, enum gcry_random_level level)
     _gcry_rngcsprng_randomize (buffer, length, level);
 }
 
+/* Seed function for the per-thread generators.  */
+static void
+seed_local_rng (void *buffer, size_t length)
+{
+  do_randomize_master (buffer, length, GCRY_STRONG_RANDOM);
+}
+
+/* Helper function.  Requests below GCRY_VERY_STRONG_RANDOM are served
+   by a DRBG private to the calling thread which is seeded from the
+   master generator; this avoids taking the global RNG lock.  */
+static void
+do_randomize (void *buffer, size_t length, enum gcry_random_level level)
+{
+  if (level < GCRY_VERY_STRONG_RANDOM && use_local_rng ()
+      && !_gcry_rngdrbg_randomize_local (buffer, length, seed_local_rng))
+    return;
+  do_randomize_master (buffer, length, level);
+}
+
 /* The public function to return random data of the quality LEVEL.
    Returns a pointer to a newly allocated and randomized buffer of
    LEVEL and NBYTES length.  Caller must free the buffer.  */
@@ -512,6 +557,12 @@ _gcry_create_nonce (void *buffer, size_t length)
   /* Make sure we are initialized. */
   _gcry_random_initialize (1);
 
+  /* Nonces are commonly requested in small pieces; the buffered
+     per-thread DRBG serves them without taking any lock.  */
+  if (use_local_rng ()
+      && !_gcry_rngdrbg_randomize_local (buffer, length, seed_local_rng))
+    return;
+
   /* Acquire the nonce buffer lock. */
   err = gpgrt_lock_lock (&nonce_buffer_lock);
   if (err)
@@ -62,9 +62,8 @@ struct mpi_ec_ctx_s
     gcry_mpi_t scratch[11];
 
     /* Helper for fast reduction.  */
-    /*   int nist_nbits; /\* If this is a NIST curve, the # of bits.  *\/ */
-    /*   gcry_mpi_t s[10]; */
-    /*   gcry_mpi_t c; */
+    int nist_nbits;    /* If P is the NIST P-256 or P-384 prime, the
+                          # of bits; otherwise 0.  */
   } t;
 };
 
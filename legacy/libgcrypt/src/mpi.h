@@ -278,6 +278,13 @@ void _gcry_mpi_ec_sub_points (mpi_point_t result,
 void _gcry_mpi_ec_mul_point (mpi_point_t result,
                              gcry_mpi_t scalar, mpi_point_t point,
                              mpi_ec_t ctx);
+void _gcry_mpi_ec_mul_base (mpi_point_t result,
+                            gcry_mpi_t scalar, mpi_point_t G,
+                            mpi_ec_t ctx);
+void _gcry_mpi_ec_mul_point2 (mpi_point_t result,
+                              gcry_mpi_t u1, mpi_point_t p1,
+                              gcry_mpi_t u2, mpi_point_t p2,
+                              mpi_ec_t ctx);
 int  _gcry_mpi_ec_curve_point (gcry_mpi_point_t point, mpi_ec_t ctx);
 
 gcry_mpi_t _gcry_mpi_ec_ec2os (gcry_mpi_point_t point, mpi_ec_t ectx);
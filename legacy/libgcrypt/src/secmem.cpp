@@ -36,6 +36,9 @@
 #include <sys/capability.h>
 #endif
 #endif
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
 
 #include "g10lib.h"
 #include "secmem.h"
@@ -59,6 +62,20 @@ typedef struct memblock
 /* This flag specifies that the memory block is in use.  */
 #define MB_FLAG_ACTIVE (1 << 0)
 
+/* This flag specifies that the memory block belongs to a size class.
+ * The index of the class is stored at MB_CLASS_SHIFT.  Such blocks
+ * stay active while they are on a free list.  */
+#define MB_FLAG_CLASS  (1 << 1)
+
+/* This flag specifies that the memory block is on a free list.  */
+#define MB_FLAG_CACHED (1 << 2)
+
+#define MB_CLASS_SHIFT 8
+#define MB_GET_CLASS(mb) (((mb)->flags >> MB_CLASS_SHIFT) & 0xff)
+
+/* The link of a block on a free list is stored in its user data.  */
+#define MB_NEXT_FREE(mb) (*(memblock_t **) (void *) (mb)->aligned.c)
+
 /* An object describing a memory pool.  */
 typedef struct pooldesc_s
 {
@@ -107,6 +124,56 @@ GPGRT_LOCK_DEFINE (secmem_lock);
 #define SECMEM_LOCK   gpgrt_lock_lock   (&secmem_lock)
 #define SECMEM_UNLOCK gpgrt_lock_unlock (&secmem_lock)
 
+/* Small requests are served from per-class free lists of blocks with
+ * the size of the class.  Those blocks are carved from the pools in
+ * runs of up to SLAB_BLOCKS adjacent blocks, so that the first-fit
+ * scan is only needed once per run.  Larger requests use the
+ * first-fit allocator directly.  */
+#define N_SIZE_CLASSES 6
+#define SLAB_BLOCKS    8
+static const unsigned int size_classes[N_SIZE_CLASSES] =
+  { 32, 64, 128, 256, 512, 1024 };
+
+/* The free lists and their stats; protected by SECMEM_LOCK.  */
+static struct
+{
+  memblock_t *head;
+  unsigned int count;       /* Number of blocks on the list.  */
+  unsigned int nblocks;     /* Number of blocks of this class.  */
+  unsigned long reused;     /* Allocations served from a free list.  */
+} class_lists[N_SIZE_CLASSES];
+
+/* Incremented by _gcry_secmem_term to invalidate the thread caches.  */
+static unsigned int secmem_generation;
+
+#ifdef HAVE_PTHREAD
+/* Each thread keeps a few freed blocks of each class so that the
+ * common free/malloc sequence of MPI temporaries does not need to
+ * take the lock.  The amount is small because blocks in the caches
+ * are only reclaimed when a pool runs out of space.  */
+#define TCACHE_MAX_BLOCKS 8
+#define TCACHE_MAX_BYTES  4096
+
+typedef struct tcache_s
+{
+  struct tcache_s *next;    /* Link for TCACHE_LIST.  */
+  pthread_mutex_t lock;     /* Protects the lists against class_flush.  */
+  unsigned int generation;  /* SECMEM_GENERATION the blocks belong to.  */
+  size_t nbytes;            /* Bytes held in all lists.  */
+  memblock_t *head[N_SIZE_CLASSES];
+  unsigned int count[N_SIZE_CLASSES];
+  unsigned long reused[N_SIZE_CLASSES];
+} tcache_t;
+
+static pthread_key_t tcache_key;
+static pthread_once_t tcache_once = PTHREAD_ONCE_INIT;
+static int tcache_key_okay;
+
+/* All thread caches; protected by SECMEM_LOCK.  Used for the stats
+ * and by class_flush.  */
+static tcache_t *tcache_list;
+#endif /*HAVE_PTHREAD*/
+
 /* The size of the memblock structure; this does not include the
    memory that is available to the user.  */
 #define BLOCK_HEAD_SIZE \
@@ -243,6 +310,332 @@ mb_get_new (pooldesc_t *pool, memblock_t *block, size_t size)
   return mb;
 }
 
+/* Return the index of the size class for requests of SIZE bytes or
+ * -1 if SIZE is too large for a size class.  */
+static int
+size_to_class (size_t size)
+{
+  int i;
+
+  for (i = 0; i < N_SIZE_CLASSES; i++)
+    if (size <= size_classes[i])
+      return i;
+  return -1;
+}
+
+/* Put the block MB on the free list of its class.  */
+static void
+class_push (memblock_t *mb)
+{
+  int cls = MB_GET_CLASS (mb);
+
+  mb->flags |= MB_FLAG_CACHED;
+  MB_NEXT_FREE (mb) = class_lists[cls].head;
+  class_lists[cls].head = mb;
+  class_lists[cls].count++;
+}
+
+/* Take a block from the free list of class CLS.  */
+static memblock_t *
+class_pop (int cls)
+{
+  memblock_t *mb;
+
+  mb = class_lists[cls].head;
+  if (mb)
+    {
+      class_lists[cls].head = MB_NEXT_FREE (mb);
+      class_lists[cls].count--;
+      MB_NEXT_FREE (mb) = NULL;
+      mb->flags &= ~MB_FLAG_CACHED;
+    }
+  return mb;
+}
+
+/* Carve a run of blocks of class CLS from POOL.  The first block is
+ * returned and the others are put on the free list.  Returns NULL if
+ * there is no room in POOL.  */
+static memblock_t *
+mb_get_class_run (pooldesc_t *pool, int cls)
+{
+  size_t size = size_classes[cls];
+  memblock_t *mb = NULL, *first;
+  size_t rest;
+  unsigned int n, i;
+
+  for (n = SLAB_BLOCKS; n; n /= 2)
+    {
+      mb = mb_get_new (pool, (memblock_t *) pool->mem,
+                       n * (BLOCK_HEAD_SIZE + size) - BLOCK_HEAD_SIZE);
+      if (mb)
+        break;
+    }
+  if (!mb)
+    return NULL;
+
+  /* Split the run.  The last block also takes the slack which
+   * mb_get_new leaves if the remainder is too small for a block.  */
+  first = mb;
+  rest = mb->size;
+  for (i = 0; i < n; i++)
+    {
+      if (i + 1 < n)
+        {
+          mb->size = size;
+          rest -= BLOCK_HEAD_SIZE + size;
+        }
+      else
+        mb->size = rest;
+      mb->flags = MB_FLAG_ACTIVE | MB_FLAG_CLASS | (cls << MB_CLASS_SHIFT);
+      stats_update (pool, mb->size, 0);
+      if (i)
+        class_push (mb);
+      if (i + 1 < n)
+        mb = mb_get_next (pool, mb);
+    }
+  class_lists[cls].nblocks += n;
+
+  return first;
+}
+
+/* Return a new block from POOL which can hold SIZE bytes.  CLS is
+ * the size class for SIZE or -1.  */
+static memblock_t *
+pool_get_block (pooldesc_t *pool, size_t size, int cls)
+{
+  memblock_t *mb;
+
+  if (cls >= 0)
+    return mb_get_class_run (pool, cls);
+
+  mb = mb_get_new (pool, (memblock_t *) pool->mem, size);
+  if (mb)
+    stats_update (pool, mb->size, 0);
+  return mb;
+}
+
+/* Return the pool A belongs to or NULL.  No lock is required because
+ * pools are never removed while in use (see _gcry_private_is_secure).  */
+static pooldesc_t *
+ptr_to_pool (const void *a)
+{
+  pooldesc_t *pool;
+
+  for (pool = &mainpool; pool; pool = pool->next)
+    if (pool->okay && ptr_into_pool_p (pool, a))
+      return pool;
+  return NULL;
+}
+
+/* Give the already wiped block MB back to POOL.  */
+static void
+mb_release (pooldesc_t *pool, memblock_t *mb)
+{
+  if ((mb->flags & MB_FLAG_CLASS))
+    class_lists[MB_GET_CLASS (mb)].nblocks--;
+  stats_update (pool, 0, mb->size);
+  mb->flags = 0;
+  mb_merge (pool, mb);
+}
+
+
+#ifdef HAVE_PTHREAD
+static void tcache_destroy (void *opaque);
+
+static void
+tcache_key_init (void)
+{
+  if (!pthread_key_create (&tcache_key, tcache_destroy))
+    tcache_key_okay = 1;
+}
+
+/* Return the cache of the calling thread with its lock taken or
+ * NULL if it has none or another thread is flushing it.  With CREATE
+ * set a new cache is allocated; the lock must not be held in this
+ * case.  */
+static tcache_t *
+tcache_lock (int create)
+{
+  tcache_t *tc;
+
+  pthread_once (&tcache_once, tcache_key_init);
+  if (!tcache_key_okay)
+    return NULL;
+
+  tc = (tcache_t *) pthread_getspecific (tcache_key);
+  if (!tc && create)
+    {
+      tc = (tcache_t *) calloc (1, sizeof *tc);
+      if (!tc)
+        return NULL;
+      tc->generation = secmem_generation;
+      if (pthread_mutex_init (&tc->lock, NULL))
+        {
+          free (tc);
+          return NULL;
+        }
+      if (pthread_setspecific (tcache_key, tc))
+        {
+          pthread_mutex_destroy (&tc->lock);
+          free (tc);
+          return NULL;
+        }
+      SECMEM_LOCK;
+      tc->next = tcache_list;
+      tcache_list = tc;
+      SECMEM_UNLOCK;
+    }
+  /* Never wait here: class_flush takes this lock while holding
+   * SECMEM_LOCK.  */
+  if (!tc || pthread_mutex_trylock (&tc->lock))
+    return NULL;
+
+  if (tc->generation != secmem_generation)
+    {
+      /* The pools have been released by _gcry_secmem_term.  */
+      memset (tc->head, 0, sizeof tc->head);
+      memset (tc->count, 0, sizeof tc->count);
+      tc->nbytes = 0;
+      tc->generation = secmem_generation;
+    }
+  return tc;
+}
+
+/* Put the wiped class block MB into the cache of the calling thread.
+ * Returns true on success.  */
+static int
+tcache_put (memblock_t *mb)
+{
+  tcache_t *tc;
+  int cls = MB_GET_CLASS (mb);
+
+  tc = tcache_lock (1);
+  if (!tc)
+    return 0;
+  if (tc->count[cls] >= TCACHE_MAX_BLOCKS
+      || tc->nbytes + mb->size > TCACHE_MAX_BYTES)
+    {
+      pthread_mutex_unlock (&tc->lock);
+      return 0;
+    }
+
+  mb->flags |= MB_FLAG_CACHED;
+  MB_NEXT_FREE (mb) = tc->head[cls];
+  tc->head[cls] = mb;
+  tc->count[cls]++;
+  tc->nbytes += mb->size;
+  pthread_mutex_unlock (&tc->lock);
+  return 1;
+}
+
+/* Take a block of class CLS from the cache of the calling thread.  */
+static memblock_t *
+tcache_take (int cls)
+{
+  tcache_t *tc;
+  memblock_t *mb;
+
+  tc = tcache_lock (0);
+  if (!tc)
+    return NULL;
+
+  mb = tc->head[cls];
+  if (mb)
+    {
+      tc->head[cls] = MB_NEXT_FREE (mb);
+      tc->count[cls]--;
+      tc->nbytes -= mb->size;
+      tc->reused[cls]++;
+      MB_NEXT_FREE (mb) = NULL;
+      mb->flags &= ~MB_FLAG_CACHED;
+    }
+  pthread_mutex_unlock (&tc->lock);
+  return mb;
+}
+
+/* Move all blocks of the cache TC to the global free lists.  Must be
+ * called with the lock held and the cache either locked or owned by
+ * the calling thread.  */
+static void
+tcache_drain (tcache_t *tc)
+{
+  memblock_t *mb;
+  int cls;
+
+  if (!tc)
+    return;
+  for (cls = 0; cls < N_SIZE_CLASSES; cls++)
+    {
+      while ((mb = tc->head[cls]))
+        {
+          tc->head[cls] = MB_NEXT_FREE (mb);
+          class_push (mb);
+        }
+      tc->count[cls] = 0;
+    }
+  tc->nbytes = 0;
+}
+
+/* Thread exit handler for the cache.  */
+static void
+tcache_destroy (void *opaque)
+{
+  tcache_t *tc = (tcache_t *) opaque;
+  tcache_t **tcp;
+  int cls;
+
+  SECMEM_LOCK;
+  if (tc->generation == secmem_generation)
+    tcache_drain (tc);
+  for (cls = 0; cls < N_SIZE_CLASSES; cls++)
+    class_lists[cls].reused += tc->reused[cls];
+  for (tcp = &tcache_list; *tcp; tcp = &(*tcp)->next)
+    if (*tcp == tc)
+      {
+        *tcp = tc->next;
+        break;
+      }
+  SECMEM_UNLOCK;
+  pthread_mutex_destroy (&tc->lock);
+  free (tc);
+}
+#endif /*HAVE_PTHREAD*/
+
+
+/* Return all blocks on the free lists, including those in the
+ * caches of all threads, to their pools.  Must be called with the
+ * lock held.  Returns true if any block has been released.  */
+static int
+class_flush (void)
+{
+  pooldesc_t *pool;
+  memblock_t *mb;
+  int cls, any = 0;
+#ifdef HAVE_PTHREAD
+  tcache_t *tc;
+
+  /* A cache which its thread is just using is skipped; it holds only
+   * a few blocks.  */
+  for (tc = tcache_list; tc; tc = tc->next)
+    if (!pthread_mutex_trylock (&tc->lock))
+      {
+        if (tc->generation == secmem_generation)
+          tcache_drain (tc);
+        pthread_mutex_unlock (&tc->lock);
+      }
+#endif
+  for (cls = 0; cls < N_SIZE_CLASSES; cls++)
+    while ((mb = class_pop (cls)))
+      {
+        pool = ptr_to_pool (mb);
+        if (pool)
+          mb_release (pool, mb);
+        any = 1;
+      }
+  return any;
+}
+
+
 /* Print a warning message.  */
 static void
 print_warn (void)
@@ -452,6 +845,46 @@ init_pool (pooldesc_t *pool, size_t n)
   mb->flags = 0;
 }
 
+/* Allocate the memory for the overflow pool POOL of POOL->SIZE bytes
+ * and try to lock it.  Unlike the main pool a failure to lock is not
+ * recorded; overflow pools have always been allowed to be unlocked.
+ * Returns true if the memory has been locked.  */
+static int
+init_overflow_pool (pooldesc_t *pool)
+{
+  int locked = 0;
+
+#if HAVE_MMAP && defined (MAP_ANONYMOUS)
+  {
+    size_t pgsize;
+    long int pgsize_val;
+
+    pgsize_val = sysconf (_SC_PAGESIZE);
+    pgsize = (pgsize_val != -1 && pgsize_val > 0)? pgsize_val:DEFAULT_PAGE_SIZE;
+
+    pool->size = (pool->size + pgsize - 1) & ~(pgsize - 1);
+    pool->mem = mmap (0, pool->size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (pool->mem == (void *) -1)
+      pool->mem = NULL;
+    else
+      pool->is_mmapped = 1;
+  }
+#endif /*HAVE_MMAP*/
+
+  if (!pool->mem)
+    pool->mem = malloc (pool->size);
+  if (!pool->mem)
+    return 0;
+
+#ifdef HAVE_MLOCK
+  if (!no_mlock && !not_locked && !mlock (pool->mem, pool->size))
+    locked = 1;
+#endif
+
+  return locked;
+}
+
 void
 _gcry_secmem_set_flags (unsigned flags)
 {
@@ -571,6 +1004,8 @@ _gcry_secmem_malloc_internal (size_t size, int xhint)
 {
   pooldesc_t *pool;
   memblock_t *mb;
+  int cls;
+  int locked;
 
   pool = &mainpool;
 
@@ -598,16 +1033,28 @@ _gcry_secmem_malloc_internal (size_t size, int xhint)
       print_warn ();
     }
 
-  /* Blocks are always a multiple of 32. */
-  size = ((size + 31) / 32) * 32;
-
-  mb = mb_get_new (pool, (memblock_t *) pool->mem, size);
-  if (mb)
+  cls = size_to_class (size);
+  if (cls >= 0)
     {
-      stats_update (pool, mb->size, 0);
-      return &mb->aligned.c;
+      mb = class_pop (cls);
+      if (mb)
+        {
+          class_lists[cls].reused++;
+          return &mb->aligned.c;
+        }
+    }
+  else
+    {
+      /* Blocks are always a multiple of 32. */
+      size = ((size + 31) / 32) * 32;
     }
 
+  mb = pool_get_block (pool, size, cls);
+  if (!mb && class_flush ())
+    mb = pool_get_block (pool, size, cls);
+  if (mb)
+    return &mb->aligned.c;
+
   /* If we are called from xmalloc style function resort to the
    * overflow pools to return memory.  We don't do this in FIPS mode,
    * though. */
@@ -615,12 +1062,9 @@ _gcry_secmem_malloc_internal (size_t size, int xhint)
     {
       for (pool = pool->next; pool; pool = pool->next)
         {
-          mb = mb_get_new (pool, (memblock_t *) pool->mem, size);
+          mb = pool_get_block (pool, size, cls);
           if (mb)
-            {
-              stats_update (pool, mb->size, 0);
-              return &mb->aligned.c;
-            }
+            return &mb->aligned.c;
         }
       /* Allocate a new overflow pool.  We put a new pool right after
        * the mainpool so that the next allocation will happen in that
@@ -630,9 +1074,14 @@ _gcry_secmem_malloc_internal (size_t size, int xhint)
       if (!pool)
         return NULL;  /* Not enough memory for a new pool descriptor.  */
       pool->size = STANDARD_POOL_SIZE;
-      pool->mem = malloc (pool->size);
+      if (size > pool->size - BLOCK_HEAD_SIZE)
+        pool->size = size + BLOCK_HEAD_SIZE;
+      locked = init_overflow_pool (pool);
       if (!pool->mem)
-        return NULL; /* Not enough memory available for a new pool.  */
+        {
+          free (pool);
+          return NULL; /* Not enough memory available for a new pool.  */
+        }
       /* Initialize first memory block.  */
       mb = (memblock_t *) pool->mem;
       mb->size = pool->size - BLOCK_HEAD_SIZE;
@@ -645,18 +1094,15 @@ _gcry_secmem_malloc_internal (size_t size, int xhint)
       pool->next = mainpool.next;
       mainpool.next = pool;
 
-      /* After the first time we allocated an overflow pool, print a
-       * warning.  */
-      if (!pool->next)
+      /* After the first time we allocated an overflow pool which
+       * could not be locked, print a warning.  */
+      if (!pool->next && !locked)
         print_warn ();
 
       /* Allocate.  */
-      mb = mb_get_new (pool, (memblock_t *) pool->mem, size);
+      mb = pool_get_block (pool, size, cls);
       if (mb)
-        {
-          stats_update (pool, mb->size, 0);
-          return &mb->aligned.c;
-        }
+        return &mb->aligned.c;
     }
 
   return NULL;
@@ -669,6 +1115,17 @@ void *
 _gcry_secmem_malloc (size_t size, int xhint)
 {
   void *p;
+#ifdef HAVE_PTHREAD
+  memblock_t *mb;
+  int cls;
+
+  /* Try the cache of this thread first.  A non-empty cache implies
+   * that the pool has been initialized and used before.  */
+  cls = size_to_class (size);
+  if (cls >= 0 && !(not_locked && fips_mode ())
+      && (mb = tcache_take (cls)))
+    return &mb->aligned.c;
+#endif /*HAVE_PTHREAD*/
 
   SECMEM_LOCK;
   p = _gcry_secmem_malloc_internal (size, xhint);
@@ -677,21 +1134,11 @@ _gcry_secmem_malloc (size_t size, int xhint)
   return p;
 }
 
-static int
-_gcry_secmem_free_internal (void *a)
+/* Wipe out the user data of MB.  */
+static void
+mb_wipe (memblock_t *mb)
 {
-  pooldesc_t *pool;
-  memblock_t *mb;
-  int size;
-
-  for (pool = &mainpool; pool; pool = pool->next)
-    if (pool->okay && ptr_into_pool_p (pool, a))
-      break;
-  if (!pool)
-    return 0; /* A does not belong to use.  */
-
-  mb = ADDR_TO_BLOCK (a);
-  size = mb->size;
+  size_t size = mb->size;
 
   /* This does not make much sense: probably this memory is held in the
    * cache. We do it anyway: */
@@ -702,13 +1149,32 @@ _gcry_secmem_free_internal (void *a)
   MB_WIPE_OUT (0xaa);
   MB_WIPE_OUT (0x55);
   MB_WIPE_OUT (0x00);
+}
 
-  /* Update stats.  */
-  stats_update (pool, 0, size);
+/* Put the wiped block MB of POOL on its free list or back into
+ * POOL.  Must be called with the lock held.  */
+static void
+mb_put (pooldesc_t *pool, memblock_t *mb)
+{
+  if ((mb->flags & MB_FLAG_CLASS))
+    class_push (mb);
+  else
+    mb_release (pool, mb);
+}
 
-  mb->flags &= ~MB_FLAG_ACTIVE;
+static int
+_gcry_secmem_free_internal (void *a)
+{
+  pooldesc_t *pool;
+  memblock_t *mb;
 
-  mb_merge (pool, mb);
+  pool = ptr_to_pool (a);
+  if (!pool)
+    return 0; /* A does not belong to use.  */
+
+  mb = ADDR_TO_BLOCK (a);
+  mb_wipe (mb);
+  mb_put (pool, mb);
 
   return 1; /* Freed.  */
 }
@@ -719,15 +1185,29 @@ _gcry_secmem_free_internal (void *a)
 int
 _gcry_secmem_free (void *a)
 {
-  int mine;
+  pooldesc_t *pool;
+  memblock_t *mb;
 
   if (!a)
     return 1; /* Tell caller that we handled it.  */
 
+  /* The block still belongs to the caller, thus it can be wiped
+   * without holding the lock.  */
+  pool = ptr_to_pool (a);
+  if (!pool)
+    return 0;
+  mb = ADDR_TO_BLOCK (a);
+  mb_wipe (mb);
+
+#ifdef HAVE_PTHREAD
+  if ((mb->flags & MB_FLAG_CLASS) && tcache_put (mb))
+    return 1;
+#endif
+
   SECMEM_LOCK;
-  mine = _gcry_secmem_free_internal (a);
+  mb_put (pool, mb);
   SECMEM_UNLOCK;
-  return mine;
+  return 1;
 }
 
 
@@ -832,17 +1312,30 @@ _gcry_secmem_term ()
     }
   mainpool.next = NULL;
   not_locked = 0;
+
+  /* The blocks on the free lists are gone with the pools.  */
+  memset (class_lists, 0, sizeof class_lists);
+  secmem_generation++;
 }
 
 
 /* Print stats of the secmem allocator.  With EXTENDED passwed as true
- * a detiled listing is returned (used for testing).  */
+ * a detiled listing is returned (used for testing).  Blocks held on
+ * the free lists of the size classes or in a thread cache are not
+ * counted as used but listed separately.  The numbers for the thread
+ * caches are taken without their owners' cooperation and are thus
+ * only approximate.  */
 void
 _gcry_secmem_dump_stats (int extended)
 {
   pooldesc_t *pool;
   memblock_t *mb;
   int i, poolno;
+  unsigned int cached, cached_bytes;
+  unsigned long reused;
+#ifdef HAVE_PTHREAD
+  tcache_t *tc;
+#endif
 
   SECMEM_LOCK;
 
@@ -850,11 +1343,26 @@ _gcry_secmem_dump_stats (int extended)
     {
       if (!extended)
         {
-          if (pool->okay)
-            log_info ("%-13s %u/%lu bytes in %u blocks\n",
-                      pool == &mainpool? "secmem usage:":"",
-                      pool->cur_alloced, (unsigned long)pool->size,
-                      pool->cur_blocks);
+          if (!pool->okay)
+            continue;
+          cached = cached_bytes = 0;
+          for (mb = (memblock_t *) pool->mem;
+               ptr_into_pool_p (pool, mb);
+               mb = mb_get_next (pool, mb))
+            if ((mb->flags & MB_FLAG_CACHED))
+              {
+                cached++;
+                cached_bytes += mb->size;
+              }
+          /* The counters of the pool still include the cached blocks;
+           * guard against a racing thread cache.  */
+          if (cached > pool->cur_blocks || cached_bytes > pool->cur_alloced)
+            cached = pool->cur_blocks, cached_bytes = pool->cur_alloced;
+          log_info ("%-13s %u/%lu bytes in %u blocks, %u bytes in %u cached\n",
+                    pool == &mainpool? "secmem usage:":"",
+                    pool->cur_alloced - cached_bytes,
+                    (unsigned long)pool->size,
+                    pool->cur_blocks - cached, cached_bytes, cached);
         }
       else
         {
@@ -863,10 +1371,30 @@ _gcry_secmem_dump_stats (int extended)
                mb = mb_get_next (pool, mb), i++)
             log_info ("SECMEM: pool %d %s block %i size %i\n",
                       poolno,
+                      (mb->flags & MB_FLAG_CACHED) ? "cached" :
                       (mb->flags & MB_FLAG_ACTIVE) ? "used" : "free",
                       i,
                       mb->size);
         }
     }
+
+  for (i = 0; i < N_SIZE_CLASSES; i++)
+    {
+      if (!class_lists[i].nblocks)
+        continue;
+      cached = class_lists[i].count;
+      reused = class_lists[i].reused;
+#ifdef HAVE_PTHREAD
+      for (tc = tcache_list; tc; tc = tc->next)
+        {
+          if (tc->generation == secmem_generation)
+            cached += tc->count[i];
+          reused += tc->reused[i];
+        }
+#endif
+      log_info ("%-13s class %4u: %u blocks, %u cached, %lu reused\n",
+                "", size_classes[i], class_lists[i].nblocks, cached, reused);
+    }
+
   SECMEM_UNLOCK;
 }
@@ -34,7 +34,6 @@
 #define PGM "bench-slope"
 #include "t-common.h"
 
-static int verbose;
 static int csv_mode;
 static int unaligned_mode;
 static int num_measurement_repetitions;
@@ -793,7 +792,7 @@ bench_xts_encrypt_do_bench (struct bench_obj *obj, void *buf, size_t buflen)
 {
   gcry_cipher_hd_t hd = obj->priv;
   unsigned int pos;
-  static const char tweak[16] = { 0xff, 0xff, 0xfe, };
+  static const unsigned char tweak[16] = { 0xff, 0xff, 0xfe, };
   size_t sectorlen = obj->step_size;
   char *cbuf = buf;
   int err;
@@ -820,7 +819,7 @@ bench_xts_decrypt_do_bench (struct bench_obj *obj, void *buf, size_t buflen)
 {
   gcry_cipher_hd_t hd = obj->priv;
   unsigned int pos;
-  static const char tweak[16] = { 0xff, 0xff, 0xfe, };
+  static const unsigned char tweak[16] = { 0xff, 0xff, 0xfe, };
   size_t sectorlen = obj->step_size;
   char *cbuf = buf;
   int err;
@@ -861,7 +860,7 @@ bench_ccm_encrypt_do_bench (struct bench_obj *obj, void *buf, size_t buflen)
   gcry_cipher_hd_t hd = obj->priv;
   int err;
   char tag[8];
-  char nonce[11] = { 0x80, 0x01, };
+  unsigned char nonce[11] = { 0x80, 0x01, };
   u64 params[3];
 
   gcry_cipher_setiv (hd, nonce, sizeof (nonce));
@@ -905,7 +904,7 @@ bench_ccm_decrypt_do_bench (struct bench_obj *obj, void *buf, size_t buflen)
   gcry_cipher_hd_t hd = obj->priv;
   int err;
   char tag[8] = { 0, };
-  char nonce[11] = { 0x80, 0x01, };
+  unsigned char nonce[11] = { 0x80, 0x01, };
   u64 params[3];
 
   gcry_cipher_setiv (hd, nonce, sizeof (nonce));
@@ -934,8 +933,8 @@ bench_ccm_decrypt_do_bench (struct bench_obj *obj, void *buf, size_t buflen)
     }
 
   err = gcry_cipher_checktag (hd, tag, sizeof (tag));
-  if (gpg_err_code (err) == GPG_ERR_CHECKSUM)
-    err = gpg_error (GPG_ERR_NO_ERROR);
+  if (err == GPG_ERR_CHECKSUM)
+    err = GPG_ERR_NO_ERROR;
   if (err)
     {
       fprintf (stderr, PGM ": gcry_cipher_gettag failed: %s\n",
@@ -952,7 +951,7 @@ bench_ccm_authenticate_do_bench (struct bench_obj *obj, void *buf,
   gcry_cipher_hd_t hd = obj->priv;
   int err;
   char tag[8] = { 0, };
-  char nonce[11] = { 0x80, 0x01, };
+  unsigned char nonce[11] = { 0x80, 0x01, };
   u64 params[3];
   char data = 0xff;
 
@@ -1021,7 +1020,7 @@ static struct bench_ops ccm_authenticate_ops = {
 
 static void
 bench_aead_encrypt_do_bench (struct bench_obj *obj, void *buf, size_t buflen,
-			     const char *nonce, size_t noncelen)
+			     const unsigned char *nonce, size_t noncelen)
 {
   gcry_cipher_hd_t hd = obj->priv;
   int err;
@@ -1051,7 +1050,7 @@ bench_aead_encrypt_do_bench (struct bench_obj *obj, void *buf, size_t buflen,
 
 static void
 bench_aead_decrypt_do_bench (struct bench_obj *obj, void *buf, size_t buflen,
-			     const char *nonce, size_t noncelen)
+			     const unsigned char *nonce, size_t noncelen)
 {
   gcry_cipher_hd_t hd = obj->priv;
   int err;
@@ -1070,8 +1069,8 @@ bench_aead_decrypt_do_bench (struct bench_obj *obj, void *buf, size_t buflen,
     }
 
   err = gcry_cipher_checktag (hd, tag, sizeof (tag));
-  if (gpg_err_code (err) == GPG_ERR_CHECKSUM)
-    err = gpg_error (GPG_ERR_NO_ERROR);
+  if (err == GPG_ERR_CHECKSUM)
+    err = GPG_ERR_NO_ERROR;
   if (err)
     {
       fprintf (stderr, PGM ": gcry_cipher_gettag failed: %s\n",
@@ -1083,7 +1082,7 @@ bench_aead_decrypt_do_bench (struct bench_obj *obj, void *buf, size_t buflen,
 
 static void
 bench_aead_authenticate_do_bench (struct bench_obj *obj, void *buf,
-				  size_t buflen, const char *nonce,
+				  size_t buflen, const unsigned char *nonce,
 				  size_t noncelen)
 {
   gcry_cipher_hd_t hd = obj->priv;
@@ -1134,8 +1133,8 @@ static void
 bench_gcm_encrypt_do_bench (struct bench_obj *obj, void *buf,
 			    size_t buflen)
 {
-  char nonce[12] = { 0xca, 0xfe, 0xba, 0xbe, 0xfa, 0xce,
-                     0xdb, 0xad, 0xde, 0xca, 0xf8, 0x88 };
+  unsigned char nonce[12] = { 0xca, 0xfe, 0xba, 0xbe, 0xfa, 0xce,
+                              0xdb, 0xad, 0xde, 0xca, 0xf8, 0x88 };
   bench_aead_encrypt_do_bench (obj, buf, buflen, nonce, sizeof(nonce));
 }
 
@@ -1143,8 +1142,8 @@ static void
 bench_gcm_decrypt_do_bench (struct bench_obj *obj, void *buf,
 			    size_t buflen)
 {
-  char nonce[12] = { 0xca, 0xfe, 0xba, 0xbe, 0xfa, 0xce,
-                     0xdb, 0xad, 0xde, 0xca, 0xf8, 0x88 };
+  unsigned char nonce[12] = { 0xca, 0xfe, 0xba, 0xbe, 0xfa, 0xce,
+                              0xdb, 0xad, 0xde, 0xca, 0xf8, 0x88 };
   bench_aead_decrypt_do_bench (obj, buf, buflen, nonce, sizeof(nonce));
 }
 
@@ -1152,8 +1151,8 @@ static void
 bench_gcm_authenticate_do_bench (struct bench_obj *obj, void *buf,
 				 size_t buflen)
 {
-  char nonce[12] = { 0xca, 0xfe, 0xba, 0xbe, 0xfa, 0xce,
-                     0xdb, 0xad, 0xde, 0xca, 0xf8, 0x88 };
+  unsigned char nonce[12] = { 0xca, 0xfe, 0xba, 0xbe, 0xfa, 0xce,
+                              0xdb, 0xad, 0xde, 0xca, 0xf8, 0x88 };
   bench_aead_authenticate_do_bench (obj, buf, buflen, nonce, sizeof(nonce));
 }
 
@@ -1180,9 +1179,9 @@ static void
 bench_ocb_encrypt_do_bench (struct bench_obj *obj, void *buf,
 			    size_t buflen)
 {
-  char nonce[15] = { 0xca, 0xfe, 0xba, 0xbe, 0xfa, 0xce,
-                     0xdb, 0xad, 0xde, 0xca, 0xf8, 0x88,
-                     0x00, 0x00, 0x01 };
+  unsigned char nonce[15] = { 0xca, 0xfe, 0xba, 0xbe, 0xfa, 0xce,
+                              0xdb, 0xad, 0xde, 0xca, 0xf8, 0x88,
+                              0x00, 0x00, 0x01 };
   bench_aead_encrypt_do_bench (obj, buf, buflen, nonce, sizeof(nonce));
 }
 
@@ -1190,9 +1189,9 @@ static void
 bench_ocb_decrypt_do_bench (struct bench_obj *obj, void *buf,
 			    size_t buflen)
 {
-  char nonce[15] = { 0xca, 0xfe, 0xba, 0xbe, 0xfa, 0xce,
-                     0xdb, 0xad, 0xde, 0xca, 0xf8, 0x88,
-                     0x00, 0x00, 0x01 };
+  unsigned char nonce[15] = { 0xca, 0xfe, 0xba, 0xbe, 0xfa, 0xce,
+                              0xdb, 0xad, 0xde, 0xca, 0xf8, 0x88,
+                              0x00, 0x00, 0x01 };
   bench_aead_decrypt_do_bench (obj, buf, buflen, nonce, sizeof(nonce));
 }
 
@@ -1200,9 +1199,9 @@ static void
 bench_ocb_authenticate_do_bench (struct bench_obj *obj, void *buf,
 				 size_t buflen)
 {
-  char nonce[15] = { 0xca, 0xfe, 0xba, 0xbe, 0xfa, 0xce,
-                     0xdb, 0xad, 0xde, 0xca, 0xf8, 0x88,
-                     0x00, 0x00, 0x01 };
+  unsigned char nonce[15] = { 0xca, 0xfe, 0xba, 0xbe, 0xfa, 0xce,
+                              0xdb, 0xad, 0xde, 0xca, 0xf8, 0x88,
+                              0x00, 0x00, 0x01 };
   bench_aead_authenticate_do_bench (obj, buf, buflen, nonce, sizeof(nonce));
 }
 
@@ -1229,7 +1228,7 @@ static void
 bench_poly1305_encrypt_do_bench (struct bench_obj *obj, void *buf,
 				 size_t buflen)
 {
-  char nonce[8] = { 0xca, 0xfe, 0xba, 0xbe, 0xfa, 0xce, 0xdb, 0xad };
+  unsigned char nonce[8] = { 0xca, 0xfe, 0xba, 0xbe, 0xfa, 0xce, 0xdb, 0xad };
   bench_aead_encrypt_do_bench (obj, buf, buflen, nonce, sizeof(nonce));
 }
 
@@ -1237,7 +1236,7 @@ static void
 bench_poly1305_decrypt_do_bench (struct bench_obj *obj, void *buf,
 				 size_t buflen)
 {
-  char nonce[8] = { 0xca, 0xfe, 0xba, 0xbe, 0xfa, 0xce, 0xdb, 0xad };
+  unsigned char nonce[8] = { 0xca, 0xfe, 0xba, 0xbe, 0xfa, 0xce, 0xdb, 0xad };
   bench_aead_decrypt_do_bench (obj, buf, buflen, nonce, sizeof(nonce));
 }
 
@@ -1245,7 +1244,7 @@ static void
 bench_poly1305_authenticate_do_bench (struct bench_obj *obj, void *buf,
 				      size_t buflen)
 {
-  char nonce[8] = { 0xca, 0xfe, 0xba, 0xbe, 0xfa, 0xce, 0xdb, 0xad };
+  unsigned char nonce[8] = { 0xca, 0xfe, 0xba, 0xbe, 0xfa, 0xce, 0xdb, 0xad };
   bench_aead_authenticate_do_bench (obj, buf, buflen, nonce, sizeof(nonce));
 }
 
@@ -2012,13 +2011,6 @@ main (int argc, char **argv)
 
   xgcry_control (GCRYCTL_SET_VERBOSITY, (int) verbose);
 
-  if (!gcry_check_version (GCRYPT_VERSION))
-    {
-      fprintf (stderr, PGM ": version mismatch; pgm=%s, library=%s\n",
-	       GCRYPT_VERSION, gcry_check_version (NULL));
-      exit (1);
-    }
-
   if (debug)
     xgcry_control (GCRYCTL_SET_DEBUG_FLAGS, 1u, 0);
 
@@ -952,7 +952,7 @@ check_dsa_rfc6979 (void)
 
 
 int
-main (int argc, char **argv)
+dsa_rfc6979_main (int argc, char **argv)
 {
   if (argc > 1 && !strcmp (argv[1], "--verbose"))
     verbose = 1;
@@ -963,16 +963,17 @@ main (int argc, char **argv)
     }
 
   xgcry_control (GCRYCTL_DISABLE_SECMEM, 0);
-  /* Check that we test exactly our version - including the patchlevel.  */
-  if (strcmp (GCRYPT_VERSION, gcry_check_version (NULL)))
-    die ("version mismatch; pgm=%s, library=%s\n",
-         GCRYPT_VERSION,gcry_check_version (NULL));
   xgcry_control (GCRYCTL_INITIALIZATION_FINISHED, 0);
   if (debug)
     xgcry_control (GCRYCTL_SET_DEBUG_FLAGS, 1u, 0);
   /* No valuable keys are create, so we can speed up our RNG. */
   xgcry_control (GCRYCTL_ENABLE_QUICK_RANDOM, 0);
 
+  /* The first signatures with a curve use the generic scalar
+     multiplication, later ones the table of multiples of the base
+     point.  Run the tests twice so that each vector is checked with
+     both methods.  */
+  check_dsa_rfc6979 ();
   check_dsa_rfc6979 ();
 
   return error_count ? 1 : 0;
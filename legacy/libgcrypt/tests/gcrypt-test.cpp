@@ -3,8 +3,32 @@
 #include "gtest/gtest.h"
 
   int hmac_main(int argc, char* argv[]);
+  int chacha20_main(int argc, char* argv[]);
+  int mpitests_main(int argc, char* argv[]);
+  int dsa_rfc6979_main(int argc, char* argv[]);
+  int random_thread_main(int argc, char* argv[]);
 
 TEST(GcryptTest, hmac) {
     int result = hmac_main(0, NULL);
     ASSERT_EQ(result, 0);
 }
+
+TEST(GcryptTest, chacha20) {
+    int result = chacha20_main(0, NULL);
+    ASSERT_EQ(result, 0);
+}
+
+TEST(GcryptTest, mpitests) {
+    int result = mpitests_main(0, NULL);
+    ASSERT_EQ(result, 0);
+}
+
+TEST(GcryptTest, dsa_rfc6979) {
+    int result = dsa_rfc6979_main(0, NULL);
+    ASSERT_EQ(result, 0);
+}
+
+TEST(GcryptTest, random_thread) {
+    int result = random_thread_main(0, NULL);
+    ASSERT_EQ(result, 0);
+}
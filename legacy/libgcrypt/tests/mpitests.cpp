@@ -209,7 +209,7 @@ test_maxsize (void)
    * which may result in a segv but we ignore that to avoid actually
    * allocating such a long buffer.  */
   err = gcry_mpi_scan (&a, GCRYMPI_FMT_USG, buffer, 16*1024*1024 +1, NULL);
-  if (gpg_err_code (err) != GPG_ERR_INV_OBJ)
+  if (err != GPG_ERR_INV_OBJ)
     die ("gcry_mpi_scan does not detect its generic input limit\n");
 
   /* Now test the PGP limit.  The scan code check the two length bytes
@@ -217,7 +217,7 @@ test_maxsize (void)
   buffer[0] = (16385 >> 8);
   buffer[1] = (16385 & 0xff);
   err = gcry_mpi_scan (&a, GCRYMPI_FMT_PGP, buffer, sizeof buffer, NULL);
-  if (gpg_err_code (err) != GPG_ERR_INV_OBJ)
+  if (err != GPG_ERR_INV_OBJ)
     die ("gcry_mpi_scan does not detect the PGP input limit\n");
 
   buffer[0] = (16384 >> 8);
@@ -546,19 +546,128 @@ test_powm (void)
 }
 
 
+/* Compute BASE^EXP mod MOD by the right-to-left binary method using
+   only gcry_mpi_mulm.  */
+static gcry_mpi_t
+simple_powm (gcry_mpi_t base, gcry_mpi_t exp, gcry_mpi_t mod)
+{
+  gcry_mpi_t res = gcry_mpi_set_ui (NULL, 1);
+  gcry_mpi_t b = gcry_mpi_new (0);
+  unsigned int i, nbits = gcry_mpi_get_nbits (exp);
+
+  gcry_mpi_mod (b, base, mod);
+  gcry_mpi_mod (res, res, mod);
+  for (i=0; i < nbits; i++)
+    {
+      if (gcry_mpi_test_bit (exp, i))
+        gcry_mpi_mulm (res, res, b, mod);
+      gcry_mpi_mulm (b, b, b, mod);
+    }
+  gcry_mpi_release (b);
+  return res;
+}
+
+
+/* Compare gcry_mpi_powm with simple_powm for random odd moduli, which
+   use the Montgomery code, and even moduli.  The sizes cover a single
+   limb and both sides of the Karatsuba threshold; the exponents are
+   taken from normal and from secure memory as the latter select the
+   constant time method.  */
+static void
+test_powm_montgomery (void)
+{
+  static const unsigned int sizes[] =
+    { 3, 64, 65, 127, 256, 521, 1024, 1031, 2048, 3072 };
+  gcry_mpi_t base, exp, sexp, mod, res, ref;
+  unsigned int i, j, ebits;
+
+  base = gcry_mpi_new (0);
+  exp = gcry_mpi_new (0);
+  sexp = gcry_mpi_snew (0);
+  mod = gcry_mpi_new (0);
+  res = gcry_mpi_new (0);
+
+  for (i=0; i < DIM (sizes); i++)
+    for (j=0; j < 6; j++)
+      {
+        gcry_mpi_randomize (mod, sizes[i], GCRY_WEAK_RANDOM);
+        gcry_mpi_set_highbit (mod, sizes[i] - 1);
+        if (j & 1)
+          gcry_mpi_clear_bit (mod, 0);
+        else
+          gcry_mpi_set_bit (mod, 0);
+        /* Bases larger than the modulus must be reduced first.  */
+        gcry_mpi_randomize (base, sizes[i] + (j < 2? 0 : 70),
+                            GCRY_WEAK_RANDOM);
+        /* Short exponents such as 65537 use another window size.  */
+        ebits = j < 4? sizes[i] : 17;
+        gcry_mpi_randomize (exp, ebits, GCRY_WEAK_RANDOM);
+        gcry_mpi_set_bit (exp, ebits - 1);
+        gcry_mpi_set (sexp, exp);
+
+        ref = simple_powm (base, exp, mod);
+        gcry_mpi_powm (res, base, exp, mod);
+        if (gcry_mpi_cmp (res, ref))
+          fail ("powm: %u bit %s modulus: result does not match\n",
+                sizes[i], (j & 1)? "even":"odd");
+        gcry_mpi_powm (res, base, sexp, mod);
+        if (gcry_mpi_cmp (res, ref))
+          fail ("powm: %u bit %s modulus, secret exponent:"
+                " result does not match\n",
+                sizes[i], (j & 1)? "even":"odd");
+        gcry_mpi_release (ref);
+      }
+
+  /* Known answers: a^(p-1) = 1 (mod p) for the primes 2^255-19 and
+     2^521-1.  */
+  for (i=0; i < 2; i++)
+    {
+      gcry_mpi_set_ui (mod, 0);
+      gcry_mpi_set_bit (mod, i? 521 : 255);
+      gcry_mpi_sub_ui (mod, mod, i? 1 : 19);
+      gcry_mpi_sub_ui (exp, mod, 1);
+      gcry_mpi_set (sexp, exp);
+      gcry_mpi_randomize (base, i? 500 : 250, GCRY_WEAK_RANDOM);
+      gcry_mpi_add_ui (base, base, 2);
+      gcry_mpi_powm (res, base, exp, mod);
+      if (gcry_mpi_cmp_ui (res, 1))
+        fail ("powm: Fermat test failed for prime %d\n", i);
+      gcry_mpi_powm (res, base, sexp, mod);
+      if (gcry_mpi_cmp_ui (res, 1))
+        fail ("powm: Fermat test failed for prime %d, secret exponent\n", i);
+    }
+
+  /* A zero exponent and a zero base.  */
+  gcry_mpi_set_ui (exp, 0);
+  gcry_mpi_set_ui (sexp, 0);
+  gcry_mpi_powm (res, base, exp, mod);
+  if (gcry_mpi_cmp_ui (res, 1))
+    fail ("powm: zero exponent failed\n");
+  gcry_mpi_powm (res, base, sexp, mod);
+  if (gcry_mpi_cmp_ui (res, 1))
+    fail ("powm: zero secret exponent failed\n");
+  gcry_mpi_set_ui (base, 0);
+  gcry_mpi_set_ui (exp, 65537);
+  gcry_mpi_powm (res, base, exp, mod);
+  if (gcry_mpi_cmp_ui (res, 0))
+    fail ("powm: zero base failed\n");
+
+  gcry_mpi_release (res);
+  gcry_mpi_release (mod);
+  gcry_mpi_release (sexp);
+  gcry_mpi_release (exp);
+  gcry_mpi_release (base);
+}
+
+
 int
-main (int argc, char* argv[])
+mpitests_main (int argc, char* argv[])
 {
   if (argc > 1 && !strcmp (argv[1], "--verbose"))
     verbose = 1;
   else if (argc > 1 && !strcmp (argv[1], "--debug"))
     verbose = debug = 1;
 
-  if (!gcry_check_version (GCRYPT_VERSION))
-    {
-      fputs ("version mismatch\n", stderr);
-      exit (1);
-    }
   xgcry_control(GCRYCTL_DISABLE_SECMEM);
 
   test_const_and_immutable ();
@@ -569,6 +678,7 @@ main (int argc, char* argv[])
   test_sub ();
   test_mul ();
   test_powm ();
+  test_powm_montgomery ();
 
   return !!error_count;
 }
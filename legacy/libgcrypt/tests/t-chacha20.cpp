@@ -0,0 +1,440 @@
+/* t-chacha20.c - ChaCha20 and Poly1305 regression tests
+ * Copyright (C) 2018 g10 Code GmbH
+ *
+ * This file is part of Libgcrypt.
+ *
+ * Libgcrypt is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * Libgcrypt is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* The SIMD kernels are only used for runs of complete blocks.  Thus
+   besides the RFC-7539 test vectors these tests compare the output
+   for large buffers with the output of the same data fed in small
+   pieces, which is computed by the generic code, and compare Poly1305
+   with a straightforward implementation using MPIs.  */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+
+#define PGM "t-chacha20"
+#include "t-common.h"
+
+
+/* Lengths used for the comparisons.  They cover the block size of the
+   generic code (64), of the 4-way and 8-way kernels (256, 512) and of
+   the chunks used by the AEAD mode (8192).  */
+static const size_t test_lengths[] =
+  {
+    0, 1, 15, 16, 17, 63, 64, 65, 127, 128, 129, 255, 256, 257,
+    511, 512, 513, 1000, 4096, 8191, 8192, 8193, 20000
+  };
+#define MAX_TEST_LENGTH 20000
+
+
+static void
+hex2buffer (const char *string, unsigned char *buffer, size_t *r_length)
+{
+  size_t n;
+
+  for (n=0; string[0] && string[1]; string += 2)
+    buffer[n++] = xtoi_2 (string);
+  *r_length = n;
+}
+
+
+static void
+check_chacha20_kat (void)
+{
+  /* RFC-7539, A.1, test vector #1.  */
+  static const char keystream[] =
+    "76b8e0ada0f13d90405d6ae55386bd28bdd219b8a08ded1aa836efcc8b770dc7"
+    "da41597c5157488d7724e03fb8d84a376a43b8f41518a11cc387b669b2ee6586";
+  unsigned char key[32], nonce[12];
+  unsigned char buffer[64], expect[64];
+  size_t n;
+  gcry_cipher_hd_t hd;
+  gpg_error_t err;
+
+  wherestr = "chacha20 kat";
+  memset (key, 0, sizeof key);
+  memset (nonce, 0, sizeof nonce);
+  memset (buffer, 0, sizeof buffer);
+  hex2buffer (keystream, expect, &n);
+
+  err = gcry_cipher_open (&hd, GCRY_CIPHER_CHACHA20, GCRY_CIPHER_MODE_STREAM, 0);
+  if (err)
+    {
+      fail ("gcry_cipher_open failed: %s\n", gpg_strerror (err));
+      return;
+    }
+  err = gcry_cipher_setkey (hd, key, sizeof key);
+  if (!err)
+    err = gcry_cipher_setiv (hd, nonce, sizeof nonce);
+  if (!err)
+    err = gcry_cipher_encrypt (hd, buffer, sizeof buffer, NULL, 0);
+  if (err)
+    fail ("encryption failed: %s\n", gpg_strerror (err));
+  else if (n != sizeof buffer || memcmp (buffer, expect, n))
+    fail ("keystream does not match\n");
+  gcry_cipher_close (hd);
+}
+
+
+/* Encrypt BUFFER of LENGTH with KEY and NONCE into OUT.  If STEP is
+   not zero, pass the data in pieces of at most STEP bytes.  */
+static void
+chacha20_encrypt (const unsigned char *key, const unsigned char *nonce,
+                  unsigned char *out, const unsigned char *buffer,
+                  size_t length, size_t step)
+{
+  gcry_cipher_hd_t hd;
+  gpg_error_t err;
+  size_t off, n;
+
+  err = gcry_cipher_open (&hd, GCRY_CIPHER_CHACHA20, GCRY_CIPHER_MODE_STREAM, 0);
+  if (err)
+    die ("gcry_cipher_open failed: %s\n", gpg_strerror (err));
+  err = gcry_cipher_setkey (hd, key, 32);
+  if (!err)
+    err = gcry_cipher_setiv (hd, nonce, 12);
+  for (off=0; !err && off < length; off += n)
+    {
+      n = length - off;
+      if (step && n > step)
+        n = step;
+      err = gcry_cipher_encrypt (hd, out + off, n, buffer + off, n);
+    }
+  if (err)
+    fail ("encryption failed: %s\n", gpg_strerror (err));
+  gcry_cipher_close (hd);
+}
+
+
+static void
+check_chacha20_bulk (void)
+{
+  unsigned char key[32], nonce[12];
+  unsigned char *buffer, *out1, *out2;
+  size_t i, length;
+
+  wherestr = "chacha20 bulk";
+  buffer = (unsigned char*) xmalloc (MAX_TEST_LENGTH);
+  out1 = (unsigned char*) xmalloc (MAX_TEST_LENGTH);
+  out2 = (unsigned char*) xmalloc (MAX_TEST_LENGTH);
+  gcry_randomize (key, sizeof key, GCRY_WEAK_RANDOM);
+  gcry_randomize (nonce, sizeof nonce, GCRY_WEAK_RANDOM);
+  gcry_randomize (buffer, MAX_TEST_LENGTH, GCRY_WEAK_RANDOM);
+
+  for (i=0; i < DIM (test_lengths); i++)
+    {
+      length = test_lengths[i];
+      chacha20_encrypt (key, nonce, out1, buffer, length, 0);
+      chacha20_encrypt (key, nonce, out2, buffer, length, 1);
+      if (memcmp (out1, out2, length))
+        fail ("length %u: bulk and bytewise output differ\n",
+              (unsigned int)length);
+      /* Pieces which are not a multiple of the block size mix all
+         code paths.  */
+      chacha20_encrypt (key, nonce, out2, buffer, length, 700);
+      if (memcmp (out1, out2, length))
+        fail ("length %u: bulk and piecewise output differ\n",
+              (unsigned int)length);
+    }
+
+  xfree (out2);
+  xfree (out1);
+  xfree (buffer);
+}
+
+
+/* Return the little endian number in BUFFER of LENGTH as an MPI.  */
+static gcry_mpi_t
+mpi_from_le (const unsigned char *buffer, size_t length)
+{
+  unsigned char tmp[32];
+  gcry_mpi_t a;
+  size_t i;
+
+  for (i=0; i < length; i++)
+    tmp[i] = buffer[length - 1 - i];
+  if (gcry_mpi_scan (&a, GCRYMPI_FMT_USG, tmp, length, NULL))
+    die ("gcry_mpi_scan failed\n");
+  return a;
+}
+
+
+/* Compute the Poly1305 MAC of MSG using KEY the simple way.  */
+static void
+poly1305_mpi (unsigned char *tag, const unsigned char *key,
+              const unsigned char *msg, size_t length)
+{
+  unsigned char rkey[16], tmp[32];
+  gcry_mpi_t p, r, s, acc, n;
+  size_t off, len, nwritten, i;
+
+  memcpy (rkey, key, 16);
+  rkey[3] &= 15; rkey[7] &= 15; rkey[11] &= 15; rkey[15] &= 15;
+  rkey[4] &= 252; rkey[8] &= 252; rkey[12] &= 252;
+
+  p = gcry_mpi_set_ui (NULL, 0);
+  gcry_mpi_set_bit (p, 130);
+  gcry_mpi_sub_ui (p, p, 5);
+  r = mpi_from_le (rkey, 16);
+  s = mpi_from_le (key + 16, 16);
+  acc = gcry_mpi_set_ui (NULL, 0);
+
+  for (off=0; off < length; off += len)
+    {
+      len = length - off < 16 ? length - off : 16;
+      n = mpi_from_le (msg + off, len);
+      gcry_mpi_set_bit (n, 8 * len);
+      gcry_mpi_add (acc, acc, n);
+      gcry_mpi_mulm (acc, acc, r, p);
+      gcry_mpi_release (n);
+    }
+  gcry_mpi_add (acc, acc, s);
+  gcry_mpi_clear_highbit (acc, 128);
+
+  memset (tmp, 0, sizeof tmp);
+  if (gcry_mpi_print (GCRYMPI_FMT_USG, tmp, sizeof tmp, &nwritten, acc))
+    die ("gcry_mpi_print failed\n");
+  memset (tag, 0, 16);
+  for (i=0; i < nwritten; i++)
+    tag[i] = tmp[nwritten - 1 - i];
+
+  gcry_mpi_release (acc);
+  gcry_mpi_release (s);
+  gcry_mpi_release (r);
+  gcry_mpi_release (p);
+}
+
+
+/* Compute the Poly1305 MAC of MSG using KEY with the MAC API.  If
+   STEP is not zero, pass the data in pieces of at most STEP
+   bytes.  */
+static void
+poly1305_mac (unsigned char *tag, const unsigned char *key,
+              const unsigned char *msg, size_t length, size_t step)
+{
+  gcry_mac_hd_t hd;
+  gpg_error_t err;
+  size_t off, n, taglen = 16;
+
+  err = gcry_mac_open (&hd, GCRY_MAC_POLY1305, 0, NULL);
+  if (err)
+    die ("gcry_mac_open failed: %s\n", gpg_strerror (err));
+  err = gcry_mac_setkey (hd, key, 32);
+  for (off=0; !err && off < length; off += n)
+    {
+      n = length - off;
+      if (step && n > step)
+        n = step;
+      err = gcry_mac_write (hd, msg + off, n);
+    }
+  if (!err)
+    err = gcry_mac_read (hd, tag, &taglen);
+  if (err)
+    fail ("computing the MAC failed: %s\n", gpg_strerror (err));
+  gcry_mac_close (hd);
+}
+
+
+static void
+check_poly1305 (void)
+{
+  /* RFC-7539, 2.5.2.  */
+  static const char kat_key[] =
+    "85d6be7857556d337f4452fe42d506a80103808afb0db2fd4abff6af4149f51b";
+  static const char kat_msg[] = "Cryptographic Forum Research Group";
+  static const char kat_tag[] = "a8061dc1305136c6c22b8baf0c0127a9";
+  unsigned char key[32], expect[16], tag1[16], tag2[16];
+  unsigned char *msg;
+  size_t i, n, length;
+
+  wherestr = "poly1305";
+  hex2buffer (kat_key, key, &n);
+  hex2buffer (kat_tag, expect, &n);
+  poly1305_mac (tag1, key, (const unsigned char*) kat_msg,
+                strlen (kat_msg), 0);
+  if (memcmp (tag1, expect, 16))
+    fail ("test vector does not match\n");
+  poly1305_mpi (tag2, key, (const unsigned char*) kat_msg, strlen (kat_msg));
+  if (memcmp (tag2, expect, 16))
+    fail ("test vector does not match the MPI version\n");
+
+  msg = (unsigned char*) xmalloc (MAX_TEST_LENGTH);
+  gcry_randomize (msg, MAX_TEST_LENGTH, GCRY_WEAK_RANDOM);
+  for (i=0; i < DIM (test_lengths); i++)
+    {
+      length = test_lengths[i];
+      gcry_randomize (key, sizeof key, GCRY_WEAK_RANDOM);
+      poly1305_mpi (tag1, key, msg, length);
+      poly1305_mac (tag2, key, msg, length, 0);
+      if (memcmp (tag1, tag2, 16))
+        fail ("length %u: MAC does not match\n", (unsigned int)length);
+      poly1305_mac (tag2, key, msg, length, 100);
+      if (memcmp (tag1, tag2, 16))
+        fail ("length %u: piecewise MAC does not match\n",
+              (unsigned int)length);
+    }
+  xfree (msg);
+}
+
+
+/* Run the ChaCha20-Poly1305 AEAD over PLAIN of LENGTH into OUT and
+   store the tag at TAG.  If STEP is not zero, pass the data in
+   pieces of at most STEP bytes; STEP must then be a multiple of
+   64.  */
+static void
+aead_encrypt (const unsigned char *key, const unsigned char *nonce,
+              const unsigned char *aad, size_t aadlen,
+              unsigned char *out, const unsigned char *plain,
+              size_t length, size_t step, unsigned char *tag)
+{
+  gcry_cipher_hd_t hd;
+  gpg_error_t err;
+  size_t off, n;
+
+  err = gcry_cipher_open (&hd, GCRY_CIPHER_CHACHA20,
+                          GCRY_CIPHER_MODE_POLY1305, 0);
+  if (err)
+    die ("gcry_cipher_open failed: %s\n", gpg_strerror (err));
+  err = gcry_cipher_setkey (hd, key, 32);
+  if (!err)
+    err = gcry_cipher_setiv (hd, nonce, 12);
+  if (!err)
+    err = gcry_cipher_authenticate (hd, aad, aadlen);
+  for (off=0; !err && off < length; off += n)
+    {
+      n = length - off;
+      if (step && n > step)
+        n = step;
+      err = gcry_cipher_encrypt (hd, out + off, n, plain + off, n);
+    }
+  if (!err)
+    err = gcry_cipher_gettag (hd, tag, 16);
+  if (err)
+    fail ("AEAD encryption failed: %s\n", gpg_strerror (err));
+  gcry_cipher_close (hd);
+}
+
+
+static void
+check_aead (void)
+{
+  /* RFC-7539, 2.8.2.  */
+  static const char kat_plain[] =
+    "Ladies and Gentlemen of the class of '99: If I could offer you "
+    "only one tip for the future, sunscreen would be it.";
+  static const char kat_nonce[] = "070000004041424344454647";
+  static const char kat_aad[] = "50515253c0c1c2c3c4c5c6c7";
+  static const char kat_cipher[] =
+    "d31a8d34648e60db7b86afbc53ef7ec2a4aded51296e08fea9e2b5a736ee62d6"
+    "3dbea45e8ca9671282fafb69da92728b1a71de0a9e060b2905d6a5b67ecd3b36"
+    "92ddbd7f2d778b8c9803aee328091b58fab324e4fad675945585808b4831d7bc"
+    "3ff4def08e4b7a9de576d26586cec64b6116";
+  static const char kat_tag[] = "1ae10b594f09e26a7e902ecbd0600691";
+  unsigned char key[32], nonce[12], aad[12], tag1[16], tag2[16];
+  unsigned char expect[sizeof kat_plain];
+  unsigned char *plain, *out1, *out2;
+  size_t i, n, length;
+  gcry_cipher_hd_t hd;
+  gpg_error_t err;
+
+  wherestr = "chacha20-poly1305";
+  for (i=0; i < 32; i++)
+    key[i] = 0x80 + i;
+  hex2buffer (kat_nonce, nonce, &n);
+  hex2buffer (kat_aad, aad, &n);
+
+  plain = (unsigned char*) xmalloc (MAX_TEST_LENGTH);
+  out1 = (unsigned char*) xmalloc (MAX_TEST_LENGTH);
+  out2 = (unsigned char*) xmalloc (MAX_TEST_LENGTH);
+
+  length = strlen (kat_plain);
+  aead_encrypt (key, nonce, aad, sizeof aad, out1,
+                (const unsigned char*) kat_plain, length, 0, tag1);
+  hex2buffer (kat_cipher, expect, &n);
+  if (n != length || memcmp (out1, expect, n))
+    fail ("test vector: ciphertext does not match\n");
+  hex2buffer (kat_tag, expect, &n);
+  if (memcmp (tag1, expect, 16))
+    fail ("test vector: tag does not match\n");
+
+  /* Large requests are processed in chunks; the result must not
+     depend on how the data is passed.  */
+  gcry_randomize (key, sizeof key, GCRY_WEAK_RANDOM);
+  gcry_randomize (plain, MAX_TEST_LENGTH, GCRY_WEAK_RANDOM);
+  for (i=0; i < DIM (test_lengths); i++)
+    {
+      length = test_lengths[i];
+      aead_encrypt (key, nonce, aad, sizeof aad, out1, plain, length, 0, tag1);
+      aead_encrypt (key, nonce, aad, sizeof aad, out2, plain, length, 64,
+                    tag2);
+      if (memcmp (out1, out2, length) || memcmp (tag1, tag2, 16))
+        fail ("length %u: bulk and piecewise output differ\n",
+              (unsigned int)length);
+
+      err = gcry_cipher_open (&hd, GCRY_CIPHER_CHACHA20,
+                              GCRY_CIPHER_MODE_POLY1305, 0);
+      if (err)
+        die ("gcry_cipher_open failed: %s\n", gpg_strerror (err));
+      err = gcry_cipher_setkey (hd, key, 32);
+      if (!err)
+        err = gcry_cipher_setiv (hd, nonce, 12);
+      if (!err)
+        err = gcry_cipher_authenticate (hd, aad, sizeof aad);
+      if (!err)
+        err = gcry_cipher_decrypt (hd, out2, length, out1, length);
+      if (!err)
+        err = gcry_cipher_checktag (hd, tag1, 16);
+      if (err)
+        fail ("length %u: decryption failed: %s\n",
+              (unsigned int)length, gpg_strerror (err));
+      else if (memcmp (out2, plain, length))
+        fail ("length %u: decrypted data does not match\n",
+              (unsigned int)length);
+      gcry_cipher_close (hd);
+    }
+
+  xfree (out2);
+  xfree (out1);
+  xfree (plain);
+}
+
+
+int
+chacha20_main (int argc, char **argv)
+{
+  if (argc > 1 && !strcmp (argv[1], "--verbose"))
+    verbose = 1;
+  else if (argc > 1 && !strcmp (argv[1], "--debug"))
+    verbose = debug = 1;
+
+  xgcry_control (GCRYCTL_DISABLE_SECMEM, 0);
+  xgcry_control (GCRYCTL_INITIALIZATION_FINISHED, 0);
+  if (debug)
+    xgcry_control (GCRYCTL_SET_DEBUG_FLAGS, 1u, 0);
+
+  check_chacha20_kat ();
+  check_chacha20_bulk ();
+  check_poly1305 ();
+  check_aead ();
+
+  return error_count ? 1 : 0;
+}
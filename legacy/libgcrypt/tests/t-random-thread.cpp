@@ -0,0 +1,282 @@
+/* t-random-thread.c - Check the per-thread random generators
+ * Copyright (C) 2018 g10 Code GmbH
+ *
+ * This file is part of Libgcrypt.
+ *
+ * Libgcrypt is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * Libgcrypt is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Requests below GCRY_VERY_STRONG_RANDOM and nonces are served by a
+   DRBG private to each thread.  These tests check that the threads
+   do not get the same output, that a forked child does not repeat
+   bytes buffered by its parent, and that the periodic reseed works.  */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#if HAVE_PTHREAD
+# include <pthread.h>
+#endif
+#ifndef HAVE_W32_SYSTEM
+# include <sys/wait.h>
+#endif
+
+#define PGM "t-random-thread"
+
+#include "t-common.h"
+
+
+/* Number of threads to run.  */
+#define N_THREADS 8
+/* Number of requests of each kind per thread.  */
+#define N_REQUESTS 64
+/* Size of one request.  */
+#define REQ_SIZE 16
+
+/* The output of all threads; each thread writes only its own
+   slots.  */
+static unsigned char outbuf[N_THREADS][2*N_REQUESTS][REQ_SIZE];
+
+
+static int
+cmp_req (const void *a, const void *b)
+{
+  return memcmp (a, b, REQ_SIZE);
+}
+
+
+#if HAVE_PTHREAD
+/* Interleave nonces and random of the standard level so that both
+   paths use the same per-thread instance.  */
+static void *
+random_thread (void *arg)
+{
+  unsigned char (*out)[REQ_SIZE] = outbuf[(long)arg];
+  int i;
+
+  for (i = 0; i < N_REQUESTS; i++)
+    {
+      gcry_create_nonce (out[2*i], REQ_SIZE);
+      gcry_randomize (out[2*i+1], REQ_SIZE, GCRY_STRONG_RANDOM);
+    }
+  return NULL;
+}
+#endif /*HAVE_PTHREAD*/
+
+
+/* Run several threads requesting random and check that no request
+   returned the same bytes as another one.  */
+static void
+check_threads (void)
+{
+#if HAVE_PTHREAD
+  pthread_t threads[N_THREADS];
+  unsigned char *p;
+  size_t n;
+  long i;
+
+  if (verbose)
+    info ("checking random of %d threads\n", N_THREADS);
+
+  memset (outbuf, 0, sizeof outbuf);
+  for (i = 0; i < N_THREADS; i++)
+    if (pthread_create (&threads[i], NULL, random_thread, (void *)i))
+      die ("error creating thread %ld: %s\n", i, strerror (errno));
+  for (i = 0; i < N_THREADS; i++)
+    if (pthread_join (threads[i], NULL))
+      die ("pthread_join failed for thread %ld: %s\n", i, strerror (errno));
+
+  p = &outbuf[0][0][0];
+  n = sizeof outbuf / REQ_SIZE;
+  qsort (p, n, REQ_SIZE, cmp_req);
+  for (i = 1; i < n; i++)
+    if (!memcmp (p + (i-1)*REQ_SIZE, p + i*REQ_SIZE, REQ_SIZE))
+      fail ("the same random has been returned twice\n");
+#else
+  if (verbose)
+    info ("check_threads skipped: no thread support\n");
+#endif /*!HAVE_PTHREAD*/
+}
+
+
+#ifndef HAVE_W32_SYSTEM
+static int
+readn (int fd, void *buf, size_t buflen)
+{
+  size_t nleft = buflen;
+  int nread;
+
+  while (nleft > 0)
+    {
+      nread = read (fd, buf, nleft);
+      if (nread < 0 && errno == EINTR)
+        continue;
+      if (nread <= 0)
+        return -1;
+      nleft -= nread;
+      buf = (char*)buf + nread;
+    }
+  return 0;
+}
+#endif /*!HAVE_W32_SYSTEM*/
+
+
+/* Check that a forked child does not return the bytes which its
+   parent has already buffered in its per-thread instance.  */
+static void
+check_fork (void)
+{
+#ifndef HAVE_W32_SYSTEM
+  unsigned char nonce[REQ_SIZE], nonce_c[REQ_SIZE], nonce_p[REQ_SIZE];
+  unsigned char rnd_c[REQ_SIZE], rnd_p[REQ_SIZE];
+  pid_t pid;
+  int rp[2];
+  int i, status;
+
+  if (verbose)
+    info ("checking that a fork won't repeat the buffered random\n");
+
+  /* This fills the buffer of the instance.  */
+  gcry_create_nonce (nonce, sizeof nonce);
+
+  if (pipe (rp) == -1)
+    die ("pipe failed: %s\n", strerror (errno));
+
+  pid = fork ();
+  if (pid == (pid_t)(-1))
+    die ("fork failed: %s\n", strerror (errno));
+  if (!pid)
+    {
+      gcry_create_nonce (nonce_c, sizeof nonce_c);
+      gcry_randomize (rnd_c, sizeof rnd_c, GCRY_STRONG_RANDOM);
+      if (write (rp[1], nonce_c, sizeof nonce_c) != sizeof nonce_c
+          || write (rp[1], rnd_c, sizeof rnd_c) != sizeof rnd_c)
+        _exit (1);
+      _exit (0);
+    }
+  close (rp[1]);
+  gcry_create_nonce (nonce_p, sizeof nonce_p);
+  gcry_randomize (rnd_p, sizeof rnd_p, GCRY_STRONG_RANDOM);
+
+  if (readn (rp[0], nonce_c, sizeof nonce_c)
+      || readn (rp[0], rnd_c, sizeof rnd_c))
+    die ("read from child failed\n");
+  close (rp[0]);
+
+  while ((i = waitpid (pid, &status, 0)) == -1 && errno == EINTR)
+    ;
+  if (i == (pid_t)(-1) || !WIFEXITED (status) || WEXITSTATUS (status))
+    die ("child failed\n");
+
+  if (!memcmp (nonce_p, nonce_c, sizeof nonce_c))
+    fail ("parent and child got the same nonce\n");
+  if (!memcmp (rnd_p, rnd_c, sizeof rnd_c))
+    fail ("parent and child got the same random\n");
+#else
+  if (verbose)
+    info ("check_fork skipped: not applicable on Windows\n");
+#endif /*!HAVE_W32_SYSTEM*/
+}
+
+
+/* Request more than the reseed interval of an instance in pieces of
+   different sizes and check that the output does not repeat across
+   the reseed.  */
+static void
+check_reseed (void)
+{
+  static unsigned char buf[4096];
+  unsigned char prev[REQ_SIZE], cur[REQ_SIZE];
+  size_t total;
+  int i;
+
+  if (verbose)
+    info ("checking the reseed of the per-thread instance\n");
+
+  gcry_randomize (prev, sizeof prev, GCRY_STRONG_RANDOM);
+  for (total = 0, i = 0; total < 3*1024*1024; i++)
+    {
+      if ((i & 1))
+        {
+          gcry_create_nonce (cur, sizeof cur);
+          total += sizeof cur;
+        }
+      else
+        {
+          gcry_randomize (buf, sizeof buf, GCRY_STRONG_RANDOM);
+          memcpy (cur, buf + sizeof buf - sizeof cur, sizeof cur);
+          total += sizeof buf;
+        }
+      if (!memcmp (prev, cur, sizeof cur))
+        fail ("random repeated after %lu bytes\n", (unsigned long)total);
+      memcpy (prev, cur, sizeof cur);
+    }
+
+  /* New entropy for the master must not break the instances.  */
+  gcry_random_add_bytes (buf, 64, -1);
+  gcry_create_nonce (cur, sizeof cur);
+  if (!memcmp (prev, cur, sizeof cur))
+    fail ("random repeated after adding entropy\n");
+}
+
+
+int
+random_thread_main (int argc, char **argv)
+{
+  int last_argc = -1;
+
+  if (argc)
+    { argc--; argv++; }
+
+  while (argc && last_argc != argc )
+    {
+      last_argc = argc;
+      if (!strcmp (*argv, "--"))
+        {
+          argc--; argv++;
+          break;
+        }
+      else if (!strcmp (*argv, "--verbose"))
+        {
+          verbose++;
+          argc--; argv++;
+        }
+      else if (!strcmp (*argv, "--debug"))
+        {
+          verbose = debug = 1;
+          argc--; argv++;
+        }
+    }
+
+  xgcry_control (GCRYCTL_DISABLE_SECMEM, 0);
+  if (debug)
+    xgcry_control (GCRYCTL_SET_DEBUG_FLAGS, 1u, 0);
+  xgcry_control (GCRYCTL_ENABLE_QUICK_RANDOM, 0);
+  xgcry_control (GCRYCTL_INITIALIZATION_FINISHED, 0);
+
+  check_threads ();
+  check_fork ();
+  check_reseed ();
+
+  if (debug)
+    xgcry_control (GCRYCTL_DUMP_RANDOM_STATS);
+
+  return error_count ? 1 : 0;
+}
@@ -25,6 +25,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#if HAVE_PTHREAD
+# include <pthread.h>
+#endif
 
 #define PGM "t-secmem"
 
@@ -82,6 +85,142 @@ test_secmem_overflow (void)
 }
 
 
+/* Log handler used to pick up the "secmem usage" line of the
+ * stats.  */
+static unsigned int stats_used, stats_blocks, stats_cached;
+static int stats_seen;
+
+static void
+stats_log_handler (void *opaque, int level, const char *fmt, va_list arg_ptr)
+{
+  char line[256];
+
+  (void)opaque;
+  (void)level;
+
+  vsnprintf (line, sizeof line, fmt, arg_ptr);
+  if (!strncmp (line, "secmem usage:", 13)
+      && sscanf (line + 13, " %u/%*u bytes in %u blocks, %*u bytes in %u",
+                 &stats_used, &stats_blocks, &stats_cached) == 3)
+    stats_seen = 1;
+}
+
+static void
+get_secmem_stats (void)
+{
+  stats_seen = 0;
+  gcry_set_log_handler (stats_log_handler, NULL);
+  xgcry_control (GCRYCTL_DUMP_SECMEM_STATS, 0 , 0);
+  gcry_set_log_handler (NULL, NULL);
+  if (!stats_seen)
+    fail ("no secmem usage line in the stats\n");
+}
+
+
+/* Check that freed blocks which are kept on the free lists or in the
+ * thread cache are not reported as used.  */
+static void
+test_secmem_stats (void)
+{
+  void *a[20];
+  unsigned int used, blocks, cached;
+  int i;
+
+  get_secmem_stats ();
+  used = stats_used;
+  blocks = stats_blocks;
+
+  for (i=0; i < DIM(a); i++)
+    a[i] = gcry_xmalloc_secure (48);
+
+  get_secmem_stats ();
+  if (stats_blocks < blocks + DIM(a) || stats_used < used + DIM(a) * 48)
+    fail ("secmem stats do not show the allocated blocks"
+          " (%u/%u -> %u/%u)\n", used, blocks, stats_used, stats_blocks);
+  /* The allocation may have flushed older cached blocks; thus take
+   * the number of cached blocks only now.  */
+  cached = stats_cached;
+
+  for (i=0; i < DIM(a); i++)
+    xfree (a[i]);
+
+  get_secmem_stats ();
+  if (stats_used != used || stats_blocks != blocks)
+    fail ("secmem stats count freed blocks as used"
+          " (%u/%u -> %u/%u)\n", used, blocks, stats_used, stats_blocks);
+  if (stats_cached < cached + DIM(a))
+    fail ("secmem stats do not show the cached blocks (%u -> %u)\n",
+          cached, stats_cached);
+}
+
+
+#if HAVE_PTHREAD
+static pthread_mutex_t filler_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t filler_cond = PTHREAD_COND_INITIALIZER;
+static int filler_state;
+
+/* Fill the cache of a new thread with freed blocks and keep the
+ * thread alive until the main thread is done.  */
+static void *
+cache_filler (void *arg)
+{
+  void *a[8];
+  int i;
+
+  (void)arg;
+
+  for (i=0; i < DIM(a); i++)
+    a[i] = gcry_xmalloc_secure (512);
+  for (i=0; i < DIM(a); i++)
+    xfree (a[i]);
+
+  pthread_mutex_lock (&filler_lock);
+  filler_state = 1;
+  pthread_cond_broadcast (&filler_cond);
+  while (filler_state != 2)
+    pthread_cond_wait (&filler_cond, &filler_lock);
+  pthread_mutex_unlock (&filler_lock);
+  return NULL;
+}
+#endif /*HAVE_PTHREAD*/
+
+
+/* Check that blocks in the cache of another thread are reclaimed
+ * when the pool runs out of space.  */
+static void
+test_secmem_flush (void)
+{
+#if HAVE_PTHREAD
+  pthread_t thread;
+  void *a[28];
+  int i, n;
+
+  if (pthread_create (&thread, NULL, cache_filler, NULL))
+    die ("error creating thread: %s\n", strerror (errno));
+  pthread_mutex_lock (&filler_lock);
+  while (filler_state != 1)
+    pthread_cond_wait (&filler_cond, &filler_lock);
+  pthread_mutex_unlock (&filler_lock);
+
+  /* Like test_secmem.  */
+  memset (a, 0, sizeof a);
+  for (n=0; n < DIM(a) && (a[n] = gcry_malloc_secure (512)); n++)
+    ;
+  if (n != DIM(a))
+    fail ("blocks cached by another thread were not reclaimed"
+          " (%d of %d allocated)\n", n, (int)DIM(a));
+  for (i=0; i < n; i++)
+    xfree (a[i]);
+
+  pthread_mutex_lock (&filler_lock);
+  filler_state = 2;
+  pthread_cond_broadcast (&filler_cond);
+  pthread_mutex_unlock (&filler_lock);
+  pthread_join (thread, NULL);
+#endif /*HAVE_PTHREAD*/
+}
+
+
 /* This function is called when we ran out of core and there is no way
  * to return that error to the caller (xmalloc or mpi allocation).  */
 static int
@@ -162,6 +301,8 @@ secmem_main (int argc, char **argv)
 
   test_secmem ();
   test_secmem_overflow ();
+  test_secmem_stats ();
+  test_secmem_flush ();
   /* FIXME: We need to improve the tests, for example by registering
    * our own log handler and comparing the output of
    * PRIV_CTL_DUMP_SECMEM_STATS to expected pattern.  */
@@ -61,6 +61,7 @@ add_node (node_type_t type)
   punt->left = NULL;
   punt->name = NULL;
   punt->type = type;
+  memset (&punt->flags, 0, sizeof punt->flags);
   punt->valuetype = VALTYPE_NULL;
   punt->value.v_cstr = NULL;
   punt->off = -1;
@@ -79,6 +80,72 @@ _ksba_asn_new_node (node_type_t type)
 }
 
 
+/* Prepare ARENA for the allocation of NNODES nodes with names of a
+   total length of NAMELEN bytes.  If the block can't be allocated
+   the arena falls back to single allocations.  */
+void
+_ksba_asn_arena_init (asn_arena_t arena, size_t nnodes, size_t namelen)
+{
+  memset (arena, 0, sizeof *arena);
+  if (!nnodes)
+    return;
+  arena->next = (AsnNode) xtrymalloc (nnodes * sizeof *arena->next
+                                      + namelen);
+  if (!arena->next)
+    return;
+  arena->nnodes = nnodes;
+  arena->names = (char*)(arena->next + nnodes);
+  arena->namelen = namelen;
+}
+
+
+/* Return a new node of TYPE taken from ARENA.  ARENA may be NULL.  */
+AsnNode
+_ksba_asn_arena_new_node (asn_arena_t arena, node_type_t type)
+{
+  AsnNode node;
+
+  if (!arena || !arena->nnodes)
+    return add_node (type);
+
+  node = arena->next++;
+  arena->nnodes--;
+  memset (node, 0, sizeof *node);
+  node->type = type;
+  node->valuetype = VALTYPE_NULL;
+  node->off = -1;
+  node->flags.in_arena = 1;
+  if (!arena->head_done)
+    {
+      node->flags.arena_head = 1;
+      arena->head_done = 1;
+    }
+  return node;
+}
+
+
+/* Set the name of the fresh NODE to a copy of NAME taken from ARENA.
+   ARENA may be NULL.  */
+void
+_ksba_asn_arena_set_name (asn_arena_t arena, AsnNode node, const char *name)
+{
+  size_t n;
+
+  if (!name)
+    return;
+  n = strlen (name) + 1;
+  if (!arena || arena->namelen < n || node->name)
+    {
+      _ksba_asn_set_name (node, name);
+      return;
+    }
+  node->name = (char*) memcpy (arena->names, name, n);
+  node->flags.name_in_arena = 1;
+  arena->names += n;
+  arena->namelen -= n;
+}
+
+
 int
 _ksba_asn_is_primitive (node_type_t type)
 {
@@ -214,18 +281,29 @@ copy_value (AsnNode d, const AsnNode s)
   d->len = s->len;
 }
 
+/* Copy node S using ARENA for the allocation.  NAME is used as the
+   name of the new node.  */
 static AsnNode
-copy_node (const AsnNode s)
+copy_node_with_name (asn_arena_t arena, const AsnNode s, const char *name)
 {
-  AsnNode d = add_node (s->type);
+  AsnNode d = _ksba_asn_arena_new_node (arena, s->type);
+  struct node_flag_s flags = d->flags;
 
-  if (s->name)
-    d->name = xstrdup (s->name);
   d->flags = s->flags;
+  d->flags.in_arena = flags.in_arena;
+  d->flags.arena_head = flags.arena_head;
+  d->flags.name_in_arena = 0;
+  _ksba_asn_arena_set_name (arena, d, name);
   copy_value (d, s);
   return d;
 }
 
+static AsnNode
+copy_node (asn_arena_t arena, const AsnNode s)
+{
+  return copy_node_with_name (arena, s, s->name);
+}
+
 
 
 
@@ -238,8 +316,10 @@ _ksba_asn_set_name (AsnNode node, const char *name)
 
   if (node->name)
     {
-      xfree (node->name);
+      if (!node->flags.name_in_arena)
+        xfree (node->name);
       node->name = NULL;
+      node->flags.name_in_arena = 0;
     }
 
   if (name && *name)
@@ -279,12 +359,22 @@ _ksba_asn_remove_node (AsnNode  node)
   if (node == NULL)
     return;
 
-  xfree (node->name);
+  if (!node->flags.name_in_arena)
+    xfree (node->name);
   if (node->valuetype == VALTYPE_CSTR)
     xfree (node->value.v_cstr);
   else if (node->valuetype == VALTYPE_MEM)
     xfree (node->value.v_mem.buf);
-  xfree (node);
+  if (node->flags.in_arena)
+    {
+      /* The block is released with the node list; make sure that the
+         allocated parts are not released again.  */
+      node->name = NULL;
+      node->flags.name_in_arena = 0;
+      node->valuetype = VALTYPE_NULL;
+    }
+  else
+    xfree (node);
 }
 
 
@@ -1005,10 +1095,26 @@ _ksba_asn_type_set_config (AsnNode node)
     }
 }
 
+/* Add the number of nodes and the length of their names which
+   copy_tree will create for S to R_NNODES and R_NAMELEN.  */
+static void
+count_copy_tree (AsnNode s, size_t *r_nnodes, size_t *r_namelen)
+{
+  for (; s; s=s->right )
+    {
+      ++*r_nnodes;
+      if (s->name)
+        *r_namelen += strlen (s->name) + 1;
+      if (s->down)
+        count_copy_tree (s->down, r_nnodes, r_namelen);
+    }
+}
+
+
 /* Create a copy the tree at SRC_ROOT. s is a helper which should be
    set to SRC_ROOT by the caller */
 static AsnNode
-copy_tree (AsnNode src_root, AsnNode s)
+copy_tree (asn_arena_t arena, AsnNode src_root, AsnNode s)
 {
   AsnNode first=NULL, dprev=NULL, d, down, tmp;
   AsnNode *link_nextp = NULL;
@@ -1016,7 +1122,7 @@ copy_tree (AsnNode src_root, AsnNode s)
   for (; s; s=s->right )
     {
       down = s->down;
-      d = copy_node (s);
+      d = copy_node (arena, s);
       if (link_nextp)
 	*link_nextp = d;
       link_nextp = &d->link_next;
@@ -1031,7 +1137,7 @@ copy_tree (AsnNode src_root, AsnNode s)
       dprev = d;
       if (down)
         {
-          tmp = copy_tree (src_root, down);
+          tmp = copy_tree (arena, src_root, down);
 	  if (tmp)
 	    {
 	      if (link_nextp)
@@ -1099,8 +1205,52 @@ resolve_identifier (AsnNode root, AsnNode node, int nestlevel)
 }
 
 
+/* Add the number of nodes and the length of their names which
+   do_expand_tree will create for S to R_NNODES and R_NAMELEN.  This
+   must be kept in sync with do_expand_tree.  */
+static void
+count_expand_tree (AsnNode src_root, AsnNode s, int depth,
+                   size_t *r_nnodes, size_t *r_namelen)
+{
+  AsnNode down, d, s2;
+
+  for (; s; s=depth?s->right:NULL )
+    {
+      if (s->type == TYPE_SIZE)
+        continue;
+
+      down = s->down;
+      if (s->type == TYPE_IDENTIFIER)
+        {
+          d = resolve_identifier (src_root, s, 0);
+          if (!d)
+            continue;
+          down = d->down;
+          ++*r_nnodes;
+          if (s->name && *s->name)
+            *r_namelen += strlen (s->name) + 1;
+          for (s2=s->down; s2; s2=s2->right)
+            {
+              ++*r_nnodes;
+              if (s2->name)
+                *r_namelen += strlen (s2->name) + 1;
+            }
+        }
+      else
+        {
+          ++*r_nnodes;
+          if (s->name)
+            *r_namelen += strlen (s->name) + 1;
+        }
+
+      if (down && depth < 1000)
+        count_expand_tree (src_root, down, depth+1, r_nnodes, r_namelen);
+    }
+}
+
+
 static AsnNode
-do_expand_tree (AsnNode src_root, AsnNode s, int depth)
+do_expand_tree (asn_arena_t arena, AsnNode src_root, AsnNode s, int depth)
 {
   AsnNode first=NULL, dprev=NULL, d, down, tmp;
   AsnNode *link_nextp = NULL;
@@ -1125,7 +1275,9 @@ do_expand_tree (AsnNode src_root, AsnNode s, int depth)
               continue;
             }
           down = d->down;
-          d = copy_node (d);
+          /* we don't want the resolved name - use the original one */
+          d = copy_node_with_name (arena, d,
+                                   s->name && *s->name? s->name : NULL);
 	  if (link_nextp)
 	    *link_nextp = d;
 	  link_nextp = &d->link_next;
@@ -1139,8 +1291,6 @@ do_expand_tree (AsnNode src_root, AsnNode s, int depth)
             d->flags.is_implicit = 1;
           if (s->flags.is_any)
             d->flags.is_any = 1;
-          /* we don't want the resolved name - change it back */
-          _ksba_asn_set_name (d, s->name);
           /* copy the default and tag attributes */
           tmp = NULL;
           dp = &tmp;
@@ -1148,7 +1298,7 @@ do_expand_tree (AsnNode src_root, AsnNode s, int depth)
             {
               AsnNode x;
 
-              x = copy_node (s2);
+              x = copy_node (arena, s2);
 	      if (link_nextp)
 		*link_nextp = x;
 	      link_nextp = &x->link_next;
@@ -1165,7 +1315,7 @@ do_expand_tree (AsnNode src_root, AsnNode s, int depth)
         }
       else
         {
-	  d = copy_node (s);
+	  d = copy_node (arena, s);
 	  if (link_nextp)
 	    *link_nextp = d;
 	  link_nextp = &d->link_next;
@@ -1188,7 +1338,7 @@ do_expand_tree (AsnNode src_root, AsnNode s, int depth)
             }
           else
             {
-	      tmp = do_expand_tree (src_root, down, depth+1);
+	      tmp = do_expand_tree (arena, src_root, down, depth+1);
 	      if (tmp)
 		{
 		  if (link_nextp)
@@ -1225,14 +1375,20 @@ do_expand_tree (AsnNode src_root, AsnNode s, int depth)
    of).  This expanded tree is also an requirement for doing the DER
    decoding as the resolving of identifiers leads to a lot of
    problems.  We use more memory of course, but this is negligible
-   because the entire code will be simpler and faster */
+   because the entire code will be simpler and faster.  All nodes are
+   allocated from a single arena block.  */
 AsnNode
 _ksba_asn_expand_tree (AsnNode parse_tree, const char *name)
 {
   AsnNode root;
+  struct asn_arena_s arena;
+  size_t nnodes = 0;
+  size_t namelen = 0;
 
   root = name? find_node (parse_tree, name, 1) : parse_tree;
-  return do_expand_tree (parse_tree, root, 0);
+  count_expand_tree (parse_tree, root, 0, &nnodes, &namelen);
+  _ksba_asn_arena_init (&arena, nnodes, namelen);
+  return do_expand_tree (&arena, parse_tree, root, 0);
 }
 
 
@@ -1243,8 +1399,13 @@ _ksba_asn_insert_copy (AsnNode node)
 {
   AsnNode n;
   AsnNode *link_nextp;
+  struct asn_arena_s arena;
+  size_t nnodes = 0;
+  size_t namelen = 0;
 
-  n = copy_tree (node, node);
+  count_copy_tree (node, &nnodes, &namelen);
+  _ksba_asn_arena_init (&arena, nnodes, namelen);
+  n = copy_tree (&arena, node, node);
   if (!n)
     return NULL; /* out of core */
   return_null_if_fail (n->right == node->right);
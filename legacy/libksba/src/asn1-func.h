@@ -114,6 +114,9 @@ struct node_flag_s {
   int help_right:1;   /* helper for create_tree */
   int tag_seen:1;
   int skip_this:1;   /* helper */
+  int in_arena:1;    /* node is part of an arena block */
+  int arena_head:1;  /* node is the start of an arena block */
+  int name_in_arena:1; /* name is stored in an arena block */
 };
 
 enum asn_value_type {
@@ -172,6 +175,20 @@ struct ksba_asn_tree_s {
 };
 
 
+/* An arena is used to allocate a known number of nodes together
+   with their names in one block.  The block is released along with
+   the node marked as ARENA_HEAD.  Requests beyond the precomputed
+   size fall back to single allocations.  */
+struct asn_arena_s {
+  AsnNode next;      /* Next free node or NULL.  */
+  size_t nnodes;     /* Number of free nodes.  */
+  char *names;       /* Next free byte for names.  */
+  size_t namelen;    /* Number of free bytes for names.  */
+  int head_done;     /* The ARENA_HEAD node has been handed out.  */
+};
+typedef struct asn_arena_s *asn_arena_t;
+
+
 typedef struct static_struct_asn {
   unsigned int name_off;        /* Node name */
   node_type_t type;             /* Node type */
@@ -202,6 +219,10 @@ AsnNode _ksba_asn_insert_copy (AsnNode node);
 
 int _ksba_asn_is_primitive (node_type_t type);
 AsnNode _ksba_asn_new_node (node_type_t type);
+void _ksba_asn_arena_init (asn_arena_t arena, size_t nnodes, size_t namelen);
+AsnNode _ksba_asn_arena_new_node (asn_arena_t arena, node_type_t type);
+void _ksba_asn_arena_set_name (asn_arena_t arena, AsnNode node,
+                               const char *name);
 void _ksba_asn_node_dump (AsnNode p, FILE *fp);
 void _ksba_asn_node_dump_all (AsnNode root, FILE *fp);
 
@@ -122,6 +122,9 @@ ksba_asn_create_tree (const char *mod_name, ksba_asn_tree_t *result)
   unsigned long k;
   int rc;
   AsnNode link_next = NULL;
+  struct asn_arena_s arena;
+  struct node_flag_s arena_flags;
+  size_t namelen;
 
   if (!result)
     return GPG_ERR_INV_VALUE;
@@ -133,20 +136,31 @@ ksba_asn_create_tree (const char *mod_name, ksba_asn_tree_t *result)
   if (!root)
     return GPG_ERR_MODULE_NOT_FOUND;
 
+  /* The tree is created for each certificate; thus allocate all
+     nodes and their names at once.  */
+  namelen = 0;
+  for (k=0; root[k].stringvalue_off || root[k].type || root[k].name_off; k++)
+    if (root[k].name_off)
+      namelen += strlen (strgtbl + root[k].name_off) + 1;
+  _ksba_asn_arena_init (&arena, k, namelen);
+
   pointer = NULL;
   move = UP;
 
   k = 0;
   while (root[k].stringvalue_off || root[k].type || root[k].name_off)
     {
-      p = _ksba_asn_new_node (root[k].type);
+      p = _ksba_asn_arena_new_node (&arena, root[k].type);
+      arena_flags = p->flags;
       p->flags = root[k].flags;
       p->flags.help_down = 0;
+      p->flags.in_arena = arena_flags.in_arena;
+      p->flags.arena_head = arena_flags.arena_head;
       p->link_next = link_next;
       link_next = p;
 
       if (root[k].name_off)
-	_ksba_asn_set_name (p, strgtbl + root[k].name_off);
+	_ksba_asn_arena_set_name (&arena, p, strgtbl + root[k].name_off);
       if (root[k].stringvalue_off)
         {
           if (root[k].type == TYPE_TAG)
@@ -219,7 +233,7 @@ ksba_asn_create_tree (const char *mod_name, ksba_asn_tree_t *result)
       rc = GPG_ERR_GENERAL;
 
   if (rc)
-    _ksba_asn_delete_structure (pointer);
+    _ksba_asn_release_nodes (p);
 
   return rc;
 }
@@ -897,18 +897,34 @@ static void
 release_all_nodes (AsnNode node)
 {
   AsnNode node2;
+  AsnNode arenas = NULL;
 
   for (; node; node = node2)
     {
       node2 = node->link_next;
-      xfree (node->name);
+      if (!node->flags.name_in_arena)
+        xfree (node->name);
 
       if (node->valuetype == VALTYPE_CSTR)
         xfree (node->value.v_cstr);
       else if (node->valuetype == VALTYPE_MEM)
         xfree (node->value.v_mem.buf);
 
-      xfree (node);
+      /* Arena blocks may only be released after the walk because the
+         list runs through them.  */
+      if (node->flags.arena_head)
+        {
+          node->right = arenas;
+          arenas = node;
+        }
+      else if (!node->flags.in_arena)
+        xfree (node);
+    }
+
+  for (; arenas; arenas = node2)
+    {
+      node2 = arenas->right;
+      xfree (arenas);
     }
 }
 
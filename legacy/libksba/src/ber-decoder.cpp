@@ -40,6 +40,7 @@
 #include "asn1-func.h"
 #include "ber-decoder.h"
 #include "ber-help.h"
+#include "reader.h"
 
 
 /* The maximum length we allow for an image, that is for a BER encoded
@@ -419,6 +420,17 @@ static int
 read_buffer (ksba_reader_t reader, char *buffer, size_t count)
 {
   size_t nread;
+  const unsigned char *mem;
+
+  /* Copy or skip directly with a memory reader.  */
+  mem = _ksba_reader_mem_peek (reader, &nread);
+  if (mem && nread >= count)
+    {
+      if (buffer)
+        memcpy (buffer, mem, count);
+      _ksba_reader_mem_consume (reader, count);
+      return 0;
+    }
 
   if (buffer)
     {
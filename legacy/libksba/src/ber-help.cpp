@@ -37,6 +37,7 @@
 
 #include "asn1-func.h" /* need some constants */
 #include "ber-help.h"
+#include "reader.h"
 
 /* Fixme: The parser functions should check that primitive types don't
    have the constructed bit set (which is not allowed).  This saves us
@@ -93,6 +94,19 @@ _ksba_ber_read_tl (ksba_reader_t reader, struct tag_info *ti)
 {
   int c;
   unsigned long tag;
+  const unsigned char *mem;
+  size_t memlen;
+  gpg_error_t err;
+
+  /* With a memory reader we parse the header in place.  */
+  mem = _ksba_reader_mem_peek (reader, &memlen);
+  if (mem && memlen)
+    {
+      err = _ksba_ber_parse_tl (&mem, &memlen, ti);
+      if (!err)
+        _ksba_reader_mem_consume (reader, ti->nhdr);
+      return err;
+    }
 
   ti->length = 0;
   ti->ndef = 0;
@@ -252,6 +252,39 @@ ksba_cert_get_user_data (ksba_cert_t cert, const char *key,
 }
 
 
+/* Lookup the frequently used nodes of CERT so that the accessors
+   don't need to walk the tree again and again.  */
+static void
+cache_nodes (ksba_cert_t cert)
+{
+  static const char *tbs_paths[CERT_NODE_COUNT] = {
+    NULL, NULL,
+    "tbsCertificate.serialNumber",
+    "tbsCertificate.issuer",
+    "tbsCertificate.subject",
+    "tbsCertificate.validity.notBefore",
+    "tbsCertificate.validity.notAfter",
+    "tbsCertificate.subjectPublicKeyInfo",
+    "tbsCertificate.extensions..",
+    NULL
+  };
+  AsnNode *nodes = cert->cache.nodes;
+  int i;
+
+  nodes[CERT_NODE_CERTIFICATE] = _ksba_asn_find_node (cert->root,
+                                                      "Certificate");
+  nodes[CERT_NODE_TBS] = _ksba_asn_find_node (cert->root,
+                                              "Certificate.tbsCertificate");
+  nodes[CERT_NODE_SIGALGO] = _ksba_asn_find_node
+    (cert->root, "Certificate.signatureAlgorithm");
+  for (i=0; i < CERT_NODE_COUNT; i++)
+    if (tbs_paths[i])
+      nodes[i] = (nodes[CERT_NODE_TBS]
+                  ? _ksba_asn_find_node (nodes[CERT_NODE_TBS], tbs_paths[i])
+                  : NULL);
+}
+
+
 /**
  * ksba_cert_read_der:
  * @cert: An unitialized certificate object
@@ -279,6 +312,7 @@ ksba_cert_read_der (ksba_cert_t cert, ksba_reader_t reader)
   ksba_asn_tree_release (cert->asn_tree);
   cert->root = NULL;
   cert->asn_tree = NULL;
+  memset (cert->cache.nodes, 0, sizeof cert->cache.nodes);
 
   err = ksba_asn_create_tree ("tmttv2", &cert->asn_tree);
   if (err)
@@ -302,7 +336,10 @@ ksba_cert_read_der (ksba_cert_t cert, ksba_reader_t reader)
   err = _ksba_ber_decoder_decode (decoder, "TMTTv2.Certificate", 0,
                                   &cert->root, &cert->image, &cert->imagelen);
   if (!err)
+    {
+      cache_nodes (cert);
       cert->initialized = 1;
+    }
 
  leave:
   _ksba_ber_decoder_release (decoder);
@@ -343,7 +380,7 @@ ksba_cert_get_image (ksba_cert_t cert, size_t *r_length )
   if (!cert->initialized)
     return NULL;
 
-  n = _ksba_asn_find_node (cert->root, "Certificate");
+  n = cert->cache.nodes[CERT_NODE_CERTIFICATE];
   if (!n)
     return NULL;
 
@@ -402,9 +439,7 @@ ksba_cert_hash (ksba_cert_t cert, int what,
   if (!cert->initialized)
     return GPG_ERR_NO_DATA;
 
-  n = _ksba_asn_find_node (cert->root,
-                           what == 1? "Certificate.tbsCertificate"
-                                    : "Certificate");
+  n = cert->cache.nodes[what == 1? CERT_NODE_TBS : CERT_NODE_CERTIFICATE];
   if (!n)
     return GPG_ERR_NO_VALUE; /* oops - should be there */
   if (n->off == -1)
@@ -462,7 +497,7 @@ ksba_cert_get_digest_algo (ksba_cert_t cert)
 /*   else  */
 /*     cert->cache.digest_algo = algo; */
 
-  n = _ksba_asn_find_node (cert->root, "Certificate.signatureAlgorithm");
+  n = cert->cache.nodes[CERT_NODE_SIGALGO];
   if (!n || n->off == -1)
     {
       algo = NULL;
@@ -503,8 +538,7 @@ ksba_cert_get_serial (ksba_cert_t cert)
   if (!cert || !cert->initialized)
     return NULL;
 
-  n = _ksba_asn_find_node (cert->root,
-                           "Certificate.tbsCertificate.serialNumber");
+  n = cert->cache.nodes[CERT_NODE_SERIAL];
   if (!n)
     return NULL; /* oops - should be there */
 
@@ -538,8 +572,7 @@ _ksba_cert_get_serial_ptr (ksba_cert_t cert,
 
   if (!cert || !cert->initialized || !ptr || !length)
     return GPG_ERR_INV_VALUE;
-  n = _ksba_asn_find_node (cert->root,
-                           "Certificate.tbsCertificate.serialNumber");
+  n = cert->cache.nodes[CERT_NODE_SERIAL];
   if (!n || n->off == -1)
     return GPG_ERR_NO_VALUE;
 
@@ -561,7 +594,7 @@ _ksba_cert_get_subject_dn_ptr (ksba_cert_t cert,
   if (!cert || !cert->initialized || !ptr || !length)
     return GPG_ERR_INV_VALUE;
 
-  n = _ksba_asn_find_node (cert->root, "Certificate.tbsCertificate.subject");
+  n = cert->cache.nodes[CERT_NODE_SUBJECT];
   if (!n || !n->down)
     return GPG_ERR_NO_VALUE; /* oops - should be there */
   n = n->down; /* dereference the choice node */
@@ -596,10 +629,7 @@ get_name (ksba_cert_t cert, int idx, int use_subject, char **result)
     { /* Get the required DN */
       AsnNode n;
 
-      n = _ksba_asn_find_node (cert->root,
-                               (use_subject?
-                                "Certificate.tbsCertificate.subject":
-                                "Certificate.tbsCertificate.issuer") );
+      n = cert->cache.nodes[use_subject? CERT_NODE_SUBJECT : CERT_NODE_ISSUER];
       if (!n || !n->down)
         return GPG_ERR_NO_VALUE; /* oops - should be there */
       n = n->down; /* dereference the choice node */
@@ -791,9 +821,7 @@ ksba_cert_get_validity (ksba_cert_t cert, int what, ksba_isotime_t timebuf)
   if (!cert->initialized)
     return GPG_ERR_NO_DATA;
 
-  n = _ksba_asn_find_node (cert->root,
-        what == 0? "Certificate.tbsCertificate.validity.notBefore"
-                 : "Certificate.tbsCertificate.validity.notAfter");
+  n = cert->cache.nodes[what == 0? CERT_NODE_NOT_BEFORE : CERT_NODE_NOT_AFTER];
   if (!n)
     return 0; /* no value available */
 
@@ -828,9 +856,7 @@ ksba_cert_get_public_key (ksba_cert_t cert)
   if (!cert->initialized)
     return NULL;
 
-  n = _ksba_asn_find_node (cert->root,
-                           "Certificate"
-                           ".tbsCertificate.subjectPublicKeyInfo");
+  n = cert->cache.nodes[CERT_NODE_PUBKEY];
   if (!n)
     {
       cert->last_error = GPG_ERR_NO_VALUE;
@@ -860,8 +886,7 @@ _ksba_cert_get_public_key_ptr (ksba_cert_t cert,
   if (!cert || !cert->initialized || !ptr || !length)
     return GPG_ERR_INV_VALUE;
 
-  n = _ksba_asn_find_node (cert->root,
-                           "Certificate.tbsCertificate.subjectPublicKeyInfo");
+  n = cert->cache.nodes[CERT_NODE_PUBKEY];
   if (!n || !n->down || !n->down->right)
     return GPG_ERR_NO_VALUE; /* oops - should be there */
   n = n->down->right;
@@ -894,8 +919,7 @@ ksba_cert_get_sig_val (ksba_cert_t cert)
   if (!cert->initialized)
     return NULL;
 
-  n = _ksba_asn_find_node (cert->root,
-                           "Certificate.signatureAlgorithm");
+  n = cert->cache.nodes[CERT_NODE_SIGALGO];
   if (!n)
     {
       cert->last_error = GPG_ERR_NO_VALUE;
@@ -934,8 +958,7 @@ read_extensions (ksba_cert_t cert)
   assert (!cert->cache.extns_valid);
   assert (!cert->cache.extns);
 
-  start = _ksba_asn_find_node (cert->root,
-                               "Certificate.tbsCertificate.extensions..");
+  start = cert->cache.nodes[CERT_NODE_EXTENSIONS];
   for (count=0, n=start; n; n = n->right)
     count++;
   if (!count)
@@ -67,6 +67,24 @@ struct cert_user_data
 };
 
 
+/* Indices of the nodes which are looked up once after parsing a
+   certificate. */
+enum cert_node_idx
+  {
+    CERT_NODE_CERTIFICATE = 0,
+    CERT_NODE_TBS,
+    CERT_NODE_SERIAL,
+    CERT_NODE_ISSUER,
+    CERT_NODE_SUBJECT,
+    CERT_NODE_NOT_BEFORE,
+    CERT_NODE_NOT_AFTER,
+    CERT_NODE_PUBKEY,
+    CERT_NODE_EXTENSIONS,
+    CERT_NODE_SIGALGO,
+    CERT_NODE_COUNT
+  };
+
+
 /* The internal certificate object. */
 struct ksba_cert_s
 {
@@ -100,6 +118,7 @@ struct ksba_cert_s
     int  extns_valid;
     int  n_extns;
     struct cert_extn_info *extns;
+    AsnNode nodes[CERT_NODE_COUNT]; /* Frequently used nodes or NULL. */
   } cache;
 };
 
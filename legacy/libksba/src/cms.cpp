@@ -87,27 +87,40 @@ static const char oid_signingTime[9] = { '\x2A', '\x86', '\x48', '\x86', '\xF7',
 
 static const char oidstr_smimeCapabilities[] = "1.2.840.113549.1.9.15";
 
+/* The size of the buffer used to copy the content.  Large buffers
+   keep the number of reader, hash and writer calls low for big
+   messages.  */
+#define COPY_BUFFER_SIZE (64*1024)
+
 
 
-/* Helper for read_and_hash_cont().  */
+/* Copy NLEFT bytes from the reader to the writer.  If HASH is set
+   the bytes are also passed to the hash function.  The writer may be
+   NULL.  */
 static gpg_error_t
-read_hash_block (ksba_cms_t cms, unsigned long nleft)
+copy_block (ksba_cms_t cms, unsigned long nleft, int hash)
 {
   gpg_error_t err;
-  char buffer[4096];
   size_t n, nread;
 
+  if (!cms->copybuf)
+    {
+      cms->copybuf = (char*) xtrymalloc (COPY_BUFFER_SIZE);
+      if (!cms->copybuf)
+        return GPG_ERR_ENOMEM;
+    }
+
   while (nleft)
     {
-      n = nleft < sizeof (buffer)? nleft : sizeof (buffer);
-      err = ksba_reader_read (cms->reader, buffer, n, &nread);
+      n = nleft < COPY_BUFFER_SIZE? nleft : COPY_BUFFER_SIZE;
+      err = ksba_reader_read (cms->reader, cms->copybuf, n, &nread);
       if (err)
         return err;
       nleft -= nread;
-      if (cms->hash_fnc)
-        cms->hash_fnc (cms->hash_fnc_arg, buffer, nread);
+      if (hash && cms->hash_fnc)
+        cms->hash_fnc (cms->hash_fnc_arg, cms->copybuf, nread);
       if (cms->writer)
-        err = ksba_writer_write (cms->writer, buffer, nread);
+        err = ksba_writer_write (cms->writer, cms->copybuf, nread);
       if (err)
         return err;
     }
@@ -115,6 +128,14 @@ read_hash_block (ksba_cms_t cms, unsigned long nleft)
 }
 
 
+/* Helper for read_and_hash_cont().  */
+static gpg_error_t
+read_hash_block (ksba_cms_t cms, unsigned long nleft)
+{
+  return copy_block (cms, nleft, 1);
+}
+
+
 /* Copy all the bytes from the reader to the writer and hash them if a
    a hash function has been set.  The writer may be NULL to just do
    the hashing */
@@ -237,8 +258,6 @@ read_encrypted_cont (ksba_cms_t cms)
 {
   gpg_error_t err = 0;
   unsigned long nleft;
-  char buffer[4096];
-  size_t n, nread;
 
   if (cms->inner_cont_ndef)
     {
@@ -256,17 +275,9 @@ read_encrypted_cont (ksba_cms_t cms)
               && !ti.is_constructed)
             { /* next chunk */
               nleft = ti.length;
-              while (nleft)
-                {
-                  n = nleft < sizeof (buffer)? nleft : sizeof (buffer);
-                  err = ksba_reader_read (cms->reader, buffer, n, &nread);
-                  if (err)
-                    return err;
-                  nleft -= nread;
-                  err = ksba_writer_write (cms->writer, buffer, nread);
-                  if (err)
-                    return err;
-                }
+              err = copy_block (cms, nleft, 0);
+              if (err)
+                return err;
             }
           else if (ti.klasse == CLASS_UNIVERSAL && ti.tag == TYPE_OCTET_STRING
                    && ti.is_constructed)
@@ -281,18 +292,9 @@ read_encrypted_cont (ksba_cms_t cms)
                       && !ti.is_constructed)
                     {
                       nleft = ti.length;
-                      while (nleft)
-                        {
-                          n = nleft < sizeof (buffer)? nleft : sizeof (buffer);
-                          err = ksba_reader_read (cms->reader, buffer, n, &nread);
-                          if (err)
-                            return err;
-                          nleft -= nread;
-                          if (cms->writer)
-                            err = ksba_writer_write (cms->writer, buffer, nread);
-                          if (err)
-                            return err;
-                        }
+                      err = copy_block (cms, nleft, 0);
+                      if (err)
+                        return err;
                     }
                   else if (ti.klasse == CLASS_UNIVERSAL && !ti.tag
                            && !ti.is_constructed)
@@ -311,17 +313,9 @@ read_encrypted_cont (ksba_cms_t cms)
   else
     {
       nleft = cms->inner_cont_len;
-      while (nleft)
-        {
-          n = nleft < sizeof (buffer)? nleft : sizeof (buffer);
-          err = ksba_reader_read (cms->reader, buffer, n, &nread);
-          if (err)
-            return err;
-          nleft -= nread;
-          err = ksba_writer_write (cms->writer, buffer, nread);
-          if (err)
-            return err;
-        }
+      err = copy_block (cms, nleft, 0);
+      if (err)
+        return err;
     }
   return 0;
 }
@@ -541,6 +535,7 @@ ksba_cms_release (ksba_cms_t cms)
       xfree (cms->capability_list);
       cms->capability_list = tmp;
     }
+  xfree (cms->copybuf);
 
   xfree (cms);
 }
@@ -149,6 +149,9 @@ struct ksba_cms_s {
   struct sig_val_s *sig_val;
 
   struct enc_val_s *enc_val;
+
+  char *copybuf;  /* Buffer used to copy the content; allocated on
+                     first use.  */
 };
 
 
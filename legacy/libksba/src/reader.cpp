@@ -426,6 +426,19 @@ ksba_reader_unread (ksba_reader_t r, const void *buffer, size_t count)
   if (r->nread < count)
     return GPG_ERR_CONFLICT;
 
+  /* A memory reader can simply step back if the bytes are those we
+     just read.  This keeps the reader usable for the direct access
+     via _ksba_reader_mem_peek.  */
+  if (r->type == READER_TYPE_MEM
+      && !(r->unread.buf && r->unread.length)
+      && r->u.mem.readpos >= count
+      && !memcmp (r->u.mem.buffer + r->u.mem.readpos - count, buffer, count))
+    {
+      r->u.mem.readpos -= count;
+      r->nread -= count;
+      return 0;
+    }
+
   if (!r->unread.buf)
     {
       r->unread.size = count + 100;
@@ -448,3 +461,27 @@ ksba_reader_unread (ksba_reader_t r, const void *buffer, size_t count)
 
   return 0;
 }
+
+
+/* Return a pointer to the bytes not yet read from the memory based
+   reader R and store their number at R_LENGTH.  This allows to parse
+   the data in place.  NULL is returned if R is not a memory reader or
+   if bytes have been pushed back.  */
+const unsigned char *
+_ksba_reader_mem_peek (ksba_reader_t r, size_t *r_length)
+{
+  if (!r || r->type != READER_TYPE_MEM
+      || (r->unread.buf && r->unread.length))
+    return NULL;
+  *r_length = r->u.mem.size - r->u.mem.readpos;
+  return r->u.mem.buffer + r->u.mem.readpos;
+}
+
+
+/* Mark COUNT bytes returned by _ksba_reader_mem_peek as read.  */
+void
+_ksba_reader_mem_consume (ksba_reader_t r, size_t count)
+{
+  r->u.mem.readpos += count;
+  r->nread += count;
+}
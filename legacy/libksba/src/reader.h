@@ -71,6 +71,12 @@ struct ksba_reader_s {
 };
 
 
+/*-- reader.c --*/
+const unsigned char *_ksba_reader_mem_peek (ksba_reader_t r,
+                                            size_t *r_length);
+void _ksba_reader_mem_consume (ksba_reader_t r, size_t count);
+
+
 
 
 #endif /*READER_H*/
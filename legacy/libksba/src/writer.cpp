@@ -41,6 +41,9 @@
 #include "asn1-func.h"
 #include "ber-help.h"
 
+/* The size of the output buffer passed to a filter function.  */
+#define FILTER_BUFFER_SIZE (64*1024)
+
 /**
  * ksba_writer_new:
  *
@@ -80,6 +83,7 @@ ksba_writer_release (ksba_writer_t w)
     }
   if (w->type == WRITER_TYPE_MEM)
     xfree (w->u.mem.buffer);
+  xfree (w->filter_buf);
   xfree (w);
 }
 
@@ -385,19 +389,27 @@ ksba_writer_write (ksba_writer_t w, const void *buffer, size_t length)
 
   if (w->filter)
     {
-      char outbuf[4096];
       size_t nin, nout;
       const char *p = (const char*) buffer;
 
+      /* The filter output buffer is kept for the lifetime of the
+         writer so that bulk data can be passed in large chunks.  */
+      if (!w->filter_buf)
+        {
+          w->filter_buf = (unsigned char*) xtrymalloc (FILTER_BUFFER_SIZE);
+          if (!w->filter_buf)
+            return GPG_ERR_ENOMEM;
+        }
+
       while (length)
         {
           err = w->filter (w->filter_arg, p, length, &nin,
-                           outbuf, sizeof (outbuf), &nout);
+                           w->filter_buf, FILTER_BUFFER_SIZE, &nout);
           if (err)
             break;
-          if (nin > length || nout > sizeof (outbuf))
+          if (nin > length || nout > FILTER_BUFFER_SIZE)
             return GPG_ERR_BUG; /* tsss, someone else made an error */
-          err = do_writer_write (w, outbuf, nout);
+          err = do_writer_write (w, w->filter_buf, nout);
           if (err)
             break;
           length -= nin;
@@ -52,6 +52,7 @@ struct ksba_writer_s {
                       const void *,size_t, size_t *,
                       void *, size_t, size_t *);
   void *filter_arg;
+  unsigned char *filter_buf;  /* Output buffer for the filter.  */
 
   union {
     int fd;  /* for WRITER_TYPE_FD */
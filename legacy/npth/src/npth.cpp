@@ -133,6 +133,12 @@ static volatile pthread_t main_thread;
  * those two functions but may have be initialized before pPth. */
 static int initialized_or_any_threads;
 
+/* This flag is set by npth_init_ex with NPTH_INIT_PARALLEL.  In this
+ * mode the global lock is never taken, and all threads run truly in
+ * parallel like plain pthreads.  The application is then responsible
+ * for protecting all of its shared state with mutexes.  */
+static int parallel_mode;
+
 /* Systems that don't have pthread_mutex_timedlock get a busy wait
    implementation that probes the lock every BUSY_WAIT_INTERVAL
    milliseconds.  */
@@ -185,6 +191,9 @@ enter_npth (void)
 {
   int res;
 
+  if (parallel_mode)
+    return;
+
   got_sceptre = 0;
   res = sem_post (sceptre);
   assert (res == 0);
@@ -195,8 +204,12 @@ static void
 leave_npth (void)
 {
   int res;
-  int save_errno = errno;
+  int save_errno;
+
+  if (parallel_mode)
+    return;
 
+  save_errno = errno;
   do {
     res = sem_wait (sceptre);
   } while (res < 0 && errno == EINTR);
@@ -212,9 +225,19 @@ leave_npth (void)
 
 int
 npth_init (void)
+{
+  return npth_init_ex (0);
+}
+
+
+int
+npth_init_ex (unsigned int flags)
 {
   int res;
 
+  if ((flags & ~NPTH_INIT_PARALLEL))
+    return EINVAL;
+
   main_thread = pthread_self();
 
   /* Track that we have been initialized.  */
@@ -243,6 +266,9 @@ npth_init (void)
 #endif
     }
 
+  /* Switch the mode only after the semaphore is valid, so that
+     npth_init may be called again to return to the default mode.  */
+  parallel_mode = !!(flags & NPTH_INIT_PARALLEL);
   LEAVE();
   return 0;
 }
@@ -753,6 +779,8 @@ npth_protect (void)
 int
 npth_is_protected (void)
 {
+  if (parallel_mode)
+    return 1;
   return got_sceptre;
 }
 
@@ -78,6 +78,16 @@ extern "C" {
 
 int npth_init(void);
 
+/* Flags for npth_init_ex.  */
+#define NPTH_INIT_PARALLEL 1  /* Do not serialize the threads.  */
+
+/* Same as npth_init but with FLAGS.  With NPTH_INIT_PARALLEL the
+   global lock is not used and threads run concurrently on all cores;
+   only the npth mutexes and condition variables provide exclusion.
+   The application must not rely on the implicit serialization of the
+   default mode.  Returns error number on error and 0 on success.  */
+int npth_init_ex (unsigned int flags);
+
 /* Not needed.  */
 /* pth_kill, pth_ctrl, pth_version */
 
@@ -5,6 +5,8 @@
   int fork_main(int argc, char* argv[]);
   int mutex_main(int argc, char* argv[]);
   int thread_main(int argc, char* argv[]);
+  int parallel_main(int argc, char* argv[]);
+  int parallel_bench_main(int argc, char* argv[]);
 
 TEST(nPthTest, fork) {
     int result = fork_main(0, NULL);
@@ -20,3 +22,13 @@ TEST(nPthTest, thread) {
     int result = thread_main(0, NULL);
     ASSERT_EQ(result, 0);
 }
+
+TEST(nPthTest, parallel) {
+    int result = parallel_main(0, NULL);
+    ASSERT_EQ(result, 0);
+}
+
+TEST(nPthTest, parallel_bench) {
+    int result = parallel_bench_main(0, NULL);
+    ASSERT_EQ(result, 0);
+}
@@ -0,0 +1,223 @@
+/* t-parallel.c
+ * Copyright 2018 g10 Code GmbH
+ *
+ * This file is free software; as a special exception the author gives
+ * unlimited permission to copy and/or distribute it, with or without
+ * modifications, as long as this notice is preserved.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY, to the extent permitted by law; without even the
+ * implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include <time.h>
+
+#include "t-support.h"
+
+
+#define N_THREADS 8
+#define N_LOOPS   20000
+
+/* Parameters of the throughput benchmark.  Each operation is some
+   computation followed by an update of shared state.  */
+#define N_BENCH_OPS   2000
+#define N_BENCH_WORK  5000
+
+static npth_mutex_t counter_mutex;
+static int counter;
+static int running;
+
+
+/* Return the number of threads which have arrived so far.  */
+static int
+get_running (void)
+{
+  int rc, n;
+
+  rc = npth_mutex_lock (&counter_mutex);
+  fail_if_err (rc);
+  n = running;
+  rc = npth_mutex_unlock (&counter_mutex);
+  fail_if_err (rc);
+  return n;
+}
+
+
+static void *
+worker (void *arg)
+{
+  int rc, i;
+  time_t deadline;
+
+  if (!npth_is_protected ())
+    fail_msg ("worker is not protected");
+
+  rc = npth_mutex_lock (&counter_mutex);
+  fail_if_err (rc);
+  running++;
+  rc = npth_mutex_unlock (&counter_mutex);
+  fail_if_err (rc);
+
+  /* Spin without ever calling a blocking npth function.  In the
+     default mode this would starve all other threads; in parallel
+     mode the other threads keep running and arrive here too.  */
+  deadline = time (NULL) + 30;
+  while (get_running () < N_THREADS)
+    if (time (NULL) > deadline)
+      fail_msg ("threads are not running in parallel");
+
+  for (i=0; i < N_LOOPS; i++)
+    {
+      rc = npth_mutex_lock (&counter_mutex);
+      fail_if_err (rc);
+      counter++;
+      rc = npth_mutex_unlock (&counter_mutex);
+      fail_if_err (rc);
+    }
+
+  return arg;
+}
+
+
+int
+parallel_main (int argc, char *argv[])
+{
+  int rc, i;
+  npth_t tid[N_THREADS];
+  void *retval;
+
+  if (argc >= 2 && !strcmp (argv[1], "--verbose"))
+    opt_verbose = 1;
+
+  rc = npth_init_ex (~0U);
+  if (rc != EINVAL)
+    fail_msg ("unknown init flags not rejected");
+
+  rc = npth_init_ex (NPTH_INIT_PARALLEL);
+  fail_if_err (rc);
+
+  rc = npth_mutex_init (&counter_mutex, NULL);
+  fail_if_err (rc);
+
+  info_msg ("creating workers");
+  for (i=0; i < N_THREADS; i++)
+    {
+      rc = npth_create (&tid[i], NULL, worker, (void*)(tid + i));
+      fail_if_err (rc);
+    }
+
+  info_msg ("waiting for workers to terminate");
+  for (i=0; i < N_THREADS; i++)
+    {
+      rc = npth_join (tid[i], &retval);
+      fail_if_err (rc);
+      if (retval != (void*)(tid + i))
+        fail_msg ("worker returned an unexpected value");
+    }
+
+  if (counter != N_THREADS * N_LOOPS)
+    fail_msg ("counter value not as expected");
+
+  /* Return to the default mode for the other tests.  */
+  rc = npth_init ();
+  fail_if_err (rc);
+
+  return 0;
+}
+
+
+static unsigned int bench_sink;
+
+static void *
+bench_worker (void *arg)
+{
+  unsigned int x = (unsigned int)(size_t)arg;
+  int rc, i, j;
+
+  for (i=0; i < N_BENCH_OPS; i++)
+    {
+      for (j=0; j < N_BENCH_WORK; j++)
+        x = x * 1103515245 + 12345;
+
+      rc = npth_mutex_lock (&counter_mutex);
+      fail_if_err (rc);
+      counter++;
+      bench_sink ^= x;
+      rc = npth_mutex_unlock (&counter_mutex);
+      fail_if_err (rc);
+    }
+
+  return NULL;
+}
+
+
+/* Run the benchmark workers after initializing nPth with FLAGS and
+   return the number of operations per second.  */
+static double
+run_bench (unsigned int flags)
+{
+  int rc, i;
+  npth_t tid[N_THREADS];
+  struct timespec start, stop;
+  double secs;
+
+  rc = npth_init_ex (flags);
+  fail_if_err (rc);
+  counter = 0;
+
+  if (npth_clock_gettime (&start))
+    fail_msg ("npth_clock_gettime failed");
+  for (i=0; i < N_THREADS; i++)
+    {
+      rc = npth_create (&tid[i], NULL, bench_worker, (void*)(size_t)(i + 1));
+      fail_if_err (rc);
+    }
+  for (i=0; i < N_THREADS; i++)
+    {
+      rc = npth_join (tid[i], NULL);
+      fail_if_err (rc);
+    }
+  if (npth_clock_gettime (&stop))
+    fail_msg ("npth_clock_gettime failed");
+
+  if (counter != N_THREADS * N_BENCH_OPS)
+    fail_msg ("counter value not as expected");
+
+  secs = (stop.tv_sec - start.tv_sec)
+    + (stop.tv_nsec - start.tv_nsec) / 1e9;
+  if (secs <= 0)
+    secs = 1e-9;
+  return N_THREADS * N_BENCH_OPS / secs;
+}
+
+
+/* Compare the throughput of CPU bound threads in the default mode,
+   where only one thread runs at a time, with the parallel mode.  The
+   numbers depend on the number of CPUs and are only reported.  */
+int
+parallel_bench_main (int argc, char *argv[])
+{
+  int rc;
+  double def, par;
+
+  if (argc >= 2 && !strcmp (argv[1], "--verbose"))
+    opt_verbose = 1;
+
+  rc = npth_mutex_init (&counter_mutex, NULL);
+  fail_if_err (rc);
+
+  info_msg ("running the benchmark in default mode");
+  def = run_bench (0);
+  info_msg ("running the benchmark in parallel mode");
+  par = run_bench (NPTH_INIT_PARALLEL);
+
+  printf ("npth: %d threads: default mode %.0f ops/s,"
+          " parallel mode %.0f ops/s (%.2fx)\n",
+          N_THREADS, def, par, par / def);
+
+  /* Return to the default mode for the other tests.  */
+  rc = npth_init ();
+  fail_if_err (rc);
+
+  return 0;
+}
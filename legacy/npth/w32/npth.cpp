@@ -314,6 +314,15 @@ deref_thread (npth_t thread_id)
 
 
 
+int
+npth_init_ex (unsigned int flags)
+{
+  if (flags)
+    return EOPNOTSUPP;
+  return npth_init ();
+}
+
+
 int
 npth_init (void)
 {
@@ -57,6 +57,11 @@ struct timespec {
 
 int npth_init (void);
 
+/* The parallel mode is not supported on Windows; npth_init_ex
+   returns EOPNOTSUPP if it is requested.  */
+#define NPTH_INIT_PARALLEL 1
+int npth_init_ex (unsigned int flags);
+
 typedef struct npth_attr_s *npth_attr_t;
 typedef unsigned long int npth_t;
 typedef struct npth_mutexattr_s *npth_mutexattr_t;
@@ -173,7 +173,7 @@ struct dirmngr_client : cli::command<dirmngr_client> {
 /* Suppress help output.  */
 bool dirmngr_client::no_help = true;
 
-char* neopg_program;
+extern char* neopg_program;
 
 #if 0
 struct openpgp : cli::command<openpgp>